@@ -0,0 +1,105 @@
+// Microbenchmark for the dirty page bookkeeping of Sheriff-Protect.
+//
+// Every thread writes one word to each of its pages of a global array,
+// visiting them in a scattered order, and then takes a lock. Under
+// Sheriff the writes are the write faults (twin copy plus recording the
+// page) and the lock is a commit of the whole dirty set plus the
+// re-protection at the beginning of the next transaction.
+//
+// Sheriff-Protect stops protecting memory when transactions are short
+// (see evaluateProtection), so with few pages most rounds run without any
+// faults at all. Disable that heuristic to measure the protected path.
+//
+// g++ -O2 dirtypages.cpp -o dirtypages-dthread -rdynamic ../libsheriff_protect64.so -lrt
+// ./dirtypages-dthread [pages per thread] [rounds]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { PAGE_SIZE = 4096 };
+enum { THREADS = 2 };
+enum { MAX_PAGES = 2048 };
+
+// Globals are always protected, unlike large heap objects.
+char pages[THREADS][MAX_PAGES][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+struct result {
+  double faultNs;
+  double commitNs;
+} results[THREADS];
+
+int npages = 1024;
+int rounds = 20;
+
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void * worker (void * v) {
+  long index = (long) v;
+  double faultNs = 0;
+  double commitNs = 0;
+
+  for (int r = 0; r < rounds; r++) {
+    double start = now();
+
+    // A stride coprime with the page count visits every page once, out of order.
+    for (int i = 0, p = 0; i < npages; i++, p = (p + 617) % npages) {
+      pages[index][p][0] = (char) r;
+    }
+
+    double faulted = now();
+
+    pthread_mutex_lock (&lock);
+    pthread_mutex_unlock (&lock);
+
+    double committed = now();
+
+    faultNs += faulted - start;
+    commitNs += committed - faulted;
+  }
+
+  results[index].faultNs = faultNs;
+  results[index].commitNs = commitNs;
+  return NULL;
+}
+
+int main (int argc, char * argv[]) {
+  if (argc > 1) {
+    npages = atoi (argv[1]);
+  }
+  if (argc > 2) {
+    rounds = atoi (argv[2]);
+  }
+  if (npages < 1 || npages > MAX_PAGES || npages % 617 == 0 || rounds < 1) {
+    fprintf (stderr, "usage: %s [pages per thread <= %d] [rounds]\n", argv[0], MAX_PAGES);
+    return 1;
+  }
+
+  pthread_t threads[THREADS];
+  for (long i = 0; i < THREADS; i++) {
+    pthread_create (&threads[i], NULL, worker, (void *) i);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join (threads[i], NULL);
+  }
+
+  double faultNs = 0;
+  double commitNs = 0;
+  for (int i = 0; i < THREADS; i++) {
+    faultNs += results[i].faultNs;
+    commitNs += results[i].commitNs;
+  }
+
+  printf ("%d pages x %d rounds x %d threads\n", npages, rounds, THREADS);
+  printf ("fault:  %8.0f ns per page\n", faultNs / ((double) npages * rounds * THREADS));
+  printf ("commit: %8.0f ns per page, %8.0f us per transaction\n",
+          commitNs / ((double) npages * rounds * THREADS),
+          commitNs / ((double) rounds * THREADS) / 1000);
+  return 0;
+}
@@ -0,0 +1,102 @@
+// Microbenchmark for handoffs through an atomic flag under Sheriff-Protect.
+//
+// Two threads take turns: each writes a value to a data page, then passes
+// the turn on through a flag on a page of its own, and checks the value
+// the other thread wrote before the next handoff. No pthread call is
+// ever made, so without ATOMIC_SYNC the flag never leaves the private
+// copy of its writer and both threads spin forever. With a "futex"
+// argument a thread sleeps on the flag with a raw futex system call, as
+// lock-free runtimes do, instead of spinning on it.
+//
+// g++ -O2 flagloop.cpp -o flagloop-dthread -rdynamic ../libsheriff_protect64.so -lrt
+// ./flagloop-dthread [rounds] [futex]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+
+enum { PAGE_SIZE = 4096 };
+enum { SLOTS = PAGE_SIZE / sizeof(long) };
+
+// Globals are always protected, unlike large heap objects.
+int flag __attribute__((aligned(PAGE_SIZE)));
+long data[SLOTS] __attribute__((aligned(PAGE_SIZE)));
+
+int rounds = 1000;
+bool sleeping = false;
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Wait until the flag holds value.
+static void await (int value) {
+  int seen;
+  while ((seen = __atomic_load_n (&flag, __ATOMIC_ACQUIRE)) != value) {
+    if (sleeping) {
+      syscall (SYS_futex, &flag, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    }
+  }
+}
+
+static void pass (int value) {
+  __atomic_store_n (&flag, value, __ATOMIC_RELEASE);
+  if (sleeping) {
+    syscall (SYS_futex, &flag, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+void * pong (void * v) {
+  long bad = 0;
+  for (int i = 0; i < rounds; i++) {
+    await (2 * i + 1);
+    if (data[i % SLOTS] != i) {
+      bad++;
+    }
+    data[(i + 7) % SLOTS] = -i;
+    pass (2 * i + 2);
+  }
+  return (void *) bad;
+}
+
+int main (int argc, char * argv[]) {
+  if (argc > 1) {
+    rounds = atoi (argv[1]);
+  }
+  if (argc > 2) {
+    sleeping = (strcmp (argv[2], "futex") == 0);
+  }
+  if (rounds < 1) {
+    fprintf (stderr, "usage: %s [rounds] [futex]\n", argv[0]);
+    return 1;
+  }
+
+  pthread_t thread;
+  pthread_create (&thread, NULL, pong, NULL);
+
+  double start = now();
+  long bad = 0;
+  for (int i = 0; i < rounds; i++) {
+    data[i % SLOTS] = i;
+    pass (2 * i + 1);
+    await (2 * i + 2);
+    if (data[(i + 7) % SLOTS] != -i) {
+      bad++;
+    }
+  }
+  double ns = now() - start;
+
+  void * result;
+  pthread_join (thread, &result);
+  bad += (long) result;
+
+  printf ("%d rounds, %ld stale values\n", rounds, bad);
+  printf ("handoff: %10.1f ns per round trip\n", ns / rounds);
+  return (bad == 0) ? 0 : 1;
+}
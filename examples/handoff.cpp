@@ -0,0 +1,71 @@
+// Microbenchmark for handing a lock and a condition back and forth.
+//
+// Two threads take turns: each waits on its condition variable until the
+// turn is its own, passes the turn on and signals the other. Every turn
+// is a wake-up of the other thread through a mutex and a condition
+// variable, so the time per turn is the handoff latency of the shared
+// synchronization objects: glibc's process-shared ones by default, the
+// futex words of the registry with FUTEX_SYNC.
+//
+// g++ -O2 handoff.cpp -o handoff-dthread -rdynamic ../libsheriff_protect64.so -lrt
+// ./handoff-dthread [turns per thread]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { PAGE_SIZE = 4096 };
+enum { THREADS = 2 };
+
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t turns[THREADS] = { PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// Whose turn it is, on a page of its own.
+int turn __attribute__((aligned(PAGE_SIZE)));
+
+int rounds = 20000;
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void * player (void * v) {
+  long index = (long) v;
+
+  pthread_mutex_lock (&lock);
+  for (int i = 0; i < rounds; i++) {
+    while (turn != index) {
+      pthread_cond_wait (&turns[index], &lock);
+    }
+    turn = (index + 1) % THREADS;
+    pthread_cond_signal (&turns[turn]);
+  }
+  pthread_mutex_unlock (&lock);
+  return NULL;
+}
+
+int main (int argc, char * argv[]) {
+  if (argc > 1) {
+    rounds = atoi (argv[1]);
+  }
+  if (rounds < 1) {
+    fprintf (stderr, "usage: %s [turns per thread]\n", argv[0]);
+    return 1;
+  }
+
+  double start = now();
+  pthread_t threads[THREADS];
+  for (long i = 0; i < THREADS; i++) {
+    pthread_create (&threads[i], NULL, player, (void *) i);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join (threads[i], NULL);
+  }
+  double ns = now() - start;
+
+  printf ("%d turns x %d threads, turn %d\n", rounds, THREADS, turn);
+  printf ("handoff: %8.0f ns per turn\n", ns / ((double) rounds * THREADS));
+  return 0;
+}
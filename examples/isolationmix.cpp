@@ -0,0 +1,83 @@
+// Two workers false-share a cache line while a logger, which shares no
+// memory with them, fills pages of its own buffer between lock operations.
+// Under Sheriff-Protect the logger leaves isolation, and most of its
+// transactions then cost no write faults, twins, commits or page refreshes.
+// Its transactions are short enough for protection to be closed early on:
+// build with THRESH_TRAN_LENGTH at 0 to keep it, and compare with
+// THREAD_ISOLATION_WINDOW at 1 << 30, which never lets a thread leave.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { PAGE = 4096, LOG_PAGES = 1024, PAGES_PER_ROUND = 256 };
+enum { WORKER_LOOPS = 4000000, LOGGER_LOOPS = 400000 };
+
+struct { volatile long a; volatile long b; } counters;
+char logbuf[LOG_PAGES * PAGE] __attribute__((aligned(4096)));
+pthread_mutex_t workerLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t loggerLock = PTHREAD_MUTEX_INITIALIZER;
+int rounds;
+double loggerMs;
+
+// The workers keep every processor busy: the logger is timed by the
+// processor time it takes, faults and commits included, not by how long
+// it waits for a processor.
+static double now(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void * worker(void * arg) {
+  long id = (long)arg;
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < WORKER_LOOPS; i++) {
+      if (id) counters.b++; else counters.a++;
+    }
+    pthread_mutex_lock(&workerLock);
+    pthread_mutex_unlock(&workerLock);
+  }
+  return NULL;
+}
+
+void * logger(void *) {
+  volatile long work = 0;
+  double start = now(CLOCK_THREAD_CPUTIME_ID);
+  for (int r = 0; r < 2 * rounds; r++) {
+    // Format a record, then write it out to the buffer.
+    for (int i = 0; i < LOGGER_LOOPS; i++) {
+      work++;
+    }
+    for (int p = 0; p < PAGES_PER_ROUND; p++) {
+      logbuf[((r * PAGES_PER_ROUND + p) % LOG_PAGES) * PAGE + r % PAGE]++;
+    }
+    pthread_mutex_lock(&loggerLock);
+    pthread_mutex_unlock(&loggerLock);
+  }
+  loggerMs = now(CLOCK_THREAD_CPUTIME_ID) - start;
+  return NULL;
+}
+
+int main(int argc, char ** argv) {
+  rounds = (argc > 1) ? atoi(argv[1]) : 200;
+  double start = now(CLOCK_MONOTONIC);
+  pthread_t threads[3];
+  pthread_create(&threads[0], NULL, worker, (void *)0);
+  pthread_create(&threads[1], NULL, worker, (void *)1);
+  pthread_create(&threads[2], NULL, logger, NULL);
+  for (int i = 0; i < 3; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double total = now(CLOCK_MONOTONIC) - start;
+
+  long sum = 0;
+  for (int i = 0; i < LOG_PAGES * PAGE; i++) {
+    sum += logbuf[i];
+  }
+  bool ok = (counters.a == (long)WORKER_LOOPS * rounds && counters.b == (long)WORKER_LOOPS * rounds
+             && sum == 2L * rounds * PAGES_PER_ROUND);
+  printf("%s logger %.1f us per transaction, total %.1f ms\n",
+         ok ? "OK" : "BAD", loggerMs * 1e3 / (2 * rounds), total);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+// Microbenchmark for lock/unlock throughput under Sheriff-Protect.
+//
+// Every thread takes and releases a mutex of its own, bumping a counter
+// on its own page inside, over and over. Under Sheriff each pair is a
+// commit and a refresh, even though no other thread ever wants the lock;
+// with BIASED_LOCKS a thread keeps the lock from one pair to the next.
+// With a "shared" argument all threads use the same mutex instead, so
+// that the lock is handed over all the time.
+//
+// g++ -O2 lockloop.cpp -o lockloop-dthread -rdynamic ../libsheriff_protect64.so -lrt
+// ./lockloop-dthread [pairs per thread] [shared]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { PAGE_SIZE = 4096 };
+enum { THREADS = 2 };
+
+// Globals are always protected, unlike large heap objects.
+struct counter {
+  long value;
+} counters[THREADS][PAGE_SIZE / sizeof(long)] __attribute__((aligned(PAGE_SIZE)));
+
+pthread_mutex_t locks[THREADS];
+
+double elapsed[THREADS];
+
+int pairs = 100000;
+bool shared = false;
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void * worker (void * v) {
+  long index = (long) v;
+  pthread_mutex_t * lock = &locks[shared ? 0 : index];
+
+  double start = now();
+  for (int i = 0; i < pairs; i++) {
+    pthread_mutex_lock (lock);
+    counters[index][0].value++;
+    pthread_mutex_unlock (lock);
+  }
+  elapsed[index] = now() - start;
+  return NULL;
+}
+
+int main (int argc, char * argv[]) {
+  if (argc > 1) {
+    pairs = atoi (argv[1]);
+  }
+  if (argc > 2) {
+    shared = (strcmp (argv[2], "shared") == 0);
+  }
+  if (pairs < 1) {
+    fprintf (stderr, "usage: %s [pairs per thread] [shared]\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = 0; i < THREADS; i++) {
+    pthread_mutex_init (&locks[i], NULL);
+  }
+
+  pthread_t threads[THREADS];
+  for (long i = 0; i < THREADS; i++) {
+    pthread_create (&threads[i], NULL, worker, (void *) i);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join (threads[i], NULL);
+  }
+
+  double ns = 0;
+  long total = 0;
+  for (int i = 0; i < THREADS; i++) {
+    ns += elapsed[i];
+    total += counters[i][0].value;
+  }
+
+  printf ("%d pairs x %d threads on %s, counted %ld\n",
+          pairs, THREADS, shared ? "one shared mutex" : "private mutexes", total);
+  printf ("lock/unlock: %8.0f ns per pair\n", ns / ((double) pairs * THREADS));
+  return 0;
+}
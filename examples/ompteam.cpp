@@ -0,0 +1,160 @@
+// Test of OpenMP regions under Sheriff (see include/xomp.h).
+//
+// Runs the constructs GCC's -fopenmp code asks libgomp for, on globals and
+// on locals of main: loops of every schedule, reductions, critical and
+// named critical sections, singles, masters, sections, ordered loops and
+// barriers. Each round checks what the team left behind. Reductions and
+// atomics are done on locals of main, as atomic instructions on globals
+// are not atomic under Sheriff.
+//
+// g++ -O2 -fopenmp ompteam.cpp -o ompteam-dthread -rdynamic ../libsheriff_protect64.so -lrt
+// OMP_NUM_THREADS=4 ./ompteam-dthread [rounds]
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum { N = 100000, M = 1000 };
+
+double values[N];
+long critical;
+long named;
+long singles;
+long sections[3];
+long ordered[M];
+int orders;
+long master;
+long arrived[64];
+
+static int check (bool ok, const char * what, long got, long want) {
+  if (!ok) {
+    printf ("%s: %ld, not %ld\n", what, got, want);
+    return 1;
+  }
+  return 0;
+}
+
+int main (int argc, char * argv[]) {
+  int rounds = 3;
+  if (argc > 1) {
+    rounds = atoi (argv[1]);
+  }
+  if (rounds < 1) {
+    fprintf (stderr, "usage: %s [rounds]\n", argv[0]);
+    return 1;
+  }
+
+  int bad = 0;
+  int threads = 0;
+  for (int r = 0; r < rounds; r++) {
+    double sum = 0;
+    long local[M];
+    long last = -1;
+    long atomics = 0;
+    for (int i = 0; i < M; i++) {
+      local[i] = 0;
+    }
+
+#pragma omp parallel for reduction(+:sum)
+    for (int i = 0; i < N; i++) {
+      values[i] = i;
+      sum += i;
+    }
+    bad += check (sum == (double) N * (N - 1) / 2, "reduction", (long) sum, (long) N * (N - 1) / 2);
+
+#pragma omp parallel
+    {
+#pragma omp single
+      threads = omp_get_num_threads ();
+#pragma omp for schedule(dynamic, 7)
+      for (int i = 0; i < M; i++) {
+        local[i] += i;
+      }
+#pragma omp for schedule(guided) nowait
+      for (int i = 0; i < N; i++) {
+        values[i] *= 2;
+      }
+#pragma omp for schedule(runtime)
+      for (int i = 0; i < M; i++) {
+        local[i] += 1;
+      }
+#pragma omp critical
+      critical++;
+#pragma omp critical(other)
+      named += 2;
+#pragma omp atomic
+      atomics++;
+#pragma omp single nowait
+      singles++;
+#pragma omp sections
+      {
+#pragma omp section
+        sections[0]++;
+#pragma omp section
+        sections[1]++;
+#pragma omp section
+        sections[2]++;
+      }
+#pragma omp for ordered schedule(dynamic, 3)
+      for (int i = 0; i < M; i++) {
+#pragma omp ordered
+        ordered[orders++] = i;
+      }
+#pragma omp for lastprivate(last)
+      for (long i = 0; i < 777; i++) {
+        last = i;
+      }
+#pragma omp master
+      master = omp_get_thread_num () + 100;
+#pragma omp barrier
+      arrived[omp_get_thread_num ()]++;
+    }
+
+    for (int i = 0; i < M; i++) {
+      if (local[i] != i + 1) {
+        bad += check (false, "dynamic and runtime loops", local[i], i + 1);
+        break;
+      }
+    }
+    for (int i = 0; i < N; i += 997) {
+      if (values[i] != 2.0 * i) {
+        bad += check (false, "static and guided loops", (long) values[i], 2L * i);
+        break;
+      }
+    }
+    for (int i = 0; i < M; i++) {
+      if (ordered[i] != i) {
+        bad += check (false, "ordered loop", ordered[i], i);
+        break;
+      }
+    }
+    orders = 0;
+    bad += check (last == 776, "lastprivate", last, 776);
+    bad += check (master == 100, "master", master, 100);
+    bad += check (atomics == threads, "atomic", atomics, threads);
+
+    long down = 0;
+    long want = 0;
+#pragma omp parallel for schedule(dynamic, 2) reduction(+:down)
+    for (long i = 100; i > 0; i -= 3) {
+      down += i;
+    }
+    for (long i = 100; i > 0; i -= 3) {
+      want += i;
+    }
+    bad += check (down == want, "loop down", down, want);
+  }
+
+  long total = 0;
+  for (int i = 0; i < 64; i++) {
+    total += arrived[i];
+  }
+  bad += check (critical == (long) rounds * threads, "critical", critical, (long) rounds * threads);
+  bad += check (named == 2L * rounds * threads, "named critical", named, 2L * rounds * threads);
+  bad += check (singles == rounds, "single", singles, rounds);
+  bad += check (sections[0] + sections[1] + sections[2] == 3L * rounds, "sections",
+                sections[0] + sections[1] + sections[2], 3L * rounds);
+  bad += check (total == (long) rounds * threads, "barrier", total, (long) rounds * threads);
+
+  printf ("%s: %d rounds on %d threads\n", bad ? "FAILED" : "OK", rounds, threads);
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+// Microbenchmark for thread creation latency under Sheriff.
+//
+// The main thread creates a few threads and joins them, over and over.
+// Every thread takes its argument from the creator's stack and adds it
+// to its own slot of a global array. Under Sheriff each pthread_create
+// is a fork of the whole process; with THREAD_POOL the workers forked in
+// the first round are parked at join and handed the threads of the next
+// rounds.
+//
+// g++ -O2 spawnloop.cpp -o spawnloop-dthread -rdynamic ../libsheriff_protect64.so -lrt
+// ./spawnloop-dthread [rounds] [threads per round]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { PAGE_SIZE = 4096 };
+enum { MAX_THREADS = 32 };
+
+// Globals are always protected, unlike large heap objects.
+struct counter {
+  long value;
+} counters[MAX_THREADS][PAGE_SIZE / sizeof(long)] __attribute__((aligned(PAGE_SIZE)));
+
+struct work {
+  int index;
+  long amount;
+};
+
+int rounds = 200;
+int threads = 4;
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void * worker (void * v) {
+  struct work * w = (struct work *) v;
+  counters[w->index][0].value += w->amount;
+  return (void *) w->amount;
+}
+
+int main (int argc, char * argv[]) {
+  if (argc > 1) {
+    rounds = atoi (argv[1]);
+  }
+  if (argc > 2) {
+    threads = atoi (argv[2]);
+  }
+  if (rounds < 1 || threads < 1 || threads > MAX_THREADS) {
+    fprintf (stderr, "usage: %s [rounds] [threads per round, up to %d]\n", argv[0], MAX_THREADS);
+    return 1;
+  }
+
+  double create = 0;
+  double total = 0;
+  long returned = 0;
+  for (int r = 0; r < rounds; r++) {
+    pthread_t tids[MAX_THREADS];
+    struct work works[MAX_THREADS];
+
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+      works[i].index = i;
+      works[i].amount = r + 1;
+      pthread_create (&tids[i], NULL, worker, &works[i]);
+    }
+    double created = now();
+    for (int i = 0; i < threads; i++) {
+      void * result;
+      pthread_join (tids[i], &result);
+      returned += (long) result;
+    }
+    double joined = now();
+
+    create += created - start;
+    total += joined - start;
+  }
+
+  long sum = 0;
+  for (int i = 0; i < threads; i++) {
+    sum += counters[i][0].value;
+  }
+  long expected = (long) threads * rounds * (rounds + 1) / 2;
+
+  printf ("%d rounds x %d threads, counted %ld, returned %ld (expected %ld)\n",
+          rounds, threads, sum, returned, expected);
+  printf ("create:      %8.1f us per thread\n", create / ((double) rounds * threads) / 1000);
+  printf ("create+join: %8.1f us per thread\n", total / ((double) rounds * threads) / 1000);
+  return (sum == expected && returned == expected) ? 0 : 1;
+}
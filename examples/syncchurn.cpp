@@ -0,0 +1,75 @@
+// Stress test for the registry of synchronization objects (FUTEX_SYNC).
+//
+// Two threads each create, use and destroy many more mutexes and
+// reader-writer locks than the first table of the registry holds, so
+// that destroyed objects have to give their entries back. Then a mutex
+// on the heap is freed while still locked, as programs that tear down
+// objects wholesale do, and its memory is handed out again zeroed: the
+// new mutex must start out unlocked, not keep the state of the old one.
+//
+// g++ -O2 syncchurn.cpp -o syncchurn-dthread -rdynamic ../libsheriff_protect64.so -lrt
+// ./syncchurn-dthread [objects]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int objects = 200000;
+
+void * churn (void * v) {
+  long bad = 0;
+  for (int i = 0; i < objects; i++) {
+    pthread_mutex_t * mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+    pthread_rwlock_t * rwlock = (pthread_rwlock_t *) malloc (sizeof (pthread_rwlock_t));
+    pthread_mutex_init (mutex, NULL);
+    pthread_rwlock_init (rwlock, NULL);
+
+    pthread_mutex_lock (mutex);
+    pthread_mutex_unlock (mutex);
+    pthread_rwlock_wrlock (rwlock);
+    pthread_rwlock_unlock (rwlock);
+    if (pthread_rwlock_tryrdlock (rwlock) != 0) {
+      bad++;
+    } else {
+      pthread_rwlock_unlock (rwlock);
+    }
+
+    pthread_rwlock_destroy (rwlock);
+    pthread_mutex_destroy (mutex);
+    free (rwlock);
+    free (mutex);
+  }
+  return (void *) bad;
+}
+
+int main (int argc, char * argv[]) {
+  if (argc > 1) {
+    objects = atoi (argv[1]);
+  }
+  if (objects < 1) {
+    fprintf (stderr, "usage: %s [objects]\n", argv[0]);
+    return 1;
+  }
+
+  pthread_t thread;
+  pthread_create (&thread, NULL, churn, NULL);
+  long bad = (long) churn (NULL);
+  void * result;
+  pthread_join (thread, &result);
+  bad += (long) result;
+
+  // A locked mutex whose memory is given back and taken again.
+  pthread_mutex_t * mutex = (pthread_mutex_t *) calloc (1, sizeof (pthread_mutex_t));
+  pthread_mutex_lock (mutex);
+  free (mutex);
+  pthread_mutex_t * again = (pthread_mutex_t *) calloc (1, sizeof (pthread_mutex_t));
+  if (pthread_mutex_trylock (again) != 0) {
+    printf ("reused mutex %s still locked\n", (again == mutex) ? "is" : "is not");
+    bad++;
+  } else {
+    pthread_mutex_unlock (again);
+  }
+  free (again);
+
+  printf ("%d objects per thread, %ld failures\n", objects, bad);
+  return (bad == 0) ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+// Test of the lock calls besides lock and unlock under Sheriff-Protect.
+//
+// First, two threads add to counters under a mutex, a reader-writer lock
+// and a spin lock, taking them in turns with the blocking call and the
+// trying one, and the mutex also with a timeout. A trying thread spins
+// until it gets the lock. Then the first thread takes the mutex over and
+// over, sleeping in between without any other synchronization: with
+// BIASED_LOCKS, it keeps the mutex while it sleeps, and the other thread,
+// spinning on a try, starves unless its tries get the mutex handed over.
+// Last, the first thread holds the mutex while the other one waits for it
+// with a timeout, which has to pass.
+//
+// g++ -O2 trylocks.cpp -o trylocks-dthread -rdynamic ../libsheriff_protect64.so -lrt
+// ./trylocks-dthread [rounds]
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+enum { PAGE_SIZE = 4096 };
+
+// Each counter on a page of its own.
+long locked __attribute__((aligned(PAGE_SIZE)));
+long written __attribute__((aligned(PAGE_SIZE)));
+long spun __attribute__((aligned(PAGE_SIZE)));
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_spinlock_t spin;
+pthread_barrier_t barrier;
+
+int rounds = 100;
+
+static void deadline (struct timespec * ts, long ms) {
+  clock_gettime (CLOCK_REALTIME, ts);
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (ms % 1000) * 1000000;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+static void lockMutex (int how) {
+  struct timespec ts;
+  switch (how % 3) {
+  case 0:
+    pthread_mutex_lock (&mutex);
+    break;
+  case 1:
+    while (pthread_mutex_trylock (&mutex) != 0)
+      ;
+    break;
+  case 2:
+    do {
+      deadline (&ts, 10);
+    } while (pthread_mutex_timedlock (&mutex, &ts) != 0);
+    break;
+  }
+}
+
+static void addAll (int how) {
+  lockMutex (how);
+  locked++;
+  pthread_mutex_unlock (&mutex);
+
+  if (how % 2) {
+    while (pthread_rwlock_trywrlock (&rwlock) != 0)
+      ;
+  } else {
+    pthread_rwlock_wrlock (&rwlock);
+  }
+  written++;
+  pthread_rwlock_unlock (&rwlock);
+
+  if (how % 2) {
+    while (pthread_spin_trylock (&spin) != 0)
+      ;
+  } else {
+    pthread_spin_lock (&spin);
+  }
+  spun++;
+  pthread_spin_unlock (&spin);
+}
+
+void * trying (void * v) {
+  for (int i = 0; i < rounds; i++) {
+    addAll (1);
+    usleep (700);
+  }
+  pthread_barrier_wait (&barrier);
+
+  // Give the mutex time to get biased to the main thread.
+  usleep (5000);
+  lockMutex (1);
+  long got = locked;
+  locked++;
+  pthread_mutex_unlock (&mutex);
+
+  // Wait for the main thread to hold the mutex.
+  pthread_barrier_wait (&barrier);
+  pthread_barrier_wait (&barrier);
+  struct timespec ts;
+  deadline (&ts, 50);
+  if (pthread_mutex_timedlock (&mutex, &ts) != ETIMEDOUT) {
+    got = -1;
+  }
+  return (void *) got;
+}
+
+int main (int argc, char * argv[]) {
+  if (argc > 1) {
+    rounds = atoi (argv[1]);
+  }
+  if (rounds < 1) {
+    fprintf (stderr, "usage: %s [rounds]\n", argv[0]);
+    return 1;
+  }
+  pthread_spin_init (&spin, PTHREAD_PROCESS_PRIVATE);
+  pthread_barrier_init (&barrier, NULL, 2);
+
+  pthread_t thread;
+  pthread_create (&thread, NULL, trying, NULL);
+  for (int i = 0; i < rounds; i++) {
+    addAll (i);
+    usleep (1000);
+  }
+  pthread_barrier_wait (&barrier);
+
+  // Readers agree on what the writers left.
+  long seen = -1;
+  if (pthread_rwlock_tryrdlock (&rwlock) == 0) {
+    seen = written;
+    pthread_rwlock_unlock (&rwlock);
+  }
+
+  for (int i = 0; i < rounds; i++) {
+    pthread_mutex_lock (&mutex);
+    locked++;
+    pthread_mutex_unlock (&mutex);
+    usleep (1000);
+  }
+  pthread_barrier_wait (&barrier);
+
+  pthread_mutex_lock (&mutex);
+  pthread_barrier_wait (&barrier);
+  void * result;
+  pthread_join (thread, &result);
+  pthread_mutex_unlock (&mutex);
+  long got = (long) result;
+
+  bool ok = (locked == 3 * rounds + 1 && written == 2 * rounds && spun == 2 * rounds
+             && seen == 2 * rounds && got >= 0 && got < 3 * rounds);
+  printf ("%s mutex %ld rwlock %ld (read %ld) spin %ld, tried in after %ld of %d, timedlock %s\n",
+          ok ? "OK" : "FAILED", locked, written, seen, spun, got - 2 * rounds, rounds,
+          got >= 0 ? "timed out" : "did not time out");
+  return ok ? 0 : 1;
+}
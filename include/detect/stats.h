@@ -29,6 +29,11 @@
  * @author Tongping Liu <http://www.cs.umass.edu/~tonyliu>
  */ 
 
+#include <string.h>
+#include <syscall.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
 #include "xdefines.h"
 #include "xplock.h"
 
@@ -45,6 +50,7 @@ public:
     _pages       = (unsigned long *)(base + 3 * sizeof(unsigned long));
     _caches      = (unsigned long *)(base + 4 * sizeof(unsigned long));
     _prots       = (unsigned long *)(base + 5 * sizeof(unsigned long));
+    _counters    = (struct counters *)(base + 6 * sizeof(unsigned long));
   
     // EDB NOTE: In theory, this is unnecessary, since these pages should
     // be demand-zero.
@@ -55,6 +61,7 @@ public:
     *_pages = 0;
     *_caches = 0;
     *_prots = 0;
+    memset (_counters, 0, sizeof(struct counters));
   }
  
   virtual ~stats() {}
@@ -96,6 +103,311 @@ public:
     return atomic::increment_and_return((volatile unsigned long *)_prots);
   }
 
+  // Account one commit of some pages, merged either serially or in parallel.
+  void updateCommitTime(bool parallel, unsigned long pages, double cycles) {
+    struct commitCounters * c = &_counters->commits[parallel ? 1 : 0];
+    atomic::increment((volatile unsigned long *)&c->commits);
+    atomic::add(pages, (volatile unsigned long *)&c->pages);
+    atomic::add((unsigned long)(cycles/1000), (volatile unsigned long *)&c->kcycles);
+  }
+
+  void printCommits() {
+    const char * mode[2] = { "serial", "parallel" };
+    for (int i = 0; i < 2; i++) {
+      struct commitCounters * c = &_counters->commits[i];
+      if (c->commits == 0) {
+        continue;
+      }
+      fprintf(stderr, "%s commits %ld, pages %ld, %ld kcycles per commit, %.2f kcycles per page\n",
+              mode[i], c->commits, c->pages, c->kcycles/c->commits,
+              (double)c->kcycles/(double)(c->pages ? c->pages : 1));
+    }
+  }
+
+  // Account the system calls one thread made to refresh and protect its
+  // pages at a transaction boundary.
+  void updateRefreshes(unsigned long syscalls) {
+    atomic::increment((volatile unsigned long *)&_counters->refreshes);
+    atomic::add(syscalls, (volatile unsigned long *)&_counters->refreshSyscalls);
+  }
+
+  void printRefreshes() {
+    if (_counters->refreshes == 0) {
+      return;
+    }
+    fprintf(stderr, "page refreshes %ld, system calls %ld, %.2f per transaction\n",
+            _counters->refreshes, _counters->refreshSyscalls,
+            (double)_counters->refreshSyscalls/(double)_counters->refreshes);
+  }
+
+  // Account pages taken ahead of a sequential write fault, and the faults
+  // that were seen to be avoided by pages taken earlier.
+  void updatePrefetches(unsigned long pages, unsigned long avoided) {
+    if (pages) {
+      atomic::add(pages, (volatile unsigned long *)&_counters->prefetchedPages);
+    }
+    if (avoided) {
+      atomic::add(avoided, (volatile unsigned long *)&_counters->avoidedFaults);
+    }
+  }
+
+  void printPrefetches() {
+    if (_counters->prefetchedPages == 0) {
+      return;
+    }
+    fprintf(stderr, "prefetched pages %ld, write faults avoided at least %ld\n",
+            _counters->prefetchedPages, _counters->avoidedFaults);
+  }
+
+  // Account pages twinned when a transaction began, and how many of those
+  // the transaction turned out to write.
+  void updatePredictions(unsigned long pages, unsigned long written) {
+    if (pages) {
+      atomic::add(pages, (volatile unsigned long *)&_counters->predictedPages);
+    }
+    if (written) {
+      atomic::add(written, (volatile unsigned long *)&_counters->predictedWritten);
+    }
+  }
+
+  void printPredictions() {
+    if (_counters->predictedPages == 0) {
+      return;
+    }
+    fprintf(stderr, "pages twinned at begin %ld, written %ld\n",
+            _counters->predictedPages, _counters->predictedWritten);
+  }
+
+  // Account the minor faults this process took since it last got here as
+  // one transaction. Called as every transaction begins.
+  void updateMinorFaults() {
+    // Per process: this code is shared, the variables are not.
+    static pid_t owner = 0;
+    static long seen = 0;
+
+    struct rusage usage;
+    if (getrusage (RUSAGE_SELF, &usage) != 0) {
+      return;
+    }
+
+    // A new process starts counting from zero.
+    pid_t mypid = syscall(SYS_getpid);
+    if (owner != mypid) {
+      owner = mypid;
+      seen = 0;
+    }
+
+    atomic::increment((volatile unsigned long *)&_counters->faultTransactions);
+    atomic::add(usage.ru_minflt - seen, (volatile unsigned long *)&_counters->minorFaults);
+    seen = usage.ru_minflt;
+  }
+
+  void printMinorFaults() {
+    if (_counters->faultTransactions == 0) {
+      return;
+    }
+    fprintf(stderr, "minor faults %ld, %.2f per transaction\n",
+            _counters->minorFaults,
+            (double)_counters->minorFaults/(double)_counters->faultTransactions);
+  }
+
+  // Account pages no longer isolated because isolating them did not pay,
+  // and pages put back on probation.
+  void updateIsolation(unsigned long shared, unsigned long probations) {
+    if (shared) {
+      atomic::add(shared, (volatile unsigned long *)&_counters->pagesShared);
+    }
+    if (probations) {
+      atomic::add(probations, (volatile unsigned long *)&_counters->probations);
+    }
+  }
+
+  void printIsolation() {
+    if (_counters->pagesShared == 0) {
+      return;
+    }
+    fprintf(stderr, "pages left shared %ld, back on probation %ld\n",
+            _counters->pagesShared, _counters->probations);
+  }
+
+  // Account threads that stopped being isolated, and threads isolated again.
+  void updateThreadIsolation(unsigned long left, unsigned long back) {
+    if (left) {
+      atomic::add(left, (volatile unsigned long *)&_counters->threadsLeft);
+    }
+    if (back) {
+      atomic::add(back, (volatile unsigned long *)&_counters->threadsBack);
+    }
+  }
+
+  void printThreadIsolation() {
+    if (_counters->threadsLeft == 0) {
+      return;
+    }
+    fprintf(stderr, "threads left isolation %ld, isolated again %ld\n",
+            _counters->threadsLeft, _counters->threadsBack);
+  }
+
+  // Account an acquire of a lock: lazily, with the notices it took, or
+  // refreshing everything because they were no longer logged.
+  void updateAcquires(bool lazy, unsigned long notices) {
+    atomic::increment((volatile unsigned long *)(lazy ? &_counters->lazyAcquires : &_counters->fullAcquires));
+    if (notices) {
+      atomic::add(notices, (volatile unsigned long *)&_counters->notices);
+    }
+  }
+
+  void printAcquires() {
+    if (_counters->lazyAcquires + _counters->fullAcquires == 0) {
+      return;
+    }
+    fprintf(stderr, "lazy acquires %ld with %ld notices, acquires refreshing everything %ld\n",
+            _counters->lazyAcquires, _counters->notices, _counters->fullAcquires);
+  }
+
+  // Account locks taken again by the thread they are biased to, without
+  // synchronizing, and biases revoked because another thread waited.
+  void updateBiasedLocks(unsigned long relocks, unsigned long revoked) {
+    atomic::add(relocks, (volatile unsigned long *)&_counters->relocks);
+    atomic::add(revoked, (volatile unsigned long *)&_counters->revoked);
+  }
+
+  void printBiasedLocks() {
+    if (_counters->relocks + _counters->revoked == 0) {
+      return;
+    }
+    fprintf(stderr, "biased relocks %ld, biases revoked %ld\n",
+            _counters->relocks, _counters->revoked);
+  }
+
+  // Account read locks and unlocks that needed neither a commit nor a
+  // refresh.
+  void updateQuietReads(unsigned long reads) {
+    atomic::add(reads, (volatile unsigned long *)&_counters->quietReads);
+  }
+
+  void printQuietReads() {
+    if (_counters->quietReads == 0) {
+      return;
+    }
+    fprintf(stderr, "read locks and unlocks without a commit or refresh %ld\n", _counters->quietReads);
+  }
+
+  // Account futex system calls the program made itself, transactions
+  // ended because a thread polled, pages left shared for good, and the
+  // writes to them fenced.
+  void updatePolling(unsigned long futexes, unsigned long polls, unsigned long pinned, unsigned long fenced) {
+    if (futexes) {
+      atomic::add(futexes, (volatile unsigned long *)&_counters->futexes);
+    }
+    if (polls) {
+      atomic::add(polls, (volatile unsigned long *)&_counters->polls);
+    }
+    if (pinned) {
+      atomic::add(pinned, (volatile unsigned long *)&_counters->pinned);
+    }
+    if (fenced) {
+      atomic::add(fenced, (volatile unsigned long *)&_counters->fenced);
+    }
+  }
+
+  // Account words a polling thread wrote that another thread had written
+  // meanwhile: the polling thread's writes were lost.
+  void updateDroppedWords(unsigned long words) {
+    atomic::add(words, (volatile unsigned long *)&_counters->droppedWords);
+  }
+
+  // Account an atomic instruction that updated the private copy of a
+  // thread while other threads could update the same word.
+  // @return how many there were before this one.
+  unsigned long updateAtomicWrites() {
+    return atomic::increment_and_return((volatile unsigned long *)&_counters->atomicWrites);
+  }
+
+  void printAtomicWrites() {
+    if (_counters->atomicWrites == 0) {
+      return;
+    }
+    fprintf(stderr, "WARNING: %ld atomic instructions updated private copies of shared variables, updates may have been lost\n",
+            _counters->atomicWrites);
+  }
+
+  void printPolling() {
+    if (_counters->futexes + _counters->polls == 0) {
+      return;
+    }
+    fprintf(stderr, "futex calls %ld, transactions ended by polling %ld, pages pinned shared %ld, writes fenced %ld\n",
+            _counters->futexes, _counters->polls, _counters->pinned, _counters->fenced);
+    if (_counters->droppedWords != 0) {
+      fprintf(stderr, "WARNING: %ld words written by polling threads were lost, written by other threads meanwhile\n",
+              _counters->droppedWords);
+    }
+  }
+
+  // Account a synchronization operation and the system calls made at its
+  // transaction boundary, to see how many operations needed none.
+  void updateSyncSyscalls(int op, unsigned long syscalls) {
+    struct syncCounters * counts = &_counters->sync[op];
+    atomic::increment((volatile unsigned long *)&counts->operations);
+    if (syscalls) {
+      atomic::add(syscalls, (volatile unsigned long *)&counts->syscalls);
+    }
+    else {
+      atomic::increment((volatile unsigned long *)&counts->quiet);
+    }
+  }
+
+  void printSyncSyscalls() {
+    static const char * names[SYNC_OPS] = { "lock", "unlock", "cond wait", "cond signal", "barrier" };
+    for (int op = 0; op < SYNC_OPS; op++) {
+      struct syncCounters * counts = &_counters->sync[op];
+      if (counts->operations == 0) {
+        continue;
+      }
+      fprintf(stderr, "%s: %ld operations, %ld system calls, %.2f per operation, %ld without any\n",
+              names[op], counts->operations, counts->syscalls,
+              (double)counts->syscalls/(double)counts->operations, counts->quiet);
+    }
+  }
+
+  // Raise the high-water mark of a per-process pool to used, if it is higher.
+  // @return true if it was.
+  bool updatePoolPeak(int pool, unsigned long used) {
+    volatile unsigned long * peak = &_counters->poolPeaks[pool];
+    unsigned long old = *peak;
+    while (used > old) {
+      unsigned long seen = atomic::compare_and_swap(peak, old, used);
+      if (seen == old) {
+        return true;
+      }
+      old = seen;
+    }
+    return false;
+  }
+
+  unsigned long getPoolPeak(int pool) {
+    return _counters->poolPeaks[pool];
+  }
+
+  // Print the pool high-water marks next to the chunk each pool grows by,
+  // unless asked to only when some pool needed more than one chunk.
+  void printPools(unsigned long entryChunk, unsigned long storeChunk, bool always) {
+    if (!always && _counters->poolPeaks[PAGE_ENTRY_POOL] <= entryChunk
+        && _counters->poolPeaks[PAGE_STORE_POOL] <= storeChunk) {
+      return;
+    }
+    fprintf(stderr, "page entries: at most %ld per transaction, %ld per chunk\n",
+            _counters->poolPeaks[PAGE_ENTRY_POOL], entryChunk);
+    fprintf(stderr, "page store pages: at most %ld per transaction, %ld per chunk\n",
+            _counters->poolPeaks[PAGE_STORE_POOL], storeChunk);
+  }
+
+  // Pools with a high-water mark.
+  enum { PAGE_ENTRY_POOL = 0, PAGE_STORE_POOL, POOLS };
+
+  // Synchronization operations whose system calls are counted.
+  enum { SYNC_LOCK = 0, SYNC_UNLOCK, SYNC_WAIT, SYNC_SIGNAL, SYNC_BARRIER, SYNC_OPS };
+
   unsigned long getCaches() {
     return *_caches;
   }
@@ -110,6 +422,49 @@ public:
 
 private:
 
+  struct commitCounters {
+    unsigned long commits;
+    unsigned long pages;
+    unsigned long kcycles;
+  };
+
+  struct syncCounters {
+    unsigned long operations;
+    unsigned long syscalls;
+    unsigned long quiet;     // Operations that made no system call at all.
+  };
+
+  // The counters of the optional features, after the ones above.
+  struct counters {
+    struct commitCounters commits[2];  // Serial, then parallel commits.
+    unsigned long poolPeaks[POOLS];
+    unsigned long refreshes;
+    unsigned long refreshSyscalls;
+    unsigned long prefetchedPages;
+    unsigned long avoidedFaults;
+    unsigned long predictedPages;
+    unsigned long predictedWritten;
+    unsigned long faultTransactions;
+    unsigned long minorFaults;
+    unsigned long pagesShared;
+    unsigned long probations;
+    unsigned long threadsLeft;
+    unsigned long threadsBack;
+    unsigned long lazyAcquires;
+    unsigned long notices;
+    unsigned long fullAcquires;
+    unsigned long relocks;
+    unsigned long revoked;
+    struct syncCounters sync[SYNC_OPS];
+    unsigned long quietReads;
+    unsigned long futexes;
+    unsigned long polls;
+    unsigned long pinned;
+    unsigned long fenced;
+    unsigned long droppedWords;
+    unsigned long atomicWrites;
+  };
+
   static void * allocateShared (size_t sz) {
     return WRAP(mmap) (NULL,
 		       sizeof(stats),
@@ -125,6 +480,7 @@ private:
   unsigned long * _pages;
   unsigned long * _prots;
   unsigned long * _caches;
+  struct counters * _counters;
 };
 
 #endif
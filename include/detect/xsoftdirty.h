@@ -0,0 +1,172 @@
+// -*- C++ -*-
+/*
+  Copyright (C) 2011 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xsoftdirty.h
+ * @brief  Find the pages written by this process with the kernel's soft-dirty bits.
+ *
+ *         Writing "4" to /proc/self/clear_refs clears the soft-dirty bit of
+ *         every page of the process; bit 55 of a /proc/self/pagemap entry
+ *         is set again once the page is written. Both files refer to the
+ *         process that opened them, so every Sheriff "thread" opens its own.
+ *         Needs CONFIG_MEM_SOFT_DIRTY; available() checks it on a scratch page.
+ */
+
+#ifndef _XSOFTDIRTY_H_
+#define _XSOFTDIRTY_H_
+
+#include <fcntl.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "xdefines.h"
+
+class xsoftdirty {
+public:
+
+  static xsoftdirty& getInstance (void) {
+    static char buf[sizeof(xsoftdirty)];
+    static xsoftdirty * theOneTrueObject = new (buf) xsoftdirty();
+    return *theOneTrueObject;
+  }
+
+  /// @return true if the kernel keeps soft-dirty bits for us.
+  bool available (void) {
+    if (_probed) {
+      return _available;
+    }
+    _probed = true;
+
+    if (!open()) {
+      return false;
+    }
+
+    char * page = (char *) mmap (NULL, xdefines::PageSize, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+      return false;
+    }
+
+    // Without CONFIG_MEM_SOFT_DIRTY clear_refs takes "4" but the bit never shows up.
+    page[0] = 1;
+    clear();
+    page[0] = 2;
+    _available = (read (page, 1) == 1) && isDirty(_entries[0]);
+    munmap (page, xdefines::PageSize);
+
+    if (!_available) {
+      close();
+    }
+    return _available;
+  }
+
+  /// @brief Make sure this process has its own files, starting a new
+  /// interval if it has just been forked.
+  void attach (void) {
+    pid_t mypid = syscall(SYS_getpid);
+    if (_owningPid != mypid) {
+      open();
+      clear();
+    }
+  }
+
+  /// @brief Start a new interval: forget all writes so far.
+  void clear (void) {
+    if (_clearFd == -1 || ::write (_clearFd, "4", 1) != 1) {
+      fprintf (stderr, "%d : failed to clear soft-dirty bits\n", getpid());
+    }
+  }
+
+  /// @brief Read the pagemap entries of pages starting at start.
+  /// @return the number of entries read into entries(), at most SCAN_PAGES.
+  int read (void * start, int pages) {
+    if (pages > SCAN_PAGES) {
+      pages = SCAN_PAGES;
+    }
+
+    off_t offset = ((uintptr_t) start / xdefines::PageSize) * sizeof(uint64_t);
+    ssize_t bytes = pread (_pagemapFd, _entries, pages * sizeof(uint64_t), offset);
+    if (bytes <= 0) {
+      return 0;
+    }
+    return bytes / sizeof(uint64_t);
+  }
+
+  const uint64_t * entries (void) const {
+    return _entries;
+  }
+
+  static bool isDirty (uint64_t entry) {
+    return (entry >> 55) & 1;
+  }
+
+  static bool isPresent (uint64_t entry) {
+    return (entry >> 63) & 1;
+  }
+
+  /// @brief Close the files of this process, if it has any.
+  void close (void) {
+    if (_owningPid == syscall(SYS_getpid)) {
+      ::close (_pagemapFd);
+      ::close (_clearFd);
+      _pagemapFd = _clearFd = -1;
+    }
+  }
+
+  /// Pagemap entries read at once.
+  enum { SCAN_PAGES = 512 };
+
+private:
+
+  xsoftdirty (void)
+    : _owningPid (0),
+      _pagemapFd (-1),
+      _clearFd (-1),
+      _probed (false),
+      _available (false)
+  {}
+
+  bool open (void) {
+    // Descriptors inherited from the parent describe the parent, and the
+    // descriptor table is shared with it, so leave them alone.
+    _owningPid = syscall(SYS_getpid);
+    _pagemapFd = ::open ("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    _clearFd = ::open ("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    return (_pagemapFd != -1 && _clearFd != -1);
+  }
+
+  /// The process that opened the files.
+  pid_t _owningPid;
+
+  int _pagemapFd;
+  int _clearFd;
+
+  bool _probed;
+  bool _available;
+
+  /// Scans may run in the timer handler on the small signal stack.
+  uint64_t _entries[SCAN_PAGES];
+};
+
+#endif
@@ -87,6 +87,11 @@ public:
     return p;
   }
 
+  /// Hand the memory of whole pages of a freed range back to the system.
+  inline void releasePages (void * start, size_t sz) {
+    madvise (start, sz, MADV_REMOVE);
+  }
+
   // These should never be used.
   inline void free (void * ptr) { sanityCheck(); }
   inline size_t getSize (void * ptr) { sanityCheck(); return 0; } // FIXME
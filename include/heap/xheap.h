@@ -77,6 +77,12 @@ public:
     *_position  = (char *)_start;
     *_remaining = parent::size();
     *_magic     = 0xCAFEBABE;
+
+#if !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    parent::setHeapEnd(_position);
+#elif defined(SOFT_DIRTY_DETECTION) && defined(DETECT_FALSE_SHARING)
+    parent::setHeapEnd(_position);
+#endif
   }
 
   inline void * getend(void) {
@@ -106,6 +112,11 @@ public:
     
     _lock->unlock();
 
+#if defined(UFFD_TRACKING) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    // Writes to the new chunk must be caught before we hand it out.
+    parent::extendTracking((char *)p + sz);
+#endif
+
     return p;
   }
 
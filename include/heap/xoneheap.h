@@ -41,6 +41,7 @@ public:
   void initialize() { getHeap()->initialize(); }
   void finalize (void * end) { getHeap()->finalize(end); }
   void begin() { getHeap()->begin(); }
+  void twinPredictedPages() { getHeap()->twinPredictedPages(); }
   void commit (bool doChecking) { getHeap()->commit(doChecking); }
   void cleanup() { getHeap()->cleanup(); }
   void setHeapId (int index) { return getHeap()->setHeapId(index); }
@@ -65,6 +66,27 @@ public:
   void * malloc (size_t sz) { return getHeap()->malloc(sz); }
   void free (void * ptr) { getHeap()->free(ptr); }
   size_t getSize (void * ptr) { return getHeap()->getSize(ptr); }
+  void releasePages (void * start, size_t sz) { getHeap()->releasePages(start, sz); }
+  void reuseMemory (void * ptr, size_t sz) { getHeap()->reuseMemory(ptr, sz); }
+  void threadStart() { getHeap()->threadStart(); }
+  void threadExit() { getHeap()->threadExit(); }
+  bool pageLocksHeld() { return getHeap()->pageLocksHeld(); }
+  unsigned long takeSharedCommits() { return getHeap()->takeSharedCommits(); }
+  unsigned long inPlaceConflicts() { return getHeap()->inPlaceConflicts(); }
+  unsigned long refreshCalls() { return getHeap()->refreshCalls(); }
+#ifdef LAZY_RELEASE
+  void noticePage (void * addr) { getHeap()->noticePage(addr); }
+  void setLazyUpdate() { getHeap()->setLazyUpdate(); }
+#endif
+#ifdef ATOMIC_SYNC
+  void pinWord (void * addr, bool share) { getHeap()->pinWord(addr, share); }
+  unsigned long pinPolledPages() { return getHeap()->pinPolledPages(); }
+  bool isFenced (void * addr) { return getHeap()->isFenced(addr); }
+  bool fencedWrite (void * addr, bool atomic) { return getHeap()->fencedWrite(addr, atomic); }
+  void openFence (void * page) { getHeap()->openFence(page); }
+  void closeFences () { getHeap()->closeFences(); }
+  void setDropCopies () { getHeap()->setDropCopies(); }
+#endif
 
   void sharemem_write_word(void * dest, unsigned long val) {
     getHeap()->sharemem_write_word(dest, val);
@@ -1,12 +1,17 @@
 #ifndef _REAL_H_
 #define _REAL_H_
 
+#include <stdio.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #define WRAP(x) _real_##x
 
 // libc functions
 extern void* (*WRAP(mmap))(void*, size_t, int, int, int, off_t);
+extern void* (*WRAP(mremap))(void*, size_t, size_t, int, ...);
+extern void* (*WRAP(dlopen))(const char*, int);
 extern void* (*WRAP(malloc))(size_t);
 extern void  (*WRAP(free))(void *);
 extern void* (*WRAP(realloc))(void *, size_t);
@@ -14,13 +19,28 @@ extern void* (*WRAP(memalign))(size_t, size_t);
 extern size_t (*WRAP(malloc_usable_size))(void *);
 extern ssize_t (*WRAP(read))(int, void*, size_t);
 extern ssize_t (*WRAP(write))(int, const void*, size_t);
+extern ssize_t (*WRAP(recv))(int, void*, size_t, int);
+extern ssize_t (*WRAP(pread))(int, void*, size_t, off_t);
+extern ssize_t (*WRAP(readv))(int, const struct iovec*, int);
+extern ssize_t (*WRAP(recvfrom))(int, void*, size_t, int, struct sockaddr*, socklen_t*);
+extern ssize_t (*WRAP(recvmsg))(int, struct msghdr*, int);
+extern size_t (*WRAP(fread))(void*, size_t, size_t, FILE*);
 extern int (*WRAP(sigwait))(const sigset_t*, int*);
 
+// The C library's syscall(): with ATOMIC_SYNC, syscall() is ours, and
+// futexes of the runtime itself must not go through it.
+extern long (*WRAP(syscall))(long, ...);
+
+// libgomp, when the program is built with -fopenmp (NULL otherwise)
+extern int (*WRAP(omp_get_max_threads))(void);
+extern void (*WRAP(omp_get_schedule))(int*, int*);
+
 // pthread basics
 extern int (*WRAP(pthread_create))(pthread_t*, const pthread_attr_t*, void *(*)(void*), void*);
 extern int (*WRAP(pthread_cancel))(pthread_t);
 extern int (*WRAP(pthread_join))(pthread_t, void**);
 extern int (*WRAP(pthread_exit))(void*);
+extern pthread_t (*WRAP(pthread_self))(void);
 
 // pthread mutexes
 extern int (*WRAP(pthread_mutexattr_init))(pthread_mutexattr_t*);
@@ -28,6 +48,7 @@ extern int (*WRAP(pthread_mutex_init))(pthread_mutex_t*, const pthread_mutexattr
 extern int (*WRAP(pthread_mutex_lock))(pthread_mutex_t*);
 extern int (*WRAP(pthread_mutex_unlock))(pthread_mutex_t*);
 extern int (*WRAP(pthread_mutex_trylock))(pthread_mutex_t*);
+extern int (*WRAP(pthread_mutex_timedlock))(pthread_mutex_t*, const struct timespec*);
 extern int (*WRAP(pthread_mutex_destroy))(pthread_mutex_t*);
 
 // pthread condition variables
@@ -43,6 +64,17 @@ extern int (*WRAP(pthread_barrier_init))(pthread_barrier_t*, pthread_barrierattr
 extern int (*WRAP(pthread_barrier_wait))(pthread_barrier_t*);
 extern int (*WRAP(pthread_barrier_destroy))(pthread_barrier_t*);
 
+// pthread reader-writer locks
+extern int (*WRAP(pthread_rwlock_init))(pthread_rwlock_t*, const pthread_rwlockattr_t*);
+extern int (*WRAP(pthread_rwlock_rdlock))(pthread_rwlock_t*);
+extern int (*WRAP(pthread_rwlock_wrlock))(pthread_rwlock_t*);
+extern int (*WRAP(pthread_rwlock_tryrdlock))(pthread_rwlock_t*);
+extern int (*WRAP(pthread_rwlock_trywrlock))(pthread_rwlock_t*);
+extern int (*WRAP(pthread_rwlock_timedrdlock))(pthread_rwlock_t*, const struct timespec*);
+extern int (*WRAP(pthread_rwlock_timedwrlock))(pthread_rwlock_t*, const struct timespec*);
+extern int (*WRAP(pthread_rwlock_unlock))(pthread_rwlock_t*);
+extern int (*WRAP(pthread_rwlock_destroy))(pthread_rwlock_t*);
+
 void init_real_functions();
 
 #endif
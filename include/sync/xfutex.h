@@ -0,0 +1,294 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xfutex.h
+ * @brief  Mutexes, condition variables and barriers shared by processes,
+ *         built on futexes (FUTEX_SYNC).
+ *
+ *         They live in shared memory and are plain words: no attributes,
+ *         no robust or priority-inheritance lists, and nothing a fork has
+ *         to set up again. Every wait is a non-private FUTEX_WAIT, since
+ *         Sheriff threads are processes. A mutex is spun on for a while
+ *         before its waiter sleeps, and nobody makes a system call to
+ *         unlock it or signal a condition unless somebody sleeps on it.
+ */
+
+#ifndef SHERIFF_XFUTEX_H
+#define SHERIFF_XFUTEX_H
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <syscall.h>
+#include <unistd.h>
+#include <linux/futex.h>
+
+#include "xdefines.h"
+#include "atomic.h"
+#include "realfuncs.h"
+
+class xfutex {
+public:
+
+  /// How many times to spin on a mutex before sleeping: not at all with
+  /// one processor, where its holder cannot run meanwhile.
+  static int spins (void) {
+    static int count = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? xdefines::FUTEX_SPINS : 0;
+    return count;
+  }
+
+  /// Wait on or wake a word; only its low half changes between waits.
+  static void futex (volatile unsigned long * addr, int op, int val) {
+    WRAP(syscall) (SYS_futex, (int *)addr, op, val, NULL, NULL, 0);
+  }
+
+  /// @brief Wait on a word while it holds val, until abstime
+  /// (CLOCK_REALTIME) if that is not NULL.
+  /// @return false once abstime has passed.
+  static bool waitUntil (volatile unsigned long * addr, int val, const struct timespec * abstime) {
+    if (abstime == NULL) {
+      futex(addr, FUTEX_WAIT, val);
+      return true;
+    }
+    return (WRAP(syscall) (SYS_futex, (int *)addr, FUTEX_WAIT_BITSET | FUTEX_CLOCK_REALTIME, val,
+                           abstime, NULL, FUTEX_BITSET_MATCH_ANY) == 0 || errno != ETIMEDOUT);
+  }
+};
+
+/// A mutex in three states, as in Drepper's "Futexes Are Tricky".
+struct futexmutex {
+  enum { UNLOCKED = 0, LOCKED = 1, CONTENDED = 2 };
+
+  volatile unsigned long word;
+
+  void init (void) {
+    word = UNLOCKED;
+  }
+
+  /// @brief Lock, spinning for a while before sleeping.
+  inline void lock (void) {
+    int spins = xfutex::spins();
+    for (int i = 0; i < spins; i++) {
+      if (word == UNLOCKED
+          && atomic::compare_and_swap(&word, UNLOCKED, LOCKED) == UNLOCKED) {
+        return;
+      }
+      atomic::pause();
+    }
+
+    unsigned long state = atomic::compare_and_swap(&word, UNLOCKED, LOCKED);
+    if (state != UNLOCKED) {
+      lockContended(state);
+    }
+  }
+
+  inline bool trylock (void) {
+    return (atomic::compare_and_swap(&word, UNLOCKED, LOCKED) == UNLOCKED);
+  }
+
+  inline void unlock (void) {
+    if (atomic::exchange(&word, UNLOCKED) == CONTENDED) {
+      xfutex::futex(&word, FUTEX_WAKE, 1);
+    }
+  }
+
+  /// @brief Lock without spinning, unless abstime passes first.
+  /// @return false if it did.
+  bool lockUntil (const struct timespec * abstime) {
+    unsigned long state = atomic::compare_and_swap(&word, UNLOCKED, LOCKED);
+    return (state == UNLOCKED || lockContended(state, abstime));
+  }
+
+  /// @brief Lock, as one of maybe several sleepers: whoever unlocks it
+  /// next has to wake the others.
+  bool lockContended (unsigned long state = CONTENDED, const struct timespec * abstime = NULL) {
+    if (state != CONTENDED) {
+      state = atomic::exchange(&word, CONTENDED);
+    }
+    while (state != UNLOCKED) {
+      if (!xfutex::waitUntil(&word, CONTENDED, abstime)) {
+        return false;
+      }
+      state = atomic::exchange(&word, CONTENDED);
+    }
+    return true;
+  }
+};
+
+/// A reader-writer lock that lets readers in whenever no writer holds it,
+/// as glibc does by default. Whoever waits sleeps on a sequence number
+/// that every unlock bumps, and all sleepers wake to try again.
+struct futexrwlock {
+  enum { WRITER = 0x40000000 };
+
+  /// The readers inside, or WRITER.
+  volatile unsigned long word;
+  volatile unsigned long sequence;
+  volatile unsigned long sleepers;
+
+  void init (void) {
+    word = 0;
+    sequence = 0;
+    sleepers = 0;
+  }
+
+  inline bool tryrdlock (void) {
+    unsigned long state = word;
+    while (!(state & WRITER)) {
+      unsigned long found = atomic::compare_and_swap(&word, state, state + 1);
+      if (found == state) {
+        return true;
+      }
+      state = found;
+    }
+    return false;
+  }
+
+  inline bool trywrlock (void) {
+    return (atomic::compare_and_swap(&word, 0, WRITER) == 0);
+  }
+
+  /// @return false if abstime passed first.
+  bool rdlock (const struct timespec * abstime) {
+    while (!tryrdlock()) {
+      if (!sleep(false, abstime)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// @return false if abstime passed first.
+  bool wrlock (const struct timespec * abstime) {
+    while (!trywrlock()) {
+      if (!sleep(true, abstime)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// @brief Unlock, as the writer or as one of the readers.
+  inline void unlock (void) {
+    if (word == WRITER) {
+      atomic::atomic_set(&word, 0);
+    }
+    else {
+      atomic::decrement(&word);
+    }
+    atomic::increment(&sequence);
+    if (sleepers != 0) {
+      xfutex::futex(&sequence, FUTEX_WAKE, INT_MAX);
+    }
+  }
+
+private:
+
+  /// @brief Sleep until an unlock, unless the lock can be taken by now.
+  bool sleep (bool writer, const struct timespec * abstime) {
+    atomic::increment(&sleepers);
+    unsigned long seen = sequence;
+    bool intime = true;
+    if (writer ? (word != 0) : (word & WRITER)) {
+      intime = xfutex::waitUntil(&sequence, (int)seen, abstime);
+    }
+    atomic::decrement(&sleepers);
+    return intime;
+  }
+};
+
+/// A condition variable: a sequence number bumped by every signal, which
+/// waiters sleep on. Waiters that slept through several signals all wake.
+struct futexcond {
+  volatile unsigned long sequence;
+  volatile unsigned long waiters;
+
+  void init (void) {
+    sequence = 0;
+    waiters = 0;
+  }
+
+  /// @brief Unlock the mutex, wait for a signal and lock it again. Wakes
+  /// up spuriously if a signal came between the unlock and the sleep.
+  void wait (struct futexmutex * mutex) {
+    atomic::increment(&waiters);
+    unsigned long seen = sequence;
+    mutex->unlock();
+    xfutex::futex(&sequence, FUTEX_WAIT, (int)seen);
+    atomic::decrement(&waiters);
+    mutex->lockContended();
+  }
+
+  inline void signal (void) {
+    wake(1);
+  }
+
+  inline void broadcast (void) {
+    wake(INT_MAX);
+  }
+
+private:
+
+  inline void wake (int count) {
+    atomic::increment(&sequence);
+    if (waiters != 0) {
+      xfutex::futex(&sequence, FUTEX_WAKE, count);
+    }
+  }
+};
+
+/// A sense-reversing barrier. The last thread to arrive starts the count
+/// over and flips the sense, here a generation number the others sleep on.
+struct futexbarrier {
+  unsigned long count;
+  volatile unsigned long arrived;
+  volatile unsigned long generation;
+
+  void init (unsigned int threads) {
+    count = threads;
+    arrived = 0;
+    generation = 0;
+  }
+
+  /// @return PTHREAD_BARRIER_SERIAL_THREAD for the last thread to arrive.
+  /// The others call blocking() once, before they sleep.
+  int wait (void (*blocking)(void)) {
+    unsigned long seen = generation;
+
+    if ((unsigned long)atomic::increment_and_return(&arrived) + 1 == count) {
+      // Nobody arrives for the next round before the sense flips.
+      arrived = 0;
+      atomic::increment(&generation);
+      xfutex::futex(&generation, FUTEX_WAKE, INT_MAX);
+      return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+
+    blocking();
+    while (generation == seen) {
+      xfutex::futex(&generation, FUTEX_WAIT, (int)seen);
+    }
+    return 0;
+  }
+};
+
+#endif
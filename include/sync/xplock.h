@@ -13,6 +13,9 @@
 #include <stdlib.h>
 
 #include "internalheap.h"
+#ifdef FUTEX_SYNC
+#include "xfutex.h"
+#endif
 
 /**
  * @class xplock
@@ -27,6 +30,13 @@ class xplock {
 public:
 
   xplock (void) {
+#ifdef FUTEX_SYNC
+    _lock = (struct futexmutex *)
+      mmap (NULL, xdefines::PageSize,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    _lock->init();
+#else
     /// The lock's attributes.
     pthread_mutexattr_t attr;
 
@@ -41,22 +51,35 @@ public:
 		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 
     WRAP(pthread_mutex_init) (_lock, &attr);
+#endif
   }
 
   /// @brief Lock the lock.
   void lock() {
+#ifdef FUTEX_SYNC
+    _lock->lock();
+#else
     WRAP(pthread_mutex_lock) (_lock);
+#endif
   }
 
   /// @brief Unlock the lock.
   void unlock() {
+#ifdef FUTEX_SYNC
+    _lock->unlock();
+#else
     WRAP(pthread_mutex_unlock)(_lock);
+#endif
   }
 
 private:
 
   /// A pointer to the lock.
+#ifdef FUTEX_SYNC
+  struct futexmutex * _lock;
+#else
   pthread_mutex_t * _lock;
+#endif
 };
 
 #endif
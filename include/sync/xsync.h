@@ -9,6 +9,7 @@
 #include <pthread.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <syscall.h>
 #include <unistd.h>
 #endif
 
@@ -19,23 +20,153 @@
 
 #include "xdefines.h"
 #include "internalheap.h"
+#include "atomic.h"
 #if defined(DETECT_FALSE_SHARING)
 #include "xmemory.h"
 #else
 #include "xmemory_opt.h"
 #endif
+#ifdef LAZY_RELEASE
+#include "xnotices.h"
+#endif
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#ifdef FUTEX_SYNC
+#include "xfutex.h"
+#endif
 /**
  * @class xbarrier
  * @brief Manage the cross-process barrier.
  *  Here, we will do some tricks since we can not use the passed barrier because it is a global variable(protected by us). 
  *  We don't want to introduce the additional read/write set. That will cause some confuse. 
  *
+ *  With FUTEX_SYNC, the real objects are futex words (see xfutex.h) kept
+ *  in a shared registry, found by the address of the program's object.
+ *  Finding an entry takes no lock; claiming a new one takes the lock of
+ *  the registry, so that no object ever gets two: two claims racing past
+ *  a slot that turns into a tombstone meanwhile would pick different
+ *  slots, which a compare-and-swap on each alone does not rule out. An
+ *  object claims once, at its first use or initialization. The registry
+ *  is a series of open-addressed tables, each twice the last, mapped up
+ *  front but only touched as they fill up. A destroyed object leaves a
+ *  tombstone, which the next claim in its table takes over.
+ *  Reader-writer locks and spin locks always live there: a spin lock has
+ *  no room for a pointer to its real object.
+ *
+ *  A mutex, condition variable or reader-writer lock whose entry is
+ *  claimed gets a mark in its first word. Where the object is in memory
+ *  Sheriff protects, the mark is written to the shared copy only, through
+ *  sharemem_write_word(): that takes the page's lock and moves its
+ *  version, as a commit of that one word would, and so counts as a write
+ *  to the page for every thread with a copy of it. Found all zero in
+ *  both copies, the object was initialized again by the program,
+ *  statically or with memset(): its entry starts over, instead of
+ *  keeping what an object that lived at the same address left in it.
  */
 class xsync {
+
+  /// A mutex, first, and what is kept along with it.
+  struct mutexentry {
+#ifdef FUTEX_SYNC
+    struct futexmutex mutex;
+#else
+    pthread_mutex_t mutex;
+#endif
+#ifdef LAZY_RELEASE
+    /// The write notices its last release passed on.
+    struct noticeclock clock;
+#endif
+#ifdef BIASED_LOCKS
+    /// Threads blocked on it, whether a thread failed to try it since it
+    /// was last unlocked, the thread it is biased to if any, the last
+    /// thread to acquire it and how many times in a row, and how many
+    /// biases on it were revoked.
+    volatile unsigned long waiters;
+    volatile unsigned long wanted;
+    volatile unsigned long biasOwner;
+    pid_t lastOwner;
+    unsigned int acquisitions;
+    unsigned int revocations;
+#endif
+  };
+
+  /// A reader-writer lock, and how many times a writer released it.
+  struct rwlockentry {
+#ifdef FUTEX_SYNC
+    struct futexrwlock lock;
+#else
+    pthread_rwlock_t lock;
+#endif
+    volatile unsigned long writes;
+    volatile unsigned long writing;
+
+    /// Which object at the address this is, see seeRwlock().
+    unsigned long generation;
+  };
+
+#ifdef FUTEX_SYNC
+  typedef struct futexcond condentry;
+  typedef struct futexbarrier barrierentry;
+#else
+  typedef pthread_cond_t condentry;
+  typedef pthread_barrier_t barrierentry;
+#endif
+
+  /// Where an entry of the registry is, and keys that are no address:
+  /// a slot never used, and a slot of a destroyed object.
+  enum { ENTRY_BUSY = 0, ENTRY_READY };
+  enum { KEY_FREE = 0, KEY_TOMBSTONE = 1 };
+
+  /// The first word of an object with an entry.
+  enum { OBJECT_MARK = 0x5348 };
+
+  /// What all threads share about the registry: its lock, the tables in
+  /// use, and how many entries were initialized so far.
+  struct registry {
+    volatile unsigned long lock;
+    volatile unsigned long levels;
+    volatile unsigned long generation;
+  };
+
+  struct syncentry {
+    volatile unsigned long state;
+    union {
+      struct mutexentry mutex;
+      condentry cond;
+      barrierentry barrier;
+      struct rwlockentry rwlock;
+    };
+  };
+
 public:
 
   xsync()
   {
+    _registry = (struct registry *)
+      mmap(NULL, sizeof(struct registry), PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(_registry == MAP_FAILED) {
+      fprintf(stderr, "%d : sync registry mapping failed with error %s\n", getpid(), strerror(errno));
+      ::abort();
+    }
+    _registry->levels = 1;
+
+    for(int level = 0; level < xdefines::SYNC_LEVELS; level++) {
+      unsigned long entries = levelEntries(level);
+      _keys[level] = (volatile unsigned long *)
+        mmap(NULL, entries * sizeof(unsigned long), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      _entries[level] = (struct syncentry *)
+        mmap(NULL, entries * sizeof(struct syncentry), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if(_keys[level] == MAP_FAILED || _entries[level] == MAP_FAILED) {
+        fprintf(stderr, "%d : sync registry mapping failed with error %s\n", getpid(), strerror(errno));
+        ::abort();
+      }
+    }
+
+#ifndef FUTEX_SYNC
     WRAP(pthread_mutexattr_init)(&_mutex_attr);
     pthread_mutexattr_setpshared (&_mutex_attr, PTHREAD_PROCESS_SHARED);
 
@@ -44,53 +175,264 @@ public:
 
     pthread_barrierattr_init(&_barrier_attr);
     pthread_barrierattr_setpshared (&_barrier_attr, PTHREAD_PROCESS_SHARED);
+
+    pthread_rwlockattr_init(&_rwlock_attr);
+    pthread_rwlockattr_setpshared (&_rwlock_attr, PTHREAD_PROCESS_SHARED);
+#endif
+
+    thread_start();
   }
 
   /// @brief Initialize the lock.
-  inline pthread_mutex_t * mutex_init(pthread_mutex_t * lck, bool needProtect) {
-    pthread_mutex_t * realMutex = NULL;
+  inline struct mutexentry * mutex_init(pthread_mutex_t * lck, bool needProtect) {
+#ifdef FUTEX_SYNC
+    // Lazily, only whoever claims the entry initializes it.
+    bool fresh;
+    struct syncentry * slot = claimEntry(lck, &fresh, true);
+    if(fresh || !needProtect) {
+      initMutex(&slot->mutex);
+    }
+    if(fresh) {
+      publishEntry(slot);
+    }
+    return &slot->mutex;
+#else
+    struct mutexentry * entry = NULL;
 
     if(needProtect) {
       lock();
-      realMutex = (pthread_mutex_t *)getSyncEntry_sharemem(lck); 
+      entry = (struct mutexentry *)getSyncEntry_sharemem(lck); 
     }
    
-    if(!realMutex) {
-      realMutex = (pthread_mutex_t *)allocSyncEntry(lck, sizeof(pthread_mutex_t));
-    
-      // Initialize the mutex that shared by different processes
-      WRAP(pthread_mutex_init)(realMutex, &_mutex_attr);
+    if(!entry) {
+      entry = (struct mutexentry *)allocSyncEntry(lck, sizeof(struct mutexentry));
+      initMutex(entry);
     }
     
     if(needProtect) {
       unlock();
     }
     
-    return realMutex;
+    return entry;
+#endif
   }
 
   /// @brief Lock the lock.
   inline int mutex_lock (pthread_mutex_t * lck) {
-    pthread_mutex_t * realMutex = getRealMutex(lck);
+    return mutex_timedlock(lck, NULL);
+  }
+
+  /// @brief Lock the lock, unless abstime passes first (if not NULL).
+  inline int mutex_timedlock (pthread_mutex_t * lck, const struct timespec * abstime) {
+    struct mutexentry * entry = getRealMutex(lck);
   
-    assert(realMutex != NULL);
+    assert(entry != NULL);
+#ifdef BIASED_LOCKS
+    // A thread holding the bias hands the lock over once it sees us, at
+    // once if it was not inside it: see xrun::revokeBiases().
+    atomic::increment(&entry->waiters);
+    askOwner(entry);
+    int result = lockEntry(entry, abstime);
+    atomic::decrement(&entry->waiters);
+
+    if(result == 0) {
+      countAcquisition(entry);
+    }
+    return result;
+#else
     // Now lock it.
-    return WRAP(pthread_mutex_lock) (realMutex);
+    return lockEntry(entry, abstime);
+#endif
+  }
+
+  /// @return 0 if the lock was taken, EBUSY if somebody holds it.
+  inline int mutex_trylock (pthread_mutex_t * lck) {
+    struct mutexentry * entry = getRealMutex(lck);
+
+    assert(entry != NULL);
+    int result = trylockEntry(entry);
+#ifdef BIASED_LOCKS
+    if(result == 0) {
+      countAcquisition(entry);
+    }
+    else {
+      // Nobody waits, but the holder must not keep it for good either:
+      // its next unlock is a real one.
+      atomic::exchange(&entry->wanted, 1);
+      askOwner(entry);
+    }
+#endif
+    return result;
   }
 
   /// @brief Unlock the lock.
   inline int mutex_unlock (pthread_mutex_t * lck) {
-    pthread_mutex_t * realMutex = getRealMutex(lck);
-    assert(realMutex != NULL);
-    return WRAP(pthread_mutex_unlock) (realMutex);
+    struct mutexentry * entry = getRealMutex(lck);
+    assert(entry != NULL);
+    return unlockEntry(entry);
   }
   
   /// @brief Destroy the lock.
   inline void mutex_destroy (pthread_mutex_t * lck) {
+#ifdef BIASED_LOCKS
+    // Unlocked as far as the program knows, but still locked by its bias.
+    int index = findBiased(lck);
+    if(index != -1) {
+      getRealMutex(lck)->biasOwner = 0;
+      getRealMutex(lck)->wanted = 0;
+      unlockEntry(getRealMutex(lck));
+      removeBiased(index);
+    }
+#endif
     deallocSyncEntry(lck);
   }
 
-  pthread_cond_t * cond_init(void * cond, bool needProtect) {
+#ifdef LAZY_RELEASE
+  /// @return the write notices the last release of the lock passed on.
+  inline struct noticeclock * mutex_clock (pthread_mutex_t * lck) {
+    return &getRealMutex(lck)->clock;
+  }
+#endif
+
+  /// @brief This process is a new thread: it holds no bias yet, and has
+  /// seen no reader-writer lock.
+  void thread_start (void) {
+    memset(_rwlocksSeen, 0, sizeof(_rwlocksSeen));
+    _nextSeen = 0;
+#ifdef BIASED_LOCKS
+    _pid = syscall(SYS_getpid);
+    _biasedCount = 0;
+    _relocks = 0;
+    _revoked = 0;
+#endif
+  }
+
+#ifdef BIASED_LOCKS
+  /// @return the signal that asks a thread to hand its biased locks over.
+  static int revokeSignal (void) {
+    return SIGRTMIN + xdefines::REVOKE_SIGNAL;
+  }
+
+  /// @brief Lock again a lock biased to this thread, if nobody waits for
+  /// it. No other thread ran it since we unlocked it, so there is nothing
+  /// to commit or refresh.
+  /// @return false if the lock has to be taken the usual way.
+  inline bool mutex_relock (pthread_mutex_t * lck) {
+    int index = findBiased(lck);
+    if(index == -1 || _biasedHeld[index] || contended(getRealMutex(lck))) {
+      return false;
+    }
+    _biasedHeld[index] = true;
+    _relocks++;
+    return true;
+  }
+
+  /// @brief Keep the lock locked, instead of unlocking it, while it is
+  /// biased to this thread and nobody waits for it. A lock this thread
+  /// acquired BIAS_ACQUISITIONS times in a row becomes biased to it; each
+  /// revocation doubles that, up to BIAS_REVOCATIONS times.
+  /// @return false if the lock has to be unlocked the usual way.
+  inline bool mutex_keep (pthread_mutex_t * lck) {
+    struct mutexentry * entry = getRealMutex(lck);
+    int index = findBiased(lck);
+
+    if(contended(entry)) {
+      if(index != -1) {
+        revokeBias(entry);
+        entry->biasOwner = 0;
+        removeBiased(index);
+      }
+      entry->wanted = 0;
+      return false;
+    }
+
+    if(index == -1) {
+      unsigned int shift = entry->revocations;
+      if(shift > (unsigned int)xdefines::BIAS_REVOCATIONS) {
+        shift = xdefines::BIAS_REVOCATIONS;
+      }
+      if(_biasedCount == xdefines::BIASED_LOCKS_MAX
+         || entry->lastOwner != _pid
+         || entry->acquisitions < ((unsigned int)xdefines::BIAS_ACQUISITIONS << shift)) {
+        return false;
+      }
+
+      // Who starts waiting from now on sees the bias; who did before is
+      // seen here.
+      atomic::exchange(&entry->biasOwner, _pid);
+      if(contended(entry)) {
+        entry->biasOwner = 0;
+        entry->wanted = 0;
+        return false;
+      }
+      index = _biasedCount++;
+      _biased[index] = lck;
+    }
+    _biasedHeld[index] = false;
+    return true;
+  }
+
+  /// @return true if a thread waits for a lock biased to this thread that
+  /// it is not inside of.
+  bool mutex_awaited (void) {
+    for(int i = 0; i < _biasedCount; i++) {
+      if(!_biasedHeld[i] && contended(getRealMutex(_biased[i]))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// @return true if a lock is biased to this thread that it is not inside
+  /// of.
+  bool mutex_idle (void) {
+    for(int i = 0; i < _biasedCount; i++) {
+      if(!_biasedHeld[i]) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// @brief Drop the bias of every lock biased to this thread, and return
+  /// one at a time those it is not inside of: they are still locked.
+  /// @return NULL once there are none left.
+  pthread_mutex_t * mutex_unbias (void) {
+    while(_biasedCount > 0) {
+      _biasedCount--;
+      pthread_mutex_t * lck = _biased[_biasedCount];
+      struct mutexentry * entry = getRealMutex(lck);
+      if(contended(entry)) {
+        revokeBias(entry);
+      }
+      entry->biasOwner = 0;
+      if(!_biasedHeld[_biasedCount]) {
+        entry->wanted = 0;
+        return lck;
+      }
+    }
+
+    if(_relocks + _revoked != 0) {
+      stats::getInstance().updateBiasedLocks(_relocks, _revoked);
+      _relocks = 0;
+      _revoked = 0;
+    }
+    return NULL;
+  }
+#endif
+
+  condentry * cond_init(void * cond, bool needProtect) {
+#ifdef FUTEX_SYNC
+    bool fresh;
+    struct syncentry * slot = claimEntry(cond, &fresh, true);
+    if(fresh || !needProtect) {
+      slot->cond.init();
+    }
+    if(fresh) {
+      publishEntry(slot);
+    }
+    return &slot->cond;
+#else
     pthread_cond_t * realCond = NULL;
 
     if(needProtect) {
@@ -109,6 +451,7 @@ public:
     }
 
     return realCond;
+#endif
   }
 
   void cond_destroy(void * cond) {
@@ -117,46 +460,81 @@ public:
 
   int cond_wait (void * cond, void * lck) {
     // Look for this cond in the map of initialized condes.
-    pthread_cond_t * realCond = getRealCond(cond);
-    pthread_mutex_t * realMutex = getRealMutex(lck);
+    condentry * realCond = getRealCond(cond);
+    struct mutexentry * entry = getRealMutex(lck);
 
-    return WRAP(pthread_cond_wait) (realCond, realMutex);
+#ifdef FUTEX_SYNC
+    realCond->wait(&entry->mutex);
+    return 0;
+#else
+    return WRAP(pthread_cond_wait) (realCond, &entry->mutex);
+#endif
   }
 
   /// @brief Unblock at least one thread waiting on the cond.
   int cond_signal (void * cond) {
-    pthread_cond_t * realCond = getRealCond(cond);
+    condentry * realCond = getRealCond(cond);
   
+#ifdef FUTEX_SYNC
+    realCond->signal();
+    return 0;
+#else
     return WRAP(pthread_cond_signal)(realCond);
+#endif
   }
 
   /// @brief Unblock all threads waiting on the cond.
   int cond_broadcast (void * cond) {
-    pthread_cond_t * realCond = getRealCond(cond);
+    condentry * realCond = getRealCond(cond);
+#ifdef FUTEX_SYNC
+    realCond->broadcast();
+    return 0;
+#else
     return WRAP(pthread_cond_broadcast)(realCond);
+#endif
   }
  
   /// @brief Initialize the barrier.
   int barrier_init(void * barrier, unsigned int count) {
-
+#ifdef FUTEX_SYNC
+    bool fresh;
+    struct syncentry * slot = claimEntry(barrier, &fresh, false);
+    slot->barrier.init(count);
+    if(fresh) {
+      publishEntry(slot);
+    }
+#else
     // Look for this barrier in the map of initialized barrieres.
     pthread_barrier_t * realBarrier=(pthread_barrier_t *)allocSyncEntry(barrier,sizeof(pthread_barrier_t));
 
     // Set this entry to be process-shared.
     WRAP(pthread_barrier_init)(realBarrier, &_barrier_attr, count);
+#endif
 
     // Initialize the barrier that shared by different processes
     return 0;
   }
 
-  int barrier_wait (void * barrier) {
+  /// @brief Wait at the barrier, calling blocking() first unless this
+  /// thread is known to be the last to arrive.
+  int barrier_wait (void * barrier, void (*blocking)(void)) {
+#ifdef FUTEX_SYNC
+    struct syncentry * slot = findEntry(barrier);
+
+    // barrier must be initialized explicitly.
+    assert(slot != NULL);
+
+    return slot->barrier.wait(blocking);
+#else
     // Look for this barrier in the map of initialized barrieres.
     pthread_barrier_t * realBarrier = (pthread_barrier_t *)getSyncEntry(barrier);
 
     // barrier must be initialized explicitly.
     assert(realBarrier);  
 
+    blocking();
     return WRAP(pthread_barrier_wait)(realBarrier);
+#endif
   }
 
   /// @brief Destroy the barrier.
@@ -166,8 +544,495 @@ public:
     return 0;
   }
 
+  /// @brief Initialize the reader-writer lock.
+  struct rwlockentry * rwlock_init (void * rwlock, bool needProtect) {
+    bool fresh;
+    struct syncentry * slot = claimEntry(rwlock, &fresh, true);
+    if(fresh || !needProtect) {
+      struct rwlockentry * entry = &slot->rwlock;
+      entry->writes = 0;
+      entry->writing = 0;
+      entry->generation = atomic::fetch_and_add(&_registry->generation, 1);
+#ifdef FUTEX_SYNC
+      entry->lock.init();
+#else
+      WRAP(pthread_rwlock_init)(&entry->lock, &_rwlock_attr);
+#endif
+    }
+    if(fresh) {
+      publishEntry(slot);
+    }
+    return &slot->rwlock;
+  }
+
+  void rwlock_destroy (void * rwlock) {
+    retireEntry(rwlock);
+  }
+
+  /// @brief Take the lock for reading, unless abstime passes first (if
+  /// not NULL).
+  int rwlock_rdlock (void * rwlock, const struct timespec * abstime) {
+    struct rwlockentry * entry = getRealRwlock(rwlock);
+#ifdef FUTEX_SYNC
+    return entry->lock.rdlock(abstime) ? 0 : ETIMEDOUT;
+#else
+    if(abstime == NULL) {
+      return WRAP(pthread_rwlock_rdlock)(&entry->lock);
+    }
+    return WRAP(pthread_rwlock_timedrdlock)(&entry->lock, abstime);
+#endif
+  }
+
+  /// @brief Take the lock for writing, unless abstime passes first (if
+  /// not NULL).
+  int rwlock_wrlock (void * rwlock, const struct timespec * abstime) {
+    struct rwlockentry * entry = getRealRwlock(rwlock);
+    int result;
+#ifdef FUTEX_SYNC
+    result = entry->lock.wrlock(abstime) ? 0 : ETIMEDOUT;
+#else
+    if(abstime == NULL) {
+      result = WRAP(pthread_rwlock_wrlock)(&entry->lock);
+    }
+    else {
+      result = WRAP(pthread_rwlock_timedwrlock)(&entry->lock, abstime);
+    }
+#endif
+    if(result == 0) {
+      entry->writing = 1;
+    }
+    return result;
+  }
+
+  /// @return 0 if the lock was taken for reading, EBUSY if a writer has it.
+  int rwlock_tryrdlock (void * rwlock) {
+    struct rwlockentry * entry = getRealRwlock(rwlock);
+#ifdef FUTEX_SYNC
+    return entry->lock.tryrdlock() ? 0 : EBUSY;
+#else
+    return WRAP(pthread_rwlock_tryrdlock)(&entry->lock);
+#endif
+  }
+
+  /// @return 0 if the lock was taken for writing, EBUSY if anybody has it.
+  int rwlock_trywrlock (void * rwlock) {
+    struct rwlockentry * entry = getRealRwlock(rwlock);
+#ifdef FUTEX_SYNC
+    int result = entry->lock.trywrlock() ? 0 : EBUSY;
+#else
+    int result = WRAP(pthread_rwlock_trywrlock)(&entry->lock);
+#endif
+    if(result == 0) {
+      entry->writing = 1;
+    }
+    return result;
+  }
+
+  /// @brief Release the lock. A writer does it once its writes are
+  /// committed: readers who take the lock afterwards have to see them.
+  int rwlock_unlock (void * rwlock) {
+    struct rwlockentry * entry = getRealRwlock(rwlock);
+    if(entry->writing) {
+      entry->writing = 0;
+      atomic::increment(&entry->writes);
+      // This thread saw its own writes.
+      seeRwlock(rwlock, entry);
+    }
+#ifdef FUTEX_SYNC
+    entry->lock.unlock();
+    return 0;
+#else
+    return WRAP(pthread_rwlock_unlock)(&entry->lock);
+#endif
+  }
+
+  /// @return true if this thread holds the lock, or it is held, for
+  /// writing.
+  inline bool rwlock_writing (void * rwlock) {
+    return (getRealRwlock(rwlock)->writing != 0);
+  }
+
+  /// @return true if no writer released the lock since this thread last
+  /// saw it. Called with the lock held.
+  inline bool rwlock_seen (void * rwlock) {
+    struct rwlockentry * entry = getRealRwlock(rwlock);
+    for(int i = 0; i < xdefines::RWLOCKS_SEEN; i++) {
+      if(_rwlocksSeen[i].rwlock == rwlock) {
+        return (_rwlocksSeen[i].generation == entry->generation
+                && _rwlocksSeen[i].writes == entry->writes);
+      }
+    }
+    return false;
+  }
+
+  /// @brief Everything writers released with the lock is about to be
+  /// seen by this thread. Called with the lock held.
+  inline void rwlock_see (void * rwlock) {
+    seeRwlock(rwlock, getRealRwlock(rwlock));
+  }
+
+  /// @brief Initialize the spin lock. It is a mutex, which spins a while
+  /// before sleeping with FUTEX_SYNC.
+  void spin_init (void * spinlock, bool needProtect) {
+    bool fresh;
+    struct syncentry * slot = claimEntry(spinlock, &fresh, false);
+    if(fresh || !needProtect) {
+      initMutex(&slot->mutex);
+    }
+    if(fresh) {
+      publishEntry(slot);
+    }
+  }
+
+  void spin_destroy (void * spinlock) {
+    retireEntry(spinlock);
+  }
+
+  int spin_lock (void * spinlock) {
+    return lockEntry(getRealSpin(spinlock), NULL);
+  }
+
+  int spin_trylock (void * spinlock) {
+    return trylockEntry(getRealSpin(spinlock));
+  }
+
+  int spin_unlock (void * spinlock) {
+    return unlockEntry(getRealSpin(spinlock));
+  }
+
 private:
 
+  inline void initMutex (struct mutexentry * entry) {
+#ifdef LAZY_RELEASE
+    xnotices::initialize(&entry->clock);
+#endif
+#ifdef BIASED_LOCKS
+    entry->waiters = 0;
+    entry->wanted = 0;
+    entry->biasOwner = 0;
+    entry->lastOwner = 0;
+    entry->acquisitions = 0;
+    entry->revocations = 0;
+#endif
+#ifdef FUTEX_SYNC
+    entry->mutex.init();
+#else
+    // Initialize the mutex that shared by different processes
+    WRAP(pthread_mutex_init)(&entry->mutex, &_mutex_attr);
+#endif
+  }
+
+  inline int lockEntry (struct mutexentry * entry, const struct timespec * abstime) {
+#ifdef FUTEX_SYNC
+    if(abstime == NULL) {
+      entry->mutex.lock();
+      return 0;
+    }
+    return entry->mutex.lockUntil(abstime) ? 0 : ETIMEDOUT;
+#else
+    if(abstime == NULL) {
+      return WRAP(pthread_mutex_lock) (&entry->mutex);
+    }
+    return WRAP(pthread_mutex_timedlock) (&entry->mutex, abstime);
+#endif
+  }
+
+  inline int trylockEntry (struct mutexentry * entry) {
+#ifdef FUTEX_SYNC
+    return entry->mutex.trylock() ? 0 : EBUSY;
+#else
+    return WRAP(pthread_mutex_trylock) (&entry->mutex);
+#endif
+  }
+
+  inline int unlockEntry (struct mutexentry * entry) {
+#ifdef FUTEX_SYNC
+    entry->mutex.unlock();
+    return 0;
+#else
+    return WRAP(pthread_mutex_unlock) (&entry->mutex);
+#endif
+  }
+
+  inline struct mutexentry * getRealSpin (void * spinlock) {
+    bool fresh;
+    struct syncentry * slot = claimEntry(spinlock, &fresh, false);
+    if(fresh) {
+      initMutex(&slot->mutex);
+      publishEntry(slot);
+    }
+    return &slot->mutex;
+  }
+
+  inline struct rwlockentry * getRealRwlock (void * rwlock) {
+    return rwlock_init(rwlock, true);
+  }
+
+  /// @brief Remember how many write releases of the lock this thread saw,
+  /// in place of the lock seen longest ago if there is no room. A lock
+  /// initialized again at the same address counts from 0 again: it is
+  /// told apart by its generation.
+  inline void seeRwlock (void * rwlock, struct rwlockentry * entry) {
+    int index = -1;
+    for(int i = 0; i < xdefines::RWLOCKS_SEEN; i++) {
+      if(_rwlocksSeen[i].rwlock == rwlock) {
+        index = i;
+        break;
+      }
+    }
+    if(index == -1) {
+      index = _nextSeen;
+      _nextSeen = (_nextSeen + 1) % xdefines::RWLOCKS_SEEN;
+    }
+    _rwlocksSeen[index].rwlock = rwlock;
+    _rwlocksSeen[index].generation = entry->generation;
+    _rwlocksSeen[index].writes = entry->writes;
+  }
+
+#ifdef BIASED_LOCKS
+  /// @brief Note who took the lock, and how many times in a row.
+  inline void countAcquisition (struct mutexentry * entry) {
+    if(entry->lastOwner == _pid) {
+      entry->acquisitions++;
+    }
+    else {
+      entry->lastOwner = _pid;
+      entry->acquisitions = 1;
+    }
+  }
+
+  inline int findBiased (pthread_mutex_t * lck) {
+    for(int i = 0; i < _biasedCount; i++) {
+      if(_biased[i] == lck) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  /// @brief Somebody waited for a lock biased to us: bias it less readily.
+  /// @return true if a thread waits for the lock, or failed to try it.
+  static inline bool contended (struct mutexentry * entry) {
+    return (entry->waiters != 0 || entry->wanted != 0);
+  }
+
+  /// @brief Signal the thread the lock is biased to, if not this one, to
+  /// hand it over: see xrun::revokeBiases().
+  inline void askOwner (struct mutexentry * entry) {
+    pid_t owner = (pid_t)entry->biasOwner;
+    if(owner != 0 && owner != _pid) {
+      syscall(SYS_tgkill, owner, owner, revokeSignal());
+    }
+  }
+
+  inline void revokeBias (struct mutexentry * entry) {
+    entry->revocations++;
+    _revoked++;
+  }
+
+  inline void removeBiased (int index) {
+    _biasedCount--;
+    _biased[index] = _biased[_biasedCount];
+    _biasedHeld[index] = _biasedHeld[_biasedCount];
+  }
+#endif
+
+  static inline unsigned long levelEntries (int level) {
+    return ((unsigned long)xdefines::SYNC_ENTRIES << level);
+  }
+
+  /// @brief Where the registry starts looking for an object's entry.
+  static inline unsigned long hashEntry (void * object) {
+    unsigned long h = (unsigned long)object >> 3;
+    h ^= h >> 16;
+    h *= 2654435761UL;
+    h ^= h >> 16;
+    return h;
+  }
+
+  /// @brief The entry of the object, claimed for it if it has none yet
+  /// or the program initialized it again.
+  /// @return the entry, ready unless fresh is set: then the caller has to
+  /// initialize it and publish it. Marked objects are told apart from
+  /// those living at the same address before.
+  struct syncentry * claimEntry (void * object, bool * fresh, bool marked) {
+    struct syncentry * entry = lookupEntry(object);
+    if(entry != NULL) {
+      waitEntry(entry);
+      *fresh = (marked && !isMarked(object)
+                && atomic::compare_and_swap(&entry->state, ENTRY_READY, ENTRY_BUSY) == ENTRY_READY);
+      if(*fresh) {
+        markObject(object);
+      }
+      else {
+        waitEntry(entry);
+      }
+      return entry;
+    }
+
+    lockRegistry();
+    // Somebody may have claimed one meanwhile.
+    if(lookupEntry(object) != NULL) {
+      unlockRegistry();
+      return claimEntry(object, fresh, marked);
+    }
+    entry = addEntry(object);
+    unlockRegistry();
+
+    *fresh = true;
+    if(marked) {
+      markObject(object);
+    }
+    return entry;
+  }
+
+  /// @return the entry of the object, or NULL if it has none.
+  struct syncentry * findEntry (void * object) {
+    struct syncentry * entry = lookupEntry(object);
+    if(entry != NULL) {
+      waitEntry(entry);
+    }
+    return entry;
+  }
+
+  /// @return the entry of the object, ready or not, or NULL. Takes no
+  /// lock: a key is stored once its entry is ENTRY_BUSY, and a tombstone
+  /// becomes free only at the end of a run of them.
+  struct syncentry * lookupEntry (void * object) {
+    unsigned long key = (unsigned long)object;
+    unsigned long hash = hashEntry(object);
+    int levels = _registry->levels;
+
+    for(int level = 0; level < levels; level++) {
+      unsigned long mask = levelEntries(level) - 1;
+      for(int i = 0; i < xdefines::SYNC_PROBES; i++) {
+        unsigned long index = (hash + i) & mask;
+        unsigned long found = _keys[level][index];
+        if(found == key) {
+          return &_entries[level][index];
+        }
+        if(found == KEY_FREE) {
+          break;
+        }
+      }
+    }
+    return NULL;
+  }
+
+  /// @brief Give the object a new entry, ENTRY_BUSY: the first free slot
+  /// or tombstone within reach in the first table that has one. Called
+  /// with the registry locked.
+  struct syncentry * addEntry (void * object) {
+    unsigned long hash = hashEntry(object);
+
+    for(int level = 0; level < xdefines::SYNC_LEVELS; level++) {
+      unsigned long mask = levelEntries(level) - 1;
+      for(int i = 0; i < xdefines::SYNC_PROBES; i++) {
+        unsigned long index = (hash + i) & mask;
+        unsigned long found = _keys[level][index];
+        if(found == KEY_FREE || found == KEY_TOMBSTONE) {
+          if(level >= (int)_registry->levels) {
+            _registry->levels = level + 1;
+          }
+          struct syncentry * entry = &_entries[level][index];
+          entry->state = ENTRY_BUSY;
+          atomic::atomic_set(&_keys[level][index], (unsigned long)object);
+          return entry;
+        }
+      }
+    }
+
+    fprintf(stderr, "%d : too many synchronization objects\n", getpid());
+    ::abort();
+    return NULL;
+  }
+
+  /// @brief The object was destroyed: its slot becomes a tombstone, and
+  /// free again with those before it when the next one is free.
+  inline void retireEntry (void * object) {
+    unsigned long key = (unsigned long)object;
+    unsigned long hash = hashEntry(object);
+
+    lockRegistry();
+    for(int level = 0; level < (int)_registry->levels; level++) {
+      unsigned long mask = levelEntries(level) - 1;
+      for(int i = 0; i < xdefines::SYNC_PROBES; i++) {
+        unsigned long index = (hash + i) & mask;
+        unsigned long found = _keys[level][index];
+        if(found == KEY_FREE) {
+          break;
+        }
+        if(found != key) {
+          continue;
+        }
+
+        atomic::atomic_set(&_keys[level][index], KEY_TOMBSTONE);
+        if(_keys[level][(index + 1) & mask] == KEY_FREE) {
+          while(_keys[level][index] == KEY_TOMBSTONE) {
+            atomic::atomic_set(&_keys[level][index], KEY_FREE);
+            index = (index - 1) & mask;
+          }
+        }
+        unlockRegistry();
+        return;
+      }
+    }
+    unlockRegistry();
+  }
+
+  /// @brief Wait for whoever claimed the entry to initialize it.
+  /// sched_yield() is the program's, and does not yield: see libsheriff.cpp.
+  inline void waitEntry (struct syncentry * entry) {
+    while(entry->state == ENTRY_BUSY) {
+      syscall(SYS_sched_yield);
+    }
+  }
+
+  inline void publishEntry (struct syncentry * entry) {
+    atomic::atomic_set(&entry->state, ENTRY_READY);
+  }
+
+  inline void lockRegistry (void) {
+    while(atomic::exchange(&_registry->lock, 1) != 0) {
+      syscall(SYS_sched_yield);
+    }
+  }
+
+  inline void unlockRegistry (void) {
+    atomic::atomic_set(&_registry->lock, 0);
+  }
+
+  /// @return false if the object reads all zero, in this thread's copy
+  /// and in the shared one.
+  inline bool isMarked (void * object) {
+    return (*(volatile unsigned long *)object != 0
+            || xmemory::getInstance().sharemem_read_word(object) != 0);
+  }
+
+  /// @brief Mark the object, behind the back of the program where its
+  /// memory is protected: threads read the shared copy when theirs is 0.
+  inline void markObject (void * object) {
+    if(xmemory::getInstance().inRange(object)) {
+      xmemory::getInstance().sharemem_write_word(object, OBJECT_MARK);
+    }
+    else {
+      *(volatile unsigned long *)object = OBJECT_MARK;
+    }
+  }
+
+#ifdef FUTEX_SYNC
+  inline void deallocSyncEntry (void * object) {
+    retireEntry(object);
+  }
+
+  inline condentry * getRealCond (void * cond) {
+    return cond_init(cond, true);
+  }
+
+  inline struct mutexentry * getRealMutex (void * lck) {
+    return mutex_init((pthread_mutex_t *)lck, true);
+  }
+#else
   inline void * allocSyncEntry(void *origentry, int size) {
     void * entry = ((void *)InternalHeap::getInstance().malloc(size));
     setSyncEntry(origentry, entry);
@@ -228,8 +1093,8 @@ private:
     return result;
   }
 
-  inline pthread_mutex_t * getRealMutex(void * lck) {
-    pthread_mutex_t * mutex = (pthread_mutex_t *)getSyncEntry(lck);
+  inline struct mutexentry * getRealMutex(void * lck) {
+    struct mutexentry * mutex = (struct mutexentry *)getSyncEntry(lck);
 
     if(mutex ==NULL) {
       // Whenever it is not allocated, then we will try to allocate one.
@@ -245,13 +1110,45 @@ private:
   void unlock(void) {
     _global_sync_lock.unlock();
   }
+#endif
+
+  /// The registry: per table, the addresses of the program's objects, or
+  /// KEY_FREE or KEY_TOMBSTONE, and their entries at the same indices.
+  struct registry * _registry;
+  volatile unsigned long * _keys[xdefines::SYNC_LEVELS];
+  struct syncentry * _entries[xdefines::SYNC_LEVELS];
+
+  /// The reader-writer locks this thread took last, and how many write
+  /// releases of each it saw.
+  struct {
+    void * rwlock;
+    unsigned long generation;
+    unsigned long writes;
+  } _rwlocksSeen[xdefines::RWLOCKS_SEEN];
+  int _nextSeen;
 
+#ifndef FUTEX_SYNC
   /// The barrier's attributes.
   pthread_barrierattr_t _barrier_attr;
   pthread_condattr_t _cond_attr;
   pthread_mutexattr_t _mutex_attr;
+  pthread_rwlockattr_t _rwlock_attr;
 
   xplock _global_sync_lock;
+#endif
+
+#ifdef BIASED_LOCKS
+  /// The locks biased to this thread, and whether it is inside each.
+  pthread_mutex_t * _biased[xdefines::BIASED_LOCKS_MAX];
+  bool _biasedHeld[xdefines::BIASED_LOCKS_MAX];
+  int _biasedCount;
+
+  /// Locks taken again without synchronizing, and biases revoked, not
+  /// counted in the statistics yet.
+  unsigned long _relocks;
+  unsigned long _revoked;
+  pid_t _pid;
+#endif
 };
 
 
@@ -80,6 +80,20 @@ public:
         : : "memory");
   }
 
+  // Atomically add i and return the original value.
+  static inline unsigned long fetch_and_add(volatile unsigned long * obj, unsigned long i) {
+#if defined(__i386__)
+    asm volatile("lock; xaddl %0, %1"
+        : "+r" (i), "+m" (*obj)
+        : : "memory");
+#else
+    asm volatile("lock; xaddq %0, %1"
+        : "+r" (i), "+m" (*obj)
+        : : "memory");
+#endif
+    return i;
+  }
+
   static inline void decrement(volatile unsigned long * obj) {
     asm volatile("lock; decl %0;"
         : :"m" (*obj)
@@ -111,10 +125,32 @@ public:
     return;
   }
 
+  // Set *obj to newval if it still holds oldval; return what it held.
+  static inline unsigned long compare_and_swap(volatile unsigned long * obj,
+      unsigned long oldval, unsigned long newval) {
+#if defined(__i386__)
+    asm volatile ("lock; cmpxchgl %2, %1"
+        : "+a" (oldval), "+m" (*obj)
+        : "r" (newval)
+        : "memory");
+#else
+    asm volatile ("lock; cmpxchgq %2, %1"
+        : "+a" (oldval), "+m" (*obj)
+        : "r" (newval)
+        : "memory");
+#endif
+    return oldval;
+  }
+
   static inline int atomic_read(const volatile unsigned long *obj) {
     return (*obj);
   }
 
+  // Tell the processor we are spinning.
+  static inline void pause(void) {
+    asm volatile ("pause" : : : "memory");
+  }
+
   static inline void memoryBarrier(void) {
     // Memory barrier: x86 only for now.
     __asm__ __volatile__ ("mfence": : :"memory");
@@ -28,9 +28,20 @@
 #ifndef SHERIFF_MM_H
 #define SHERIFF_MM_H
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <linux/falloc.h>
 
 #include "realfuncs.h"
+#include "xdefines.h"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
 
 class MM {
 public:
@@ -53,6 +64,103 @@ public:
     return allocate (false, sz, fd, startaddr);
   }
 
+  /// @brief Create an unnamed file of sz bytes to back a region.
+  /// @return its descriptor, or -1.
+  static int createBackingFile (const char * name, size_t sz)
+  {
+    int fd = -1;
+
+#ifdef SYS_memfd_create
+    // Memory only: nothing is ever written back to a disk, and punched
+    // holes hand the memory back right away.
+    fd = syscall (SYS_memfd_create, name, MFD_CLOEXEC);
+#endif
+
+    // Kernels before 3.17: a temporary file (which had better not be NFS-mounted...).
+    if (fd == -1) {
+      char fname[L_tmpnam];
+      sprintf (fname, "/tmp/sheriff-backing-XXXXXX");
+      fd = mkstemp (fname);
+      if (fd == -1) {
+        return -1;
+      }
+      unlink (fname);
+    }
+
+    // Set the file to the size of the region; it stays sparse.
+    if (ftruncate (fd, sz)) {
+      close (fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  /// @brief Free the memory behind [offset, offset + sz) of a backing file.
+  /// The range reads as zeros afterwards.
+  static bool punchHole (int fd, off_t offset, size_t sz)
+  {
+    return (fallocate (fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, sz) == 0);
+  }
+
+  /// @brief Map a range in for reading ahead of use: one
+  /// madvise(MADV_POPULATE_READ) on Linux 5.14+, a read of every page
+  /// on older kernels.
+  /// @return the number of system calls made.
+  static int populateRead (void * start, size_t sz)
+  {
+    static bool unsupported = false;
+
+    if (!unsupported) {
+      if (madvise (start, sz, MADV_POPULATE_READ) == 0 || errno != EINVAL) {
+        return 1;
+      }
+      unsupported = true;
+    }
+
+    for (size_t offset = 0; offset < sz; offset += xdefines::PageSize) {
+      (void) *((volatile char *) start + offset);
+    }
+    return 0;
+  }
+
+  /// @brief Private anonymous memory aligned to and advised for
+  /// transparent huge pages. Without THP support it is still usable.
+  static void * allocatePrivateHuge (size_t sz)
+  {
+    size_t huge = xdefines::HUGE_PAGE_SIZE;
+    sz = (sz + huge - 1) & ~(huge - 1);
+
+    // Over-allocate by a huge page and trim both ends to align the start.
+    char * ptr = (char *) mmap (NULL, sz + huge, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+      return MAP_FAILED;
+    }
+
+    char * start = (char *)(((unsigned long)ptr + huge - 1) & ~(huge - 1));
+    if (start != ptr) {
+      munmap (ptr, start - ptr);
+    }
+    munmap (start + sz, (ptr + huge) - start);
+
+#ifdef MADV_HUGEPAGE
+    madvise (start, sz, MADV_HUGEPAGE);
+#endif
+    return start;
+  }
+
+  /// @brief Give the whole pages inside a large object back to the system
+  /// before it goes on a free list; the first word keeps the list link.
+  template <class Heap>
+  static void releaseObject (Heap & heap, void * ptr, size_t sz)
+  {
+    intptr_t start = ((intptr_t)ptr + sizeof(void *) + xdefines::PageSize - 1) & ~xdefines::PAGE_SIZE_MASK;
+    intptr_t end = ((intptr_t)ptr + sz) & ~xdefines::PAGE_SIZE_MASK;
+    if (end > start) {
+      heap.releasePages ((void *)start, end - start);
+    }
+  }
+
 private:
 
   static void * allocate (bool isShared,
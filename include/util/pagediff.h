@@ -0,0 +1,381 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   pagediff.h
+ * @brief  Page diff-and-merge kernels, picked once at load time using cpuid.
+ *
+ *         Every kernel works on one page at a time and skips cache lines
+ *         where nothing changed. Changed lines are merged with byte-exact
+ *         stores, since other processes may be committing their own bytes
+ *         of the same line to the shared mapping at the same time (that is
+ *         exactly the false sharing we are tolerating). Lines that changed
+ *         completely are written with streaming stores when most of the
+ *         page changed, since the committing thread drops its copy of the
+ *         page at the next transaction anyway.
+ */
+
+#ifndef SHERIFF_PAGEDIFF_H
+#define SHERIFF_PAGEDIFF_H
+
+#include <new>
+#include <string.h>
+
+#ifdef SSE_SUPPORT
+#include <immintrin.h>
+#endif
+
+#include "xdefines.h"
+
+class pagediff {
+public:
+
+  /// Merge the bytes of local that differ from twin into dest.
+  typedef void commitFunction (const void * local, const void * twin, void * dest);
+
+  /// @return a mask with bit i set iff cache line i differs between two pages.
+  typedef unsigned long long linesFunction (const void * a, const void * b);
+
+  enum { LINE_WORDS = xdefines::CACHE_LINE_SIZE / sizeof(unsigned long) };
+
+  // Stream fully-changed lines when at least this many lines of a page
+  // changed completely.
+  enum { STREAM_LINES_THRESHOLD = (xdefines::CACHES_PER_PAGE * 3) / 4 };
+
+  static pagediff& getInstance (void) {
+    static char buf[sizeof(pagediff)] __attribute__((aligned(64)));
+    static pagediff * theOneTrueObject = new (buf) pagediff();
+    return *theOneTrueObject;
+  }
+
+  inline void commit (const void * local, const void * twin, void * dest) {
+    _commit (local, twin, dest);
+  }
+
+  inline unsigned long long diffLines (const void * a, const void * b) {
+    return _diffLines (a, b);
+  }
+
+  /// @return a mask of the cache lines holding any non-zero word.
+  inline unsigned long long nonzeroLines (const void * a) {
+    return _diffLines (a, _zeroPage);
+  }
+
+  inline const char * name (void) const {
+    return _name;
+  }
+
+  /// @brief Pop the lowest line out of a line mask.
+  static inline int nextLine (unsigned long long & lines) {
+    int line = __builtin_ctzll (lines);
+    lines &= lines - 1;
+    return line;
+  }
+
+private:
+
+  pagediff (void)
+  {
+    memset (_zeroPage, 0, sizeof(_zeroPage));
+
+    _commit    = commitScalar;
+    _diffLines = diffLinesScalar;
+    _name      = "scalar";
+
+#ifdef SSE_SUPPORT
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports ("avx512bw")) {
+      _commit    = commitAVX512;
+      _diffLines = diffLinesAVX512;
+      _name      = "avx512";
+    } else if (__builtin_cpu_supports ("avx2")) {
+      _commit    = commitAVX2;
+      _diffLines = diffLinesAVX2;
+      _name      = "avx2";
+    } else {
+      _commit    = commitSSE2;
+      _diffLines = diffLinesSSE2;
+      _name      = "sse2";
+    }
+#endif
+  }
+
+  static inline void commitBytes (const char * local, char * dest, unsigned long mask) {
+    while (mask) {
+      int i = __builtin_ctzl (mask);
+      dest[i] = local[i];
+      mask &= mask - 1;
+    }
+  }
+
+  /* If hardware can't support SSE instructions, use slow commits as following. */
+  static void commitScalar (const void * local, const void * twin, void * dest) {
+    const unsigned long * mylocal = (const unsigned long *)local;
+    const unsigned long * mytwin = (const unsigned long *)twin;
+    unsigned long * mydest = (unsigned long *)dest;
+
+    for (size_t i = 0; i < xdefines::PageSize/sizeof(unsigned long); i++) {
+      if (mylocal[i] != mytwin[i]) {
+        const char * l = (const char *)&mylocal[i];
+        const char * t = (const char *)&mytwin[i];
+        char * d = (char *)&mydest[i];
+
+        for (size_t j = 0; j < sizeof(unsigned long); j++) {
+          if (l[j] != t[j]) {
+            d[j] = l[j];
+          }
+        }
+      }
+    }
+  }
+
+  static unsigned long long diffLinesScalar (const void * a, const void * b) {
+    const unsigned long * mya = (const unsigned long *)a;
+    const unsigned long * myb = (const unsigned long *)b;
+    unsigned long long lines = 0;
+
+    for (int line = 0; line < xdefines::CACHES_PER_PAGE; line++) {
+      for (int i = line * LINE_WORDS; i < (line + 1) * LINE_WORDS; i++) {
+        if (mya[i] != myb[i]) {
+          lines |= 1ULL << line;
+          break;
+        }
+      }
+    }
+    return lines;
+  }
+
+#ifdef SSE_SUPPORT
+  // SSE2: one masked store per changed 16 bytes, as before, but whole
+  // unchanged lines are skipped.
+  static void commitSSE2 (const void * local, const void * twin, void * dest) {
+    const __m128i * localbuf = (const __m128i *) local;
+    const __m128i * twinbuf  = (const __m128i *) twin;
+    __m128i * destbuf = (__m128i *) dest;
+    __m128i allones = _mm_set1_epi32 (-1);
+
+    for (size_t i = 0; i < xdefines::PageSize / sizeof(__m128i); i += 4) {
+      __m128i localChunk[4], eqChunk[4];
+      int eq = 0xFFFF;
+
+      for (int j = 0; j < 4; j++) {
+        localChunk[j] = _mm_load_si128 (&localbuf[i+j]);
+        eqChunk[j] = _mm_cmpeq_epi8 (localChunk[j], _mm_load_si128 (&twinbuf[i+j]));
+        eq &= _mm_movemask_epi8 (eqChunk[j]);
+      }
+
+      // Nothing changed in this line.
+      if (eq == 0xFFFF) {
+        continue;
+      }
+
+      for (int j = 0; j < 4; j++) {
+        // Invert the bits by XORing them with ones.
+        __m128i neqChunk = _mm_xor_si128 (allones, eqChunk[j]);
+
+        // Write local pieces into destbuf everywhere diffs.
+        _mm_maskmoveu_si128 (localChunk[j], neqChunk, (char *) &destbuf[i+j]);
+      }
+    }
+    _mm_sfence();
+  }
+
+  static unsigned long long diffLinesSSE2 (const void * a, const void * b) {
+    const __m128i * abuf = (const __m128i *) a;
+    const __m128i * bbuf = (const __m128i *) b;
+    unsigned long long lines = 0;
+
+    for (int line = 0; line < xdefines::CACHES_PER_PAGE; line++) {
+      const __m128i * pa = &abuf[line * 4];
+      const __m128i * pb = &bbuf[line * 4];
+      __m128i eq = _mm_and_si128 (_mm_and_si128 (_mm_cmpeq_epi8 (_mm_load_si128 (&pa[0]), _mm_load_si128 (&pb[0])),
+                                                 _mm_cmpeq_epi8 (_mm_load_si128 (&pa[1]), _mm_load_si128 (&pb[1]))),
+                                  _mm_and_si128 (_mm_cmpeq_epi8 (_mm_load_si128 (&pa[2]), _mm_load_si128 (&pb[2])),
+                                                 _mm_cmpeq_epi8 (_mm_load_si128 (&pa[3]), _mm_load_si128 (&pb[3]))));
+      if (_mm_movemask_epi8 (eq) != 0xFFFF) {
+        lines |= 1ULL << line;
+      }
+    }
+    return lines;
+  }
+
+  // AVX2 has no byte-granular masked store, so a changed half-line is
+  // written as whole dwords where all four bytes changed plus single
+  // bytes for the rest.
+  __attribute__((target("avx2")))
+  static inline void commitHalfAVX2 (__m256i localChunk, __m256i twinChunk, const char * local, char * dest) {
+    __m256i allones = _mm256_set1_epi32 (-1);
+    __m256i neqChunk = _mm256_xor_si256 (allones, _mm256_cmpeq_epi8 (localChunk, twinChunk));
+    unsigned int neq = (unsigned int) _mm256_movemask_epi8 (neqChunk);
+
+    if (neq == 0xFFFFFFFFU) {
+      _mm256_store_si256 ((__m256i *) dest, localChunk);
+      return;
+    }
+
+    // Dwords whose four bytes all changed.
+    __m256i fullChunk = _mm256_cmpeq_epi32 (neqChunk, allones);
+    unsigned int full = (unsigned int) _mm256_movemask_epi8 (fullChunk);
+
+    if (full) {
+      _mm256_maskstore_epi32 ((int *) dest, fullChunk, localChunk);
+    }
+    commitBytes (local, dest, neq & ~full);
+  }
+
+  __attribute__((target("avx2")))
+  static void commitAVX2 (const void * local, const void * twin, void * dest) {
+    const char * localbuf = (const char *) local;
+    const char * twinbuf  = (const char *) twin;
+    char * destbuf = (char *) dest;
+    unsigned int neq[xdefines::CACHES_PER_PAGE][2];
+    int fullLines = 0;
+
+    // First pass: find out what changed, line by line.
+    for (int line = 0; line < xdefines::CACHES_PER_PAGE; line++) {
+      for (int j = 0; j < 2; j++) {
+        int off = line * xdefines::CACHE_LINE_SIZE + j * sizeof(__m256i);
+        __m256i eq = _mm256_cmpeq_epi8 (_mm256_load_si256 ((const __m256i *) &localbuf[off]),
+                                        _mm256_load_si256 ((const __m256i *) &twinbuf[off]));
+        neq[line][j] = ~(unsigned int) _mm256_movemask_epi8 (eq);
+      }
+      if ((neq[line][0] & neq[line][1]) == 0xFFFFFFFFU) {
+        fullLines++;
+      }
+    }
+
+    bool stream = (fullLines >= STREAM_LINES_THRESHOLD);
+
+    // Second pass: merge every changed line.
+    for (int line = 0; line < xdefines::CACHES_PER_PAGE; line++) {
+      if ((neq[line][0] | neq[line][1]) == 0) {
+        continue;
+      }
+
+      int off = line * xdefines::CACHE_LINE_SIZE;
+      __m256i l0 = _mm256_load_si256 ((const __m256i *) &localbuf[off]);
+      __m256i l1 = _mm256_load_si256 ((const __m256i *) &localbuf[off + sizeof(__m256i)]);
+
+      if (stream && (neq[line][0] & neq[line][1]) == 0xFFFFFFFFU) {
+        _mm256_stream_si256 ((__m256i *) &destbuf[off], l0);
+        _mm256_stream_si256 ((__m256i *) &destbuf[off + sizeof(__m256i)], l1);
+        continue;
+      }
+
+      if (neq[line][0]) {
+        commitHalfAVX2 (l0, _mm256_load_si256 ((const __m256i *) &twinbuf[off]),
+                        &localbuf[off], &destbuf[off]);
+      }
+      if (neq[line][1]) {
+        commitHalfAVX2 (l1, _mm256_load_si256 ((const __m256i *) &twinbuf[off + sizeof(__m256i)]),
+                        &localbuf[off + sizeof(__m256i)], &destbuf[off + sizeof(__m256i)]);
+      }
+    }
+
+    if (stream) {
+      _mm_sfence();
+    }
+  }
+
+  __attribute__((target("avx2")))
+  static unsigned long long diffLinesAVX2 (const void * a, const void * b) {
+    const __m256i * abuf = (const __m256i *) a;
+    const __m256i * bbuf = (const __m256i *) b;
+    unsigned long long lines = 0;
+
+    for (int line = 0; line < xdefines::CACHES_PER_PAGE; line++) {
+      __m256i eq = _mm256_and_si256 (_mm256_cmpeq_epi8 (_mm256_load_si256 (&abuf[line * 2]), _mm256_load_si256 (&bbuf[line * 2])),
+                                     _mm256_cmpeq_epi8 (_mm256_load_si256 (&abuf[line * 2 + 1]), _mm256_load_si256 (&bbuf[line * 2 + 1])));
+      if ((unsigned int) _mm256_movemask_epi8 (eq) != 0xFFFFFFFFU) {
+        lines |= 1ULL << line;
+      }
+    }
+    return lines;
+  }
+
+  // AVX-512BW stores exactly the changed bytes of a line with one
+  // masked store.
+  __attribute__((target("avx512f,avx512bw")))
+  static void commitAVX512 (const void * local, const void * twin, void * dest) {
+    const __m512i * localbuf = (const __m512i *) local;
+    const __m512i * twinbuf  = (const __m512i *) twin;
+    __m512i * destbuf = (__m512i *) dest;
+    __mmask64 neq[xdefines::CACHES_PER_PAGE];
+    int fullLines = 0;
+
+    for (int line = 0; line < xdefines::CACHES_PER_PAGE; line++) {
+      neq[line] = _mm512_cmpneq_epi8_mask (_mm512_load_si512 (&localbuf[line]),
+                                           _mm512_load_si512 (&twinbuf[line]));
+      if (neq[line] == ~(__mmask64) 0) {
+        fullLines++;
+      }
+    }
+
+    bool stream = (fullLines >= STREAM_LINES_THRESHOLD);
+
+    for (int line = 0; line < xdefines::CACHES_PER_PAGE; line++) {
+      if (neq[line] == 0) {
+        continue;
+      }
+
+      __m512i localChunk = _mm512_load_si512 (&localbuf[line]);
+
+      if (neq[line] == ~(__mmask64) 0) {
+        if (stream) {
+          _mm512_stream_si512 (&destbuf[line], localChunk);
+        } else {
+          _mm512_store_si512 (&destbuf[line], localChunk);
+        }
+      } else {
+        _mm512_mask_storeu_epi8 (&destbuf[line], neq[line], localChunk);
+      }
+    }
+
+    if (stream) {
+      _mm_sfence();
+    }
+  }
+
+  __attribute__((target("avx512f,avx512bw")))
+  static unsigned long long diffLinesAVX512 (const void * a, const void * b) {
+    const __m512i * abuf = (const __m512i *) a;
+    const __m512i * bbuf = (const __m512i *) b;
+    unsigned long long lines = 0;
+
+    for (int line = 0; line < xdefines::CACHES_PER_PAGE; line++) {
+      if (_mm512_cmpneq_epi64_mask (_mm512_load_si512 (&abuf[line]), _mm512_load_si512 (&bbuf[line]))) {
+        lines |= 1ULL << line;
+      }
+    }
+    return lines;
+  }
+#endif
+
+  commitFunction * _commit;
+  linesFunction *  _diffLines;
+  const char *     _name;
+
+  /// Compared against to find the non-zero lines of a page.
+  char _zeroPage[xdefines::PageSize] __attribute__((aligned(64)));
+};
+
+#endif
@@ -0,0 +1,89 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   x86insn.h
+ * @brief  Telling atomic instructions from plain ones at a fault.
+ *
+ *         Only as much of the x86 encoding is looked at as it takes to
+ *         find a lock prefix, or an xchg with memory, which is locked
+ *         without one. Compilers emit nothing else for atomic updates.
+ */
+
+#ifndef SHERIFF_X86INSN_H
+#define SHERIFF_X86INSN_H
+
+#include <stdint.h>
+#include <ucontext.h>
+
+class x86insn {
+public:
+
+  /// @return the instruction a signal interrupted at context.
+  static const unsigned char * pc (void * context) {
+    ucontext_t * uc = (ucontext_t *) context;
+#ifdef X86_32BIT
+    return (const unsigned char *) uc->uc_mcontext.gregs[REG_EIP];
+#else
+    return (const unsigned char *) uc->uc_mcontext.gregs[REG_RIP];
+#endif
+  }
+
+  /// @return true if the instruction interrupted at context is atomic.
+  static bool locked (void * context) {
+    const unsigned char * insn = pc (context);
+
+    int i = 0;
+    for (; i < MAX_PREFIXES; i++) {
+      unsigned char byte = insn[i];
+      if (byte == LOCK) {
+        return true;
+      }
+      if (!legacyPrefix (byte)) {
+        break;
+      }
+    }
+#ifndef X86_32BIT
+    if ((insn[i] & 0xf0) == REX) {
+      i++;
+    }
+#endif
+    return (insn[i] == XCHG_BYTE || insn[i] == XCHG);
+  }
+
+private:
+
+  enum { MAX_PREFIXES = 14 };
+  enum { LOCK = 0xf0, REX = 0x40, XCHG_BYTE = 0x86, XCHG = 0x87 };
+
+  static bool legacyPrefix (unsigned char byte) {
+    switch (byte) {
+    case 0xf2: case 0xf3:
+    case 0x2e: case 0x36: case 0x3e: case 0x26: case 0x64: case 0x65:
+    case 0x66: case 0x67:
+      return true;
+    default:
+      return false;
+    }
+  }
+};
+
+#endif
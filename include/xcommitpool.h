@@ -0,0 +1,245 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xcommitpool.h
+ * @brief  A small pool of helper threads that merge page ranges during a commit.
+ *
+ *         Each Sheriff "thread" is a process, so the helpers are real
+ *         threads living inside the committing process. They share its
+ *         private pages and twins and only ever write the shared mapping.
+ *         Helpers do not survive a fork, so the pool is rebuilt lazily
+ *         the first time a new process commits a large dirty set.
+ *
+ *         Helpers are bare clone()d threads synchronized with futexes:
+ *         pthread_create() would allocate from the protected heap in the
+ *         middle of a commit, and the helpers never need libc state. They
+ *         have no thread-local storage of their own, so they run on the
+ *         committing thread's: whatever they call must not touch it, not
+ *         even errno, which is why their futexes are raw system calls.
+ */
+
+#ifndef SHERIFF_XCOMMITPOOL_H
+#define SHERIFF_XCOMMITPOOL_H
+
+#include <new>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <limits.h>
+#include <syscall.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+
+#include "xdefines.h"
+#include "atomic.h"
+#include "realfuncs.h"
+
+class xcommitpool {
+public:
+
+  /// Commit the items in [begin, end) of a job.
+  typedef void rangeFunction (void * owner, int begin, int end);
+
+  static xcommitpool& getInstance (void) {
+    static char buf[sizeof(xcommitpool)];
+    static xcommitpool * theOneTrueObject = new (buf) xcommitpool();
+    return *theOneTrueObject;
+  }
+
+  /// @brief Run fn over items split in chunks, using the helpers too.
+  /// @return false if there were no helpers and the caller did it all.
+  bool run (rangeFunction * fn, void * owner, int items) {
+    if (!startHelpers()) {
+      fn (owner, 0, items);
+      return false;
+    }
+
+    _fn = fn;
+    _owner = owner;
+    _items = items;
+    _next = 0;
+    _pending = _helpers;
+
+    // Publish the job and wake up the helpers.
+    atomic::increment(&_generation);
+    futex (&_generation, FUTEX_WAKE, INT_MAX);
+
+    // The committing thread takes its share of chunks as well.
+    work();
+
+    while (true) {
+      int pending = atomic::atomic_read(&_pending);
+      if (pending == 0) {
+        break;
+      }
+      futex (&_pending, FUTEX_WAIT, pending);
+    }
+    return true;
+  }
+
+private:
+
+  xcommitpool (void)
+    : _owningPid (0),
+      _helpers (0),
+      _generation (0),
+      _pending (0)
+  {
+    for (int i = 0; i < xdefines::COMMIT_HELPERS; i++) {
+      _stacks[i] = NULL;
+    }
+  }
+
+  /// @return true if helpers are running in this process.
+  bool startHelpers (void) {
+    pid_t mypid = syscall(SYS_getpid);
+
+    if (_owningPid == mypid) {
+      return (_helpers > 0);
+    }
+
+    // We are new, or were forked from the process owning the helpers.
+    // The helpers did not come along, but their stacks did and can be reused.
+    _owningPid = mypid;
+    _helpers = 0;
+    _generation = 0;
+    _pending = 0;
+
+    // Helpers must never take our timer or any other asynchronous signal.
+    // Faults are synchronous and still reach the thread that caused them.
+    sigset_t async, old;
+    sigfillset (&async);
+    sigdelset (&async, SIGSEGV);
+    sigdelset (&async, SIGBUS);
+    pthread_sigmask (SIG_BLOCK, &async, &old);
+
+    // There is no point in more helpers than the other cores can run.
+    int helpers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (helpers > xdefines::COMMIT_HELPERS) {
+      helpers = xdefines::COMMIT_HELPERS;
+    }
+
+    for (int i = 0; i < helpers; i++) {
+      if (_stacks[i] == NULL) {
+        void * stack = WRAP(mmap)(NULL, xdefines::COMMIT_HELPER_STACK, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (stack == MAP_FAILED) {
+          break;
+        }
+        _stacks[i] = (char *)stack;
+      }
+
+      if (clone (helperThread, _stacks[i] + xdefines::COMMIT_HELPER_STACK,
+                 CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM,
+                 this) == -1) {
+        fprintf (stderr, "%d : failed to start commit helper %d\n", mypid, i);
+        break;
+      }
+      _helpers++;
+    }
+
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+    return (_helpers > 0);
+  }
+
+  /// @brief Grab chunks until the job is exhausted.
+  void work (void) {
+    while (true) {
+      int begin = atomic::increment_and_return(&_next) * xdefines::COMMIT_CHUNK_PAGES;
+      if (begin >= _items) {
+        break;
+      }
+
+      int end = begin + xdefines::COMMIT_CHUNK_PAGES;
+      if (end > _items) {
+        end = _items;
+      }
+      _fn (_owner, begin, end);
+    }
+  }
+
+  static int helperThread (void * arg) {
+    xcommitpool * pool = (xcommitpool *) arg;
+    unsigned long seen = 0;
+
+    while (true) {
+      while (pool->_generation == seen) {
+        futex (&pool->_generation, FUTEX_WAIT, seen);
+      }
+      seen = pool->_generation;
+
+      pool->work();
+
+      if (atomic::decrement_and_return(&pool->_pending) == 1) {
+        futex (&pool->_pending, FUTEX_WAKE, 1);
+      }
+    }
+    return 0;
+  }
+
+  /// Wait on or wake a counter; only its low word changes between waits.
+  /// The system call is made directly, leaving errno alone.
+  static void futex (volatile unsigned long * addr, int op, int val) {
+    long result;
+#if defined(__i386__)
+    // %ebx may hold the GOT pointer, so the address goes through %edi.
+    asm volatile ("xchgl %%edi, %%ebx\n\t"
+                  "int $0x80\n\t"
+                  "xchgl %%edi, %%ebx"
+                  : "=a" (result)
+                  : "0" (SYS_futex), "D" (addr), "c" (op), "d" (val), "S" (0)
+                  : "memory");
+#elif defined(__x86_64__)
+    register long timeout asm ("r10") = 0;
+    asm volatile ("syscall"
+                  : "=a" (result)
+                  : "0" (SYS_futex), "D" (addr), "S" (op), "d" (val), "r" (timeout)
+                  : "rcx", "r11", "memory");
+#else
+#error "Not supported on this architecture."
+#endif
+    (void) result;
+  }
+
+  /// The process that started the helpers.
+  pid_t _owningPid;
+
+  int _helpers;
+  char * _stacks[xdefines::COMMIT_HELPERS];
+
+  /// Bumped once per job; helpers wait for it to move.
+  volatile unsigned long _generation;
+
+  /// Helpers that have not finished the current job.
+  volatile unsigned long _pending;
+
+  /// The current job.
+  rangeFunction * _fn;
+  void * _owner;
+  int _items;
+
+  /// Index of the next chunk to hand out.
+  volatile unsigned long _next;
+};
+
+#endif
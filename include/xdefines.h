@@ -31,6 +31,20 @@
 
 #include "realfuncs.h"
 
+// Builds with any of these options count what the options do, and print
+// the counters as the program exits.
+#if defined(PARALLEL_COMMIT) || defined(GET_CHARACTERISTICS) || defined(IO_URING_BATCHING) \
+    || defined(POPULATE_REFRESH) || defined(LAZY_RELEASE) || defined(BIASED_LOCKS) \
+    || defined(SYSCALL_COUNTERS) || defined(ATOMIC_SYNC)
+#define SHERIFF_COUNTERS
+#endif
+
+// Counters that cost system calls of their own, such as getrusage() as
+// every transaction begins, are only kept when asked for.
+#if defined(GET_CHARACTERISTICS) || defined(SYSCALL_COUNTERS)
+#define SHERIFF_COSTLY_COUNTERS
+#endif
+
 /*
  * @file   xdefines.h   
  * @brief  Global definitions for Sheriff-Detect and Sheriff-Protect.
@@ -110,6 +124,7 @@ public:
   enum { INTERNALHEAP_SIZE = 1048576UL * 20 };
   enum { PageSize = 4096UL };
   enum { PAGE_SIZE_MASK = (PageSize-1) };
+  enum { HUGE_PAGE_SIZE = 2097152UL };
   enum { NUM_HEAPS = 32 };
   //enum { PERIODIC_CHECKING_INTERVAL = 10000};
   enum { PERIODIC_CHECKING_INTERVAL = 1000};
@@ -123,6 +138,128 @@ public:
   enum { MIN_INVALIDATES_CARE = MIN_INTERWRITES_CARE};
   enum { MIN_WRITES_CARE = 100000};
   enum { CPU_CORES = 8 };
+
+  // Parallel commit (PARALLEL_COMMIT): dirty sets of at least this many
+  // pages are merged by helper threads, a chunk of pages at a time.
+  enum { PARALLEL_COMMIT_PAGES = 512 };
+  enum { COMMIT_CHUNK_PAGES = 64 };
+  enum { COMMIT_HELPERS = 3 };
+  enum { COMMIT_HELPER_STACK = 65536 };
+
+  // Freed objects at least this large give their inner pages back to the
+  // system. Sheriff-Protect keeps objects up to LARGE_CHUNK in the protected
+  // heap, so only those are worth releasing there.
+#if defined(DETECT_FALSE_SHARING) || defined(DETECT_FALSE_SHARING_OPT)
+  enum { RELEASE_OBJECT_SIZE = 1048576 };
+#else
+  enum { RELEASE_OBJECT_SIZE = 32768 };
+#endif
+
+  // Sheriff-Protect: while write faults sweep a region upwards, up to this
+  // many pages past the faulting one are unprotected and twinned at once.
+  enum { PREFETCH_PAGES = 32 };
+
+  // Sheriff-Protect: pages a thread wrote in this many transactions in a row
+  // are twinned and left writable when its next transaction begins.
+  enum { PREDICT_TRANSACTIONS = 3 };
+
+  // With POPULATE_REFRESH, dropped pages that the thread dirtied in one of
+  // this many transactions before are mapped in again right away.
+  enum { POPULATE_TRANSACTIONS = 3 };
+
+  // Sheriff-Protect: per-page isolation. Every commit of a page costs
+  // ISOLATION_COST, every cache line of it that another thread wrote in
+  // the meantime earns INTERLEAVE_BENEFIT. A page still in the red after
+  // ISOLATION_WINDOW commits (a quarter of that on probation) is left
+  // shared by all threads.
+  enum { ISOLATION_WINDOW = 32 };
+  enum { ISOLATION_COST = 1 };
+  enum { INTERLEAVE_BENEFIT = 4 };
+
+  // A page left shared goes back on probation after this many transactions
+  // of all threads, doubled for every probation it failed, up to
+  // PROBATION_STRIKES times; or once the heap hands its memory out again.
+  enum { PROBATION_TRANSACTIONS = 1024 };
+  enum { PROBATION_STRIKES = 6 };
+
+  // Threads count their transactions towards that clock this many at a
+  // time, so that beginning one rarely touches a shared cache line.
+  enum { CLOCK_TICKS = 8 };
+
+  // Sheriff-Protect: per-thread isolation. A thread that commits no page
+  // other threads had dirty for THREAD_ISOLATION_WINDOW transactions in a
+  // row writes the shared mappings directly. It is isolated again once its
+  // writes land on cache lines an isolated thread writes, or after
+  // THREAD_PROBATION_TRANSACTIONS of its transactions, doubled for every
+  // time it came back clean, up to PROBATION_STRIKES times.
+  enum { THREAD_ISOLATION_WINDOW = 64 };
+  enum { THREAD_PROBATION_TRANSACTIONS = 256 };
+
+  // Lazy release consistency (LAZY_RELEASE): logs of committed pages,
+  // shared by threads with the same index modulo NOTICE_LOGS, and notices
+  // each log keeps before the oldest are overwritten.
+  enum { NOTICE_LOGS = 32 };
+  enum { LOG_NOTICES = 8192 };
+
+  // Biased mutexes (BIASED_LOCKS): locks biased to one thread at most,
+  // acquisitions in a row that bias a lock, and revocations after which
+  // that stops doubling. A waiter sends the thread holding the bias the
+  // real-time signal this far above SIGRTMIN.
+  enum { BIASED_LOCKS_MAX = 8 };
+  enum { BIAS_ACQUISITIONS = 4 };
+  enum { BIAS_REVOCATIONS = 10 };
+  enum { REVOKE_SIGNAL = 2 };
+
+  // Futex synchronization (FUTEX_SYNC): times a mutex is spun on before
+  // its waiter sleeps. Entries of the first table of the registry of
+  // synchronization objects, a power of two, each next table having twice
+  // as many; reader-writer and spin locks always use it. Slots an object
+  // may take in a table before it goes to the next.
+  enum { FUTEX_SPINS = 100 };
+  enum { SYNC_ENTRIES = 65536 };
+  enum { SYNC_LEVELS = 6 };
+  enum { SYNC_PROBES = 32 };
+
+  // Reader-writer locks a thread remembers having seen the last write
+  // release of, so that it can read under them again without a refresh.
+  enum { RWLOCKS_SEEN = 16 };
+
+  // Statuses of threads in the shared table. Threads beyond that many
+  // have a page of their own.
+  enum { THREAD_STATUSES = 1024 };
+
+  // How often a join checks that the thread it waits for is still alive,
+  // in nanoseconds.
+  enum { JOIN_CHECK_INTERVAL = 10000000 };
+
+  // Worker pool (THREAD_POOL): processes kept parked for new threads, the
+  // stack each one runs its later threads on, and how much of a spawner's
+  // live stack is copied to the worker at most (deeper spawners fork).
+  enum { THREAD_POOL_WORKERS = 64 };
+  enum { THREAD_POOL_STACK = 1048576 * 8 };
+  enum { THREAD_POOL_COPY = 131072 };
+
+  // OpenMP teams (see xomp.h): threads in a team at most, constructs a
+  // thread may run ahead of the others through with nowait, named
+  // critical sections told apart, the stack a master runs its share of a
+  // region on, and how deep its frames may be to be shared with the team.
+  enum { OMP_THREADS = 64 };
+  enum { OMP_SHARES = 16 };
+  enum { OMP_CRITICALS = 64 };
+  enum { OMP_STACK = 1048576 * 8 };
+  enum { OMP_SHARED_STACK = 1048576 * 64 };
+
+  // Raw futexes and polling (ATOMIC_SYNC): a running thread is sampled
+  // every POLL_INTERVAL microseconds of its own CPU time. One that went
+  // POLL_SAMPLES samples without synchronizing, writing no more than
+  // POLL_PAGES pages, is taken to poll and has its transaction ended.
+  enum { POLL_INTERVAL = 2000 };
+  enum { POLL_SAMPLES = 2 };
+  enum { POLL_PAGES = 4 };
+
+  // userfaultfd tracking (UFFD_TRACKING): how far past the heap's bump
+  // pointer pages are write-protected ahead of use.
+  enum { UFFD_TRACKING_SLACK = 1048576 * 4 };
 };
 
 #endif
@@ -0,0 +1,206 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xdirtypages.h
+ * @brief  A set of pages of one region, such as those dirtied by this
+ *         process in the current transaction.
+ *
+ *         Pages are added from the write fault handler, so adding one must
+ *         not allocate: the set is a bitmap over all pages of the region
+ *         plus a slot per page holding its pageinfo, both mapped up front.
+ *         A second bitmap with one bit per bitmap word lets iteration and
+ *         clear() skip the untouched parts of a large region.
+ *
+ *         Iteration goes by page number, so callers can still batch runs of
+ *         adjacent pages into a single system call:
+ *
+ *           for (int pageNo = set.first(); pageNo != -1; pageNo = set.next(pageNo))
+ *             ... set.get(pageNo) ...
+ */
+
+#ifndef SHERIFF_XDIRTYPAGES_H
+#define SHERIFF_XDIRTYPAGES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "xdefines.h"
+#include "xpageinfo.h"
+#include "mm.h"
+
+template <unsigned long TotalPages>
+class xdirtypages {
+public:
+
+  xdirtypages (void)
+    : _count (0),
+      _summaryEnd (0)
+  {
+    // Private anonymous memory: each process gets its own set after a
+    // fork, and only the slots of pages actually written are ever touched.
+    _bits = (unsigned long *) MM::allocatePrivate (Words * sizeof(unsigned long));
+    _summary = (unsigned long *) MM::allocatePrivate (SummaryWords * sizeof(unsigned long));
+    _slots = (struct pageinfo **) MM::allocatePrivate (TotalPages * sizeof(struct pageinfo *));
+
+    if (_bits == MAP_FAILED || _summary == MAP_FAILED || _slots == MAP_FAILED) {
+      fprintf (stderr, "Failed to allocate the dirty page set.\n");
+      ::abort();
+    }
+  }
+
+  /// @brief Record pageinfo for pageNo.
+  /// If the page is already in the set, its entry is overwritten instead.
+  inline void insert (int pageNo, struct pageinfo * info) {
+    unsigned long word = pageNo / WORD_BITS;
+    unsigned long bit = 1UL << (pageNo % WORD_BITS);
+
+    if (_bits[word] & bit) {
+      if (_slots[pageNo] != info) {
+        memcpy (_slots[pageNo], info, sizeof(struct pageinfo));
+      }
+      return;
+    }
+
+    _bits[word] |= bit;
+    _slots[pageNo] = info;
+    _count++;
+
+    unsigned long sword = word / WORD_BITS;
+    _summary[sword] |= 1UL << (word % WORD_BITS);
+    if (sword >= _summaryEnd) {
+      _summaryEnd = sword + 1;
+    }
+  }
+
+  /// @brief Remove pageNo from the set, if it is there.
+  inline void erase (int pageNo) {
+    unsigned long word = pageNo / WORD_BITS;
+    unsigned long bit = 1UL << (pageNo % WORD_BITS);
+
+    if (!(_bits[word] & bit)) {
+      return;
+    }
+
+    _bits[word] &= ~bit;
+    _count--;
+
+    if (_bits[word] == 0) {
+      _summary[word / WORD_BITS] &= ~(1UL << (word % WORD_BITS));
+    }
+  }
+
+  inline bool contains (int pageNo) const {
+    return (_bits[pageNo / WORD_BITS] >> (pageNo % WORD_BITS)) & 1;
+  }
+
+  inline struct pageinfo * get (int pageNo) const {
+    return _slots[pageNo];
+  }
+
+  inline int size (void) const {
+    return _count;
+  }
+
+  inline bool empty (void) const {
+    return (_count == 0);
+  }
+
+  /// @return the lowest dirty page, or -1.
+  inline int first (void) const {
+    return findFrom (0);
+  }
+
+  /// @return the lowest dirty page after pageNo, or -1.
+  inline int next (int pageNo) const {
+    return findFrom (pageNo + 1);
+  }
+
+  /// @brief Forget all pages; only the words that have bits set are touched.
+  void clear (void) {
+    for (unsigned long sword = 0; sword < _summaryEnd; sword++) {
+      unsigned long summary = _summary[sword];
+      while (summary) {
+        _bits[sword * WORD_BITS + __builtin_ctzl(summary)] = 0;
+        summary &= summary - 1;
+      }
+      _summary[sword] = 0;
+    }
+    _count = 0;
+    _summaryEnd = 0;
+  }
+
+private:
+
+  enum { WORD_BITS = sizeof(unsigned long) * 8 };
+  enum { Words = (TotalPages + WORD_BITS - 1) / WORD_BITS };
+  enum { SummaryWords = (Words + WORD_BITS - 1) / WORD_BITS };
+
+  int findFrom (unsigned long pageNo) const {
+    unsigned long word = pageNo / WORD_BITS;
+    if (_count == 0 || word >= Words) {
+      return -1;
+    }
+
+    // Rest of the current word first.
+    unsigned long bits = _bits[word] & (~0UL << (pageNo % WORD_BITS));
+    if (bits) {
+      return word * WORD_BITS + __builtin_ctzl(bits);
+    }
+
+    // Then the next word with any bit set, found through the summary.
+    word++;
+    unsigned long sword = word / WORD_BITS;
+    if (sword >= _summaryEnd) {
+      return -1;
+    }
+    unsigned long summary = _summary[sword] & (~0UL << (word % WORD_BITS));
+
+    while (!summary) {
+      if (++sword >= _summaryEnd) {
+        return -1;
+      }
+      summary = _summary[sword];
+    }
+
+    word = sword * WORD_BITS + __builtin_ctzl(summary);
+    return word * WORD_BITS + __builtin_ctzl(_bits[word]);
+  }
+
+  /// One bit per page of the region.
+  unsigned long * _bits;
+
+  /// One bit per word of _bits that may be non-zero.
+  unsigned long * _summary;
+
+  /// The pageinfo of each dirty page, indexed by page number.
+  struct pageinfo ** _slots;
+
+  /// Pages in the set.
+  int _count;
+
+  /// No summary word at or above this one has bits set.
+  unsigned long _summaryEnd;
+};
+
+#endif
@@ -56,6 +56,7 @@
 #include "internalheap.h"
 #include "xoneheap.h"
 #include "xheap.h"
+#include "mm.h"
 
 #include "xplock.h"
 #include "xpageentry.h"
@@ -66,6 +67,10 @@
 #include "stats.h"
 #include "finetime.h"
 
+#ifdef SOFT_DIRTY_DETECTION
+#include "xsoftdirty.h"
+#endif
+
 class xmemory {
 private:
 
@@ -95,6 +100,9 @@ public:
     _globals.initialize();
     xpageentry::getInstance().initialize();
     xpagestore::getInstance().initialize();
+
+    // Pick the page diff kernels for this CPU before any commit.
+    pagediff::getInstance();
   
     // In the beginning, we will protect. 
     _protection = true;
@@ -106,6 +114,11 @@ public:
   void finalize() {
     _globals.finalize(NULL);
     _heap.finalize (_heap.getend());
+#ifdef SHERIFF_COUNTERS
+    stats::getInstance().printRefreshes();
+    stats::getInstance().printMinorFaults();
+#endif
+    stats::getInstance().printPools(xpageentry::chunkSize(), xpagestore::chunkSize(), false);
   }
 
 
@@ -172,6 +185,9 @@ Remalloc_again:
     size_t s = getSize(ptr);
 
     //printf("Now free ptr %p with size %d\n", ptr, s);
+    if (s >= xdefines::RELEASE_OBJECT_SIZE) {
+      MM::releaseObject (_heap, ptr, s);
+    }
     _heap.free(_heapid, ptr);
   }
 
@@ -185,6 +201,12 @@ Remalloc_again:
     //fprintf(stderr, "Now %d open the protection\n", getpid());
     _globals.openProtection();
     _heap.openProtection();
+#ifdef SOFT_DIRTY_DETECTION
+    // Both regions have their twins: start the first interval.
+    if (xsoftdirty::getInstance().available()) {
+      xsoftdirty::getInstance().clear();
+    }
+#endif
     _protection = true;
   }
 
@@ -207,12 +229,22 @@ Remalloc_again:
   /// Beginning of an atomic transaction.
   inline void begin (bool startTimer, bool startThread) {
     //stopCheckingTimer();
+#ifdef SOFT_DIRTY_DETECTION
+    if (xsoftdirty::getInstance().available()) {
+      xsoftdirty::getInstance().attach();
+    }
+#endif
+#ifdef SHERIFF_COSTLY_COUNTERS
+    stats::getInstance().updateMinorFaults();
+#endif
     _globals.begin();
     _heap.begin();
 
-    if(startTimer) { 
+    // A timer left running by an empty commit just goes on.
+    if(startTimer && !_timerKept) { 
       startCheckingTimer();
     }
+    _timerKept = false;
   }
 
   // Actual page fault handler.
@@ -229,17 +261,51 @@ Remalloc_again:
   
   // Commit those local changes to the shared mapping.
   inline void commit (bool doChecking, bool update) {
-    stopCheckingTimer();
+    // Nothing to commit: the next period can be checked just as well.
+    // Soft-dirty bits are scanned by the check itself, so pages dirtied
+    // that way are not known here: never keep the timer over that scan.
+    _timerKept = (_timerStarted && _heap.getDirtyPages() + _globals.getDirtyPages() == 0);
+#ifdef SOFT_DIRTY_DETECTION
+    if (xsoftdirty::getInstance().available()) {
+      _timerKept = false;
+    }
+#endif
+    if(!_timerKept) {
+      stopCheckingTimer();
+    }
+
+#ifdef SOFT_DIRTY_DETECTION
+    // The scans take the same page locks as the timer handler does: a
+    // tick that slipped in while we hold one would spin on it forever.
+    bool scanning = xsoftdirty::getInstance().available();
+    sigset_t alarm, old;
+    if (scanning) {
+      sigemptyset(&alarm);
+      sigaddset(&alarm, SIGALRM);
+      sigprocmask(SIG_BLOCK, &alarm, &old);
+    }
+#endif
 
     // Commit local modifications to the shared mapping.
     _heap.commit(doChecking);
     _globals.commit(doChecking);
+
+#ifdef SOFT_DIRTY_DETECTION
+    // Both regions have been scanned: start a new interval.
+    if (scanning) {
+      xsoftdirty::getInstance().clear();
+      sigprocmask(SIG_SETMASK, &old, NULL);
+    }
+#endif
   } 
 
   /// @brief Disable checking timer
   inline void stopCheckingTimer() {
-    if(_timerStarted)
+    if(_timerStarted) {
       ualarm(0, 0);
+      _timerStarted = false;
+    }
+    _timerKept = false;
   } 
  
   // Start the timer 
@@ -257,15 +323,30 @@ Remalloc_again:
   } 
 
   void doPeriodicChecking () {
+    // A tick that was already on its way when the timer was stopped.
+    if(!_timerStarted) {
+      return;
+    }
    // if(_doChecking == 1) {
     //  stopCheckingTimer();
     _globals.periodicCheck();
     _heap.periodicCheck();
    // }
 
+#ifdef SOFT_DIRTY_DETECTION
+    if (xsoftdirty::getInstance().available()) {
+      xsoftdirty::getInstance().clear();
+    }
+#endif
+
     startCheckingTimer(); 
   }
 
+  /// @return true if the address is in protected memory.
+  bool inRange(void * addr) {
+    return (_heap.inRange(addr) || _globals.inRange(addr));
+  }
+
   unsigned long sharemem_read_word(void * dest) {
     if(_heap.inRange(dest)) {
       return _heap.sharemem_read_word(dest);
@@ -383,6 +464,10 @@ private:
   int _heapid;
 
   bool _timerStarted;
+
+  /// The last commit had nothing to commit and left the timer running.
+  bool _timerKept;
+
   /// Internal share heap.
   InternalHeap  _internalheap;
   unsigned long _doChecking;
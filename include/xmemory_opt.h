@@ -53,6 +53,7 @@
 #include "internalheap.h"
 #include "xoneheap.h"
 #include "xheap.h"
+#include "mm.h"
 
 #include "xplock.h"
 #include "xpageentry.h"
@@ -62,6 +63,16 @@
 
 #include "stats.h"
 #include "finetime.h"
+#include "realfuncs.h"
+#include "x86insn.h"
+
+#ifdef UFFD_TRACKING
+#include "xuffd.h"
+#endif
+
+#ifdef LAZY_RELEASE
+#include "xnotices.h"
+#endif
 
 class xmemory {
 private:
@@ -94,6 +105,9 @@ public:
     _globals.initialize();
     xpageentry::getInstance().initialize();
     xpagestore::getInstance().initialize();
+
+    // Pick the page diff kernels for this CPU before any commit.
+    pagediff::getInstance();
   
     // In the beginning, we will protect. 
     _protection = true;
@@ -106,6 +120,13 @@ public:
 #else
     _lasttrans = 0;
     _lastema = 0;
+    _sharedByChoice = false;
+    _cleanTrans = 0;
+    _probations = 0;
+#endif
+#if defined(LAZY_RELEASE) && !defined(DETECT_FALSE_SHARING_OPT)
+    xnotices::getInstance().initialize();
+    _lazyBegin = false;
 #endif
     _init = true;
   }
@@ -117,6 +138,24 @@ public:
   void finalize() {
     _globals.finalize(NULL);
     _bheap.finalize (_bheap.getend());
+#ifdef SHERIFF_COUNTERS
+    _stats.printCommits();
+    _stats.printRefreshes();
+    _stats.printMinorFaults();
+    _stats.printPrefetches();
+    _stats.printPredictions();
+    _stats.printIsolation();
+    _stats.printThreadIsolation();
+    _stats.printAcquires();
+    _stats.printBiasedLocks();
+    _stats.printQuietReads();
+    _stats.printPolling();
+    _stats.printSyncSyscalls();
+    _stats.printPools(xpageentry::chunkSize(), xpagestore::chunkSize(), true);
+#else
+    _stats.printPools(xpageentry::chunkSize(), xpagestore::chunkSize(), false);
+#endif
+    _stats.printAtomicWrites();
   }
 
 
@@ -168,8 +207,12 @@ Remalloc_again:
   #endif
   }
 #else
-  if(sz <= xdefines::LARGE_CHUNK) 
+  if(sz <= xdefines::LARGE_CHUNK) {
     ptr = _bheap.malloc (_heapid, sz);
+    if(ptr && _protection) {
+      _bheap.reuseMemory (ptr, sz);
+    }
+  }
   else 
     ptr = _sheap.malloc (_heapid, sz);
 #endif
@@ -195,9 +238,15 @@ Remalloc_again:
     size_t s = getSize (ptr);
   
 #ifdef DETECT_FALSE_SHARING_OPT
+    if (s >= xdefines::RELEASE_OBJECT_SIZE) {
+      MM::releaseObject (_bheap, ptr, s);
+    }
     _bheap.free(_heapid, ptr);
 #else
     if (s <= xdefines::LARGE_CHUNK) {
+      if (s >= xdefines::RELEASE_OBJECT_SIZE) {
+        MM::releaseObject (_bheap, ptr, s);
+      }
       _bheap.free(_heapid, ptr);
     } else {
       _sheap.free(_heapid, ptr);
@@ -216,6 +265,10 @@ Remalloc_again:
     _bheap.openProtection();
     _protectLargeHeap = true;
     _protection = true;
+#ifndef DETECT_FALSE_SHARING_OPT
+    _sharedByChoice = false;
+    _cleanTrans = 0;
+#endif
   }
 
   void closeProtection() {
@@ -229,24 +282,104 @@ Remalloc_again:
     }
   }
 
+#ifndef DETECT_FALSE_SHARING_OPT
+  /// @brief A new thread starts out isolated, even if its parent writes
+  /// the shared mappings by choice: nothing is known about its writes yet.
+  void threadStart() {
+    _globals.threadStart();
+    _bheap.threadStart();
+    if(_sharedByChoice) {
+      openProtection();
+    }
+    _probations = 0;
+  }
+
+  /// @brief This thread is about to exit: it stops writing any page directly.
+  void threadExit() {
+    _globals.threadExit();
+    _bheap.threadExit();
+  }
+
+  /// @return true if this thread holds the lock of a page, or waits for
+  /// one: a signal handler must not commit then.
+  bool pageLocksHeld() {
+    return (_globals.pageLocksHeld() || _bheap.pageLocksHeld());
+  }
+#endif
+
   inline void setThreadIndex (int heapid) {
     _heapid = heapid%xdefines::NUM_HEAPS;
     _bheap.setHeapId(heapid%xdefines::NUM_HEAPS);
+#if defined(LAZY_RELEASE) && !defined(DETECT_FALSE_SHARING_OPT)
+    xnotices::getInstance().setThread(heapid);
+#endif
+  }
+
+#if defined(LAZY_RELEASE) && !defined(DETECT_FALSE_SHARING_OPT)
+  /// @brief A lock was just acquired, with clock: the next begin only
+  /// refreshes pages committed before its last release that this thread
+  /// has not seen yet, if they are all still logged. A NULL clock, for a
+  /// release, adds nothing to refresh.
+  void acquireNotices(struct noticeclock * clock) {
+    if(clock == NULL) {
+      _lazyBegin = true;
+      return;
+    }
+
+    struct noticeTarget target = { this };
+    unsigned long taken = 0;
+    bool lazy = xnotices::getInstance().acquire(clock, target, &taken);
+    _stats.updateAcquires(lazy, lazy ? taken : 0);
+    _lazyBegin = lazy;
   }
 
+  /// @brief A lock is about to be released: pass on the notices of this
+  /// thread with it. Called after the commit, with the lock still held.
+  void releaseNotices(struct noticeclock * clock) {
+    xnotices::getInstance().release(clock);
+  }
+#endif
+
   inline void begin (bool startTimer, bool startThread) {
 #ifdef DETECT_FALSE_SHARING_OPT
-    stopCheckingTimer();
+    // A timer left running by an empty commit just goes on.
+    bool kept = _timerKept;
+    _timerKept = false;
+    if(!kept) {
+      stopCheckingTimer();
+    }
     _globals.begin();
     _bheap.begin();
-    if(startTimer) { 
+    if(startTimer && !kept) { 
       startCheckingTimer(true);
     }
 #else
+#ifdef SHERIFF_COSTLY_COUNTERS
+    // getrusage() and getpid().
+    _stats.updateMinorFaults();
+    countSyscalls(2);
+#endif
+#ifdef LAZY_RELEASE
+    bool lazy = _lazyBegin;
+    _lazyBegin = false;
+    if (!lazy) {
+      // Every commit logged so far is about to be seen.
+      xnotices::getInstance().seeAll();
+    }
+#endif
     if (_protection) {
+#ifdef LAZY_RELEASE
+      if (lazy) {
+        _globals.setLazyUpdate();
+        _bheap.setLazyUpdate();
+      }
+#endif
       // Reset global and heap protection.
       _globals.begin();
       _bheap.begin();
+      _globals.twinPredictedPages();
+      _bheap.twinPredictedPages();
+      countSyscalls(_globals.refreshCalls() + _bheap.refreshCalls());
     }
     if (startThread) {
       _lasttrans = _stats.getTrans();
@@ -283,7 +416,11 @@ Remalloc_again:
 
   inline void commit (bool doChecking, bool update) {
 #ifdef DETECT_FALSE_SHARING_OPT
-    stopCheckingTimer();
+    // Nothing to commit: the next period can be checked just as well.
+    _timerKept = (_timerStarted && _globals.getDirtyPages() + _bheap.getDirtyPages() == 0);
+    if(!_timerKept) {
+      stopCheckingTimer();
+    }
 #endif
 
     // Commit local modifications to the shared mapping.
@@ -297,9 +434,117 @@ Remalloc_again:
     evaluateProtection(update, true);
 #else 
     evaluateProtection(update);
+    evaluateIsolation();
 #endif
 } 
 
+  /// @return true if this transaction has pages to commit, or pages
+  /// predicted to be written.
+  inline bool hasDirtyPages() {
+    return (_globals.getDirtyPages() + _bheap.getDirtyPages() != 0);
+  }
+
+#if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING_OPT)
+  /// @return the pages this transaction has to commit, or predicted.
+  inline unsigned long countDirtyPages() {
+    return (_globals.getDirtyPages() + _bheap.getDirtyPages());
+  }
+
+  /// @brief The word at addr is a futex: see xpersist::pinWord(). Called
+  /// right after a commit.
+  void pinWord(void * addr) {
+    if (_bheap.inRange (addr)) {
+      _bheap.pinWord (addr, _protection);
+    } else if (_globals.inRange (addr)) {
+      _globals.pinWord (addr, _protection);
+    }
+  }
+
+  /// @brief This thread polls: see xpersist::pinPolledPages(). Called
+  /// right before a commit.
+  /// @return how many words of this thread were dropped.
+  unsigned long pinPolledPages() {
+    return _globals.pinPolledPages() + _bheap.pinPolledPages();
+  }
+
+  /// @return true if a write to addr is fenced: see xpersist::isFenced().
+  inline bool isFenced(void * addr) {
+    if (_bheap.inRange (addr)) {
+      return _bheap.isFenced (addr);
+    } else if (_globals.inRange (addr)) {
+      return _globals.isFenced (addr);
+    }
+    return false;
+  }
+
+  /// @return true if the write to addr that faulted at context is to be
+  /// fenced: see xpersist::fencedWrite().
+  inline bool fencedWrite(void * addr, void * context) {
+    if (_bheap.inRange (addr)) {
+      return _bheap.fencedWrite (addr, x86insn::locked (context));
+    } else if (_globals.inRange (addr)) {
+      return _globals.fencedWrite (addr, x86insn::locked (context));
+    }
+    return false;
+  }
+
+  /// @brief See xpersist::openFence().
+  void openFence(void * page) {
+    if (_bheap.inRange (page)) {
+      _bheap.openFence (page);
+    } else if (_globals.inRange (page)) {
+      _globals.openFence (page);
+    }
+  }
+
+  /// @brief See xpersist::closeFences().
+  inline void closeFences() {
+    _globals.closeFences();
+    _bheap.closeFences();
+  }
+
+  /// @brief See xpersist::setDropCopies().
+  void dropCopies() {
+    _globals.setDropCopies();
+    _bheap.setDropCopies();
+  }
+
+  /// @brief Hand writes to fenced pages, with the page and the context of
+  /// the fault, to handler.
+  void setFenceHandler(void (*handler)(void *, void *)) {
+    _fenceHandler = handler;
+  }
+#endif
+
+  /// @brief Look for atomic instructions among the writes that fault, as
+  /// long as on is set: several threads run code that may update the same
+  /// word with them, as an OpenMP team does (see xomp.h).
+  void checkAtomics(bool on) {
+    _checkAtomics = on;
+  }
+
+  /// @brief A write faulted: if it is atomic and atomics are looked for,
+  /// say so. It updates the private copy of this thread only, and loses
+  /// to any other thread updating the same word before the next commit.
+  inline void checkWrite(void * context) {
+    if (_checkAtomics && x86insn::locked (context)) {
+      atomicWrite();
+    }
+  }
+
+  /// @brief Count an atomic write to isolated memory, and say so loudly
+  /// the first time in the program.
+  void atomicWrite() {
+    static const char message[] =
+      "Sheriff: WARNING: atomic instruction on a global or heap variable in a parallel region: "
+      "it is not atomic across threads here, and concurrent updates may be lost.\n";
+
+    if (_stats.updateAtomicWrites() == 0) {
+      ssize_t written = WRAP(write)(2, message, sizeof(message) - 1);
+      (void) written;
+    }
+  }
+
   inline int getElapsedMs() {
     return (elapsed2ms(stop(&_lasttime, NULL)));
   }
@@ -345,7 +590,7 @@ Remalloc_again:
       _lastema = ema;
       start(&_lasttime);
     }
-    else if(!_protection && trans - _lasttrans > CHECK_AGAIN_NO_PROTECTION) {
+    else if(!_protection && !_sharedByChoice && trans - _lasttrans > CHECK_AGAIN_NO_PROTECTION) {
       // If we are not protected, we check periodically whether transaction
       // length is long enough.
       elapse = getElapsedMs();
@@ -359,6 +604,38 @@ Remalloc_again:
       start(&_lasttime);
     }
   }
+
+  /// @brief Let this thread write the shared mappings directly while none
+  /// of its commits write pages other threads write, and isolate it again
+  /// once its writes interleave with theirs or its probation comes.
+  void evaluateIsolation (void) {
+    if(_protection) {
+      if(_globals.takeSharedCommits() + _bheap.takeSharedCommits() != 0) {
+        _cleanTrans = 0;
+        _probations = 0;
+      }
+      else if(++_cleanTrans >= xdefines::THREAD_ISOLATION_WINDOW) {
+        _globals.cleanup();
+        _bheap.cleanup();
+        closeProtection();
+
+        _sharedByChoice = true;
+        _sharedTrans = 0;
+        _seenConflicts = _globals.inPlaceConflicts() + _bheap.inPlaceConflicts();
+        _stats.updateThreadIsolation(1, 0);
+      }
+    }
+    else if(_sharedByChoice) {
+      bool interleaved = (_globals.inPlaceConflicts() + _bheap.inPlaceConflicts() != _seenConflicts);
+      if(interleaved || ++_sharedTrans >= (xdefines::THREAD_PROBATION_TRANSACTIONS << _probations)) {
+        if(!interleaved && _probations < xdefines::PROBATION_STRIKES) {
+          _probations++;
+        }
+        openProtection();
+        _stats.updateThreadIsolation(0, 1);
+      }
+    }
+  }
 #endif
 
 #ifdef DETECT_FALSE_SHARING_OPT
@@ -429,8 +706,14 @@ Remalloc_again:
 
   /// @brief Disable checking timer
   inline void stopCheckingTimer() {
-    if(_timerStarted)
+    if(_timerStarted) {
       ualarm(0, 0);
+      countSyscalls(1);
+      _timerStarted = false;
+    }
+#ifdef DETECT_FALSE_SHARING_OPT
+    _timerKept = false;
+#endif
   } 
  
   // Save some time to set the timer. TONGPING 
@@ -441,6 +724,7 @@ Remalloc_again:
     // checking timer. TONGPING
     if(!evaluate) {
       ualarm(xdefines::PERIODIC_CHECKING_INTERVAL, 0);
+      countSyscalls(1);
       _timerStarted = true;
       return;
     }
@@ -454,6 +738,7 @@ Remalloc_again:
     // Evaluate the checking timer.
     if(_needChecking) {
       ualarm(xdefines::PERIODIC_CHECKING_INTERVAL, 0);
+      countSyscalls(1);
       _timerStarted = true;
     }
     else {
@@ -461,6 +746,23 @@ Remalloc_again:
     }
   }
 
+  /// @brief Note system calls made at a transaction boundary.
+  inline void countSyscalls(unsigned long syscalls) {
+#ifdef SYSCALL_COUNTERS
+    _syscalls += syscalls;
+#endif
+  }
+
+#ifdef SYSCALL_COUNTERS
+  /// @return the system calls made at transaction boundaries since the
+  /// last call.
+  unsigned long takeSyscalls() {
+    unsigned long syscalls = _syscalls;
+    _syscalls = 0;
+    return syscalls;
+  }
+#endif
+
   inline void enableCheck() {
     atomic::atomic_set(&_doChecking, 1);
   }
@@ -470,6 +772,14 @@ Remalloc_again:
   } 
 
   void doPeriodicChecking () {
+#ifdef SYSCALL_COUNTERS
+    // Not made at a transaction boundary.
+    unsigned long syscalls = _syscalls;
+#endif
+    // A tick that was already on its way when the timer was stopped.
+    if(!_timerStarted) {
+      return;
+    }
     if(_doChecking == 1) {
       stopCheckingTimer();
       _globals.periodicCheck();
@@ -480,6 +790,14 @@ Remalloc_again:
     }
 
     startCheckingTimer(false); 
+#ifdef SYSCALL_COUNTERS
+    _syscalls = syscalls;
+#endif
+  }
+
+  /// @return true if the address is in protected memory.
+  bool inRange(void * addr) {
+    return (_bheap.inRange(addr) || _globals.inRange(addr));
   }
 
   unsigned long sharemem_read_word(void * dest) {
@@ -524,6 +842,16 @@ public:
       // Compute the page that holds this address.
       void * page = (void *) (((size_t) addr) & ~(xdefines::PageSize-1));
 
+#if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING_OPT)
+      if (xmemory::getInstance()._fenceHandler != NULL && xmemory::getInstance().fencedWrite (addr, context)) {
+        xmemory::getInstance()._fenceHandler (page, context);
+        return;
+      }
+      xmemory::getInstance().closeFences();
+#endif
+
+      xmemory::getInstance().checkWrite (context);
+
       // Unprotect the page and record the write.
       mprotect ((char *) page,
                 xdefines::PageSize,
@@ -545,6 +873,38 @@ public:
 #endif
   }
 
+#if defined(UFFD_TRACKING) && !defined(DETECT_FALSE_SHARING_OPT)
+  /// @brief Signal handler to trap writes to pages write-protected by userfaultfd.
+  static void busHandle (int signum,
+                         siginfo_t * siginfo,
+                         void * context)
+  {
+    void * addr = siginfo->si_addr; // address of access
+
+    if (!xmemory::getInstance()._bheap.inRange (addr)
+        && !xmemory::getInstance()._globals.inRange (addr)) {
+      fprintf (stderr, "%d : bus error with addr %p.\n", getpid(), addr);
+      ::abort();
+    }
+
+    // Compute the page that holds this address.
+    void * page = (void *) (((size_t) addr) & ~(xdefines::PageSize-1));
+
+#ifdef ATOMIC_SYNC
+    if (xmemory::getInstance()._fenceHandler != NULL && xmemory::getInstance().fencedWrite (addr, context)) {
+      xmemory::getInstance()._fenceHandler (page, context);
+      return;
+    }
+    xmemory::getInstance().closeFences();
+#endif
+
+    // Unprotect the page and record the write.
+    xmemory::getInstance().checkWrite (context);
+    xuffd::getInstance().unprotect (page, xdefines::PageSize);
+    xmemory::getInstance().handleWrite (addr);
+  }
+#endif
+
   /// @brief Handle those timers about checking.
   static void checkingTimerHandle (int signum,
 				   siginfo_t * siginfo,
@@ -569,6 +929,17 @@ public:
     // Set the following signals to a set 
     sigaddset (&siga.sa_mask, SIGSEGV);
     sigaddset (&siga.sa_mask, SIGALRM);
+#if defined(UFFD_TRACKING) && !defined(DETECT_FALSE_SHARING_OPT)
+    sigaddset (&siga.sa_mask, SIGBUS);
+#endif
+#ifdef ATOMIC_SYNC
+    // No polling sample in the middle of a fault.
+    sigaddset (&siga.sa_mask, SIGVTALRM);
+#endif
+#ifdef BIASED_LOCKS
+    // Nor a revocation of biased locks.
+    sigaddset (&siga.sa_mask, SIGRTMIN + xdefines::REVOKE_SIGNAL);
+#endif
 
     sigprocmask (SIG_BLOCK, &siga.sa_mask, NULL);
 
@@ -585,6 +956,15 @@ public:
       exit (-1);
     }
 
+#if defined(UFFD_TRACKING) && !defined(DETECT_FALSE_SHARING_OPT)
+    // Writes caught by userfaultfd arrive as SIGBUS.
+    siga.sa_sigaction = xmemory::busHandle;
+    if (sigaction (SIGBUS, &siga, NULL) == -1) {
+      fprintf (stderr, "Signal handler for SIGBUS failed to install.\n");
+      exit (-1);
+    }
+#endif
+
     // We use the alarm to trigger checking timer.
     siga.sa_sigaction = xmemory::checkingTimerHandle;
     if (sigaction (SIGALRM, &siga, NULL) == -1) {
@@ -633,6 +1013,23 @@ private:
   // Do we allow the checking.
   bool _timerStarted;
   unsigned long _doChecking;
+
+#ifdef DETECT_FALSE_SHARING_OPT
+  /// The last commit had nothing to commit and left the timer running.
+  bool _timerKept;
+#endif
+
+#ifdef SYSCALL_COUNTERS
+  /// System calls made at transaction boundaries, not taken yet.
+  unsigned long _syscalls;
+#endif
+#if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING_OPT)
+  /// Who takes writes to fenced pages, once set.
+  void (*_fenceHandler)(void *, void *);
+#endif
+
+  /// Whether writes that fault are checked for atomic instructions.
+  bool _checkAtomics;
   bool _protection;
 
   unsigned long _lasttrans;
@@ -641,6 +1038,37 @@ private:
 
   bool _needChecking;
   bool _protectLargeHeap;
+
+#ifndef DETECT_FALSE_SHARING_OPT
+  /// Protection is off because this thread writes no page others write.
+  bool _sharedByChoice;
+
+  /// Transactions in a row without commits to pages others had dirty,
+  /// and transactions since this thread left isolation.
+  unsigned long _cleanTrans;
+  unsigned long _sharedTrans;
+
+  /// In-place conflicts counted when this thread left isolation.
+  unsigned long _seenConflicts;
+
+  /// Probations this thread came back clean from in a row.
+  int _probations;
+
+#ifdef LAZY_RELEASE
+  /// The next begin follows a lazy acquire or a release.
+  bool _lazyBegin;
+
+  /// Hands the pages of a lock's notices to the region they belong to.
+  struct noticeTarget {
+    xmemory * memory;
+
+    inline void operator() (void * addr) {
+      memory->_globals.noticePage(addr);
+      memory->_bheap.noticePage(addr);
+    }
+  };
+#endif
+#endif
 };
 
 #endif
@@ -0,0 +1,216 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xnotices.h
+ * @brief  Write notices for lazy release consistency (LAZY_RELEASE).
+ *
+ *         Every commit of a page appends a notice, the page's address
+ *         and the committing thread, to the log of that thread. Each
+ *         thread keeps how far it has taken every log into account: a
+ *         vector timestamp, as in TreadMarks. Releasing a lock stores that
+ *         vector, advanced to the end of the releaser's own log, with the
+ *         lock; acquiring it only refreshes the pages other threads
+ *         committed between the acquirer's vector and the lock's. Writes
+ *         reaching the releaser through other locks are thereby passed on
+ *         too.
+ *
+ *         Logs live in shared memory and are rings, whose slots carry the
+ *         number of the notice last written to them: a notice counts only
+ *         once its number is there, the same before and after it is read.
+ *         Threads whose index is the same modulo NOTICE_LOGS share a log,
+ *         which only makes them notice each other's pages too. A thread
+ *         that fell more than LOG_NOTICES notices behind refreshes
+ *         everything instead, which takes every log into account up to
+ *         where it stood.
+ */
+
+#ifndef SHERIFF_XNOTICES_H
+#define SHERIFF_XNOTICES_H
+
+#include <new>
+#include <string.h>
+#include <syscall.h>
+#include <unistd.h>
+
+#include "xdefines.h"
+#include "atomic.h"
+#include "mm.h"
+
+/// How far into each log a thread was when it released a lock.
+/// Counts wrap around: compare them by their difference only.
+struct noticeclock {
+  unsigned int logs[xdefines::NOTICE_LOGS];
+};
+
+class xnotices {
+public:
+
+  static xnotices& getInstance (void) {
+    static char buf[sizeof(xnotices)];
+    static xnotices * theOneTrueObject = new (buf) xnotices();
+    return *theOneTrueObject;
+  }
+
+  /// @brief Allocate the logs, before any thread is spawned.
+  void initialize (void) {
+    _logs = (struct noticelog *) MM::allocateShared (xdefines::NOTICE_LOGS * sizeof(struct noticelog));
+    _log = 0;
+    _pid = syscall(SYS_getpid);
+    memset (&_seen, 0, sizeof(_seen));
+  }
+
+  /// @brief Log the commits of this thread, the index-th, from now on.
+  /// A thread reusing the pid of one that exited has seen all its notices
+  /// by its first begin, so notices can be told apart by pid.
+  void setThread (int index) {
+    _log = index % xdefines::NOTICE_LOGS;
+    _pid = syscall(SYS_getpid);
+  }
+
+  /// @brief Note a commit to the page at pageStart, once its new version
+  /// is published. Commit helpers of this thread may call it at once.
+  inline void append (void * pageStart) {
+    struct noticelog * log = &_logs[_log];
+    unsigned int index = (unsigned int)atomic::fetch_and_add(&log->count, 1);
+    struct notice * notice = &log->notices[index % xdefines::LOG_NOTICES];
+
+    // Nobody takes the slot for the old notice, or the new one, meanwhile.
+    notice->number = index;
+    atomic::memoryBarrier();
+    notice->page = pageStart;
+    notice->pid = _pid;
+    atomic::memoryBarrier();
+    notice->number = index + 1;
+  }
+
+  /// @brief Initialize the clock of a new lock.
+  static void initialize (struct noticeclock * clock) {
+    memset (clock, 0, sizeof(*clock));
+  }
+
+  /// @brief Visit the pages other threads committed, noticed in the clock
+  /// and not seen yet by this thread, and take them as seen. Called with
+  /// the lock held.
+  /// @return false if some of them were no longer logged, not written
+  /// yet, or overwritten while being read: everything has to be refreshed
+  /// then.
+  template <class Visitor>
+  bool acquire (const struct noticeclock * clock, Visitor & visit, unsigned long * notices) {
+    for (int i = 0; i < xdefines::NOTICE_LOGS; i++) {
+      unsigned int end = clock->logs[i];
+      if (!ahead(end, _seen.logs[i])) {
+        continue;
+      }
+      if (!logged(i, _seen.logs[i])) {
+        return false;
+      }
+      for (unsigned int index = _seen.logs[i]; ahead(end, index); index++) {
+        struct notice * notice = &_logs[i].notices[index % xdefines::LOG_NOTICES];
+        if (notice->number != index + 1) {
+          return false;
+        }
+        atomic::memoryBarrier();
+        void * page = notice->page;
+        pid_t pid = notice->pid;
+        atomic::memoryBarrier();
+        if (notice->number != index + 1) {
+          return false;
+        }
+        if (pid != _pid) {
+          visit (page);
+          (*notices)++;
+        }
+      }
+      _seen.logs[i] = end;
+    }
+    return true;
+  }
+
+  /// @brief Everything logged so far is seen: called right before all
+  /// private copies other threads changed are refreshed.
+  void seeAll (void) {
+    for (int i = 0; i < xdefines::NOTICE_LOGS; i++) {
+      _seen.logs[i] = counted(i);
+    }
+  }
+
+  /// @brief Pass what this thread has seen, and its own commits, on to
+  /// whoever acquires the lock next. Called with the lock held.
+  void release (struct noticeclock * clock) {
+    for (int i = 0; i < xdefines::NOTICE_LOGS; i++) {
+      if (ahead(_seen.logs[i], clock->logs[i])) {
+        clock->logs[i] = _seen.logs[i];
+      }
+    }
+    // Not into our own clock: threads sharing the log may have added
+    // pages this thread has not seen.
+    clock->logs[_log] = counted(_log);
+  }
+
+private:
+
+  xnotices (void)
+    : _logs (NULL),
+      _log (0),
+      _pid (0)
+  {}
+
+  static inline bool ahead (unsigned int count, unsigned int than) {
+    return ((int)(count - than) > 0);
+  }
+
+  /// @return the notices appended to log so far, wrapped around as the
+  /// counts of clocks are.
+  inline unsigned int counted (int log) {
+    return (unsigned int)_logs[log].count;
+  }
+
+  /// @return true if the notices of log from index on may all still be
+  /// there: notices are checked one by one as they are read.
+  inline bool logged (int log, unsigned int index) {
+    return (counted(log) - index <= (unsigned int)xdefines::LOG_NOTICES);
+  }
+
+  struct notice {
+    volatile unsigned int number;
+    void * volatile page;
+    volatile pid_t pid;
+  };
+
+  struct noticelog {
+    /// Notices appended, including those still being written.
+    volatile unsigned long count;
+    struct notice notices[xdefines::LOG_NOTICES];
+  };
+
+  /// The logs, shared by all threads.
+  struct noticelog * _logs;
+
+  /// The log of this thread, and the pid its notices carry.
+  int _log;
+  pid_t _pid;
+
+  /// How far this thread has taken each log into account.
+  struct noticeclock _seen;
+};
+
+#endif
@@ -0,0 +1,769 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xomp.h
+ * @brief  OpenMP teams of Sheriff threads, for programs built with GCC's
+ *         -fopenmp.
+ *
+ *         libgomp keeps its thread pool, its barriers and its loop
+ *         counters in memory Sheriff isolates, so its threads would never
+ *         see each other. The GOMP_* entry points compiled code calls are
+ *         taken over instead (see libsheriff.cpp). A team is a set of
+ *         threads spawned and joined through xrun; its barriers, critical
+ *         and ordered sections are xrun barriers and mutexes, so that each
+ *         is a commit and a refresh as with pthreads. Loop chunks, sections
+ *         and singles are handed out from a ring of work shares in shared
+ *         memory, through which a thread may run up to OMP_SHARES
+ *         constructs ahead of the others with nowait.
+ *
+ *         Shared variables are reached through pointers into the frames of
+ *         the master, on a stack Sheriff does not manage. Those frames are
+ *         mapped shared for the length of the region, while the master runs
+ *         its own share on a stack of its own: writes to them are seen at
+ *         once, as with threads, and the atomic updates of reductions stay
+ *         atomic.
+ *
+ *         One team runs at a time. Nested regions, regions started while
+ *         another team runs and regions started off the main stack run on
+ *         a team of one. Tasks are left to libgomp, which runs them at once
+ *         outside of its own teams.
+ *
+ *         Atomics are the exception. GCC compiles "#pragma omp atomic",
+ *         and the reductions it can do without a lock, to atomic
+ *         instructions straight on the variable, without a call to
+ *         libgomp. On the master's frames those stay atomic, but on globals
+ *         and on the heap they update the private copy of the thread: two
+ *         threads updating the same word lose one of the updates at the
+ *         next commit, as with C11 atomics. Only atomics GCC cannot do
+ *         lock-free go through GOMP_atomic_start(), a mutex here. Such
+ *         variables belong in a critical section, or on the stack of the
+ *         function that starts the region. While a team runs, writes that
+ *         fault are checked for atomic instructions, and the first one
+ *         found is reported on stderr at once: a page is only caught at
+ *         its first write in a transaction, so some may go unreported, but
+ *         a loop of atomics on a global rarely does. With ATOMIC_SYNC, the
+ *         page is pinned shared instead, and the atomics stay atomic (see
+ *         xpoll.h).
+ */
+
+#ifndef SHERIFF_XOMP_H
+#define SHERIFF_XOMP_H
+
+#include <limits.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+
+#include "xdefines.h"
+#include "xrun.h"
+#include "xfutex.h"
+#include "atomic.h"
+#include "mm.h"
+#include "realfuncs.h"
+
+extern "C" void * __libc_stack_end;
+
+/// A worksharing loop, as a count of iterations from first by incr.
+struct omploop {
+  unsigned long long first;
+  unsigned long long incr;
+  unsigned long count;
+  unsigned long chunk;
+  int schedule;
+  bool ordered;
+};
+
+/// A worksharing construct of a team: a loop, sections or a single.
+struct ompshare {
+  /// The construct the share serves, counted from 1 in every team, once
+  /// claimed and once set up, and how many threads are done with it.
+  volatile unsigned long number;
+  volatile unsigned long ready;
+  volatile unsigned long left;
+
+  struct omploop loop;
+
+  /// The next iteration to hand out, for dynamic and guided schedules.
+  volatile unsigned long next;
+
+  /// Ordered loops: the first iteration of the chunk whose thread may run
+  /// its ordered sections, and a count of its moves to sleep on.
+  volatile unsigned long turn;
+  volatile unsigned long moves;
+};
+
+class xomp {
+public:
+
+  /// Schedules, as GOMP_loop_start() numbers them.
+  enum { SCHEDULE_RUNTIME = 0, SCHEDULE_STATIC = 1, SCHEDULE_DYNAMIC = 2,
+         SCHEDULE_GUIDED = 3, SCHEDULE_AUTO = 4 };
+  enum { SCHEDULE_MONOTONIC = 0x80000000 };
+
+  static xomp& getInstance (void) {
+    static char buf[sizeof(xomp)];
+    static xomp * theOneTrueObject = new (buf) xomp();
+    return *theOneTrueObject;
+  }
+
+  /// @brief Set up teams, before any thread is spawned, if the program
+  /// uses libgomp at all.
+  void initialize (void) {
+    if (WRAP(omp_get_max_threads) == NULL) {
+      return;
+    }
+
+    _team = (struct ompteam *) MM::allocateShared (sizeof(struct ompteam));
+    _stack = (char *) mmap (NULL, xdefines::OMP_STACK, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (_team == MAP_FAILED || _stack == MAP_FAILED) {
+      fprintf (stderr, "Sheriff: cannot set up OpenMP teams\n");
+      ::abort();
+    }
+
+    // Locks and barriers are the program's, as far as xrun knows.
+    xrun & run = xrun::getInstance();
+    _sync = (struct ompsync *) run.malloc (sizeof(struct ompsync));
+    run.mutex_init (&_sync->critical);
+    run.mutex_init (&_sync->atomics);
+    run.mutex_init (&_sync->ordered);
+    for (int i = 0; i < xdefines::OMP_CRITICALS; i++) {
+      run.mutex_init (&_sync->named[i]);
+    }
+    for (int i = 0; i < xdefines::OMP_THREADS; i++) {
+      run.barrier_init (&_sync->barriers[i], i + 1);
+    }
+  }
+
+  /// @brief Run fn(data) on a team of threads (all of them if 0), the
+  /// first work share set up for loop already if not NULL.
+  void parallel (void (*fn) (void *), void * data, unsigned int threads, const struct omploop * loop) {
+    threads = teamSize (threads);
+
+    // The frames of our callers, up to the start of the main stack.
+    char * lo = (char *)((unsigned long) __builtin_frame_address(0) & ~xdefines::PAGE_SIZE_MASK);
+    char * hi = (char *)(((unsigned long) __libc_stack_end + xdefines::PAGE_SIZE_MASK) & ~xdefines::PAGE_SIZE_MASK);
+
+    if (threads == 1 || _state.level != 0 || _team == NULL
+        || lo >= hi || (size_t)(hi - lo) > (size_t)xdefines::OMP_SHARED_STACK
+        || atomic::compare_and_swap (&_team->busy, 0, 1) != 0) {
+      solo (fn, data, loop);
+      return;
+    }
+
+    _team->threads = threads;
+    _team->fn = fn;
+    _team->data = data;
+    for (int i = 0; i < xdefines::OMP_SHARES; i++) {
+      _team->shares[i].number = 0;
+      _team->shares[i].ready = 0;
+    }
+    _team->constructs = 0;
+    if (loop != NULL) {
+      setUp (&_team->shares[1], 1, loop);
+      _team->constructs = 1;
+    }
+
+    _lo = lo;
+    _size = hi - lo;
+    _outer = _state;
+
+    // Nothing may run on the frames being shared while the team runs.
+    getcontext (&_teamContext);
+    _teamContext.uc_stack.ss_sp = _stack;
+    _teamContext.uc_stack.ss_size = xdefines::OMP_STACK;
+    _teamContext.uc_link = &_masterContext;
+    makecontext (&_teamContext, runTeam, 0);
+    swapcontext (&_masterContext, &_teamContext);
+
+    _state = _outer;
+    atomic::atomic_set (&_team->busy, 0);
+  }
+
+  inline int threadNum (void) const {
+    return _state.thread;
+  }
+
+  inline int numThreads (void) const {
+    return _state.threads;
+  }
+
+  inline int level (void) const {
+    return _state.level;
+  }
+
+  inline int activeLevel (void) const {
+    return _state.activeLevel;
+  }
+
+  void barrier (void) {
+    if (_state.threads > 1) {
+      xrun::getInstance().barrier_wait (&_sync->barriers[_state.threads - 1]);
+    }
+  }
+
+  inline pthread_mutex_t * critical (void) {
+    return &_sync->critical;
+  }
+
+  inline pthread_mutex_t * atomics (void) {
+    return &_sync->atomics;
+  }
+
+  /// @return the lock of a named critical section, told apart by the
+  /// address GCC passes for its name. Beyond OMP_CRITICALS names, the
+  /// rest share the lock of unnamed ones.
+  pthread_mutex_t * critical (void ** name) {
+    unsigned long key = (unsigned long) name;
+    unsigned long start = key / sizeof(void *);
+
+    for (int i = 0; i < xdefines::OMP_CRITICALS; i++) {
+      int index = (start + i) % xdefines::OMP_CRITICALS;
+      unsigned long found = _team->names[index];
+      if (found == 0) {
+        found = atomic::compare_and_swap (&_team->names[index], 0, key);
+      }
+      if (found == 0 || found == key) {
+        return &_sync->named[index];
+      }
+    }
+    return &_sync->critical;
+  }
+
+  /// @brief Enter an ordered section: wait for the chunks before ours.
+  void orderedStart (void) {
+    if (_state.holding) {
+      waitTurn (_state.share, _state.from);
+    }
+    xrun::getInstance().mutex_lock (&_sync->ordered);
+  }
+
+  void orderedEnd (void) {
+    xrun::getInstance().mutex_unlock (&_sync->ordered);
+  }
+
+  /// @return true for the first thread of the team to get there.
+  bool singleStart (void) {
+    bool first;
+    struct ompshare * share = arrive (NULL, &first);
+    atomic::increment (&share->left);
+    return first;
+  }
+
+  /// @brief Arrive at a loop and take a first chunk of it, unless istart
+  /// is NULL.
+  /// @return false if no iteration is left for this thread.
+  template <class Iter>
+  bool loopStart (const struct omploop & loop, Iter * istart, Iter * iend) {
+    bool first;
+    _state.share = arrive (&loop, &first);
+    _state.trip = 0;
+    _state.holding = false;
+    return (istart == NULL || loopNext (istart, iend));
+  }
+
+  /// @brief Take the next chunk of the loop, [istart, iend).
+  template <class Iter>
+  bool loopNext (Iter * istart, Iter * iend) {
+    passTurn();
+
+    unsigned long from;
+    unsigned long to;
+    if (!take (&from, &to)) {
+      return false;
+    }
+
+    const struct omploop * loop = &_state.share->loop;
+    *istart = (Iter)(loop->first + from * loop->incr);
+    *iend = (Iter)(loop->first + to * loop->incr);
+    if (loop->ordered) {
+      _state.holding = true;
+      _state.from = from;
+      _state.to = to;
+    }
+    return true;
+  }
+
+  /// @brief Leave the loop or sections, and wait for the others unless
+  /// nowait.
+  void loopEnd (bool wait) {
+    passTurn();
+    atomic::increment (&_state.share->left);
+    _state.share = NULL;
+    if (wait) {
+      barrier();
+    }
+  }
+
+  /// @return the section to run first, from 1, or 0 for none.
+  unsigned int sectionsStart (unsigned int count) {
+    long section;
+    long end;
+    struct omploop loop = makeLoop (1, count + 1, 1, SCHEDULE_DYNAMIC, 1, false);
+    return (loopStart (loop, &section, &end) ? section : 0);
+  }
+
+  unsigned int sectionsNext (void) {
+    long section;
+    long end;
+    return (loopNext (&section, &end) ? section : 0);
+  }
+
+  /// @brief A loop over [start, end) by incr.
+  static struct omploop makeLoop (long start, long end, long incr, long schedule, long chunk, bool ordered) {
+    struct omploop loop;
+    loop.first = (unsigned long long) start;
+    loop.incr = (unsigned long long) incr;
+    if (incr > 0) {
+      loop.count = (end > start) ? ((unsigned long) end - (unsigned long) start + incr - 1) / incr : 0;
+    }
+    else {
+      loop.count = (start > end) ? ((unsigned long) start - (unsigned long) end - incr - 1) / (unsigned long) -incr : 0;
+    }
+    loop.ordered = ordered;
+    setSchedule (&loop, schedule, chunk > 0 ? chunk : 0);
+    return loop;
+  }
+
+  /// @brief A loop over unsigned long long iterations, counting down by
+  /// -incr unless up.
+  static struct omploop makeLoop (bool up, unsigned long long start, unsigned long long end,
+                                  unsigned long long incr, long schedule, unsigned long long chunk, bool ordered) {
+    struct omploop loop;
+    loop.first = start;
+    loop.incr = incr;
+    if (up) {
+      loop.count = (end > start) ? (end - start + incr - 1) / incr : 0;
+    }
+    else {
+      loop.count = (start > end) ? (start - end - incr - 1) / -incr : 0;
+    }
+    loop.ordered = ordered;
+    setSchedule (&loop, schedule, chunk);
+    return loop;
+  }
+
+  /// @brief A construct we cannot run on Sheriff threads.
+  static void unsupported (const char * what) {
+    fprintf (stderr, "%d : Sheriff does not support %s.\n", getpid(), what);
+    ::abort();
+  }
+
+private:
+
+  xomp (void)
+    : _team (NULL),
+      _sync (NULL),
+      _stack (NULL),
+      _lo (NULL),
+      _size (0),
+      _view (NULL)
+  {
+    _idle.number = 0;
+    _idle.left = 0;
+    _state.thread = 0;
+    _state.threads = 1;
+    _state.level = 0;
+    _state.activeLevel = 0;
+    _state.shares = &_idle;
+    _state.ring = 1;
+    _state.constructs = 0;
+    _state.share = NULL;
+    _state.trip = 0;
+    _state.holding = false;
+  }
+
+  /// What a thread knows of its team and of the construct it is in.
+  struct ompstate {
+    int thread;
+    int threads;
+    int level;
+    int activeLevel;
+
+    /// The ring of work shares, and the constructs arrived at so far.
+    struct ompshare * shares;
+    unsigned long ring;
+    unsigned long constructs;
+
+    /// The loop or sections being run, and how many chunks of a static
+    /// schedule were taken.
+    struct ompshare * share;
+    unsigned long trip;
+
+    /// Ordered loops: the chunk held, [from, to).
+    bool holding;
+    unsigned long from;
+    unsigned long to;
+  };
+
+  /// The running team, in shared memory.
+  struct ompteam {
+    volatile unsigned long busy;
+    unsigned long threads;
+    void (*fn) (void *);
+    void * data;
+
+    /// 1 if the master set up the first work share already.
+    unsigned long constructs;
+    struct ompshare shares[xdefines::OMP_SHARES];
+
+    /// The names of critical sections told apart so far.
+    volatile unsigned long names[xdefines::OMP_CRITICALS];
+  };
+
+  /// Locks and barriers, in the program's heap for xrun.
+  struct ompsync {
+    pthread_mutex_t critical;
+    pthread_mutex_t atomics;
+    pthread_mutex_t ordered;
+    pthread_mutex_t named[xdefines::OMP_CRITICALS];
+
+    /// One for each team size.
+    pthread_barrier_t barriers[xdefines::OMP_THREADS];
+  };
+
+  unsigned int teamSize (unsigned int threads) {
+    if (threads == 0) {
+      threads = (WRAP(omp_get_max_threads) != NULL) ? WRAP(omp_get_max_threads)() : 1;
+    }
+    if (threads > (unsigned int)xdefines::OMP_THREADS) {
+      threads = xdefines::OMP_THREADS;
+    }
+    return (threads > 0) ? threads : 1;
+  }
+
+  /// @brief Resolve runtime and auto schedules. Dynamic and guided chunks
+  /// are at least 1; a static chunk of 0 means one block per thread.
+  static void setSchedule (struct omploop * loop, long schedule, unsigned long chunk) {
+    schedule &= ~(long)SCHEDULE_MONOTONIC;
+    if (schedule == SCHEDULE_RUNTIME) {
+      int kind = SCHEDULE_DYNAMIC;
+      int size = 1;
+      if (WRAP(omp_get_schedule) != NULL) {
+        WRAP(omp_get_schedule) (&kind, &size);
+      }
+      schedule = kind & ~SCHEDULE_MONOTONIC;
+      chunk = (size > 0) ? size : 0;
+    }
+    if (schedule == SCHEDULE_AUTO) {
+      schedule = SCHEDULE_STATIC;
+      chunk = 0;
+    }
+    if (schedule != SCHEDULE_STATIC && chunk == 0) {
+      chunk = 1;
+    }
+    if (chunk > loop->count && loop->count != 0) {
+      chunk = loop->count;
+    }
+    loop->schedule = schedule;
+    loop->chunk = chunk;
+  }
+
+  /// @brief Run a region on a team of one.
+  void solo (void (*fn) (void *), void * data, const struct omploop * loop) {
+    struct ompstate outer = _state;
+    struct ompshare share;
+    share.number = 0;
+    share.left = 0;
+
+    _state.thread = 0;
+    _state.threads = 1;
+    _state.level++;
+    _state.shares = &share;
+    _state.ring = 1;
+    _state.constructs = 0;
+    _state.share = NULL;
+    _state.holding = false;
+    if (loop != NULL) {
+      bool first;
+      _state.share = arrive (loop, &first);
+      _state.trip = 0;
+    }
+
+    fn (data);
+    _state = outer;
+  }
+
+  /// @brief Run the team, on the stack of the master's share.
+  static void runTeam (void) {
+    xomp & omp = getInstance();
+    xrun & run = xrun::getInstance();
+
+    if (!omp.shareStack()) {
+      omp._team->threads = 1;
+    }
+
+    // Members are forked, never handed to parked workers: those do not
+    // have the frames of the master mapped shared, and copyStack() could
+    // not find them from the team stack anyway.
+    unsigned long threads = omp._team->threads;
+    run.checkAtomics (threads > 1);
+    for (unsigned long i = 1; i < threads; i++) {
+      omp._members[i] = run.spawn (member, (void *) i, false);
+    }
+    member ((void *) 0);
+    for (unsigned long i = 1; i < threads; i++) {
+      run.join (omp._members[i], NULL);
+    }
+    run.checkAtomics (false);
+
+    omp.unshareStack();
+  }
+
+  /// @brief The share of the index-th thread of the team.
+  static void * member (void * index) {
+    xomp & omp = getInstance();
+    struct ompteam * team = omp._team;
+
+    omp._state.thread = (int)(unsigned long) index;
+    omp._state.threads = team->threads;
+    omp._state.level = 1;
+    omp._state.activeLevel = (team->threads > 1) ? 1 : 0;
+    omp._state.shares = team->shares;
+    omp._state.ring = xdefines::OMP_SHARES;
+    omp._state.constructs = team->constructs;
+    omp._state.share = (team->constructs != 0) ? &team->shares[1] : NULL;
+    omp._state.trip = 0;
+    omp._state.holding = false;
+
+    team->fn (team->data);
+
+    if (index != 0) {
+      omp.dropStack();
+    }
+    return NULL;
+  }
+
+  /// @brief Map the frames being shared, [_lo, _lo + _size), shared.
+  /// @return false if they could not be.
+  bool shareStack (void) {
+    int fd = MM::createBackingFile ("sheriff-omp-stack", _size);
+    if (fd == -1) {
+      return false;
+    }
+
+    _view = (char *) mmap (NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (_view != MAP_FAILED) {
+      memcpy (_view, _lo, _size);
+      if (mmap (_lo, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        fprintf (stderr, "Sheriff: cannot share the stack with an OpenMP team\n");
+        ::abort();
+      }
+    }
+    // The mappings keep the file; the descriptor table is the team's.
+    close (fd);
+
+    if (_view == MAP_FAILED) {
+      _view = NULL;
+      return false;
+    }
+    return true;
+  }
+
+  /// @brief Make the shared frames the master's own again.
+  void unshareStack (void) {
+    if (_view == NULL) {
+      return;
+    }
+    mmap (_lo, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    memcpy (_lo, _view, _size);
+    munmap (_view, _size);
+    _view = NULL;
+  }
+
+  /// @brief A member is done with the frames: one living on as a parked
+  /// worker must not share them with others.
+  void dropStack (void) {
+    mmap (_lo, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    munmap (_view, _size);
+    _view = NULL;
+  }
+
+  /// @brief Arrive at the next construct, and set up its work share for
+  /// loop if the first to.
+  struct ompshare * arrive (const struct omploop * loop, bool * first) {
+    unsigned long number = ++_state.constructs;
+    struct ompshare * share = &_state.shares[number % _state.ring];
+
+    while (true) {
+      unsigned long claimed = share->number;
+      if (claimed == number) {
+        while (share->ready != number) {
+          atomic::pause();
+        }
+        *first = false;
+        return share;
+      }
+
+      // The share is free once all threads are done with what it served.
+      if (claimed < number
+          && (claimed == 0 || share->left == (unsigned long)_state.threads)
+          && atomic::compare_and_swap (&share->number, claimed, number) == claimed) {
+        setUp (share, number, loop);
+        *first = true;
+        return share;
+      }
+      syscall (SYS_sched_yield);
+    }
+  }
+
+  static void setUp (struct ompshare * share, unsigned long number, const struct omploop * loop) {
+    share->number = number;
+    share->left = 0;
+    if (loop != NULL) {
+      share->loop = *loop;
+    }
+    share->next = 0;
+    share->turn = 0;
+    share->moves = 0;
+    atomic::atomic_set (&share->ready, number);
+  }
+
+  /// @brief Take a chunk of the current loop, [from, to).
+  /// @return false if none is left for this thread.
+  bool take (unsigned long * from, unsigned long * to) {
+    struct ompshare * share = _state.share;
+    unsigned long count = share->loop.count;
+    unsigned long chunk = share->loop.chunk;
+    unsigned long threads = _state.threads;
+    unsigned long thread = _state.thread;
+    unsigned long start;
+    unsigned long size;
+
+    switch (share->loop.schedule) {
+    case SCHEDULE_STATIC:
+      if (chunk == 0) {
+        // One block each, the first ones longer by one.
+        if (_state.trip++ != 0) {
+          return false;
+        }
+        size = count / threads;
+        start = size * thread + ((thread < count % threads) ? thread : count % threads);
+        if (thread < count % threads) {
+          size++;
+        }
+        if (size == 0) {
+          return false;
+        }
+        break;
+      }
+      start = _state.trip++ * threads + thread;
+      if (count == 0 || start > (count - 1) / chunk) {
+        return false;
+      }
+      start *= chunk;
+      size = (count - start < chunk) ? count - start : chunk;
+      break;
+
+    case SCHEDULE_GUIDED:
+      // What is left split among the threads, down to the chunk.
+      start = share->next;
+      while (true) {
+        if (start >= count) {
+          return false;
+        }
+        size = (count - start + threads - 1) / threads;
+        if (size < chunk) {
+          size = chunk;
+        }
+        if (size > count - start) {
+          size = count - start;
+        }
+        unsigned long found = atomic::compare_and_swap (&share->next, start, start + size);
+        if (found == start) {
+          break;
+        }
+        start = found;
+      }
+      break;
+
+    default:
+      start = atomic::fetch_and_add (&share->next, chunk);
+      if (start >= count) {
+        return false;
+      }
+      size = (count - start < chunk) ? count - start : chunk;
+      break;
+    }
+
+    *from = start;
+    *to = start + size;
+    return true;
+  }
+
+  /// @brief Wait until the chunk starting at from may run its ordered
+  /// sections.
+  void waitTurn (struct ompshare * share, unsigned long from) {
+    while (true) {
+      unsigned long moves = share->moves;
+      if (share->turn == from) {
+        return;
+      }
+      xfutex::futex (&share->moves, FUTEX_WAIT, (int) moves);
+    }
+  }
+
+  /// @brief Hand the turn on to the chunk after the one held, once it is
+  /// ours.
+  void passTurn (void) {
+    if (!_state.holding) {
+      return;
+    }
+    struct ompshare * share = _state.share;
+    waitTurn (share, _state.from);
+    atomic::atomic_set (&share->turn, _state.to);
+    atomic::increment (&share->moves);
+    xfutex::futex (&share->moves, FUTEX_WAKE, INT_MAX);
+    _state.holding = false;
+  }
+
+  struct ompteam * _team;
+  struct ompsync * _sync;
+
+  /// This thread's place in its team, and the master's outside of it.
+  struct ompstate _state;
+  struct ompstate _outer;
+
+  /// The work share of constructs outside of any region.
+  struct ompshare _idle;
+
+  /// The stack the master runs its share on, and the contexts it
+  /// switches between.
+  char * _stack;
+  ucontext_t _masterContext;
+  ucontext_t _teamContext;
+
+  /// The frames shared with the team, and the master's view of them.
+  char * _lo;
+  size_t _size;
+  char * _view;
+
+  void * _members[xdefines::OMP_THREADS];
+};
+
+#endif
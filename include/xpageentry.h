@@ -13,13 +13,15 @@
 
 #include "xdefines.h"
 #include "xpageinfo.h"
+#include "mm.h"
+#include "stats.h"
 
 
 /* This class is used to manage the page entries.
  * Page fault handler will ask for one page entry here.
- * Normally, we will keep 256 pages entries. If the page entry 
- * is not enough, then we can allocate 64 more, but those will be
- * freed in atomicEnd() to avoid unnecessary memory blowup.
+ * Entries and their twin pages come in chunks of PAGE_ENTRY_NUM. When a
+ * transaction dirties more pages than we have, another chunk is mapped
+ * and kept for later transactions; the twins are backed by huge pages.
  * Since one process will have one own copy of this and it is served
  * for one process only, memory can be allocated from private heap.
  */
@@ -29,12 +31,15 @@ class xpageentry {
 #else
 	enum {PAGE_ENTRY_NUM = 5120 };
 #endif
+	// Enough chunks for 400 GB (detect) or 20 GB (protect) of dirty pages.
+	enum {MAX_CHUNKS = 1024 };
 public:
 	xpageentry()
 	{
-		_start = NULL;
+		_chunks = 0;
 		_cur = 0;
         _total = 0;
+        _peak = 0;
 	}
 
 	static xpageentry& getInstance (void) {
@@ -44,71 +49,82 @@ public:
     }
 
 	void initialize(void) {
-		void * start;
-        struct pageinfo * cur;
-        int i = 0;
-        unsigned long pagestart;
-
-		// We don't need to allocate all pages, only the difference between newnum and oldnum.
-		start = mmap (NULL,
-         			  PAGE_ENTRY_NUM * sizeof(pageinfo),
-         			  PROT_READ | PROT_WRITE,
-         			  MAP_PRIVATE | MAP_ANONYMOUS,
-         			  -1,
-         			  0);
-         pagestart = (unsigned long)mmap (NULL,
-         			 xdefines::PageSize * PAGE_ENTRY_NUM,
-         			 PROT_READ | PROT_WRITE,
-         			 MAP_PRIVATE | MAP_ANONYMOUS,
-         			 -1,
-         			 0);
-
-		if(start == NULL || pagestart == 0)  {
+		_cur = 0;
+		_peak = 0;
+		if(!grow()) {
 			fprintf(stderr, "%d fail to allocate page entries : %s\n", getpid(), strerror(errno));
 			::abort();
 		}
-		
-		// start to initialize it.
-        cur = (struct pageinfo *)start;
-        i = 0;
-        while(i < PAGE_ENTRY_NUM) {
-            cur->origTwinPage = (void *)(pagestart + i * xdefines::PageSize);
-            cur++;
-            i++;
-        }
-
-		_cur = 0;
-		_total = PAGE_ENTRY_NUM;
-		_start = (struct pageinfo *)start;
-		return;
 	}
 
 	struct pageinfo * alloc(void) {
-		struct pageinfo * entry = NULL;
-		if(_cur < _total) {
-			entry = &_start[_cur];
-			_cur++;
-		}
- 		else {
-			// There is no enough entry now, re-allocate new entries now.
-			fprintf(stderr, "NO enough page entry, now _cur %x, _total %x!!!\n", _cur, _total);
+		if(_cur == _total && !grow()) {
+			fprintf(stderr, "%d : NO more page entries, _cur %x, _total %x: %s\n", getpid(), _cur, _total, strerror(errno));
 			::abort();
 		}
+
+		struct pageinfo * entry = &_start[_cur / PAGE_ENTRY_NUM][_cur % PAGE_ENTRY_NUM];
+		_cur++;
 		return entry;
     }
 
 	void cleanup(void) {
+		if(_cur > _peak) {
+			_peak = _cur;
+			stats::getInstance().updatePoolPeak(stats::PAGE_ENTRY_POOL, _peak);
+		}
 		_cur = 0;
 	}
 
+	static unsigned long chunkSize(void) {
+		return PAGE_ENTRY_NUM;
+	}
+
 private:
+	// Map one more chunk of entries and twin pages.
+	// This may run in the fault handler, so it only makes system calls.
+	bool grow(void) {
+		if(_chunks == MAX_CHUNKS) {
+			return false;
+		}
+
+		void * start = MM::allocatePrivate(PAGE_ENTRY_NUM * sizeof(pageinfo));
+		if(start == MAP_FAILED) {
+			return false;
+		}
+
+		// Twins are compared word by word against the working copy when
+		// committing, so fewer TLB misses there pay off.
+		void * twins = MM::allocatePrivateHuge(xdefines::PageSize * PAGE_ENTRY_NUM);
+		if(twins == MAP_FAILED) {
+			MM::deallocate(start, PAGE_ENTRY_NUM * sizeof(pageinfo));
+			return false;
+		}
+
+        struct pageinfo * cur = (struct pageinfo *)start;
+        unsigned long pagestart = (unsigned long)twins;
+        for(int i = 0; i < PAGE_ENTRY_NUM; i++) {
+            cur->origTwinPage = (void *)(pagestart + i * xdefines::PageSize);
+            cur++;
+        }
+
+		_start[_chunks++] = (struct pageinfo *)start;
+		_total += PAGE_ENTRY_NUM;
+		return true;
+	}
+
 	// How many entries in total.
 	int _total;
 
 	// Current index of entry that need to be allocated.
 	int _cur;
-	
-	struct pageinfo * _start;
+
+	// The most entries this process has used in one transaction.
+	int _peak;
+
+	// Chunks mapped so far.
+	int _chunks;
+	struct pageinfo * _start[MAX_CHUNKS];
 };
 
 #endif
@@ -28,6 +28,20 @@ struct pageinfo {
   bool shared;
   bool alloced;
   bool hasTwinPage;
+
+  // A predicted page was twinned before any write to it was seen; its
+  // commit finds out whether it was written at all.
+  bool predicted;
+  bool written;
+
+  // Sheriff-Protect: the page was merged into the shared page.
+  bool committed;
+
+  // Sheriff-Detect: a checked shared page is write-protected again until
+  // its next write; dirtyLines has a bit per cache line that any check
+  // has seen changed.
+  bool armed;
+  unsigned long long dirtyLines;
 };
 
 #endif /* SHERIFF_PAGEINFO_H */
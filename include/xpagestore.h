@@ -14,6 +14,8 @@
 
 #include "xplock.h"
 #include "xdefines.h"
+#include "mm.h"
+#include "stats.h"
 
 
 class xpagestore {
@@ -23,13 +25,20 @@ class xpagestore {
   // kernel can't reserve the memory usage for stack. Then the memory
   // returned by this may overlapped with the stack memory. Then there
   // are a lot of strange problems.
-  
-  enum { INITIAL_PAGESTORE_PAGES = 20000 };
+  //
+  // So pages come in chunks of this many, and more chunks are mapped
+  // only when a transaction needs them.
+  enum { PAGESTORE_CHUNK_PAGES = 20480 };
+
+  // Enough chunks for 80 GB of pages.
+  enum { MAX_CHUNKS = 1024 };
 
 public:
   xpagestore()
     : _cur (0),
-      _start (NULL)
+      _total (0),
+      _peak (0),
+      _chunks (0)
   { }
 
   static xpagestore& getInstance (void) {
@@ -39,49 +48,71 @@ public:
   }
 
   void initialize(void) {
-    _start = mmap (NULL,
-		   xdefines::PageSize * INITIAL_PAGESTORE_PAGES,
-		   PROT_READ | PROT_WRITE,
-		   MAP_PRIVATE | MAP_ANONYMOUS,
-		   -1,
-		   0);
-    
-    if (_start == MAP_FAILED)  {
+    _cur = 0;
+    _peak = 0;
+    if (!grow()) {
       fprintf(stderr, "%d failed to initialize page store: %s\n", getpid(), strerror(errno));
       ::abort();
     }
-    
-    _cur = 0;
-    _total = INITIAL_PAGESTORE_PAGES;
   }
 
   void * alloc() {
-    void * pageStart;
-    
-    if (_cur < _total) {
-      pageStart = (void *)((intptr_t)_start + _cur * xdefines::PageSize);
-      _cur++;
-    } else {
-      // There are not enough entries now; re-allocate new entries now.
-
-      // EDB: This seems broken. FIX ME.
-      fprintf (stderr, "%d: NOT enough pages in page store, _cur %x _total %x!!!\n", getpid(), _cur, _total);
+    if (_cur == _total && !grow()) {
+      fprintf (stderr, "%d: NO more pages in page store, _cur %x _total %x: %s\n",
+               getpid(), _cur, _total, strerror(errno));
+      ::abort();
     }
+
+    void * pageStart = _start[_cur / PAGESTORE_CHUNK_PAGES]
+                       + (_cur % PAGESTORE_CHUNK_PAGES) * xdefines::PageSize;
+    _cur++;
     return pageStart;
   }
 
   void cleanup() {
     //fprintf(stderr, "%d : cleaning up _cur\n", getpid());
+    if (_cur > _peak) {
+      _peak = _cur;
+      stats::getInstance().updatePoolPeak(stats::PAGE_STORE_POOL, _peak);
+    }
     _cur = 0;
   }
+
+  static unsigned long chunkSize(void) {
+    return PAGESTORE_CHUNK_PAGES;
+  }
   
 private:
 
+  // Map one more chunk of pages, backed by huge pages: word changes and
+  // temporary twins are scanned whole when committing.
+  // This may run in the fault handler, so it only makes system calls.
+  bool grow(void) {
+    if (_chunks == MAX_CHUNKS) {
+      return false;
+    }
+
+    void * start = MM::allocatePrivateHuge (xdefines::PageSize * PAGESTORE_CHUNK_PAGES);
+    if (start == MAP_FAILED) {
+      return false;
+    }
+
+    _start[_chunks++] = (char *)start;
+    _total += PAGESTORE_CHUNK_PAGES;
+    return true;
+  }
+
   // Current index of entry that need to be allocated.
   int _cur;
 
   int _total;
-  void *_start;
+
+  // The most pages this process has used in one transaction.
+  int _peak;
+
+  // Chunks mapped so far.
+  int _chunks;
+  char * _start[MAX_CHUNKS];
 };
 
 #endif
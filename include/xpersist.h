@@ -20,7 +20,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <xmmintrin.h>
 
 #include "atomic.h"
 #include "ansiwrapper.h"
@@ -32,6 +31,8 @@
 #include "xdefines.h"
 #include "xpageentry.h"
 #include "xpagestore.h"
+#include "xdirtypages.h"
+#include "pagediff.h"
 
 #ifdef GET_CHARACTERISTICS
 #include "xpageprof.h"
@@ -42,6 +43,15 @@
 #include "xheapcleanup.h"
 #include "stats.h"
 
+#ifdef SOFT_DIRTY_DETECTION
+#include <sched.h>
+#include "xsoftdirty.h"
+#endif
+
+#ifdef IO_URING_BATCHING
+#include "xuring.h"
+#endif
+
 #if defined(sun)
 extern "C" int madvise(caddr_t addr, size_t len, int advice);
 #endif
@@ -56,11 +66,8 @@ template <class Type,
    unsigned long NElts = 1>
 class xpersist {
 public:
-  typedef std::pair<int, void *> objType;
-  typedef HL::STLAllocator<objType, privateheap> dirtyListTypeAllocator;
-  typedef std::less<int> localComparator;
-  /// A map of pointers to objects and their allocated sizes.
-  typedef std::map<int, void *, localComparator, dirtyListTypeAllocator> dirtyListType;
+  /// The dirty pages of this process, by page number.
+  typedef xdirtypages<NElts * sizeof(Type) / xdefines::PageSize> dirtyListType;
 
   /// @arg startaddr  the optional starting address of local memory.
   /// @arg startsize  the optional size of local memory.
@@ -77,24 +84,12 @@ public:
       }
     }
     
-    // Get a temporary file name (which had better not be NFS-mounted...).
-    char _backingFname[L_tmpnam];
-    sprintf (_backingFname, "/tmp/sheriff-backing-XXXXXX");
-    _backingFd = mkstemp (_backingFname);
+    _backingFd = MM::createBackingFile ("sheriff-backing", NElts * sizeof(Type));
     if (_backingFd == -1) {
-      fprintf (stderr, "Failed to make persistent file.\n");
-      ::abort();
-    }
-
-    // Set the files to the sizes of the desired object.
-    if (ftruncate (_backingFd,  NElts * sizeof(Type))) { 
-      fprintf (stderr, "Mysterious error with ftruncate.\n");
+      fprintf (stderr, "Failed to make persistent file: %s\n", strerror(errno));
       ::abort();
     }
 
-    // Get rid of the files when we exit.
-    unlink (_backingFname);
-
     //
     // Establish two maps to the backing file.
     //
@@ -107,6 +102,12 @@ public:
       ::abort();
     }
 
+#if defined(HUGEPAGE_BACKING) && defined(MADV_HUGEPAGE)
+    // Let the shared pages come in 2 MB folios; writes through this map
+    // (commits) allocate them. Private copies stay in 4 KB pages.
+    madvise (_persistentMemory, NElts * sizeof(Type), MADV_HUGEPAGE);
+#endif
+
     // If we specified a start address (globals), copy the contents into the
     // persistent area now because the transient memory map is going
     // to squash it.
@@ -125,6 +126,15 @@ public:
       = (Type *) MM::allocateShared (NElts * sizeof(Type), _backingFd, startaddr);
 
     _isProtected = false;
+    _refreshCalls = 0;
+#ifdef IO_URING_BATCHING
+    _uringBatching = false;
+#endif
+#ifdef POPULATE_REFRESH
+    _dropStamps = (unsigned int *)
+      MM::allocatePrivate (TotalPageNums * sizeof(unsigned int));
+    _dropRounds = 0;
+#endif
   
 #ifndef NDEBUG
     fprintf (stderr, "transient = %p, persistent = %p, size = %lx\n", _transientMemory, _persistentMemory, NElts * sizeof(Type));
@@ -161,11 +171,16 @@ public:
 	                (void *)_cacheInvalidates, (void *)_cacheLastthread, (void *)_wordChanges);
     }
 
-#ifdef SSE_SUPPORT
-    // A string of one bits.
-    allones = _mm_setzero_si128();
-    allones = _mm_cmpeq_epi32(allones, allones);
-#endif 
+#ifdef SOFT_DIRTY_DETECTION
+    // One twin per page for all threads, so that every change is only
+    // counted once, by the first writer of the page that scans it.
+    _scanTwins = (Type *)
+      MM::allocateShared (NElts * sizeof(Type));
+    _scanLocks = (unsigned long *)
+      MM::allocateShared (TotalPageNums * sizeof(unsigned long));
+    _softDirty = false;
+    _heapEnd = NULL;
+#endif
   }
 
   virtual ~xpersist (void) {
@@ -332,11 +347,26 @@ public:
 
   // We set the attribute to Private and Readable
   void openProtection (void) {
+#ifdef SOFT_DIRTY_DETECTION
+    // Leave the memory shared and sample writes from the soft-dirty bits.
+    if(xsoftdirty::getInstance().available()) {
+      startScanning();
+      _isProtected = true;
+      return;
+    }
+#endif
     mmapRdPrivate(base(), size());
     _isProtected = true;
   }
 
   void closeProtection(void) {
+#ifdef SOFT_DIRTY_DETECTION
+    if(_softDirty) {
+      _softDirty = false;
+      _isProtected = false;
+      return;
+    }
+#endif
     mmapRwShared(base(), size());
     _isProtected = false;
   }
@@ -381,6 +411,13 @@ public:
     return true;
   }
 
+  /// @brief Hand the memory of whole pages of a freed range back to
+  /// the system; they read as zeros afterwards.
+  void releasePages (void * start, size_t sz) {
+    size_t offset = (intptr_t)start - (intptr_t)base();
+    MM::punchHole (_backingFd, offset, sz);
+  }
+
   /// @return true iff the address is in this space.
   inline bool inRange (void * addr) {
     if (((size_t) addr >= (size_t) base())
@@ -405,14 +442,8 @@ public:
   }
 
   inline void addPageEntry(int pageNo, struct pageinfo * curPage, dirtyListType * pageList) {
-    pair<dirtyListType::iterator, bool> it;
-      
-    it = pageList->insert(pair<int, void *>(pageNo, curPage));
-    if(it.second == false) {
-      // The element is existing in the list now.
-      memcpy((void *)it.first->second, curPage, sizeof(struct pageinfo));
-    }
-    return;                                                                       
+    // An existing entry of this page is overwritten in place.
+    pageList->insert(pageNo, curPage);
   }
 
   /// @brief Handle the write operation on a page.
@@ -428,12 +459,23 @@ public:
     int pageNo = computePage ((size_t) addr - (size_t) base());
 
     //printf("handlePAGEWRITE: addr %p pageNO %d\n", addr, pageNo);
+
+    // A shared page re-armed by the last check already has its twins;
+    // the next check only has to look at it again.
+    // The timer is blocked in here, so it can not re-arm the page before
+    // armed is cleared.
+    if (_privatePagesList.contains(pageNo)) {
+      _privatePagesList.get(pageNo)->armed = false;
+      return;
+    }
  
     // Get an entry from page store.
     struct pageinfo * curPage = xpageentry::getInstance().alloc();
     curPage->pageNo = pageNo;
     curPage->pageStart = (void *)pageStart;
     curPage->alloced = false;
+    curPage->armed = false;
+    curPage->dirtyLines = 0;
 
     // Force the copy-on-write of kernel by writing to this address directly
     // Using assemly language here to avoid the code to be optimized.
@@ -487,9 +529,20 @@ public:
     int pageNo;
     bool createTempPage = false;
 
-    for (dirtyListType::iterator i = _privatePagesList.begin(); i != _privatePagesList.end(); i++) {
-      pageinfo = (struct pageinfo *)i->second;
-      pageNo = pageinfo->pageNo;
+    // Runs of checked pages to write-protect again.
+    void * armStart = NULL;
+    int    armPages = 0;
+    int    lastArmed = -2;
+
+#ifdef SOFT_DIRTY_DETECTION
+    if(_softDirty) {
+      scanDirtyPages();
+      return;
+    }
+#endif
+
+    for (pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      pageinfo = _privatePagesList.get(pageNo);
 
       // If the original page is not shared, now we can check again.
       if(pageinfo->shared != true) {
@@ -519,10 +572,31 @@ public:
           memcpy(pageinfo->tempTwinPage, pageinfo->origTwinPage, xdefines::PageSize);
         }
 
+        // Not written since the last check: nothing can have changed.
+        if(pageinfo->armed) {
+          continue;
+        }
+
         // We will try to record changes for those shared pages
         recordChangesAndUpdate(pageinfo);
+
+        // Catch the next write to this page with a fault again.
+        pageinfo->armed = true;
+        if(pageNo != lastArmed + 1) {
+          if(armPages > 0) {
+            mprotect(armStart, armPages * xdefines::PageSize, PROT_READ);
+          }
+          armStart = pageinfo->pageStart;
+          armPages = 0;
+        }
+        armPages++;
+        lastArmed = pageNo;
       }
     }
+
+    if(armPages > 0) {
+      mprotect(armStart, armPages * xdefines::PageSize, PROT_READ);
+    }
   }
 
   inline int recordCacheInvalidates(int pageNo, int cacheNo) {
@@ -555,39 +629,30 @@ public:
       
     int * twin = (int *)pageinfo->tempTwinPage;
     
-    int * wordChanges;
-    int interWrites = 0;
-    wordChanges = (int *)pageinfo->wordChanges;
+    int * wordChanges = (int *)pageinfo->wordChanges;
   
-    // We will check those modifications by comparing "local" and "twin".
-    int cacheNo;
-    int startCacheNo = pageinfo->pageNo*xdefines::CACHES_PER_PAGE;
-    int recordedCacheNo = 0xFFFFFF00;
-
-    for(int i = 0; i < xdefines::PageSize/sizeof(int); i++) {
-      if(local[i] != twin[i]) {
-        int lastTid;
-    
-     //   fprintf(stderr, "%d: difference at %p. Local %x twin %x\n", getpid(), &local[i], local[i], twin[i]);
-        // Calculate the cache number for current words.  
-        cacheNo = calcCacheNo(i);
-        
-        // We will update corresponding cache invalidates.
-        if(cacheNo != recordedCacheNo) {
-          //printf("%d: now recordCacheInvalidates pageNo %d cacheNo %d. Address %p\n", getpid(), pageinfo->pageNo, cacheNo, &local[i]);
-//          fprintf(stderr, "%d: now recordCacheInvalidates pageNo %d cacheNo %d. Address %p\n", getpid(), pageinfo->pageNo, cacheNo, &local[i]);
-          recordCacheInvalidates(pageinfo->pageNo, 
-                       pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
-          recordedCacheNo = cacheNo;
-        }
-        
-        // Update words on twin page if we are comparing against temporary twin page.
-        // We can't update the original twin page!!! That is a bug.
-        twin[i] = local[i];
+    // We will check those modifications by comparing "local" and "twin",
+    // but only inside those cache lines that actually changed.
+    unsigned long long lines = pagediff::getInstance().diffLines(local, twin);
+    pageinfo->dirtyLines |= lines;
+
+    while(lines) {
+      int cacheNo = pagediff::nextLine(lines);
+
+      // We will update corresponding cache invalidates.
+      recordCacheInvalidates(pageinfo->pageNo, 
+                   pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
+
+      for(int i = cacheNo * IntsPerLine; i < (cacheNo + 1) * IntsPerLine; i++) {
+        if(local[i] != twin[i]) {
+          // Update words on twin page if we are comparing against temporary twin page.
+          // We can't update the original twin page!!! That is a bug.
+          twin[i] = local[i];
        
-        // Record changes for words in this cache line.
-        wordChanges[i]++; 
-      }   
+          // Record changes for words in this cache line.
+          wordChanges[i]++; 
+        }
+      }
     }
   }
 
@@ -599,42 +664,7 @@ public:
   // Use vectorization to improve the performance if we can.
   inline void commitPageDiffs (const void * local, const void * twin, int pageNo) {
     void * dest = (void *)((intptr_t)_persistentMemory + xdefines::PageSize * pageNo);
-  #ifdef SSE_SUPPORT
-    __m128i * localbuf = (__m128i *) local;
-    __m128i * twinbuf  = (__m128i *) twin;
-    __m128i * destbuf  = (__m128i *) dest;
-    for (int i = 0; i < xdefines::PageSize / sizeof(__m128i); i++) {
-  
-      __m128i localChunk, twinChunk, destChunk;
-  
-      localChunk = _mm_load_si128 (&localbuf[i]);
-      twinChunk  = _mm_load_si128 (&twinbuf[i]);
-  
-      // Compare the local and twin byte-wise.
-      __m128i eqChunk = _mm_cmpeq_epi8 (localChunk, twinChunk);
-  
-      // Invert the bits by XORing them with ones.
-      __m128i neqChunk = _mm_xor_si128 (allones, eqChunk);
-  
-      // Write local pieces into destbuf everywhere diffs.
-      _mm_maskmoveu_si128 (localChunk, neqChunk, (char *) &destbuf[i]);
-    }
-  #else
-    /* If hardware can't support SSE3 instructions, use slow commits as following. */
-    unsigned long * mylocal = (unsigned long *)local;
-    unsigned long * mytwin = (unsigned long *)twin;
-    unsigned long * mydest = (unsigned long *)dest;
-
-    for(int i = 0; i < xdefines::PageSize/sizeof(unsigned long); i++) {
-      if(mylocal[i] != mytwin[i]) {
-          //if(mytwin[i] != mydest[i] && mylocal[i] != mydest[i])
-          //fprintf(stderr, "%d: RACE at %p from %x to %x (dest %x). pageno %d\n", getpid(), &mylocal[i], mytwin[i], mylocal[i], mydest[i], pageno);
-    //    mydest[i] = mylocal[i];
-        checkCommitWord(mylocal, mytwin, mydest);
-      }
-    }
-
-  #endif
+    pagediff::getInstance().commit(local, twin, dest);
   }
 
   inline void checkCommitWord(char * local, char * twin, char * share) {
@@ -684,50 +714,53 @@ public:
     int * localChanges = (int *) pageinfo->wordChanges;
     // Here we assume sizeof(unsigned long) == 2 * sizeof(unsigned short);
     int * globalChanges = (int *)((intptr_t)_wordChanges + xdefines::PageSize * pageinfo->pageNo);
-    unsigned long recordedCacheNo = 0xFFFFFF00;
-    unsigned long cacheNo;
-    unsigned long interWrites = 0;
+
+    // Only those cache lines with some changes or with some recorded word
+    // changes (ABA changes) need to be checked. The checks have seen all
+    // of them but the ones written since the last check, if any.
+    unsigned long long lines = pageinfo->dirtyLines;
+    if(!pageinfo->armed) {
+      lines |= pagediff::getInstance().diffLines(local, tempTwin);
+    }
 
     //fprintf(stderr, "%d: pageStart %p twin %p\n", getpid(), local, twin);
     // Now we have the temporary twin page and original twin page.
     // We always commit those changes against the original twin page.
     // But we need to capture the changes since last period by checking against 
     // the temporary twin page.  
-    for (int i = 0; i < xdefines::PageSize/sizeof(int); i++) {
-      if(local[i] == twin[i]) {
-        if(localChanges[i] != 0) {
-          //fprintf(stderr, "detect the ABA changes %d, local %x temptwin %x\n", localChanges[i], local[i], tempTwin[i]);
-          recordWordChanges((void *)&globalChanges[i], localChanges[i]);
+    while(lines) {
+      int cacheNo = pagediff::nextLine(lines);
+      bool recorded = false;
+
+      for (int i = cacheNo * IntsPerLine; i < (cacheNo + 1) * IntsPerLine; i++) {
+        if(local[i] == twin[i]) {
+          if(localChanges[i] != 0) {
+            //fprintf(stderr, "detect the ABA changes %d, local %x temptwin %x\n", localChanges[i], local[i], tempTwin[i]);
+            recordWordChanges((void *)&globalChanges[i], localChanges[i]);
+          }
+          // It is very unlikely that we have ABA changes, so we don't check
+          // against temporary twin page now.
+          continue;
         }
-        // It is very unlikely that we have ABA changes, so we don't check
-        // against temporary twin page now.
-        continue;
-      }
-      unsigned long wordAddr = (intptr_t)&local[i];
-
-      // Now there are some changes, at least we must commit the word.
-      if(local[i] != tempTwin[i]) {
-        // Calculate the cache number for current words.    
-        cacheNo = calcCacheNo(i);
-
-        // We will update corresponding cache invalidates.
-        if(cacheNo != recordedCacheNo) {
-          recordCacheInvalidates(pageinfo->pageNo, 
-                          pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
 
-          recordedCacheNo = cacheNo;
-        }
+        // Now there are some changes, at least we must commit the word.
+        if(local[i] != tempTwin[i]) {
+          // We will update corresponding cache invalidates.
+          if(!recorded) {
+            recordCacheInvalidates(pageinfo->pageNo, 
+                            pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
+            recorded = true;
+          }
        
-    //    fprintf(stderr, "Check and commit changes at %p, with localChanges %d, now changed too\n", &local[i], localChanges[i]);
-        recordWordChanges((void *)&globalChanges[i], localChanges[i] + 1);
-      }
-      else {
-     //   fprintf(stderr, "%d: Check and commit changes at %p, with localChanges %d\n", getpid(), &local[i], localChanges[i]);
-        recordWordChanges((void *)&globalChanges[i], localChanges[i]);
-      }
+          recordWordChanges((void *)&globalChanges[i], localChanges[i] + 1);
+        }
+        else {
+          recordWordChanges((void *)&globalChanges[i], localChanges[i]);
+        }
 
-      // Now we are doing a byte-by-byte based commit
-      checkCommitWord((char *)&local[i], (char *)&twin[i], (char *)&share[i]);
+        // Now we are doing a byte-by-byte based commit
+        checkCommitWord((char *)&local[i], (char *)&twin[i], (char *)&share[i]);
+      }
     }
   }
 
@@ -750,20 +783,25 @@ public:
     int    pageNo;
     void * batchedStart = NULL;
     int    batchedPages = 0;
+
+    _refreshCalls = 0;
+#ifdef IO_URING_BATCHING
+    _uringBatching = xuring::getInstance().available();
+#endif
     
     // We are setting lastpage to a impossible page no at first.
     unsigned int lastpage = 0xFFFFFF00;
     struct pageinfo * pageinfo;
 
     // Check every pages in the private pages list.
-    for (dirtyListType::iterator i = _privatePagesList.begin(); i != _privatePagesList.end(); ++i) {
-      pageNo = i->first;
-      pageinfo = (struct pageinfo *)i->second;
+    for (pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      pageinfo = _privatePagesList.get(pageNo);
     
     //  fprintf(stderr, "Inside the loop with pageNo %d\n", pageNo); 
       // Check whether current page is continuous with previous page. 
       if(pageNo == lastpage + 1) {
         batchedPages++;
+        lastpage = pageNo;
       }
       else {
         if(batchedPages > 0) {
@@ -785,6 +823,20 @@ public:
       updateBatchedPages(batchedPages, batchedStart);
     }
 
+#ifdef IO_URING_BATCHING
+    // The pages to drop were only queued so far.
+    if(_uringBatching) {
+      xuring::getInstance().submit();
+      _refreshCalls += xuring::getInstance().takeEnters();
+    }
+#endif
+#ifdef POPULATE_REFRESH
+    populateDropped();
+#endif
+#ifdef SHERIFF_COUNTERS
+    stats::getInstance().updateRefreshes(_refreshCalls);
+#endif
+
     //fprintf(stderr, "COMMIT-BEGIN at process %d\n", getpid());
     // Now we already finish the commit, let's cleanup the list. 
     // For every transaction, we will restart to capture those writeset
@@ -797,6 +849,14 @@ public:
 
   // Commit those pages in the end of each transaction. 
   inline void commit(bool doChecking) {
+#ifdef SOFT_DIRTY_DETECTION
+    // Nothing to commit, the memory is shared: just account the writes.
+    if(_softDirty) {
+      scanDirtyPages();
+      return;
+    }
+#endif
+
     // Don't need to commit a page if no pages in the writeset.
     if(_privatePagesList.size() == 0) {
       return;
@@ -806,9 +866,8 @@ public:
     struct pageinfo * pageinfo = NULL;
     int    pageNo;
     // Check every pages in the private pages list.
-    for (dirtyListType::iterator i = _privatePagesList.begin(); i != _privatePagesList.end(); ++i) {
-      pageinfo = (struct pageinfo *)i->second;
-      pageNo = pageinfo->pageNo;
+    for (pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      pageinfo = _privatePagesList.get(pageNo);
  
      // fprintf(stderr, "COMMIT: %d on page %d (at %p) on heap %d\n", getpid(), pageNo, pageinfo->pageStart, _isHeap);
  
@@ -832,20 +891,160 @@ public:
     atomic::memoryBarrier();
   }
 
+#ifdef SOFT_DIRTY_DETECTION
+  /// @brief Only scan the heap up to its bump pointer.
+  void setHeapEnd(char ** end) {
+    _heapEnd = end;
+  }
+
+  /// @brief Take the twins of everything written so far and start sampling.
+  void startScanning(void) {
+    int pages = scannedPages();
+
+    for(int pageNo = 0; pageNo < pages; ) {
+      void * start = (void *)((intptr_t)base() + pageNo * xdefines::PageSize);
+      int entries = xsoftdirty::getInstance().read(start, pages - pageNo);
+      if(entries == 0) {
+        break;
+      }
+
+      // Pages that were never mapped here are still zero, like the twins.
+      const uint64_t * entry = xsoftdirty::getInstance().entries();
+      for(int i = 0; i < entries; i++) {
+        if(xsoftdirty::isPresent(entry[i])) {
+          memcpy(scanTwin(pageNo + i), (void *)((intptr_t)start + i * xdefines::PageSize), xdefines::PageSize);
+        }
+      }
+      pageNo += entries;
+    }
+
+    _softDirty = true;
+  }
+
+  /// @brief Account the changes on every page written since the last scan.
+  /// The caller clears the soft-dirty bits once all regions are scanned.
+  void scanDirtyPages(void) {
+    int pages = scannedPages();
+
+    for(int pageNo = 0; pageNo < pages; ) {
+      void * start = (void *)((intptr_t)base() + pageNo * xdefines::PageSize);
+      int entries = xsoftdirty::getInstance().read(start, pages - pageNo);
+      if(entries == 0) {
+        break;
+      }
+
+      const uint64_t * entry = xsoftdirty::getInstance().entries();
+      for(int i = 0; i < entries; i++) {
+        if(xsoftdirty::isDirty(entry[i])) {
+          recordScannedPage(pageNo + i);
+        }
+      }
+      pageNo += entries;
+    }
+  }
+#endif
+
 private:
 
+#ifdef SOFT_DIRTY_DETECTION
+  inline int scannedPages(void) {
+    size_t used = _heapEnd ? (size_t)(*_heapEnd - (char *)base()) : size();
+    return (used + xdefines::PageSize - 1) / xdefines::PageSize;
+  }
+
+  inline int * scanTwin(int pageNo) {
+    return (int *)((intptr_t)_scanTwins + xdefines::PageSize * pageNo);
+  }
+
+  // Compare a written page with the shared twin, record the changed cache
+  // lines and words as ours and bring the twin up to date. If another
+  // thread wrote the page in the same interval and scans it later, it only
+  // sees what changed since. The page lock is taken in the SIGALRM
+  // handler, so the commit holds that signal off while it scans.
+  inline void recordScannedPage(int pageNo) {
+    int * local = (int *)((intptr_t)base() + xdefines::PageSize * pageNo);
+    int * twin = scanTwin(pageNo);
+    int * globalChanges = (int *)((intptr_t)_wordChanges + xdefines::PageSize * pageNo);
+
+    while(atomic::exchange(&_scanLocks[pageNo], 1) != 0) {
+      sched_yield();
+    }
+
+    unsigned long long lines = pagediff::getInstance().diffLines(local, twin);
+    while(lines) {
+      int cacheNo = pagediff::nextLine(lines);
+
+      recordCacheInvalidates(pageNo, pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
+
+      for(int i = cacheNo * IntsPerLine; i < (cacheNo + 1) * IntsPerLine; i++) {
+        int value = local[i];
+        if(value != twin[i]) {
+          twin[i] = value;
+          recordWordChanges((void *)&globalChanges[i], 1);
+        }
+      }
+    }
+
+    atomic::atomic_set(&_scanLocks[pageNo], 0);
+  }
+#endif
+
   //inline int computePage (int index) {
   inline int computePage (size_t index) {
     return (index * sizeof(Type)) / xdefines::PageSize;
   }
 
+#ifdef POPULATE_REFRESH
+  /// @brief Map the dropped pages expected to be read again in, a run at
+  /// a time, before those reads fault them in one by one. A page this thread
+  /// dirtied in one of the last few transactions as well is in its working set.
+  void populateDropped (void) {
+    void * runStart = NULL;
+    int runPages = 0;
+
+    _dropRounds++;
+    for (int pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      bool predicted = (_dropStamps[pageNo] != 0
+                        && _dropRounds - _dropStamps[pageNo] <= xdefines::POPULATE_TRANSACTIONS);
+      _dropStamps[pageNo] = _dropRounds;
+      if(!predicted) {
+        continue;
+      }
+
+      void * pageStart = _privatePagesList.get(pageNo)->pageStart;
+      if(runPages > 0 && pageStart == (void *)((intptr_t)runStart + runPages * xdefines::PageSize)) {
+        runPages++;
+        continue;
+      }
+      if(runPages > 0) {
+        _refreshCalls += MM::populateRead(runStart, runPages * xdefines::PageSize);
+      }
+      runStart = pageStart;
+      runPages = 1;
+    }
+    if(runPages > 0) {
+      _refreshCalls += MM::populateRead(runStart, runPages * xdefines::PageSize);
+    }
+  }
+#endif
+
   /// @brief Update the given page frame from the backing file.
+  /// With an io_uring, dropping the contents waits for the end of updateAll().
   void updatePages (void * local, int size) {
+#ifdef IO_URING_BATCHING
+    if(_uringBatching) {
+      xuring::getInstance().madvise(local, size, MADV_DONTNEED);
+      mprotect (local, size, PROT_READ);
+      _refreshCalls++;
+      return;
+    }
+#endif
     madvise (local, size, MADV_DONTNEED);
 
   //  fprintf(stderr, "%d: protect page %p size %d\n", getpid(), local, size);
     // Set this page to PROT_READ again.
     mprotect (local, size, PROT_READ);
+    _refreshCalls += 2;
   }
  
   /// True if current xpersist.h is a heap.
@@ -857,7 +1056,7 @@ private:
   /// The size of the region.
   size_t _startsize;
 
-  /// A map of dirtied pages.
+  /// The pages dirtied in this transaction.
   dirtyListType _privatePagesList;
 
   dirtyListType _savedPagesList;
@@ -883,17 +1082,13 @@ private:
   /// The length of the version array.
   enum { TotalPageNums = NElts * sizeof(Type)/(xdefines::PageSize) };
   enum { TotalCacheNums = NElts * sizeof(Type)/(xdefines::CACHE_LINE_SIZE) };
+  enum { IntsPerLine = xdefines::CACHE_LINE_SIZE/sizeof(int) };
 
   unsigned long * _cacheInvalidates;
 
   // Last thread to modify current cache
   unsigned long * _cacheLastthread;
 
-#if defined(SSE_SUPPORT)
-  // A string of one bits.
-  __m128i allones;
-#endif
-  
   // In order to save space, we will use the higher 16 bit to store the thread id
   // and use the lower 16 bit to store versions.
   wordchangeinfo * _wordChanges;
@@ -903,6 +1098,35 @@ private:
   // thus we don't need to pay additional physical pages on _wordChanges since
   // _wordChanges will double the physical pages's usage.
   unsigned long * _pageUsers;
+
+  /// System calls made by the current updateAll().
+  unsigned long _refreshCalls;
+
+#ifdef POPULATE_REFRESH
+  /// The updateAll() in which each page was last dropped; only the entries
+  /// of pages this process writes are ever touched.
+  unsigned int * _dropStamps;
+  unsigned int _dropRounds;
+#endif
+
+#ifdef IO_URING_BATCHING
+  /// True if this process drops pages through its io_uring.
+  bool _uringBatching;
+#endif
+
+#ifdef SOFT_DIRTY_DETECTION
+  /// True while writes are sampled from soft-dirty bits.
+  bool _softDirty;
+
+  /// What every page looked like at its last scan, shared by all threads.
+  Type * _scanTwins;
+
+  /// Serialize the scans of one page.
+  unsigned long * _scanLocks;
+
+  /// The heap's bump pointer, or NULL for the globals.
+  char ** _heapEnd;
+#endif
  
   xtracker<NElts> _tracker;
 };
@@ -10,6 +10,8 @@
 #if !defined(_WIN32)
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <sched.h>
+#include <syscall.h>
 #include <unistd.h>
 #endif
 
@@ -20,7 +22,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <xmmintrin.h>
 
 #include "atomic.h"
 #include "ansiwrapper.h"
@@ -32,16 +33,38 @@
 #include "xdefines.h"
 #include "xpageentry.h"
 #include "xpagestore.h"
+#include "xdirtypages.h"
+#include "pagediff.h"
 
 #ifdef GET_CHARACTERISTICS
 #include "xpageprof.h"
 #endif
 
+#if defined(PARALLEL_COMMIT) || defined(GET_CHARACTERISTICS)
+#include "finetime.h"
+#endif
+
+#ifdef PARALLEL_COMMIT
+#include "xcommitpool.h"
+#endif
+
+#ifdef UFFD_TRACKING
+#include "xuffd.h"
+#endif
+
+#ifdef IO_URING_BATCHING
+#include "xuring.h"
+#endif
+
+#ifdef LAZY_RELEASE
+#include "xnotices.h"
+#endif
+
+#include "stats.h"
 
 #ifdef DETECT_FALSE_SHARING_OPT
 #include "xtracker.h"
 #include "xheapcleanup.h"
-#include "stats.h"
 #endif
 
 #if defined(sun)
@@ -58,14 +81,8 @@ template <class Type,
    unsigned long NElts = 1>
 class xpersist {
 public:
-  typedef std::pair<int, void *> objType;
-  
-  typedef HL::STLAllocator<objType, privateheap> dirtyListTypeAllocator;
-
-  typedef std::less<int> localComparator;
-
-  /// A map of pointers to objects and their allocated sizes.
-  typedef std::map<int, void *, localComparator, dirtyListTypeAllocator> dirtyListType;
+  /// The dirty pages of this process, by page number.
+  typedef xdirtypages<NElts * sizeof(Type) / xdefines::PageSize> dirtyListType;
 
   enum {
     PAGE_TYPE_UPDATE = 0, 
@@ -79,7 +96,9 @@ public:
   xpersist (void * startaddr = 0, 
 	    size_t startsize = 0)
     : _startaddr (startaddr),
-      _startsize (startsize)
+      _startsize (startsize),
+      _commitPages (NULL),
+      _commitPagesSize (0)
   {
     if (_startsize > 0) {
       if (_startsize > NElts * sizeof(Type)) {
@@ -89,24 +108,12 @@ public:
       }
     }
     
-    // Get a temporary file name (which had better not be NFS-mounted...).
-    char _backingFname[L_tmpnam];
-    sprintf (_backingFname, "/tmp/sheriff-backing-XXXXXX");
-    _backingFd = mkstemp (_backingFname);
+    _backingFd = MM::createBackingFile ("sheriff-backing", NElts * sizeof(Type));
     if (_backingFd == -1) {
-      fprintf (stderr, "Failed to make persistent file.\n");
-      ::abort();
-    }
-
-    // Set the files to the sizes of the desired object.
-    if (ftruncate (_backingFd,  NElts * sizeof(Type))) { 
-      fprintf (stderr, "Mysterious error with ftruncate.\n");
+      fprintf (stderr, "Failed to make persistent file: %s\n", strerror(errno));
       ::abort();
     }
 
-    // Get rid of the files when we exit.
-    unlink (_backingFname);
-
     //
     // Establish two maps to the backing file.
     //
@@ -122,6 +129,12 @@ public:
       ::abort();
     }
 
+#if defined(HUGEPAGE_BACKING) && defined(MADV_HUGEPAGE)
+    // Let the shared pages come in 2 MB folios; writes through this map
+    // (commits) allocate them. Private copies stay in 4 KB pages.
+    madvise (_persistentMemory, NElts * sizeof(Type), MADV_HUGEPAGE);
+#endif
+
     // If we specified a start address (globals), copy the contents into the
     // persistent area now because the transient memory map is going
     // to squash it.
@@ -147,6 +160,25 @@ public:
 				     startaddr);
 
     _isProtected = false;
+    _refreshCalls = 0;
+
+#ifdef POPULATE_REFRESH
+    _dropStamps = (unsigned int *)
+      MM::allocatePrivate (TotalPageNums * sizeof(unsigned int));
+    _dropRounds = 0;
+#endif
+
+#ifdef IO_URING_BATCHING
+    _uringBatching = false;
+#endif
+
+#ifdef UFFD_TRACKING
+    // Try userfaultfd first; writeProtect() falls back to the read-only mapping.
+    _uffdTracking = true;
+    _trackingPid = 0;
+    _trackedEnd = (char *)base();
+#endif
+    _heapEnd = NULL;
   
 #ifndef NDEBUG
     //fprintf (stderr, "transient = %p, persistent = %p, size = %lx\n", _transientMemory, _persistentMemory, NElts * sizeof(Type));
@@ -154,6 +186,62 @@ public:
 
     _pageUsers = (unsigned long *)
       MM::allocateShared (TotalPageNums * sizeof(unsigned long));
+
+#ifndef DETECT_FALSE_SHARING_OPT
+    // Every commit to a page bumps its version, so that a thread can tell
+    // whether its private copy of the page is still current.
+    _pageVersions = (unsigned long *)
+      MM::allocateShared (TotalPageNums * sizeof(unsigned long));
+    _localVersions = (unsigned int *)
+      MM::allocatePrivate (TotalPageNums * sizeof(unsigned int));
+
+    _counters = (struct counters *)
+      MM::allocateShared (sizeof(struct counters));
+    _seenProtectionChanges = 0;
+    _writingPid = 0;
+    _clockTicks = 0;
+    _sharedCommits = 0;
+#ifdef LAZY_RELEASE
+    _lazyUpdate = false;
+#endif
+    _sweepNext = -1;
+    _sweepPages = 0;
+
+    // Only the entries of pages this process writes are ever touched.
+    _writeStamps = (unsigned int *)
+      MM::allocatePrivate (TotalPageNums * sizeof(unsigned int));
+    _writeStreaks = (unsigned char *)
+      MM::allocatePrivate (TotalPageNums * sizeof(unsigned char));
+    _transactions = 0;
+    _historyPid = 0;
+    _pid = syscall(SYS_getpid);
+
+    _locksHeld = 0;
+    _pageLocks = (unsigned long *)
+      MM::allocateShared (TotalPageNums * sizeof(unsigned long));
+
+    // Every page starts out isolated.
+    _isolation = (struct isolation *)
+      MM::allocateShared (TotalPageNums * sizeof(struct isolation));
+    _pageDirectWriters = (unsigned long *)
+      MM::allocateShared (TotalPageNums * sizeof(unsigned long));
+    _lastCommitters = (volatile unsigned long *)
+      MM::allocateShared (TotalPageNums * sizeof(unsigned long));
+    _cacheInvalidates = (unsigned long *)
+      MM::allocateShared (TotalCacheNums * sizeof(unsigned long));
+
+    _twinStates = (volatile unsigned char *)
+      MM::allocateShared (TotalPageNums * sizeof(unsigned char));
+
+    // Only pages saved for a thread without a twin are ever touched.
+    _savedTwins = mmap (NULL, NElts * sizeof(Type), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    _twinElision = (_savedTwins != MAP_FAILED);
+#ifdef ATOMIC_SYNC
+    _polledCount = 0;
+    _dropCopies = false;
+#endif
+#endif
       
     _cacheLastthread = (unsigned long *)
       MM::allocateShared (TotalCacheNums * sizeof(unsigned long));
@@ -199,9 +287,6 @@ public:
 	 (void *)_wordChanges);
     }
 #endif
-    // A string of one bits.
-    allones = _mm_setzero_si128();
-    allones = _mm_cmpeq_epi32(allones, allones); 
   }
 
   virtual ~xpersist (void) {
@@ -262,7 +347,16 @@ public:
 
   void sharemem_write_word(void * addr, unsigned long val) {
     unsigned long offset = (intptr_t)addr - (intptr_t)base();
+#ifndef DETECT_FALSE_SHARING_OPT
+    int pageNo = offset / xdefines::PageSize;
+    lockPage(pageNo);
+    saveElidedTwin(pageNo);
+    *((unsigned long *)((intptr_t)_persistentMemory + offset)) = val;
+    atomic::increment(&_pageVersions[pageNo]);
+    unlockPage(pageNo);
+#else
     *((unsigned long *)((intptr_t)_persistentMemory + offset)) = val;
+#endif
     return;
   }
 
@@ -347,6 +441,26 @@ public:
     void * area;
     int  offset = (intptr_t)start - (intptr_t)base();
 
+    // The pages written in place go away with the old mapping.
+    forgetSharedPages();
+
+#ifdef UFFD_TRACKING
+    // Keep the private area writable and write-protect its page table entries instead.
+    // Only touched pages need swap, so do not reserve it for the whole area.
+    if(_uffdTracking) {
+      area = (Type *) mmap (start,
+                        size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE,
+                        _backingFd,
+                        offset);
+      if(area != MAP_FAILED && armTracking()) {
+        return(area);
+      }
+      _uffdTracking = false;
+    }
+#endif
+
     // Map to readonly private area. 
     area = (Type *) mmap (start,
                       size,
@@ -367,6 +481,11 @@ public:
     void * area;
     int  offset = (intptr_t)start - (intptr_t)base();
 
+#ifdef UFFD_TRACKING
+    // The registration goes away with the private mapping.
+    _trackingPid = 0;
+#endif
+
     // Map to writable share area. 
     area = (Type *) mmap (start,
                     size,
@@ -385,11 +504,34 @@ public:
 
   void openProtection (void) {
     writeProtect(base(), size());
+#ifndef DETECT_FALSE_SHARING_OPT
+    stopWritingDirectly();
+#endif
     _detectPeriod = true;
     _isProtected = true;
   }
 
   void closeProtection(void) {
+#ifndef DETECT_FALSE_SHARING_OPT
+    // From now on this process writes the shared pages without versions.
+    // A new thread that inherited the shared mappings counts on its own.
+    if(_writingPid != _pid) {
+      atomic::increment(&_counters->directWriters);
+      _writingPid = _pid;
+    }
+    atomic::increment(&_counters->protectionChanges);
+
+    // Threads without a twin can not diff against the shared pages any more.
+    if(_twinElision) {
+      for(int pageNo = 0; pageNo < TotalPageNums; pageNo++) {
+        if(_twinStates[pageNo] == TWIN_ELIDED) {
+          lockPage(pageNo);
+          saveElidedTwin(pageNo);
+          unlockPage(pageNo);
+        }
+      }
+    }
+#endif
     removeProtect(base(), size());
     _isProtected = false;
   }
@@ -397,6 +539,11 @@ public:
   int getDirtyPages(void) {
     return _privatePagesList.size();
   }
+
+  /// @return the system calls made by the last batch of page updates.
+  unsigned long refreshCalls (void) {
+    return _refreshCalls;
+  }
  
   // Cleanup those counter information about one heap object when one object is re-used.
   bool cleanupHeapObject(void * ptr, size_t sz) {
@@ -435,6 +582,51 @@ public:
     return true;
   }
 
+  /// @brief Hand the memory of whole pages of a freed range back to
+  /// the system; they read as zeros afterwards.
+  void releasePages (void * start, size_t sz) {
+    size_t offset = (intptr_t)start - (intptr_t)base();
+#ifdef DETECT_FALSE_SHARING_OPT
+    MM::punchHole (_backingFd, offset, sz);
+#else
+    int first = offset / xdefines::PageSize;
+    int last = (offset + sz) / xdefines::PageSize;
+
+    // What this thread wrote there is garbage now: forget it, or the
+    // next commit writes it back into the hole.
+    for (int pageNo = first; pageNo < last; pageNo++) {
+      struct pageinfo * pageinfo = _privatePagesList.get(pageNo);
+      if (pageinfo == NULL || pageinfo->committed) {
+        continue;
+      }
+      lockPage(pageNo);
+      if (!pageinfo->hasTwinPage) {
+        _twinStates[pageNo] = TWIN_NONE;
+      }
+      unlockPage(pageNo);
+      atomic::decrement(&_pageUsers[pageNo]);
+      _privatePagesList.erase(pageNo);
+
+      // Not queued on the io_uring: the copy must be gone before the next write.
+      void * pageStart = (void *)((intptr_t)base() + pageNo * xdefines::PageSize);
+      madvise(pageStart, xdefines::PageSize, MADV_DONTNEED);
+      protectPages(pageStart, xdefines::PageSize);
+    }
+
+    // Other threads twinning on the shared pages keep their copies, and
+    // the private copies kept by any thread are stale afterwards.
+    for (int pageNo = first; pageNo < last; pageNo++) {
+      lockPage(pageNo);
+      saveElidedTwin(pageNo);
+    }
+    MM::punchHole (_backingFd, offset, sz);
+    for (int pageNo = first; pageNo < last; pageNo++) {
+      atomic::increment(&_pageVersions[pageNo]);
+      unlockPage(pageNo);
+    }
+#endif
+  }
+
   /// @return true iff the address is in this space.
   inline bool inRange (void * addr) {
     if (((size_t) addr >= (size_t) base())
@@ -460,20 +652,34 @@ public:
   }
 
   inline void addPageEntry(int pageNo, struct pageinfo * curr, dirtyListType * pageList) {
-    pair<dirtyListType::iterator, bool> it;
-      
-    it = pageList->insert(pair<int, void *>(pageNo, curr));
-    if(it.second == false) {
-      // The element is existing in the list now.
-      memcpy((void *)it.first->second, curr, sizeof(struct pageinfo));
-    }
-    return;                                                                       
+    // An existing entry of this page is overwritten in place.
+    pageList->insert(pageNo, curr);
   }
 
   /// @brief Record a write to this location.
   void handleWrite (void * addr) {
     // Compute the page number of this item
     int pageNo = computePage ((size_t) addr - (size_t) base());
+
+#ifndef DETECT_FALSE_SHARING_OPT
+    // Somebody found that isolating this page does not pay.
+    if(leftShared(pageNo)) {
+      sharePage(pageNo);
+      return;
+    }
+#endif
+
+    recordWrite(pageNo, false);
+#ifndef DETECT_FALSE_SHARING_OPT
+    prefetchWrites(pageNo);
+#endif
+  }
+
+  /// @brief Take the private copy and the twin of a page about to be written,
+  /// or only predicted to be. The page must be writable already.
+  /// A kept copy survived the last begin and keeps the version it was
+  /// taken at: other threads may have committed to the page since.
+  void recordWrite (int pageNo, bool predicted, bool kept = false) {
     int * pageStart = (int *)((intptr_t)_transientMemory + xdefines::PageSize * pageNo);
     int origUsers = 0;
  
@@ -482,6 +688,9 @@ public:
     curr->pageNo = pageNo;
     curr->pageStart = (void *)pageStart;
     curr->alloced = false;
+    curr->predicted = predicted;
+    curr->written = !predicted;
+    curr->committed = false;
 
     // Get current page's version number. 
     // Trick here: we have to get version number before the force of copy-on-write.
@@ -490,14 +699,55 @@ public:
      
     // Force the copy-on-write of kernel by writing to this address directly
 #ifndef DETECT_FALSE_SHARING_OPT
+    // Nobody commits to the page while we take our copy.
+    lockPage(pageNo);
+
+    unsigned int version = _pageVersions[pageNo];
+    if(!kept) {
+      _localVersions[pageNo] = version;
+    }
+
     asm volatile ("movl %0, %1 \n\t"
             :   // Output, no output 
             : "r"(pageStart[0]),  // Input 
               "m"(pageStart[0])
             : "memory");
 
-    // Create the "origTwinPage" from _transientMemory.
-    memcpy(curr->origTwinPage, pageStart, xdefines::PageSize);
+#ifdef UFFD_TRACKING
+    // A write to a page that is not mapped yet is copied by the kernel
+    // before the write-protect fault is raised, so the copy may predate
+    // the version read above. Take it again from the shared page.
+    if(_uffdTracking) {
+      memcpy(pageStart, (void *)((intptr_t)_persistentMemory + xdefines::PageSize * pageNo), xdefines::PageSize);
+      _localVersions[pageNo] = version;
+    }
+#endif
+
+    origUsers = atomic::increment_and_return(&_pageUsers[pageNo]);
+
+    // If nobody else has the page dirty and our copy is current, the shared
+    // page itself is our twin until somebody else commits to it; that
+    // committer saves it for us first (see saveElidedTwin).
+    curr->hasTwinPage = true;
+    if(_twinElision && origUsers == 0 && _localVersions[pageNo] == version) {
+      _twinStates[pageNo] = TWIN_ELIDED;
+      atomic::memoryBarrier();
+
+      // Pairs with closeProtection() and sharePage(): a process about to
+      // write the shared page directly either sees our page or is seen here.
+      if(_counters->directWriters == 0 && _pageDirectWriters[pageNo] == 0) {
+        curr->hasTwinPage = false;
+      }
+      else {
+        _twinStates[pageNo] = TWIN_NONE;
+      }
+    }
+    unlockPage(pageNo);
+
+    if(curr->hasTwinPage) {
+      // Create the "origTwinPage" from _transientMemory.
+      memcpy(curr->origTwinPage, pageStart, xdefines::PageSize);
+    }
 #else
     if(_localSharedInfo[pageNo] == true) {
       asm volatile ("movl %0, %1 \n\t"
@@ -513,9 +763,9 @@ public:
     else {
       curr->hasTwinPage = false;
     }
-#endif
     // We will update the users of this page.
     origUsers = atomic::increment_and_return(&_pageUsers[pageNo]);
+#endif
     if(origUsers != 0) {
       curr->shared = true;
     }
@@ -528,6 +778,60 @@ public:
     addPageEntry(pageNo, curr, &_privatePagesList);
   }
 
+#ifndef DETECT_FALSE_SHARING_OPT
+  /// @brief Take the pages after pageNo as written too, when the write
+  /// faults of this process sweep the region upwards: one system call then
+  /// replaces a fault per page. The run doubles each time a fault lands
+  /// right past the pages taken for the previous one, and starts over on
+  /// any other fault, so a sweep that stops leaves few unused twins behind.
+  void prefetchWrites (int pageNo) {
+    if(pageNo == _sweepNext) {
+#ifdef SHERIFF_COUNTERS
+      stats::getInstance().updatePrefetches(0, _sweepPages);
+#endif
+      _sweepPages = (_sweepPages == 0) ? 2 : 2 * _sweepPages;
+      if(_sweepPages > xdefines::PREFETCH_PAGES) {
+        _sweepPages = xdefines::PREFETCH_PAGES;
+      }
+    }
+    else {
+      _sweepPages = 0;
+    }
+
+    // Pages written already in this transaction are writable: stop there,
+    // and at pages written in place, or about to be. Nothing is allocated
+    // past the heap's bump pointer.
+    char * limit = _heapEnd ? *_heapEnd : (char *)base() + size();
+#ifdef UFFD_TRACKING
+    if(_uffdTracking && _trackedEnd < limit) {
+      limit = _trackedEnd;
+    }
+#endif
+    int lastPage = ((intptr_t)limit - (intptr_t)base() + xdefines::PageSize - 1) / xdefines::PageSize - 1;
+    int pages = 0;
+    while(pages < _sweepPages && pageNo + pages < lastPage
+          && !_privatePagesList.contains(pageNo + pages + 1)
+          && !leftShared(pageNo + pages + 1)
+          && !_sharedPages.contains(pageNo + pages + 1)) {
+      pages++;
+    }
+    _sweepNext = pageNo + pages + 1;
+
+    if(pages == 0) {
+      return;
+    }
+
+    unprotectPages((void *)((intptr_t)base() + (pageNo + 1) * xdefines::PageSize),
+                   pages * xdefines::PageSize);
+    for(int i = 1; i <= pages; i++) {
+      recordWrite(pageNo + i, true);
+    }
+#ifdef SHERIFF_COUNTERS
+    stats::getInstance().updatePrefetches(pages, 0);
+#endif
+  }
+#endif
+
   inline void allocResourcesForSharePage(struct pageinfo * pageinfo) {
     // Alloc those resources for share page.
     pageinfo->wordChanges = (unsigned long *)xpagestore::getInstance().alloc();
@@ -543,9 +847,8 @@ public:
     struct pageinfo * pageinfo;
     int pageNo;
 
-    for (dirtyListType::iterator i = _privatePagesList.begin(); i != _privatePagesList.end(); i++) {
-      pageinfo = (struct pageinfo *)i->second;
-      pageNo = pageinfo->pageNo;
+    for (pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      pageinfo = _privatePagesList.get(pageNo);
       if(pageinfo->shared != true) {
         // Check whether one un-shared page becomes shared now?
         int curUsers = atomic::atomic_read(&_pageUsers[pageNo]);
@@ -607,8 +910,6 @@ public:
     unsigned long cacheNo;
     int myTid = getpid();
     unsigned long * local = (unsigned long *)pageinfo->pageStart;
-    int startCacheNo = pageinfo->pageNo*xdefines::CACHES_PER_PAGE;
-    unsigned long recordedCacheNo = 0xFFFFFFFF;
     unsigned long * twin;
     unsigned long * wordChanges;
   #if defined(DETECT_FALSE_SHARING_OPT)
@@ -632,26 +933,25 @@ public:
   
     wordChanges = (unsigned long *)pageinfo->wordChanges;
   
-    // We will check those modifications by comparing "local" and "twin".
-    for(int i = 0; i < xdefines::PageSize/sizeof(unsigned long); i++) {
-      if(local[i] != twin[i]) {
-        int lastTid;
-    
-        // Calculate the cache number for current words.  
-        cacheNo = calcCacheNo(i);
-        
-        // We will update corresponding cache invalidates.
-        if(cacheNo != recordedCacheNo) {
-      #if defined(DETECT_FALSE_SHARING_OPT)
-          interWrites += recordCacheInvalidates(pageinfo->pageNo, pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
-      #endif
-          recordedCacheNo = cacheNo;
+    // We will check those modifications by comparing "local" and "twin",
+    // but only inside those cache lines that actually changed.
+    unsigned long long lines = pagediff::getInstance().diffLines(local, twin);
+
+    while(lines) {
+      cacheNo = pagediff::nextLine(lines);
+
+      // We will update corresponding cache invalidates.
+    #if defined(DETECT_FALSE_SHARING_OPT)
+      interWrites += recordCacheInvalidates(pageinfo->pageNo, pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
+    #endif
+
+      for(int i = cacheNo * pagediff::LINE_WORDS; i < (cacheNo + 1) * pagediff::LINE_WORDS; i++) {
+        if(local[i] != twin[i]) {
+          // Update corresponding words on twin page and record changes for words in this cache line.
+          twin[i] = local[i];
+          wordChanges[i]++; 
         }
-        
-        // Update corresponding words on twin page and record changes for words in this cache line.
-        twin[i] = local[i];
-        wordChanges[i]++; 
-      }   
+      }
     }
   }
 
@@ -671,6 +971,20 @@ public:
 
   /// @brief Start a transaction.
   inline void begin (void) {
+#ifdef UFFD_TRACKING
+    if(_uffdTracking) {
+      // A new process inherits the mapping but not the registration.
+      if(_trackingPid != syscall(SYS_getpid) && !armTracking()) {
+        _uffdTracking = false;
+        writeProtect(base(), size());
+      }
+      else if(_heapEnd) {
+        // Cover heap chunks carved out by other threads.
+        extendTracking(*_heapEnd);
+      }
+    }
+#endif
+
     // Update all pages related in this dirty page list
     updateAll();
   }
@@ -681,41 +995,7 @@ public:
 
   // Here, we are trying to use vectorization to improve the performance.
   inline void writePageDiffs (const void * local, const void * twin, void * dest) {
-  #ifdef SSE_SUPPORT
-    __m128i * localbuf = (__m128i *) local;
-    __m128i * twinbuf  = (__m128i *) twin;
-    __m128i * destbuf  = (__m128i *) dest;
-    for (int i = 0; i < xdefines::PageSize / sizeof(__m128i); i++) {
-  
-      __m128i localChunk, twinChunk, destChunk;
-  
-      localChunk = _mm_load_si128 (&localbuf[i]);
-      twinChunk  = _mm_load_si128 (&twinbuf[i]);
-  
-      // Compare the local and twin byte-wise.
-      __m128i eqChunk = _mm_cmpeq_epi8 (localChunk, twinChunk);
-  
-      // Invert the bits by XORing them with ones.
-      __m128i neqChunk = _mm_xor_si128 (allones, eqChunk);
-  
-      // Write local pieces into destbuf everywhere diffs.
-      _mm_maskmoveu_si128 (localChunk, neqChunk, (char *) &destbuf[i]);
-    }
-  #else
-    /* If hardware can't support SSE3 instructions, use slow commits as following. */
-    unsigned long * mylocal = (unsigned long *)local;
-    unsigned long * mytwin = (unsigned long *)twin;
-    unsigned long * mydest = (unsigned long *)dest;
-
-    for(int i = 0; i < xdefines::PageSize/sizeof(unsigned long); i++) {
-      if(mylocal[i] != mytwin[i]) {
-          //if(mytwin[i] != mydest[i] && mylocal[i] != mydest[i])
-          //fprintf(stderr, "%d: RACE at %p from %x to %x (dest %x). pageno %d\n", getpid(), &mylocal[i], mytwin[i], mylocal[i], mydest[i], pageno);
-        mydest[i] = mylocal[i];
-      }
-    }
-
-  #endif
+    pagediff::getInstance().commit(local, twin, dest);
   }
 
   inline void checkCommitWord(char * local, char * twin, char * share) {
@@ -760,66 +1040,67 @@ public:
     unsigned long * localChanges = (unsigned long *) pageinfo->wordChanges;
     // Here we assume sizeof(unsigned long) == 2 * sizeof(unsigned short);
     unsigned long * globalChange = (unsigned long *)((intptr_t)_wordChanges + xdefines::PageSize * pageinfo->pageNo);
-    unsigned long recordedCacheNo = 0xFFFFFFFF;
-    unsigned long cacheNo;
+    unsigned long long lines;
   #if defined(DETECT_FALSE_SHARING_OPT)
     unsigned long interWrites = 0;
   #endif
   
     // Also, it is possible to change the global version number about invalidates too. 
-    // Iterate through the page a word at a time.
+    // Iterate through the changed cache lines a word at a time.
     if(localChanges == NULL) {
-      for (int i = 0; i < xdefines::PageSize/sizeof(unsigned long); i++) {
-        if(local[i] != twin[i]) {
-          // Calculate the cache number for current words.    
-          cacheNo = calcCacheNo(i);
+      lines = pagediff::getInstance().diffLines(local, twin);
 
-          // We will update corresponding cache invalidates.
-          if(cacheNo != recordedCacheNo) {
-        #if defined(DETECT_FALSE_SHARING_OPT)
-            interWrites += recordCacheInvalidates(pageinfo->pageNo, pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
-        #endif
+      while(lines) {
+        int cacheNo = pagediff::nextLine(lines);
+
+        // We will update corresponding cache invalidates.
+      #if defined(DETECT_FALSE_SHARING_OPT)
+        interWrites += recordCacheInvalidates(pageinfo->pageNo, pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
+      #endif
+
+        for (int i = cacheNo * pagediff::LINE_WORDS; i < (cacheNo + 1) * pagediff::LINE_WORDS; i++) {
+          if(local[i] != twin[i]) {
+            checkCommitWord((char *)&local[i], (char *)&twin[i], (char *)&share[i]);
+            recordWordChanges((void *)&globalChange[i], 1);
           }
-          checkCommitWord((char *)&local[i], (char *)&twin[i], (char *)&share[i]);
-          recordWordChanges((void *)&globalChange[i], 1);
         }
       }
     }
     else {
-      for (int i = 0; i < xdefines::PageSize/sizeof(unsigned long); i++) {
-        unsigned long cacheNo;
-        unsigned long recordedCacheNo = 0xFFFFFFFF; 
-  
-        if(local[i] == twin[i] && localChanges[i] == 0) {
-          // There is no need to commit
-          continue;
-        }
-        else if(local[i] == twin[i] && localChanges[i] != 0) {
-          // There is ABA change, we just update the global version directly.
-          //fprintf(stderr, "detect the ABA changes %d\n", localChanges[i]);
-          recordWordChanges((void *)&globalChange[i], localChanges[i]);
-          continue;
-        }
-        
-        // Here, we find some modification. 
-        if(local[i] != tempTwin[i]) {
-          // Calculate the cache number for current words.    
-          cacheNo = calcCacheNo(i);
-
-          // We will update corresponding cache invalidates.
-          if(cacheNo != recordedCacheNo) {
+      // ABA changes leave local and twin identical, so we also have to visit
+      // those lines with recorded word changes.
+      lines = pagediff::getInstance().diffLines(local, twin)
+            | pagediff::getInstance().nonzeroLines(localChanges);
+
+      while(lines) {
+        int cacheNo = pagediff::nextLine(lines);
+
+        for (int i = cacheNo * pagediff::LINE_WORDS; i < (cacheNo + 1) * pagediff::LINE_WORDS; i++) {
+          if(local[i] == twin[i] && localChanges[i] == 0) {
+            // There is no need to commit
+            continue;
+          }
+          else if(local[i] == twin[i] && localChanges[i] != 0) {
+            // There is ABA change, we just update the global version directly.
+            //fprintf(stderr, "detect the ABA changes %d\n", localChanges[i]);
+            recordWordChanges((void *)&globalChange[i], localChanges[i]);
+            continue;
+          }
+          
+          // Here, we find some modification. 
+          if(local[i] != tempTwin[i]) {
+            // We will update corresponding cache invalidates, once for
+            // every word changed since the last check.
         #if defined(DETECT_FALSE_SHARING_OPT)
             interWrites += recordCacheInvalidates(pageinfo->pageNo, pageinfo->pageNo*xdefines::CACHES_PER_PAGE + cacheNo);
         #endif
 
-            recordedCacheNo = cacheNo;
+            recordWordChanges((void *)&globalChange[i], 1);
           }
-
-          recordWordChanges((void *)&globalChange[i], 1);
+        
+          checkCommitWord((char *)&local[i], (char *)&twin[i], (char *)&share[i]);
+          recordWordChanges((void *)&globalChange[i], localChanges[i]);
         }
-      
-        checkCommitWord((char *)&local[i], (char *)&twin[i], (char *)&share[i]);
-        recordWordChanges((void *)&globalChange[i], localChanges[i]);
       }
     }
   }
@@ -867,11 +1148,28 @@ public:
       return;
     }
 
+#if defined(PARALLEL_COMMIT) || defined(GET_CHARACTERISTICS)
+    struct timeinfo commitStart;
+    start(&commitStart);
+#endif
+
+#if defined(PARALLEL_COMMIT) && !defined(DETECT_FALSE_SHARING_OPT)
+    // Large dirty sets are merged by the helpers of this process.
+    if(_privatePagesList.size() >= xdefines::PARALLEL_COMMIT_PAGES) {
+      bool parallel = parallelCommit();
+      stats::getInstance().updateCommitTime(parallel, _privatePagesList.size(), stop(&commitStart, NULL));
+      return;
+    }
+#endif
+
+#ifdef DETECT_FALSE_SHARING_OPT
+    beginUpdates();
+#endif
+
     // Commit those private pages if _localSharedInfo is set to true since that means current page
     // are using the private copy.
-    for (dirtyListType::iterator i = _privatePagesList.begin(); i != _privatePagesList.end(); ++i) {
-      pageinfo = (struct pageinfo *)i->second;
-      pageNo = pageinfo->pageNo;
+    for (pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      pageinfo = _privatePagesList.get(pageNo);
       persistent = (unsigned long *) ((intptr_t)_persistentMemory + xdefines::PageSize * pageNo);
     
     #ifdef DETECT_FALSE_SHARING_OPT
@@ -907,12 +1205,13 @@ public:
       }
       else {
         pagetype = PAGE_TYPE_INVALID;
-        _savedPagesList.insert(pair<int, void *>(pageNo, pageinfo));
+        _savedPagesList.insert(pageNo, pageinfo);
       }
   
       // FIXME: Put the system calls stuff in one funtion call  
       if(pagetype == lastpagetype && pageNo == lastpage + 1) {
         batched++;
+        lastpage = pageNo;
       }
       else {
         // Issue batched system calls.  
@@ -926,7 +1225,7 @@ public:
     #else
       // It is possible that one thread are accessing the same page directly when I am trying to access,
       // It is safer to commit the changes only. Memcpy can compromise the changes by the thread directly working on that.
-      writePageDiffs(pageinfo->pageStart, pageinfo->origTwinPage, persistent);
+      commitPage(pageinfo, persistent);
     #endif
       atomic::decrement(&_pageUsers[pageinfo->pageNo]);
     }
@@ -936,15 +1235,15 @@ public:
   
     if(_detectPeriod && _savedPagesList.size() > 0) {
       lastpagetype = PAGE_TYPE_READONLY;
-      lastpage = -1;
+      lastpage = -2;
       batched = 0;
     
-      for (dirtyListType::iterator i = _savedPagesList.begin(); i != _savedPagesList.end(); ++i) {
-        pageinfo = (struct pageinfo *)i->second;
-        pageNo = pageinfo->pageNo;
+      for (pageNo = _savedPagesList.first(); pageNo != -1; pageNo = _savedPagesList.next(pageNo)) {
+        pageinfo = _savedPagesList.get(pageNo);
       
         if(pageNo == lastpage + 1) {
           batched++;
+          lastpage = pageNo;
         }
         else {
          // Issue batched system calls.  
@@ -955,101 +1254,882 @@ public:
           lastpage = pageNo;
         }
       }
+      issueBatchedSystemcalls(lastpagetype, batched, batchedStart);
       _savedPagesList.clear();
     }
+    submitUpdates();
 
     _privatePagesList.clear();
 
     // Clean up those page entries.
     xpageentry::getInstance().cleanup();
     xpagestore::getInstance().cleanup();
+  #elif defined(PARALLEL_COMMIT) || defined(GET_CHARACTERISTICS)
+    stats::getInstance().updateCommitTime(false, _privatePagesList.size(), stop(&commitStart, NULL));
   #endif
   }
 
-#ifndef DETECT_FALSE_SHARING_OPT
-  /// @brief Update every page frame from the backing file.
-  /// Change to this function so that it will deallocate those backup pages. Previous way
-  /// will have a memory leakage here without deallocation of Backup Pages.
-  /// Also, re-protect those block in the list.
-  void updateAll (void) {
-    // Dump the now-unnecessary page frames, reducing space overhead.
-    dirtyListType::iterator i;
-    for (i = _privatePagesList.begin(); i != _privatePagesList.end(); ++i) {
-      struct pageinfo * pageinfo = (struct pageinfo *)i->second;
-      updatePage(pageinfo->pageStart, xdefines::PageSize);
+#if defined(PARALLEL_COMMIT) && !defined(DETECT_FALSE_SHARING_OPT)
+  /// @brief Merge the dirty pages in chunks, using the commit helpers.
+  /// @return false if there were no helpers to share the work.
+  bool parallelCommit(void) {
+    int pages = _privatePagesList.size();
+
+    // Lay the dirty pages out in an array so that they can be split in ranges.
+    if(pages > _commitPagesSize) {
+      if(_commitPages) {
+        privateheap::free(_commitPages);
+      }
+      _commitPagesSize = 2 * pages;
+      _commitPages = (struct pageinfo **)privateheap::malloc(_commitPagesSize * sizeof(struct pageinfo *));
     }
-    
-    _privatePagesList.clear();
-    
-    // Clean up those page entries.
-    xpageentry::getInstance().cleanup();
-    xpagestore::getInstance().cleanup();
-  }
-#else
-  void updateAll(void) {
-  // Do nothing.  
+
+    int n = 0;
+    for (int pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      _commitPages[n++] = _privatePagesList.get(pageNo);
+    }
+
+    return xcommitpool::getInstance().run(commitRange, this, pages);
   }
-#endif
 
-  void protectPage(int pageNo) {
-    void * area;
-    int offset = pageNo * xdefines::PageSize;
-    void * start =(void *)((int)base() + offset);
+  static void commitRange(void * owner, int begin, int end) {
+    xpersist<Type, NElts> * persist = (xpersist<Type, NElts> *)owner;
 
-    //fprintf(stderr, "%d : remove protect %x size 0x%x, offset 0x%x\n", getpid(), start, size, offset);
-    // Map to writable share area. 
-    area = mmap (start,
-                 xdefines::PageSize,
-                 PROT_READ | PROT_WRITE,
-                 MAP_PRIVATE | MAP_FIXED,
-                 _backingFd,
-                 offset);
+    for (int i = begin; i < end; i++) {
+      struct pageinfo * pageinfo = persist->_commitPages[i];
+      void * persistent = (void *)((intptr_t)persist->_persistentMemory + xdefines::PageSize * pageinfo->pageNo);
 
-    if(area == MAP_FAILED) {
-      fprintf(stderr, "Weird, %d remove protect failed!!!\n", getpid());
-      exit(-1);
+      persist->commitPage(pageinfo, persistent);
+      atomic::decrement(&persist->_pageUsers[pageinfo->pageNo]);
     }
   }
+#endif
 
-  void setProtectionPeriod(void) {
-    writeProtect(base(), size());
-    _detectPeriod = true; 
-  }
+#ifndef DETECT_FALSE_SHARING_OPT
+  /// @brief Merge one dirty page into the shared page and publish it.
+  inline void commitPage(struct pageinfo * pageinfo, void * persistent) {
+    int pageNo = pageinfo->pageNo;
+
+    lockPage(pageNo);
+    void * twin = pageinfo->origTwinPage;
+    if(!pageinfo->hasTwinPage) {
+      // Our twin is the shared page, unless somebody committed in between
+      // and saved it first.
+      twin = persistent;
+      if(_twinStates[pageNo] == TWIN_SAVED) {
+        twin = (void *)((intptr_t)_savedTwins + xdefines::PageSize * pageNo);
+      }
+      _twinStates[pageNo] = TWIN_NONE;
+    }
 
-  void unsetProtectionPeriod(void) {
-    _detectPeriod = false;  
+    // A page that was never written leaves the shared page and its version
+    // alone, so that other threads' copies stay current.
+    if(pageinfo->predicted) {
+      pageinfo->written = (pagediff::getInstance().diffLines(pageinfo->pageStart, twin) != 0);
+    }
+    if(pageinfo->written) {
+      accountIsolation(pageinfo, twin);
+      accountConflicts(pageinfo, twin, persistent);
+      if(pageinfo->hasTwinPage) {
+        saveElidedTwin(pageNo);
+      }
+      writePageDiffs(pageinfo->pageStart, twin, persistent);
+      commitVersion(pageNo);
+#ifdef LAZY_RELEASE
+      xnotices::getInstance().append(pageinfo->pageStart);
+#endif
+    }
+    pageinfo->committed = true;
+    unlockPage(pageNo);
   }
 
-#ifdef DETECT_FALSE_SHARING_OPT
-  void *setPagesRwShared(int start, int stop) {
-    int  offset = start*xdefines::PageSize;
-    void * startAddr = (void *)((int)base() + offset);
-    int size = (stop - start + 1)*xdefines::PageSize;
-    mprotect(startAddr, size, PROT_READ|PROT_WRITE); 
- }
-
-  void unprotectNonProfitPages(void * end) {
-    int totalpages;
-    if(end == NULL) {
-      totalpages = size()/xdefines::PageSize;
+  /// @brief Publish a commit to pageNo, once its diffs are written.
+  /// Our private copy stays current if nobody else committed since we took it.
+  inline void commitVersion(int pageNo) {
+    unsigned int version = atomic::increment_and_return(&_pageVersions[pageNo]);
+    if(version == _localVersions[pageNo]) {
+      _localVersions[pageNo] = version + 1;
     }
     else {
-      totalpages = ((intptr_t)end - (intptr_t)base())/xdefines::PageSize;
+      // The shared version is already past this one, so it never matches again.
+      _localVersions[pageNo] = version;
     }
+  }
 
-    int start = 0;
-    bool unprotect = false;
+  /// @brief Refresh the private pages this thread dirtied.
+  /// They are dropped, so that they are read again from the backing file,
+  /// and protected again to catch the next write. Pages this thread keeps
+  /// writing stay writable and get their twin now; their copies are only
+  /// dropped if other threads changed the pages since they were taken.
+  /// Runs of adjacent pages needing the same treatment are updated at once.
+  /// After a lazy acquire, only pages noticed since are checked at all.
+  void updateAll (void) {
+    // Writes through the shared mapping bump no versions, so no copy
+    // can be trusted if anybody wrote that way since the last check.
+    bool trusted = (_counters->directWriters == 0 && _counters->protectionChanges == _seenProtectionChanges);
+    _seenProtectionChanges = _counters->protectionChanges;
+    if(++_clockTicks == xdefines::CLOCK_TICKS) {
+      atomic::add(_clockTicks, &_counters->transactionClock);
+      _clockTicks = 0;
+    }
+    beginUpdates();
 
-    unsetProtectionPeriod(); 
-  }
+    // A sweep is only followed within a transaction.
+    _sweepNext = -1;
+    _sweepPages = 0;
+
+    // A new thread starts without the write history of its parent.
+    if(_historyPid != _pid) {
+      _historyPid = _pid;
+      _transactions += 2;
+    }
+    updateSharedPages();
+#ifdef ATOMIC_SYNC
+    bool dropCopies = _dropCopies;
+    _dropCopies = false;
+#else
+    bool dropCopies = false;
+#endif
+
+    // Transactions that wrote nothing at all, such as short critical
+    // sections, do not count in the write history.
+    bool active = false;
+    for(int pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      if(_privatePagesList.get(pageNo)->written) {
+        active = true;
+        break;
+      }
+    }
+    if(active) {
+      _transactions++;
+    }
+    unsigned long predictedWritten = 0;
+
+    void * runStart = NULL;
+    int runPages = 0;
+    bool runDrop = false;
+    bool runProtect = false;
+
+    for(int pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      struct pageinfo * pageinfo = _privatePagesList.get(pageNo);
+      bool current = trusted && _pageDirectWriters[pageNo] == 0
+                     && (_localVersions[pageNo] == (unsigned int)_pageVersions[pageNo]);
+#ifdef LAZY_RELEASE
+      // Commits nobody told us about are not ours to see yet. The copy
+      // keeps its version, so a later full refresh still drops it.
+      if(_lazyUpdate && !_noticedPages.contains(pageNo)) {
+        current = trusted && _pageDirectWriters[pageNo] == 0;
+      }
+#endif
+
+      // Isolating the page did not pay: write it in place from now on,
+      // unless it was shared right after the commit.
+      if(leftShared(pageNo)) {
+        if(!_sharedPages.contains(pageNo)) {
+          sharePage(pageNo);
+        }
+        continue;
+      }
+
+      bool keep = false;
+      if(pageinfo->written && wasPredicted(pageNo)) {
+        predictedWritten++;
+      }
+      // Copying a page somebody else changed is a fault of its own, not
+      // worth taking for a transaction that may write nothing again.
+      if(!dropCopies && predictWrite(pageNo, pageinfo->written, active) && (active || current)) {
+        _predictedPages.insert(pageNo, NULL);
+        keep = true;
+      }
+
+      // A copy that is not written again is dropped even while it is
+      // current: kept, it would hide the commits of other threads from
+      // reads that are not synchronized, which see them once dropped.
+      bool drop = !(keep && current);
+      bool protect = !keep;
+      if(!drop) {
+        _keptCopies.insert(pageNo, NULL);
+      }
+      if(drop || protect) {
+        void * pageStart = (void *)((intptr_t)base() + pageNo * xdefines::PageSize);
+        if(runPages > 0 && runDrop == drop && runProtect == protect
+           && pageStart == (void *)((intptr_t)runStart + runPages * xdefines::PageSize)) {
+          runPages++;
+        }
+        else {
+          updateRun(runStart, runPages, runDrop, runProtect);
+          runStart = pageStart;
+          runPages = 1;
+          runDrop = drop;
+          runProtect = protect;
+        }
+      }
+    }
+
+    updateRun(runStart, runPages, runDrop, runProtect);
+
+    submitUpdates();
+    
+    _privatePagesList.clear();
+#ifdef LAZY_RELEASE
+    _noticedPages.clear();
+    _lazyUpdate = false;
+#endif
+    
+    // Clean up those page entries.
+    xpageentry::getInstance().cleanup();
+    xpagestore::getInstance().cleanup();
+
+    stats::getInstance().updatePredictions(0, predictedWritten);
+  }
+
+  /// @brief Twin the pages updateAll() left writable, once every region
+  /// is updated: the page entry pools are shared by the regions and
+  /// emptied by each update.
+  void twinPredictedPages (void) {
+    unsigned long predicted = 0;
+
+    // Dropped pages are read again by the first write of recordWrite().
+    for(int pageNo = _predictedPages.first(); pageNo != -1; pageNo = _predictedPages.next(pageNo)) {
+      recordWrite(pageNo, true, _keptCopies.contains(pageNo));
+      predicted++;
+    }
+    _predictedPages.clear();
+    _keptCopies.clear();
+
+    stats::getInstance().updatePredictions(predicted, 0);
+  }
+
+  inline void updateRun(void * start, int pages, bool drop, bool protect) {
+    if(pages == 0) {
+      return;
+    }
+
+    if(drop) {
+      dropPages(start, pages * xdefines::PageSize);
+    }
+    if(protect) {
+      protectPages(start, pages * xdefines::PageSize);
+    }
+  }
+
+  /// @brief Learn whether the transaction that just ended wrote pageNo.
+  /// @return true if it was written in enough transactions in a row to
+  /// expect the next one to write it too.
+  inline bool predictWrite(int pageNo, bool written, bool active) {
+    if(!active) {
+      // Still twinned at begin if it was last time.
+      return (_writeStreaks[pageNo] >= xdefines::PREDICT_TRANSACTIONS
+              && _writeStamps[pageNo] == _transactions);
+    }
+
+    if(!written) {
+      _writeStreaks[pageNo] = 0;
+      return false;
+    }
+
+    if(_writeStamps[pageNo] == _transactions - 1) {
+      if(_writeStreaks[pageNo] < xdefines::PREDICT_TRANSACTIONS) {
+        _writeStreaks[pageNo]++;
+      }
+    }
+    else {
+      _writeStreaks[pageNo] = 1;
+    }
+    _writeStamps[pageNo] = _transactions;
+    return (_writeStreaks[pageNo] >= xdefines::PREDICT_TRANSACTIONS);
+  }
+
+  /// @return true if pageNo was twinned when the transaction that just
+  /// ended began.
+  inline bool wasPredicted(int pageNo) {
+    return (_writeStreaks[pageNo] >= xdefines::PREDICT_TRANSACTIONS
+            && _writeStamps[pageNo] == _transactions - 1);
+  }
+
+  /// @brief Weigh what isolating a page cost in one commit against the
+  /// interleaved writes it kept apart, and give a verdict once a window of
+  /// commits is over. Called with the page locked.
+  inline void accountIsolation(struct pageinfo * pageinfo, void * twin) {
+    int pageNo = pageinfo->pageNo;
+    struct isolation * iso = &_isolation[pageNo];
+    if(leftShared(pageNo)) {
+      return;
+    }
+
+    // Only a thread that had the page dirty at the same time can have
+    // written its cache lines in between.
+    int benefit = 0;
+    if(pageinfo->shared || _pageUsers[pageNo] > 1) {
+      unsigned long long lines = pagediff::getInstance().diffLines(pageinfo->pageStart, twin);
+      while(lines) {
+        int cacheNo = pageNo * xdefines::CACHES_PER_PAGE + pagediff::nextLine(lines);
+        if(recordCacheInvalidates(pageNo, cacheNo)) {
+          benefit += xdefines::INTERLEAVE_BENEFIT;
+        }
+      }
+    }
+    iso->balance += benefit - xdefines::ISOLATION_COST;
+    iso->commits++;
+
+    int window = xdefines::ISOLATION_WINDOW;
+    if(iso->state == ISOLATION_PROBATION) {
+      window /= 4;
+    }
+    if(iso->commits < window) {
+      return;
+    }
+
+    if(iso->balance < 0) {
+      if(iso->state == ISOLATION_PROBATION && iso->strikes < xdefines::PROBATION_STRIKES) {
+        iso->strikes++;
+      }
+      iso->state = ISOLATION_OFF;
+      iso->since = _counters->transactionClock;
+      stats::getInstance().updateIsolation(1, 0);
+    }
+    else {
+      iso->state = ISOLATION_ON;
+      iso->strikes = 0;
+    }
+    iso->balance = 0;
+    iso->commits = 0;
+  }
+
+  /// @return true if threads write pageNo in place, for now or for good.
+  inline bool leftShared(int pageNo) {
+    unsigned char state = _isolation[pageNo].state;
+    return (state == ISOLATION_OFF || state == ISOLATION_PINNED);
+  }
+
+#ifdef ATOMIC_SYNC
+  /// @brief Leave a page shared by all threads for good, with no
+  /// probation: threads synchronize on a word in it.
+  void pinPage(int pageNo) {
+    struct isolation * iso = &_isolation[pageNo];
+    if(iso->state == ISOLATION_PINNED) {
+      return;
+    }
+    lockPage(pageNo);
+    if(iso->state != ISOLATION_PINNED) {
+      iso->state = ISOLATION_PINNED;
+      stats::getInstance().updatePolling(0, 0, 1, 0);
+    }
+    unlockPage(pageNo);
+  }
+
+  /// @return true if addr lies in a page pinned shared that this process
+  /// writes in place. A write to it is fenced: whatever the thread wrote
+  /// before is committed first, and everything is refreshed after.
+  inline bool isFenced(void * addr) {
+    int pageNo = computePage((intptr_t)addr - (intptr_t)base());
+    return (_isolation[pageNo].state == ISOLATION_PINNED && _sharedPages.contains(pageNo));
+  }
+
+  /// @brief A write to addr faulted; atomic tells if the instruction is.
+  /// An atomic instruction updates a word threads synchronize on, or race
+  /// for: its page is pinned right away, before any thread can lose an
+  /// update to it in a private copy. A pinned page this process still
+  /// isolates is shared now, rather than at the next begin.
+  /// @return true if the write is to be fenced.
+  bool fencedWrite(void * addr, bool atomic) {
+    int pageNo = computePage((intptr_t)addr - (intptr_t)base());
+    if(_isolation[pageNo].state != ISOLATION_PINNED) {
+      if(!atomic) {
+        return false;
+      }
+      pinPage(pageNo);
+    }
+    if(!_sharedPages.contains(pageNo)) {
+      sharePage(pageNo);
+    }
+    return true;
+  }
+
+  /// @brief Let the thread write a page pinned shared in place, until it
+  /// writes a private page again: see closeFences().
+  void openFence(void * page) {
+    int pageNo = computePage((intptr_t)page - (intptr_t)base());
+    mprotect(page, xdefines::PageSize, PROT_READ | PROT_WRITE);
+    _openFences.insert(pageNo, NULL);
+  }
+
+  /// @brief The thread is about to write a private page: the pinned pages
+  /// it writes in place are fenced again, so that none of its next writes
+  /// to them overtakes this one.
+  inline void closeFences(void) {
+    if(_openFences.empty()) {
+      return;
+    }
+    for(int pageNo = _openFences.first(); pageNo != -1; pageNo = _openFences.next(pageNo)) {
+      mprotect((void *)((intptr_t)base() + pageNo * xdefines::PageSize), xdefines::PageSize, PROT_READ);
+    }
+    _openFences.clear();
+  }
+
+  /// @brief The next begin drops every private copy, and twins no page up
+  /// front: the thread polls, or is about to write a page pinned shared in
+  /// place, and every page it has not written since has to be read afresh.
+  void setDropCopies(void) {
+    _dropCopies = true;
+  }
+
+  /// @brief The word at addr is a futex. Its page is pinned, and written
+  /// in place by this process at once if share is set: the kernel has to
+  /// find the same word through every process, and may write it, so that
+  /// the page is fenced again at the next begin only. Called after a
+  /// commit, so that no private change to the page is lost.
+  void pinWord(void * addr, bool share) {
+    int pageNo = computePage((intptr_t)addr - (intptr_t)base());
+    pinPage(pageNo);
+    if(share) {
+      if(!_sharedPages.contains(pageNo)) {
+        sharePage(pageNo);
+      }
+      mprotect((void *)((intptr_t)base() + pageNo * xdefines::PageSize), xdefines::PageSize, PROT_READ | PROT_WRITE);
+    }
+  }
+
+  enum { PolledWords = xdefines::PageSize / sizeof(unsigned long) };
+  enum { WordBits = 8 * sizeof(unsigned long) };
+
+  /// A page this thread wrote when it last polled, and what it left in
+  /// the words it changed.
+  struct polledpage {
+    int pageNo;
+    unsigned long changed[PolledWords / WordBits];
+    unsigned long words[PolledWords];
+  };
+
+  /// @brief This thread seems to poll, and is about to commit. Pages in
+  /// which it changed a word that another thread changed too, in this
+  /// transaction or since the last one it polled in, hold words threads
+  /// synchronize on, or race for: they are pinned, and shared from the
+  /// next begin. Pages falsely shared stay isolated.
+  /// @return how many words of this thread were dropped, see racedOn().
+  unsigned long pinPolledPages(void) {
+    unsigned long dropped = 0;
+
+    for(int i = 0; i < _polledCount; i++) {
+      if(!leftShared(_polled[i].pageNo) && changedSince(&_polled[i])) {
+        pinPage(_polled[i].pageNo);
+      }
+    }
+
+    _polledCount = 0;
+    for(int pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      if(leftShared(pageNo) || _polledCount == xdefines::POLL_PAGES) {
+        continue;
+      }
+      if(racedOn(_privatePagesList.get(pageNo), &_polled[_polledCount], &dropped)) {
+        pinPage(pageNo);
+      }
+      else {
+        _polledCount++;
+      }
+    }
+    return dropped;
+  }
+
+  /// @brief Note in polled the words of a dirty page changed by this thread.
+  /// A word another thread changed too, in the shared page since this
+  /// thread copied it, is not committed: this thread's value, computed
+  /// from a stale copy, would overwrite the other one without a trace.
+  /// It is put back as it was in the twin, and counted in dropped.
+  /// @return true if there was such a word.
+  bool racedOn(struct pageinfo * pageinfo, struct polledpage * polled, unsigned long * dropped) {
+    int pageNo = pageinfo->pageNo;
+    unsigned long * mine = (unsigned long *)pageinfo->pageStart;
+    unsigned long * persistent = (unsigned long *)((intptr_t)_persistentMemory + xdefines::PageSize * pageNo);
+    bool raced = false;
+
+    polled->pageNo = pageNo;
+    memset(polled->changed, 0, sizeof(polled->changed));
+
+    lockPage(pageNo);
+    unsigned long * twin = (unsigned long *)pageinfo->origTwinPage;
+    if(!pageinfo->hasTwinPage) {
+      // The shared page is our twin, unless somebody committed and saved it.
+      twin = persistent;
+      if(_twinStates[pageNo] == TWIN_SAVED) {
+        twin = (unsigned long *)((intptr_t)_savedTwins + xdefines::PageSize * pageNo);
+      }
+    }
+    for(unsigned int i = 0; i < PolledWords; i++) {
+      if(mine[i] == twin[i]) {
+        continue;
+      }
+      if(persistent[i] != twin[i]) {
+        mine[i] = twin[i];
+        (*dropped)++;
+        raced = true;
+        continue;
+      }
+      polled->changed[i / WordBits] |= 1UL << (i % WordBits);
+      polled->words[i] = mine[i];
+    }
+    unlockPage(pageNo);
+    return raced;
+  }
+
+  /// @return true if another thread changed a word since this thread
+  /// committed it when it last polled.
+  bool changedSince(struct polledpage * polled) {
+    unsigned long * persistent = (unsigned long *)((intptr_t)_persistentMemory + xdefines::PageSize * polled->pageNo);
+    for(unsigned int i = 0; i < PolledWords; i++) {
+      if((polled->changed[i / WordBits] & (1UL << (i % WordBits))) && persistent[i] != polled->words[i]) {
+        return true;
+      }
+    }
+    return false;
+  }
+#endif
+
+  /// @brief Isolate a page left shared again, for a shorter window.
+  /// Called with the page locked.
+  inline void startProbation(int pageNo) {
+    struct isolation * iso = &_isolation[pageNo];
+    iso->state = ISOLATION_PROBATION;
+    iso->balance = 0;
+    iso->commits = 0;
+    stats::getInstance().updateIsolation(0, 1);
+  }
+
+  /// @brief Map a page shared and writable in this process.
+  void sharePage(int pageNo) {
+    int offset = pageNo * xdefines::PageSize;
+    void * start = (void *)((intptr_t)base() + offset);
+
+    // Private copies of the page can not be trusted from now on, and
+    // threads using the shared page as their twin need it saved.
+    atomic::increment(&_pageDirectWriters[pageNo]);
+    if(_twinElision) {
+      lockPage(pageNo);
+      saveElidedTwin(pageNo);
+      unlockPage(pageNo);
+    }
+
+    int prot = PROT_READ | PROT_WRITE;
+#ifdef ATOMIC_SYNC
+    // Writes to a pinned page are fenced: see isFenced().
+    if(_isolation[pageNo].state == ISOLATION_PINNED) {
+      prot = PROT_READ;
+    }
+#endif
+    void * area = mmap (start, xdefines::PageSize, prot,
+                        MAP_SHARED | MAP_FIXED, _backingFd, offset);
+    if(area == MAP_FAILED) {
+      fprintf(stderr, "Weird, %d sharing page %d failed with error %s!!!\n", getpid(), pageNo, strerror(errno));
+      exit(-1);
+    }
+    _sharedPages.insert(pageNo, NULL);
+  }
+
+  /// @brief Isolate a page this process writes in place again.
+  void unsharePage(int pageNo) {
+    int offset = pageNo * xdefines::PageSize;
+    void * start = (void *)((intptr_t)base() + offset);
+    void * area;
+
+#ifdef UFFD_TRACKING
+    if(_uffdTracking) {
+      area = mmap (start, xdefines::PageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, _backingFd, offset);
+      if(area != MAP_FAILED && xuffd::getInstance().registerRange(start, xdefines::PageSize)) {
+        xuffd::getInstance().writeProtect(start, xdefines::PageSize);
+      }
+      else {
+        area = MAP_FAILED;
+      }
+    }
+    else
+#endif
+    area = mmap (start, xdefines::PageSize, PROT_READ,
+                 MAP_PRIVATE | MAP_FIXED, _backingFd, offset);
+
+    if(area == MAP_FAILED) {
+      fprintf(stderr, "Weird, %d isolating page %d failed with error %s!!!\n", getpid(), pageNo, strerror(errno));
+      exit(-1);
+    }
+    forgetSharedPage(pageNo);
+    _sharedPages.erase(pageNo);
+  }
+
+  /// @brief This process stops writing a page in place: the copies other
+  /// threads took before are stale.
+  inline void forgetSharedPage(int pageNo) {
+    atomic::increment(&_pageVersions[pageNo]);
+    atomic::decrement(&_pageDirectWriters[pageNo]);
+  }
+
+  /// @brief Isolate again the pages this process writes in place that are
+  /// back on probation, putting there those whose time has come first.
+  void updateSharedPages(void) {
+#ifdef ATOMIC_SYNC
+    _openFences.clear();
+#endif
+    if(_sharedPages.empty()) {
+      return;
+    }
+
+    unsigned long clock = _counters->transactionClock;
+    for(int pageNo = _sharedPages.first(); pageNo != -1; pageNo = _sharedPages.next(pageNo)) {
+      struct isolation * iso = &_isolation[pageNo];
+      if(iso->state == ISOLATION_OFF
+         && clock - iso->since >= ((unsigned long)xdefines::PROBATION_TRANSACTIONS << iso->strikes)) {
+        lockPage(pageNo);
+        if(iso->state == ISOLATION_OFF) {
+          startProbation(pageNo);
+        }
+        unlockPage(pageNo);
+      }
+
+      if(!leftShared(pageNo)) {
+        unsharePage(pageNo);
+      }
+#ifdef ATOMIC_SYNC
+      // Fence again the pages pinned shared that this process wrote in
+      // place, or that were pinned meanwhile.
+      else if(iso->state == ISOLATION_PINNED) {
+        mprotect((void *)((intptr_t)base() + pageNo * xdefines::PageSize), xdefines::PageSize, PROT_READ);
+      }
+#endif
+    }
+  }
+
+  /// @brief The heap hands [ptr, ptr + sz) out again. Pages left shared
+  /// under it may well be written differently now: try isolating them
+  /// again, once they have been shared for a window at least.
+  void reuseMemory(void * ptr, size_t sz) {
+    int first = computePage((intptr_t)ptr - (intptr_t)base());
+    int last = computePage((intptr_t)ptr + sz - 1 - (intptr_t)base());
+    unsigned long clock = _counters->transactionClock;
+
+    for(int pageNo = first; pageNo <= last; pageNo++) {
+      struct isolation * iso = &_isolation[pageNo];
+      if(iso->state == ISOLATION_OFF && clock - iso->since >= xdefines::ISOLATION_WINDOW) {
+        lockPage(pageNo);
+        if(iso->state == ISOLATION_OFF) {
+          startProbation(pageNo);
+        }
+        unlockPage(pageNo);
+      }
+    }
+  }
+
+  /// @brief Stop writing any page in place, because the whole region is
+  /// remapped or this thread exits.
+  void forgetSharedPages(void) {
+    for(int pageNo = _sharedPages.first(); pageNo != -1; pageNo = _sharedPages.next(pageNo)) {
+      forgetSharedPage(pageNo);
+    }
+    _sharedPages.clear();
+  }
+
+  /// @brief This process no longer writes the shared mappings directly.
+  /// Copies other threads took in the meantime are checked again.
+  inline void stopWritingDirectly(void) {
+    if(_writingPid == _pid) {
+      atomic::decrement(&_counters->directWriters);
+    }
+    _writingPid = 0;
+    atomic::increment(&_counters->protectionChanges);
+  }
+
+  /// @brief This process is a new thread. Known here, the pid needs no
+  /// system call at every transaction boundary.
+  void threadStart(void) {
+    _pid = syscall(SYS_getpid);
+    // A pooled worker runs threads one after another under the same pid.
+    _historyPid = 0;
+
+    // It does write the pages its parent, or its last thread, wrote in
+    // place: count them before anything can forget them.
+    for(int pageNo = _sharedPages.first(); pageNo != -1; pageNo = _sharedPages.next(pageNo)) {
+      atomic::increment(&_pageDirectWriters[pageNo]);
+    }
+  }
+
+  /// @brief This thread is about to exit. The pages it wrote in place stay
+  /// mapped so, for a pooled worker to count again with its next thread.
+  /// Pages it dirtied but never committed, as when it exits without a
+  /// synchronization, give their twin state and their user back.
+  void threadExit(void) {
+    for(int pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      struct pageinfo * pageinfo = _privatePagesList.get(pageNo);
+      if(pageinfo->committed) {
+        continue;
+      }
+      if(!pageinfo->hasTwinPage) {
+        lockPage(pageNo);
+        _twinStates[pageNo] = TWIN_NONE;
+        unlockPage(pageNo);
+      }
+      pageinfo->committed = true;
+      atomic::decrement(&_pageUsers[pageNo]);
+    }
+    for(int pageNo = _sharedPages.first(); pageNo != -1; pageNo = _sharedPages.next(pageNo)) {
+      forgetSharedPage(pageNo);
+    }
+    if(_writingPid == _pid) {
+      stopWritingDirectly();
+    }
+  }
+
+  /// @return true if this process holds a page lock, or waits for one.
+  bool pageLocksHeld(void) {
+    return (_locksHeld != 0);
+  }
+
+  /// @brief Note whether a commit writes a page other threads write too:
+  /// another thread had it dirty at the same time or committed it last, or
+  /// a thread writing the shared mappings directly changed cache lines we
+  /// wrote. Called with the page locked.
+  inline void accountConflicts(struct pageinfo * pageinfo, void * twin, void * persistent) {
+    int pageNo = pageinfo->pageNo;
+    unsigned long mypid = _pid;
+    unsigned long last = atomic::exchange(&_lastCommitters[pageNo], mypid);
+    if(pageinfo->shared || _pageUsers[pageNo] > 1 || (last != 0 && last != mypid)) {
+      atomic::increment(&_sharedCommits);
+      return;
+    }
+
+    // Nobody else committed to the page since we did: whatever changed in
+    // the shared page under our twin was written in place.
+    if(_counters->directWriters == 0 || _pageDirectWriters[pageNo] != 0 || !pageinfo->hasTwinPage) {
+      return;
+    }
+    unsigned long long ours = pagediff::getInstance().diffLines(pageinfo->pageStart, twin);
+    unsigned long long theirs = pagediff::getInstance().diffLines(persistent, twin);
+    if(ours & theirs) {
+      atomic::increment(&_counters->inPlaceConflicts);
+      atomic::increment(&_sharedCommits);
+    }
+  }
+
+  /// @return the commits of this process to pages other threads had dirty
+  /// too since the last call.
+  unsigned long takeSharedCommits(void) {
+    unsigned long commits = _sharedCommits;
+    _sharedCommits = 0;
+    return commits;
+  }
+
+  /// @return how often any commit found cache lines it wrote changed in place.
+  unsigned long inPlaceConflicts(void) {
+    return _counters->inPlaceConflicts;
+  }
+
+#ifdef LAZY_RELEASE
+  /// @brief A commit to the page at addr happened before a lock this
+  /// thread acquired: check our copy of it, if any, at the next begin.
+  inline void noticePage(void * addr) {
+    if(inRange(addr)) {
+      _noticedPages.insert(computePage((intptr_t)addr - (intptr_t)base()), NULL);
+    }
+  }
+
+  /// @brief Make the next begin check noticed pages only.
+  void setLazyUpdate(void) {
+    _lazyUpdate = true;
+  }
+#endif
+#else
+  void updateAll(void) {
+  // Do nothing.  
+  }
+#endif
+
+  void protectPage(int pageNo) {
+    void * area;
+    int offset = pageNo * xdefines::PageSize;
+    void * start =(void *)((int)base() + offset);
+
+    //fprintf(stderr, "%d : remove protect %x size 0x%x, offset 0x%x\n", getpid(), start, size, offset);
+    // Map to writable share area. 
+    area = mmap (start,
+                 xdefines::PageSize,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED,
+                 _backingFd,
+                 offset);
+
+    if(area == MAP_FAILED) {
+      fprintf(stderr, "Weird, %d remove protect failed!!!\n", getpid());
+      exit(-1);
+    }
+  }
+
+  void setProtectionPeriod(void) {
+    writeProtect(base(), size());
+    _detectPeriod = true; 
+  }
+
+  /// @brief Pages past the heap's bump pointer, which is shared by all
+  /// threads, are not in use: neither prefetched nor write-protected.
+  void setHeapEnd(char ** end) {
+    _heapEnd = end;
+  }
+
+#ifdef UFFD_TRACKING
+  /// @brief Write-protect the pages up to end that are not protected yet.
+  /// Untouched pages cost page table space once protected, so the heap is
+  /// covered as it grows, some slack at a time.
+  inline void extendTracking(void * end) {
+    if(!_uffdTracking || (char *)end <= _trackedEnd) {
+      return;
+    }
+
+    // Not registered in this process yet: begin() covers it.
+    if(_trackingPid != syscall(SYS_getpid)) {
+      return;
+    }
+
+    char * limit = (char *)base() + size();
+    char * newEnd = (char *)end + xdefines::UFFD_TRACKING_SLACK;
+    newEnd = (char *)(((intptr_t)newEnd + xdefines::PageSize - 1) & ~(xdefines::PageSize - 1));
+    if(newEnd > limit) {
+      newEnd = limit;
+    }
+
+    xuffd::getInstance().writeProtect(_trackedEnd, newEnd - _trackedEnd);
+    _trackedEnd = newEnd;
+  }
+#endif
+
+  void unsetProtectionPeriod(void) {
+    _detectPeriod = false;  
+  }
+
+#ifdef DETECT_FALSE_SHARING_OPT
+  void *setPagesRwShared(int start, int stop) {
+    int  offset = start*xdefines::PageSize;
+    void * startAddr = (void *)((int)base() + offset);
+    int size = (stop - start + 1)*xdefines::PageSize;
+    mprotect(startAddr, size, PROT_READ|PROT_WRITE); 
+ }
+
+  void unprotectNonProfitPages(void * end) {
+    int totalpages;
+    if(end == NULL) {
+      totalpages = size()/xdefines::PageSize;
+    }
+    else {
+      totalpages = ((intptr_t)end - (intptr_t)base())/xdefines::PageSize;
+    }
+
+    int start = 0;
+    bool unprotect = false;
+
+    unsetProtectionPeriod(); 
+  }
 #endif
 
   // We don't need to set the page protection.
   void cleanup (void) {
     // Dump the now-unnecessary page frames, reducing space overhead.
-    dirtyListType::iterator i;
-    for (i = _privatePagesList.begin(); i != _privatePagesList.end(); ++i) {
-      struct pageinfo * pageinfo = (struct pageinfo *)i->second;
+    for (int pageNo = _privatePagesList.first(); pageNo != -1; pageNo = _privatePagesList.next(pageNo)) {
+      struct pageinfo * pageinfo = _privatePagesList.get(pageNo);
       madvise (pageinfo->pageStart, xdefines::PageSize, MADV_DONTNEED);
     }
 
@@ -1072,13 +2152,161 @@ private:
     return (index * sizeof(Type)) / xdefines::PageSize;
   }
 
+#ifndef DETECT_FALSE_SHARING_OPT
+  /// @brief Serialize commits to a page with faults that take its twin.
+  /// The fault handler holds off the signals whose handlers commit; the
+  /// others check pageLocksHeld() first, as the lock is not reentrant.
+  inline void lockPage(int pageNo) {
+    atomic::increment(&_locksHeld);
+    while(atomic::exchange(&_pageLocks[pageNo], 1)) {
+      sched_yield();
+    }
+  }
+
+  inline void unlockPage(int pageNo) {
+    atomic::atomic_set(&_pageLocks[pageNo], 0);
+    atomic::decrement(&_locksHeld);
+  }
+
+  /// @brief Before the shared page changes, keep a copy for the thread
+  /// using it as its twin. Called with the page locked.
+  inline void saveElidedTwin(int pageNo) {
+    if(_twinStates[pageNo] == TWIN_ELIDED) {
+      memcpy((void *)((intptr_t)_savedTwins + xdefines::PageSize * pageNo),
+             (void *)((intptr_t)_persistentMemory + xdefines::PageSize * pageNo),
+             xdefines::PageSize);
+      _twinStates[pageNo] = TWIN_SAVED;
+    }
+  }
+#endif
+
+  /// @brief Start a batch of page updates.
+  void beginUpdates (void) {
+    _refreshCalls = 0;
+#ifdef POPULATE_REFRESH
+    _dropRounds++;
+#endif
+#ifdef IO_URING_BATCHING
+    _uringBatching = xuring::getInstance().available();
+#endif
+  }
+
+  /// @brief Finish the page updates queued since beginUpdates().
+  void submitUpdates (void) {
+#ifdef IO_URING_BATCHING
+    if(_uringBatching) {
+      xuring::getInstance().submit();
+      _refreshCalls += xuring::getInstance().takeEnters();
+    }
+#endif
+#ifdef POPULATE_REFRESH
+    populateUpdated();
+#endif
+#ifdef SHERIFF_COUNTERS
+    stats::getInstance().updateRefreshes(_refreshCalls);
+#endif
+  }
+
+#ifdef POPULATE_REFRESH
+  /// @brief Map the updated pages in again, a run at a time, before the
+  /// reads expected to follow fault them in one by one.
+  void populateUpdated (void) {
+    void * runStart = NULL;
+    int runPages = 0;
+
+    for(int pageNo = _refetchPages.first(); pageNo != -1; pageNo = _refetchPages.next(pageNo)) {
+      void * pageStart = (void *)((intptr_t)base() + pageNo * xdefines::PageSize);
+      if(runPages > 0 && pageStart == (void *)((intptr_t)runStart + runPages * xdefines::PageSize)) {
+        runPages++;
+        continue;
+      }
+      if(runPages > 0) {
+        _refreshCalls += MM::populateRead(runStart, runPages * xdefines::PageSize);
+      }
+      runStart = pageStart;
+      runPages = 1;
+    }
+    if(runPages > 0) {
+      _refreshCalls += MM::populateRead(runStart, runPages * xdefines::PageSize);
+    }
+    _refetchPages.clear();
+  }
+#endif
+
   /// @brief Update the given page frame from the backing file.
   void updatePage (void * local, int size) {
+    dropPages(local, size);
+    protectPages(local, size);
+  }
+
+  /// @brief Throw the private contents of the given pages away, so that
+  /// the next access reads them from the backing file again.
+  /// With an io_uring, this waits for submitUpdates().
+  void dropPages (void * local, int size) {
+#ifdef POPULATE_REFRESH
+    // A page this thread dirtied in one of the last few transactions as
+    // well is in its working set, and read again soon: see populateUpdated().
+    int first = ((intptr_t)local - (intptr_t)base()) / xdefines::PageSize;
+    for(int pageNo = first; pageNo < first + size / xdefines::PageSize; pageNo++) {
+      if(_dropStamps[pageNo] != 0
+         && _dropRounds - _dropStamps[pageNo] <= xdefines::POPULATE_TRANSACTIONS) {
+        _refetchPages.insert(pageNo, NULL);
+      }
+      _dropStamps[pageNo] = _dropRounds;
+    }
+#endif
+#ifdef IO_URING_BATCHING
+    if(_uringBatching) {
+      xuring::getInstance().madvise(local, size, MADV_DONTNEED);
+      return;
+    }
+#endif
     madvise (local, size, MADV_DONTNEED);
+    _refreshCalls++;
+  }
+
+  /// @brief Catch the next write to the given pages again.
+  void protectPages (void * local, int size) {
+    _refreshCalls++;
+#ifdef UFFD_TRACKING
+    if(_uffdTracking) {
+      xuffd::getInstance().writeProtect(local, size);
+      return;
+    }
+#endif
 
     // Set this page to PROT_READ again.
     mprotect (local, size, PROT_READ);
   }
+
+#ifndef DETECT_FALSE_SHARING_OPT
+  /// @brief Let writes through to the given pages.
+  void unprotectPages (void * local, int size) {
+#ifdef UFFD_TRACKING
+    if(_uffdTracking) {
+      xuffd::getInstance().unprotect(local, size);
+      return;
+    }
+#endif
+    mprotect (local, size, PROT_READ | PROT_WRITE);
+  }
+#endif
+
+#ifdef UFFD_TRACKING
+  /// @brief Register the private mapping with userfaultfd in this process
+  /// and write-protect everything in use.
+  /// @return false if userfaultfd can not track this region.
+  bool armTracking (void) {
+    if(!xuffd::getInstance().registerRange(base(), size())) {
+      return false;
+    }
+
+    _trackingPid = syscall(SYS_getpid);
+    _trackedEnd = (char *)base();
+    extendTracking(_heapEnd ? *_heapEnd : (char *)base() + size());
+    return true;
+  }
+#endif
  
   /// True if current xpersist.h is a heap.
   bool _isHeap;
@@ -1090,7 +2318,7 @@ private:
   /// The size of the region.
   size_t _startsize;
 
-  /// A map of dirtied pages.
+  /// The pages dirtied in this transaction.
   dirtyListType _privatePagesList;
 
   dirtyListType _savedPagesList;
@@ -1123,9 +2351,6 @@ private:
   // Last thread to modify current cache
   unsigned long * _cacheLastthread;
 
-  // A string of one bits.
-  __m128i allones;
-  
   enum { TotalWordNums = NElts * sizeof(Type)/sizeof(unsigned long) };
   
   // In order to save space, we will use the higher 16 bit to store the thread id
@@ -1133,6 +2358,151 @@ private:
   wordchangeinfo * _wordChanges;
 
   bool _detectPeriod;
+
+#ifndef DETECT_FALSE_SHARING_OPT
+  /// Commits to each page so far, shared by all threads.
+  unsigned long * _pageVersions;
+
+  /// The version each private copy of this process was taken at.
+  unsigned int * _localVersions;
+
+  /// Counters shared by all processes, each on a cache line of its own:
+  /// processes writing the shared mapping directly, and how often any
+  /// process has started or stopped doing so; commits that found cache
+  /// lines they wrote changed in place; and transactions begun so far,
+  /// the clock of probations, which every process adds to in batches of
+  /// CLOCK_TICKS.
+  struct counters {
+    volatile unsigned long directWriters;
+    volatile unsigned long protectionChanges;
+    char pad1[xdefines::CACHE_LINE_SIZE - 2 * sizeof(unsigned long)];
+    volatile unsigned long inPlaceConflicts;
+    char pad2[xdefines::CACHE_LINE_SIZE - sizeof(unsigned long)];
+    volatile unsigned long transactionClock;
+  };
+  struct counters * _counters;
+  unsigned long _seenProtectionChanges;
+
+  /// Transactions of this process not yet added to the clock.
+  unsigned long _clockTicks;
+
+  /// The process that counted itself in directWriters, if any. A new
+  /// thread inherits the shared mappings but not the count.
+  pid_t _writingPid;
+
+  /// Commits of this process to pages others had dirty too.
+  volatile unsigned long _sharedCommits;
+
+  /// The process that committed to each page last.
+  volatile unsigned long * _lastCommitters;
+
+  /// The page a write fault continuing the current sweep would hit, and
+  /// how many pages were taken ahead for the last one.
+  int _sweepNext;
+  int _sweepPages;
+
+  /// Per page, the last transaction of this process that wrote it, and
+  /// how many transactions in a row wrote it up to that one.
+  unsigned int * _writeStamps;
+  unsigned char * _writeStreaks;
+  unsigned int _transactions;
+  pid_t _historyPid;
+
+  /// This process, see threadStart().
+  pid_t _pid;
+
+  /// Pages to twin as the transaction begins, see twinPredictedPages().
+  dirtyListType _predictedPages;
+
+  /// Those of them whose private copy was not dropped.
+  dirtyListType _keptCopies;
+
+  /// Whether some thread uses the shared page as its twin, per page.
+  enum { TWIN_NONE = 0, TWIN_ELIDED, TWIN_SAVED };
+  volatile unsigned char * _twinStates;
+
+  /// The shared pages saved for those threads before a commit changed them.
+  void * _savedTwins;
+  bool _twinElision;
+
+  unsigned long * _pageLocks;
+
+  /// Page locks this process holds or waits for, commit helpers included.
+  volatile unsigned long _locksHeld;
+
+  /// How isolating each page pays off, shared by all threads and updated
+  /// with the page locked: the balance and commits of the current window,
+  /// and for a page left shared, since when and how many probations failed.
+  struct isolation {
+    int balance;
+    unsigned short commits;
+    unsigned char state;
+    unsigned char strikes;
+    unsigned long since;
+  };
+  enum { ISOLATION_ON = 0, ISOLATION_OFF, ISOLATION_PROBATION, ISOLATION_PINNED };
+  struct isolation * _isolation;
+
+  /// Processes writing each page in place, see sharePage().
+  unsigned long * _pageDirectWriters;
+
+  /// The pages this process writes in place.
+  dirtyListType _sharedPages;
+
+#ifdef ATOMIC_SYNC
+  /// Pages this thread wrote when it last polled.
+  struct polledpage _polled[xdefines::POLL_PAGES];
+  int _polledCount;
+
+  /// Pages pinned shared that this thread writes in place for now, and
+  /// whether the next begin drops every copy.
+  dirtyListType _openFences;
+  bool _dropCopies;
+#endif
+
+#ifdef LAZY_RELEASE
+  /// Pages noticed since the last begin, and whether that begin follows
+  /// a lazy acquire.
+  dirtyListType _noticedPages;
+  bool _lazyUpdate;
+#endif
+#endif
+
+  /// The dirty pages of a parallel commit, in page order.
+  struct pageinfo ** _commitPages;
+  int _commitPagesSize;
+
+  /// System calls made by the current batch of page updates.
+  unsigned long _refreshCalls;
+
+#ifdef IO_URING_BATCHING
+  /// True if this process drops pages through its io_uring.
+  bool _uringBatching;
+#endif
+
+#ifdef POPULATE_REFRESH
+  /// Pages updated since beginUpdates(), to map in again at submitUpdates().
+  dirtyListType _refetchPages;
+
+  /// The batch of updates in which each page was last updated; only the
+  /// entries of pages this process writes are ever touched.
+  unsigned int * _dropStamps;
+  unsigned int _dropRounds;
+#endif
+
+#ifdef UFFD_TRACKING
+  /// True while writes are tracked with userfaultfd instead of mprotect.
+  bool _uffdTracking;
+
+  /// The process that registered the private mapping.
+  pid_t _trackingPid;
+
+  /// Everything below is write-protected in that process.
+  char * _trackedEnd;
+#endif
+
+  /// The heap's bump pointer, or NULL for the globals.
+  char ** _heapEnd;
  
 #ifdef GET_CHARACTERISTICS
   xpageprof<Type, NElts>  _pageprof;
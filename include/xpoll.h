@@ -0,0 +1,225 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xpoll.h
+ * @brief  Sampling threads that poll (ATOMIC_SYNC).
+ *
+ *         A thread that waits on an atomic word instead of a pthread call
+ *         never ends its transaction: what it writes stays in its private
+ *         copies, and so does a word it spins on after writing it once.
+ *         Every thread is sampled on a timer of its own CPU time. A thread
+ *         that went a few samples without synchronizing, writing a few
+ *         pages only, seems to poll, and its transaction is ended from the
+ *         sample as if it had synchronized there.
+ *
+ *         That is only safe where the program's own code was interrupted:
+ *         samples landing in the runtime, the C library or the dynamic
+ *         linker, which may hold locks or be in the middle of a commit, are
+ *         skipped, and so are those taken while the runtime works for the
+ *         thread further up the stack. Even then, the transaction is only
+ *         committed and begun again: no stdio buffer is flushed and no
+ *         biased lock handed over from the handler. Timers are not
+ *         inherited by cloned processes, so every new thread arms its own.
+ *         The timer counts time spent running the program only, and the
+ *         handler is installed with SA_RESTART, so that system calls that
+ *         can be restarted are.
+ *
+ *         Pages threads race for end up pinned shared (see
+ *         xpersist::fencedWrite()), and read-only while the thread has
+ *         private writes that are not committed: the first write to one
+ *         commits them and refreshes everything, then leaves the page
+ *         writable until the thread writes a private page again. So a
+ *         word stored there never overtakes the private writes made
+ *         before it, and a thread that spins on one reads every other page
+ *         afresh. Writes the C library makes for the program are the
+ *         program's. Writes of the runtime only leave the page writable.
+ */
+
+#ifndef SHERIFF_XPOLL_H
+#define SHERIFF_XPOLL_H
+
+#include <dlfcn.h>
+#include <link.h>
+#include <new>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/auxv.h>
+#include <sys/time.h>
+
+#include "xdefines.h"
+#include "realfuncs.h"
+#include "x86insn.h"
+
+class xpoll {
+public:
+
+  static xpoll& getInstance (void) {
+    static char buf[sizeof(xpoll)];
+    static xpoll * theOneTrueObject = new (buf) xpoll();
+    return *theOneTrueObject;
+  }
+
+  /// @brief Find the code no transaction may end in, and take samples
+  /// with handler from now on. Called before any thread is spawned.
+  void initialize (void (*handler)(int, siginfo_t *, void *)) {
+    // Each object is known by an address inside it.
+    _probes[0] = (uintptr_t)handler;
+    _probes[1] = (uintptr_t)&abort;
+    _probes[2] = (uintptr_t)&dlsym;
+    _probes[3] = (uintptr_t)WRAP(pthread_create);
+    _probes[4] = (uintptr_t)getauxval(AT_BASE);
+    _ranges = 0;
+    dl_iterate_phdr (addObject, this);
+
+    struct sigaction siga;
+    sigemptyset (&siga.sa_mask);
+    sigaddset (&siga.sa_mask, SIGALRM);
+#ifdef BIASED_LOCKS
+    sigaddset (&siga.sa_mask, SIGRTMIN + xdefines::REVOKE_SIGNAL);
+#endif
+    siga.sa_flags = SA_SIGINFO | SA_RESTART;
+    siga.sa_sigaction = handler;
+    if (sigaction (SIGVTALRM, &siga, NULL) == -1) {
+      fprintf (stderr, "Signal handler for SIGVTALRM failed to install.\n");
+      exit (-1);
+    }
+    threadStart();
+  }
+
+  /// @brief Sample this thread, a new one, from now on.
+  void threadStart (void) {
+    _samples = 0;
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = xdefines::POLL_INTERVAL;
+    timer.it_value = timer.it_interval;
+    setitimer (ITIMER_VIRTUAL, &timer, NULL);
+  }
+
+  /// @brief This thread ends a transaction.
+  inline void boundary (void) {
+    _samples = 0;
+  }
+
+  /// @brief Take a sample of this thread, interrupted at context with
+  /// dirty pages written in its transaction.
+  /// @return true if it seems to poll, and its transaction may end here.
+  bool sample (void * context, unsigned long dirty) {
+    if (dirty > (unsigned long)xdefines::POLL_PAGES) {
+      _samples = 0;
+      return false;
+    }
+    if (++_samples < (unsigned long)xdefines::POLL_SAMPLES) {
+      return false;
+    }
+    return !inRuntime (context);
+  }
+
+  /// @return true if the runtime, the C library or the dynamic linker was
+  /// interrupted at context.
+  inline bool inRuntime (void * context) const {
+    return inRuntime (pc (context), false);
+  }
+
+  /// @return true if this library itself was interrupted at context.
+  inline bool inSheriff (void * context) const {
+    return inRuntime (pc (context), true);
+  }
+
+private:
+
+  xpoll (void)
+    : _ranges (0),
+      _samples (0)
+  {}
+
+  static uintptr_t pc (void * context) {
+    return (uintptr_t) x86insn::pc (context);
+  }
+
+  inline bool inRuntime (uintptr_t pc, bool sheriff) const {
+    for (int i = 0; i < _ranges; i++) {
+      if (pc >= _range[i].start && pc < _range[i].end && (_range[i].sheriff || !sheriff)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// @brief Note the code of a loaded object, if a probe lies in it.
+  static int addObject (struct dl_phdr_info * info, size_t size, void * data) {
+    xpoll * poll = (xpoll *) data;
+
+    bool runtime = false;
+    bool sheriff = false;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+      const ElfW(Phdr) * phdr = &info->dlpi_phdr[i];
+      if (phdr->p_type != PT_LOAD) {
+        continue;
+      }
+      uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+      for (int probe = 0; probe < PROBES; probe++) {
+        if (poll->_probes[probe] >= start && poll->_probes[probe] < start + phdr->p_memsz) {
+          runtime = true;
+          sheriff |= (probe == 0);
+        }
+      }
+    }
+    if (!runtime) {
+      return 0;
+    }
+
+    for (int i = 0; i < info->dlpi_phnum && poll->_ranges < RANGES; i++) {
+      const ElfW(Phdr) * phdr = &info->dlpi_phdr[i];
+      if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) {
+        poll->_range[poll->_ranges].start = info->dlpi_addr + phdr->p_vaddr;
+        poll->_range[poll->_ranges].end = info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz;
+        poll->_range[poll->_ranges].sheriff = sheriff;
+        poll->_ranges++;
+      }
+    }
+    return 0;
+  }
+
+  /// This library (the first probe), the C library, libdl, libpthread and
+  /// the dynamic linker.
+  enum { PROBES = 5 };
+  uintptr_t _probes[PROBES];
+
+  /// Their code, and whether it is this library's.
+  enum { RANGES = 16 };
+  struct range {
+    uintptr_t start;
+    uintptr_t end;
+    bool sheriff;
+  };
+  struct range _range[RANGES];
+  int _ranges;
+
+  /// Samples of this thread in its current transaction.
+  unsigned long _samples;
+};
+
+#endif
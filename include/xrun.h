@@ -31,6 +31,9 @@
 #ifndef SHERIFF_XRUN_H
 #define SHERIFF_XRUN_H
 
+#include <stdio.h>
+#include <stdio_ext.h>
+
 #include "xdefines.h"
 
 // threads
@@ -48,6 +51,14 @@
 
 #include "xsync.h"
 
+#ifdef ATOMIC_SYNC
+#include <errno.h>
+#include <linux/futex.h>
+#if !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+#include "xpoll.h"
+#endif
+#endif
+
 // Grace utilities
 #include "atomic.h"
 
@@ -57,6 +68,10 @@ private:
 
   xrun()
   : _locksHeld (0),
+    _quietReads (0),
+    _runtimeDepth (0),
+    _revokePending (false),
+    _droppedReported (false),
     _memory (xmemory::getInstance()),
     _isInitialized (false),
     _isProtected (false)
@@ -91,6 +106,14 @@ public:
       
       // Set thread to spawn no more threads than number of processors.
       _thread.setMaxThreads (HL::CPUInfo::getNumProcessors());
+
+    #if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+      xpoll::getInstance().initialize(pollHandle);
+      _memory.setFenceHandler(fenceHandle);
+    #endif
+    #ifdef BIASED_LOCKS
+      installRevokeHandler();
+    #endif
    } else {
       fprintf(stderr, "%d : OH NOES\n", getpid());
       ::abort();
@@ -114,6 +137,9 @@ public:
     // If the tid was set, it means that this instance was
     // initialized: end the transaction (at the end of main()).
     _memory.finalize();
+  #ifdef THREAD_POOL
+    _thread.finalize(this);
+  #endif
   }
 
   /* Transaction-related functions. */
@@ -124,6 +150,15 @@ public:
  
     // Since we are a new thread, we need to use the new heap.
     _memory.setThreadIndex(threadindex+1);
+  #if !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    _memory.threadStart();
+  #endif
+    _sync.thread_start();
+    _quietReads = 0;
+    forgetSyscalls();
+  #if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    xpoll::getInstance().threadStart();
+  #endif
 
     return;
   }   
@@ -144,21 +179,38 @@ public:
     return _thread.getId();
   }
 
-  /// @brief Spawn a thread.
+  /// @brief Spawn a thread, on a parked worker unless parked is false.
   /// @return an opaque object used by sync.
-  inline void * spawn (threadFunction * fn, void * arg)
+  inline void * spawn (threadFunction * fn, void * arg, bool parked = true)
   {
     _locksHeld = 0;
-    return _thread.spawn (this, fn, arg);
+    void * thread = _thread.spawn (this, fn, arg, parked);
+    forgetSyscalls();
+    return thread;
   }
 
   /// @brief Wait for a thread.
   inline void join (void * v, void ** result) {
-  #if defined(DETECT_FALSE_SHARING) || defined(DETECT_FALSE_SHARING_OPT)
-    _memory.stopCheckingTimer();
+    aboutToBlock();
+    _thread.join (this, v, result);
+    forgetSyscalls();
+  }
+
+  /// @brief This thread is done running user code and about to exit.
+  inline void threadExit (void) {
+  #if !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    _memory.threadExit();
   #endif
+  }
 
-    _thread.join (this, v, result);
+  /// @brief This thread called pthread_exit(): its joiner gets the value.
+  inline void exitThread (void * retval) {
+    _thread.exitThread(this, retval);
+  }
+
+  /// @brief Do a pthread_detach
+  inline void detach (void * v) {
+    _thread.detach(this, v);
   }
 
   /// @brief Do a pthread_cancel
@@ -174,7 +226,9 @@ public:
 
   /* Heap-related functions. */
   void * malloc (size_t sz) {
+    enterRuntime();
     void * ptr = _memory.malloc (sz, _hasProtected);
+    leaveRuntime();
     return ptr;
   }
 
@@ -186,7 +240,9 @@ public:
   // In fact, we can delay to open its information about heap.
   inline void free (void * ptr) {
     //fprintf(stderr, "Now free object at ptr %p\n", ptr);
+    enterRuntime();
     _memory.free (ptr);
+    leaveRuntime();
   }
 
   inline size_t getSize (void * ptr) {
@@ -204,7 +260,9 @@ public:
       return NULL;
     }
 
+    enterRuntime();
     newptr = _memory.realloc (ptr, sz, _hasProtected);
+    leaveRuntime();
     return newptr;
   }
 
@@ -239,34 +297,169 @@ public:
   // cause a deadlock.
 
   void mutex_lock(pthread_mutex_t * mutex) {
+    mutex_timedlock(mutex, NULL);
+  }
+
+  /// @return 0, or ETIMEDOUT if abstime (unless NULL) passed first.
+  int mutex_timedlock(pthread_mutex_t * mutex, const struct timespec * abstime) {
+  #ifdef BIASED_LOCKS
+    if(_isProtected && relock(mutex)) {
+      countSyncOp(stats::SYNC_LOCK);
+      return 0;
+    }
+  #endif
     atomicEnd(true, true);
-    _sync.mutex_lock(mutex);
+    // The timer only stops for a thread that really waits.
+    int result = _sync.mutex_trylock(mutex);
+    if(result != 0) {
+      aboutToBlock();
+      result = _sync.mutex_timedlock(mutex, abstime);
+    }
+    if(result == 0) {
+      acquireNotices(mutex);
+    }
     atomicBegin(false, false);
+    countSyncOp(stats::SYNC_LOCK);
+    return result;
+  }
+
+  /// @return 0, or EBUSY if another thread holds the lock.
+  int mutex_trylock(pthread_mutex_t * mutex) {
+  #ifdef BIASED_LOCKS
+    if(_isProtected && relock(mutex)) {
+      countSyncOp(stats::SYNC_LOCK);
+      return 0;
+    }
+  #endif
+    // A failed try synchronizes with nobody: the transaction goes on.
+    int result = _sync.mutex_trylock(mutex);
+    if(result != 0) {
+      return result;
+    }
+    atomicEnd(true, true);
+    acquireNotices(mutex);
+    atomicBegin(false, false);
+    countSyncOp(stats::SYNC_LOCK);
+    return result;
   }
 
   void mutex_unlock(pthread_mutex_t * mutex) {
+  #ifdef BIASED_LOCKS
+    // The commit waits for whoever wants the lock next.
+    if(_isProtected && keep(mutex)) {
+      countSyncOp(stats::SYNC_UNLOCK);
+      return;
+    }
+  #endif
     atomicEnd(false, true);
+    releaseNotices(mutex);
     _sync.mutex_unlock(mutex);
+    // A release has nothing new to see.
+    acquireNotices(NULL);
     atomicBegin(true, false);
+    countSyncOp(stats::SYNC_UNLOCK);
   }
 
   int mutex_destroy(pthread_mutex_t * mutex) {
+    enterRuntime();
     _sync.mutex_destroy(mutex);
+    leaveRuntime();
+    return 0;
+  }
+
+  ///// reader-writer lock functions
+  int rwlock_init(pthread_rwlock_t * rwlock) {
+    _sync.rwlock_init(rwlock, false);
+    return 0;
+  }
+
+  int rwlock_destroy(pthread_rwlock_t * rwlock) {
+    _sync.rwlock_destroy(rwlock);
+    return 0;
+  }
+
+  int rwlock_rdlock(pthread_rwlock_t * rwlock, const struct timespec * abstime) {
+    return takeRwlock(rwlock, false, false, abstime);
+  }
+
+  int rwlock_tryrdlock(pthread_rwlock_t * rwlock) {
+    return takeRwlock(rwlock, false, true, NULL);
+  }
+
+  int rwlock_wrlock(pthread_rwlock_t * rwlock, const struct timespec * abstime) {
+    return takeRwlock(rwlock, true, false, abstime);
+  }
+
+  int rwlock_trywrlock(pthread_rwlock_t * rwlock) {
+    return takeRwlock(rwlock, true, true, NULL);
+  }
+
+  int rwlock_unlock(pthread_rwlock_t * rwlock) {
+    // A reader with nothing to commit has nothing to pass on either.
+    if(quietRead() && !_sync.rwlock_writing(rwlock)) {
+      _quietReads++;
+      return _sync.rwlock_unlock(rwlock);
+    }
+    atomicEnd(false, true);
+    int result = _sync.rwlock_unlock(rwlock);
+    acquireNotices(NULL);
+    atomicBegin(true, false);
+    countSyncOp(stats::SYNC_UNLOCK);
+    return result;
+  }
+
+  ///// spin lock functions: mutexes without a bias or write notices.
+  int spin_init(pthread_spinlock_t * lock) {
+    _sync.spin_init((void *)lock, false);
     return 0;
   }
 
+  int spin_destroy(pthread_spinlock_t * lock) {
+    _sync.spin_destroy((void *)lock);
+    return 0;
+  }
+
+  int spin_lock(pthread_spinlock_t * lock, bool trying) {
+    // As for mutexes, a failed try is no boundary.
+    int result = 0;
+    if(trying && (result = _sync.spin_trylock((void *)lock)) != 0) {
+      return result;
+    }
+    atomicEnd(true, true);
+    if(!trying && (result = _sync.spin_trylock((void *)lock)) != 0) {
+      aboutToBlock();
+      result = _sync.spin_lock((void *)lock);
+    }
+    atomicBegin(false, false);
+    countSyncOp(stats::SYNC_LOCK);
+    return result;
+  }
+
+  int spin_unlock(pthread_spinlock_t * lock) {
+    atomicEnd(false, true);
+    int result = _sync.spin_unlock((void *)lock);
+    acquireNotices(NULL);
+    atomicBegin(true, false);
+    countSyncOp(stats::SYNC_UNLOCK);
+    return result;
+  }
+
   int barrier_wait(pthread_barrier_t *barrier) {
     atomicEnd(true, true);
-    _sync.barrier_wait(barrier);
+    int result = _sync.barrier_wait(barrier, blocking);
     atomicBegin(true, false);
-    return 0;
+    countSyncOp(stats::SYNC_BARRIER);
+    return result;
   }
 
   /// FIXME: whether we can using the order like this.
   void cond_wait(void * cond, void * lock) {
     atomicEnd(false, true);
+    aboutToBlock();
+    releaseNotices((pthread_mutex_t *)lock);
     _sync.cond_wait (cond, lock);
     atomicBegin(false, false);
+    countSyncOp(stats::SYNC_WAIT);
   }
 
   void cond_broadcast (void * cond) {
@@ -279,6 +472,7 @@ public:
       _sync.cond_broadcast (cond);
       atomicBegin(true, false);
     }
+    countSyncOp(stats::SYNC_SIGNAL);
   }
 
   void cond_signal (void * cond) {
@@ -291,37 +485,456 @@ public:
        _sync.cond_signal (cond);
       atomicBegin(true, false);
     }
+    countSyncOp(stats::SYNC_SIGNAL);
   }
 
+#ifdef ATOMIC_SYNC
+  /// @brief A futex system call the program made itself. A wait acquires
+  /// and a wake releases, like the pthread operations such a word stands
+  /// for; both refresh everything, since a waker often goes on to read
+  /// what its wakee published without ever waiting. Threads are processes:
+  /// the futex can not be private, and its word has to be shared for the
+  /// kernel to find it from every one of them.
+  long futex(int * uaddr, int op, int val, const struct timespec * timeout, int * uaddr2, int val3) {
+    int cmd = op & FUTEX_CMD_MASK;
+    bool wait = (cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET || cmd == FUTEX_LOCK_PI
+                 || cmd == FUTEX_TRYLOCK_PI || cmd == FUTEX_WAIT_REQUEUE_PI);
+    bool second = (cmd == FUTEX_REQUEUE || cmd == FUTEX_CMP_REQUEUE || cmd == FUTEX_WAKE_OP
+                   || cmd == FUTEX_WAIT_REQUEUE_PI || cmd == FUTEX_CMP_REQUEUE_PI);
+    op &= ~FUTEX_PRIVATE_FLAG;
+
+    atomicEnd(true, true);
+    pinWord(uaddr);
+    if(second) {
+      pinWord(uaddr2);
+    }
+    if(wait) {
+      aboutToBlock();
+    }
+    long result = WRAP(syscall)(SYS_futex, uaddr, op, val, timeout, uaddr2, val3);
+    int error = errno;
+    atomicBegin(!wait, false);
+    stats::getInstance().updatePolling(1, 0, 0, 0);
+    countSyncOp(wait ? stats::SYNC_WAIT : stats::SYNC_SIGNAL);
+    errno = error;
+    return result;
+  }
+#endif
+
+#if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+  /// @brief Sample the running thread: see xpoll.h.
+  static void pollHandle(int signum, siginfo_t * siginfo, void * context) {
+    xrun::getInstance().pollSample(context);
+  }
+
+  /// @brief A write faulted on a fenced page: see fenceWrite().
+  static void fenceHandle(void * page, void * context) {
+    xrun::getInstance().fenceWrite(page, context);
+  }
+#endif
+
   /// @brief Start a transaction.
   void atomicBegin(bool startTimer, bool startThread) {
     if(!_isProtected)
       return;
 
     // Now start.
+    enterRuntime();
     _memory.begin(startTimer, startThread);
+    leaveRuntime();
   }
 
   /// @brief End a transaction, aborting it if necessary.
   void atomicEnd(bool doChecking, bool updateTrans) {
     if(!_isProtected)
       return;
+
+  #if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    xpoll::getInstance().boundary();
+  #endif
   
     // First, attempt to commit.
+    enterRuntime();
     _memory.commit(doChecking, updateTrans);
+    handOverBiasedLocks();
+    leaveRuntime();
+
+    if(_quietReads != 0) {
+      stats::getInstance().updateQuietReads(_quietReads);
+      _quietReads = 0;
+    }
+
+    // Flush the stdout, if anything was printed.
+    if(__fpending(stdout) > 0) {
+      fflush(stdout);
+    #if defined(SYSCALL_COUNTERS) && !defined(DETECT_FALSE_SHARING)
+      _memory.countSyscalls(1);
+    #endif
+    }
+  }
+
+private:
+
+  /// @brief Take a reader-writer lock. A reader that has nothing to
+  /// commit, gets in right away and already saw the last write release of
+  /// the lock needs neither a commit nor a refresh.
+  int takeRwlock(pthread_rwlock_t * rwlock, bool write, bool trying, const struct timespec * abstime) {
+    if(!write && quietRead() && _sync.rwlock_tryrdlock(rwlock) == 0) {
+      if(_sync.rwlock_seen(rwlock)) {
+        _quietReads++;
+        return 0;
+      }
+      // Nothing waited for: only the refresh is needed.
+      atomicEnd(true, true);
+      _sync.rwlock_see(rwlock);
+      atomicBegin(false, false);
+      countSyncOp(stats::SYNC_LOCK);
+      return 0;
+    }
+
+    // As for mutexes, a failed try is no boundary.
+    int result = 0;
+    if(trying) {
+      result = write ? _sync.rwlock_trywrlock(rwlock) : _sync.rwlock_tryrdlock(rwlock);
+      if(result != 0) {
+        return result;
+      }
+    }
+    atomicEnd(true, true);
+    if(!trying) {
+      result = write ? _sync.rwlock_trywrlock(rwlock) : _sync.rwlock_tryrdlock(rwlock);
+      if(result != 0) {
+        aboutToBlock();
+        result = write ? _sync.rwlock_wrlock(rwlock, abstime) : _sync.rwlock_rdlock(rwlock, abstime);
+      }
+    }
+    if(result == 0) {
+      _sync.rwlock_see(rwlock);
+    }
+    atomicBegin(false, false);
+    countSyncOp(stats::SYNC_LOCK);
+    return result;
+  }
 
-    // Flush the stdout.
-    fflush(stdout);
+#if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+  /// @brief End the transaction of a thread that seems to poll where the
+  /// sample interrupted it, as if it synchronized there. Pages it races
+  /// for with other threads are pinned on the way.
+  void pollSample(void * context) {
+    xpoll & poll = xpoll::getInstance();
+    if(!_isProtected || _runtimeDepth != 0 || _memory.pageLocksHeld()
+       || !poll.sample(context, _memory.countDirtyPages())) {
+      return;
+    }
+
+    int error = errno;
+    unsigned long dropped = _memory.pinPolledPages();
+    signalEnd();
+    _memory.dropCopies();
+    signalBegin();
+    stats::getInstance().updatePolling(0, 1, 0, 0);
+    if(dropped != 0) {
+      reportDroppedWords(dropped);
+    }
+    forgetSyscalls();
+    errno = error;
+  }
+
+  /// @brief The program writes a page pinned shared, where a word other
+  /// threads synchronize on lies: the write may release it, or take it.
+  /// So whatever the thread wrote before is committed, and everything is
+  /// refreshed, before the page is left writable in place; it is fenced
+  /// again as soon as the thread writes a private page (see
+  /// xpersist::closeFences()). Writes from the C library count as the
+  /// program's. Writes from the runtime only leave the page writable:
+  /// they are not the program's, and may well come in the middle of a
+  /// commit.
+  void fenceWrite(void * page, void * context) {
+    if(_isProtected && _runtimeDepth == 0 && !xpoll::getInstance().inSheriff(context)) {
+      int error = errno;
+      signalEnd();
+      _memory.dropCopies();
+      signalBegin();
+      stats::getInstance().updatePolling(0, 0, 0, 1);
+      forgetSyscalls();
+      errno = error;
+    }
+    _memory.openFence(page);
+  }
+
+  /// @brief End a transaction from a signal handler. The C library may be
+  /// interrupted anywhere, holding any of its locks, so only the commit
+  /// is done: stdio is flushed at the next synchronization, and biased
+  /// locks are handed over then, or by a revocation.
+  void signalEnd(void) {
+    xpoll::getInstance().boundary();
+    enterRuntime();
+    _memory.commit(true, true);
+    leaveRuntime();
+  }
+
+  void signalBegin(void) {
+    enterRuntime();
+    _memory.begin(true, false);
+    leaveRuntime();
+  }
+
+  /// @brief Say once, loudly, that the data of the program is broken.
+  void reportDroppedWords(unsigned long dropped) {
+    static const char message[] =
+      "Sheriff: threads polling and writing the same words raced, writes were lost.\n";
+
+    stats::getInstance().updateDroppedWords(dropped);
+    if(!_droppedReported) {
+      _droppedReported = true;
+      ssize_t written = WRAP(write)(2, message, sizeof(message) - 1);
+      (void) written;
+    }
+  }
+#endif
+
+#ifdef ATOMIC_SYNC
+  /// @brief Pin the page of a futex word, under Sheriff-Protect.
+  inline void pinWord(void * addr) {
+  #if !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    _memory.pinWord(addr);
+  #endif
+  }
+#endif
+
+public:
+
+  /// @brief A system call is about to write [buf, buf + count). The kernel
+  /// fails with EFAULT on fenced pages instead of faulting (ATOMIC_SYNC):
+  /// if there are any, the call is fenced as a whole, as a write of the
+  /// program to them would be.
+  /// Pass on the result for the other buffers of the same call.
+  /// @return true if it is: then syscallWritten() follows the call.
+  bool syscallWrites(void * buf, size_t count, bool fenced = false) {
+  #if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    if(!_isProtected || count == 0) {
+      return false;
+    }
+    char * page = (char *)((intptr_t)buf & ~xdefines::PAGE_SIZE_MASK);
+    char * last = (char *)buf + count - 1;
+    for(; page <= last; page += xdefines::PageSize) {
+      if(_memory.isFenced(page)) {
+        if(!fenced) {
+          atomicEnd(true, true);
+          fenced = true;
+        }
+        mprotect(page, xdefines::PageSize, PROT_READ | PROT_WRITE);
+      }
+    }
+  #endif
+    return fenced;
+  }
+
+  /// @brief This thread left the runtime, or is about to make a system
+  /// call: hand over the biased locks other threads asked for meanwhile,
+  /// see revokeBiases(). Before a call that may block it, hand over those
+  /// it is not inside of anyway: nobody could ask for them until it is
+  /// back.
+  inline void revokeDue(bool blocking) {
+  #ifdef BIASED_LOCKS
+    if(_runtimeDepth == 0 && (_revokePending || (blocking && _sync.mutex_idle()))) {
+      revokeBiases(blocking);
+    }
+  #endif
+  }
+
+  /// @brief Warn of atomic instructions on isolated memory while on is
+  /// set: see xmemory::checkAtomics(). Threads spawned meanwhile inherit
+  /// the setting.
+  inline void checkAtomics(bool on) {
+  #if !defined(DETECT_FALSE_SHARING)
+    _memory.checkAtomics(on);
+  #endif
+  }
+
+  /// @brief The program mapped memory: see xthread::spawn().
+  inline void programMapped(void) {
+  #ifdef THREAD_POOL
+    _thread.programMapped();
+  #endif
+  }
+
+  /// @brief The system call is done: fence its pages again.
+  void syscallWritten(void) {
+  #if defined(ATOMIC_SYNC) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    int error = errno;
+    atomicBegin(true, false);
+    stats::getInstance().updatePolling(0, 0, 0, 1);
+    errno = error;
+  #endif
   }
 
 private:
 
+  /// @return true if this thread has no writes of its own to commit,
+  /// under Sheriff-Protect.
+  inline bool quietRead(void) {
+  #if !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    return (_isProtected && !_memory.hasDirtyPages());
+  #else
+    return false;
+  #endif
+  }
+
+  /// @brief Account a synchronization operation with the system calls
+  /// made at its transaction boundary (SYSCALL_COUNTERS).
+  inline void countSyncOp(int op) {
+  #if defined(SYSCALL_COUNTERS) && !defined(DETECT_FALSE_SHARING)
+    if(_isProtected) {
+      stats::getInstance().updateSyncSyscalls(op, _memory.takeSyscalls());
+    }
+  #endif
+  }
+
+  /// @brief This thread may block now. The periodic check has nothing new
+  /// to look at until it runs again, so it does not wake it up meanwhile.
+  inline void aboutToBlock(void) {
+  #if defined(DETECT_FALSE_SHARING) || defined(DETECT_FALSE_SHARING_OPT)
+    _memory.stopCheckingTimer();
+  #endif
+  }
+
+  static void blocking(void) {
+    xrun::getInstance().aboutToBlock();
+  }
+
+  /// @brief Thread creation and joins are not counted.
+  inline void forgetSyscalls(void) {
+  #if defined(SYSCALL_COUNTERS) && !defined(DETECT_FALSE_SHARING)
+    _memory.takeSyscalls();
+  #endif
+  }
+
+  /// @brief The runtime works on the transaction of this thread, or on
+  /// state a revocation of its biased locks works on: see revokeBiases().
+  /// No polling sample or fenced write ends a transaction meanwhile.
+  inline void enterRuntime(void) {
+  #if defined(BIASED_LOCKS) || defined(ATOMIC_SYNC)
+    _runtimeDepth++;
+  #endif
+  }
+
+  inline void leaveRuntime(void) {
+  #if defined(BIASED_LOCKS) || defined(ATOMIC_SYNC)
+    _runtimeDepth--;
+  #endif
+  #ifdef BIASED_LOCKS
+    revokeDue(false);
+  #endif
+  }
+
+#ifdef BIASED_LOCKS
+  inline bool relock(pthread_mutex_t * mutex) {
+    enterRuntime();
+    bool relocked = _sync.mutex_relock(mutex);
+    leaveRuntime();
+    return relocked;
+  }
+
+  inline bool keep(pthread_mutex_t * mutex) {
+    enterRuntime();
+    bool kept = _sync.mutex_keep(mutex);
+    leaveRuntime();
+    return kept;
+  }
+
+  /// @brief Another thread waits for a lock biased to this one, which may
+  /// not synchronize again for a long time. Signalled, it only takes note
+  /// (see revokeHandle()): it may be anywhere, inside libc or in runtime
+  /// code not known to be busy. It commits and hands its biased locks over
+  /// where it is known to be idle: when it leaves the runtime, and before
+  /// the system calls it makes through us. Unless all, only if somebody
+  /// still waits.
+  void revokeBiases(bool all) {
+    _revokePending = false;
+    if(!_isProtected || (!all && !_sync.mutex_awaited())) {
+      return;
+    }
+
+    int error = errno;
+    _runtimeDepth++;
+    _memory.commit(false, true);
+    handOverBiasedLocks();
+    _memory.begin(false, false);
+    _runtimeDepth--;
+    errno = error;
+  }
+
+  static void revokeHandle(int signum, siginfo_t * siginfo, void * context) {
+    xrun::getInstance()._revokePending = true;
+  }
+
+  void installRevokeHandler(void) {
+    struct sigaction siga;
+    sigemptyset (&siga.sa_mask);
+    sigaddset (&siga.sa_mask, SIGALRM);
+  #ifdef ATOMIC_SYNC
+    sigaddset (&siga.sa_mask, SIGVTALRM);
+  #endif
+    siga.sa_flags = SA_SIGINFO | SA_RESTART;
+    siga.sa_sigaction = revokeHandle;
+    if (sigaction (xsync::revokeSignal(), &siga, NULL) == -1) {
+      fprintf (stderr, "Signal handler for bias revocations failed to install.\n");
+      exit (-1);
+    }
+  }
+#endif
+
+  /// @brief Unlock the locks biased to this thread, now that the writes
+  /// made under them are committed. Any synchronization but taking them
+  /// again does it, so that a thread blocking here never keeps a lock
+  /// another thread needs to get to it.
+  inline void handOverBiasedLocks(void) {
+  #ifdef BIASED_LOCKS
+    pthread_mutex_t * mutex;
+    while((mutex = _sync.mutex_unbias()) != NULL) {
+      releaseNotices(mutex);
+      _sync.mutex_unlock(mutex);
+    }
+  #endif
+  }
+
+  /// @brief With lazy release consistency, a lock was just acquired, or
+  /// released for a NULL mutex: see xmemory::acquireNotices().
+  inline void acquireNotices(pthread_mutex_t * mutex) {
+  #if defined(LAZY_RELEASE) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    if(_isProtected) {
+      _memory.acquireNotices(mutex ? _sync.mutex_clock(mutex) : NULL);
+    }
+  #endif
+  }
+
+  /// @brief With lazy release consistency, the lock is about to be released.
+  inline void releaseNotices(pthread_mutex_t * mutex) {
+  #if defined(LAZY_RELEASE) && !defined(DETECT_FALSE_SHARING) && !defined(DETECT_FALSE_SHARING_OPT)
+    if(_isProtected) {
+      _memory.releaseNotices(_sync.mutex_clock(mutex));
+    }
+  #endif
+  }
 
   xthread	_thread;
   xsync  	_sync;
 
   unsigned int _locksHeld;
 
+  /// Read locks and unlocks that needed no commit or refresh, not counted
+  /// in the statistics yet.
+  unsigned long _quietReads;
+
+  /// How deep the runtime is in work a revocation must not interrupt, and
+  /// whether one waits for it to finish.
+  volatile int _runtimeDepth;
+  volatile bool _revokePending;
+
+  /// Whether this thread said that polling threads lost writes.
+  bool _droppedReported;
+
   /// The memory manager (for both heap and globals).
   xmemory&     _memory;
 
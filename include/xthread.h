@@ -47,18 +47,72 @@ private:
     /// The thread id.
     int tid;
 
+    /// A pidfd of the thread's process, or -1: it stays the same process
+    /// whatever its id is reused for, and all threads share descriptors.
+    int pidfd;
+
     /// The return value from the thread.
     void * retval;
 
     /// Whether this thread was created by a fork or not.
     bool forked;
+
+    /// Where the thread is, a futex word (see ThreadState). The thread
+    /// sets it once its last transaction is committed.
+    volatile unsigned long state;
+
+    /// Whether the thread still counts as live: whoever clears it, the
+    /// thread or its canceller, takes it off the live count.
+    volatile unsigned long alive;
+  };
+
+  enum ThreadState {
+    STATUS_FREE,      // not in use; in the pool, a slot without a worker
+    STATUS_CLAIMED,   // being handed a thread
+    THREAD_RUNNING,   // running, it will be joined
+    THREAD_DETACHED,  // running, it will not
+    THREAD_DONE,      // returned, not joined yet
+    THREAD_GONE,      // left with pthread_exit() or was cancelled, its process with it
+    SLOT_PARKED       // a worker waits for a thread (THREAD_POOL)
+  };
+
+#ifdef THREAD_POOL
+  /// @class PoolSlot
+  /// @brief A worker process of the pool and the thread it runs.
+  /// The status comes first: the slot is the thread's handle.
+  class PoolSlot {
+  public:
+    ThreadStatus status;
+
+    /// The thread to run next.
+    threadFunction * fn;
+    void * arg;
+
+    /// Where the spawner's live stack was copied from, its size, and the
+    /// copy (shared memory).
+    char * stackStart;
+    size_t stackSize;
+    char * copy;
+
+    /// How many times the program had mapped memory when the worker was
+    /// forked.
+    unsigned long mappings;
   };
+#endif
 
 public:
 
   xthread()
     : _nestingLevel (0),
-      _protected (false)
+      _protected (false),
+      _live (NULL),
+      _statuses (NULL),
+      _nextStatus (0)
+#ifdef THREAD_POOL
+      , _slots (NULL),
+      _stacks (NULL),
+      _mappings (NULL)
+#endif
   {
   }
 
@@ -68,17 +122,37 @@ public:
     //    printf ("throttle = %d\n", n);
   }
 
+  /// @param parked false if the thread must not run on a parked worker
+  /// (THREAD_POOL), but on a child forked for it, as its frames are not
+  /// where a copy of the live stack would put them.
   void * spawn (xrun * runner,
 		threadFunction * fn,
-		void * arg);
+		void * arg,
+		bool parked = true);
 
   void join (xrun * runner,
 	     void * v,
 	     void ** result);
 
+  /// @brief Do pthread_detach: nobody will join the thread.
+  void detach (xrun * runner, void * v);
+
   void cancel (xrun * runner, void * v);
   void thread_kill (xrun * runner, void *v, int sig);
 
+  /// @brief This thread called pthread_exit(): commit and hand the value
+  /// to the joiner. The process exits right after.
+  void exitThread (xrun * runner, void * retval);
+
+#ifdef THREAD_POOL
+  /// @brief Kill the workers parked in the pool, at the end of main().
+  void finalize (xrun * runner);
+
+  /// @brief The program mapped memory, which the workers parked so far
+  /// do not have.
+  void programMapped (void);
+#endif
+
   inline int getId() const {
     return _tid;
   }
@@ -100,6 +174,73 @@ private:
 			  ThreadStatus * t,
 			  void * arg);
 
+  /// @brief Map what threads share, before the first one is spawned.
+  void initializeShared (void);
+
+  /// @brief The thread of the status is finished: mark it with the given
+  /// state, take it off the live count, and wake its joiner.
+  void finishThread (ThreadStatus * t, unsigned long state);
+
+  /// @brief Wait until the thread of the status is finished. A thread
+  /// whose process died without finishing, by exit(), abort() or a
+  /// signal, is finished in its place, as cancelled.
+  void waitThread (ThreadStatus * t);
+
+  /// @return false if the process of the thread is known to be gone.
+  static bool threadAlive (ThreadStatus * t);
+
+  /// @brief The process of the thread is gone, or no status refers to it
+  /// any more: close its pidfd.
+  static void forgetProcess (ThreadStatus * t);
+
+  /// @return a status from the table, claimed; or NULL if all are in use.
+  ThreadStatus * claimStatus (void);
+
+  /// @return true if the status is one of the table.
+  bool inTable (ThreadStatus * t) {
+    return (t >= _statuses && t < _statuses + xdefines::THREAD_STATUSES);
+  }
+
+  /// @brief The thread of the status is finished and joined, or detached:
+  /// give its status back.
+  void release (ThreadStatus * t);
+
+  /// @brief Give the status back, as free.
+  void freeStatus (ThreadStatus * t);
+
+  /// @brief Reap the processes of threads that have exited: joins do not
+  /// wait for them.
+  static void reap (void);
+
+#ifdef THREAD_POOL
+  /// @return a slot that was in the given state, now claimed; or NULL.
+  PoolSlot * claimSlot (unsigned long from);
+
+  /// @return true if the handle is a slot of the pool.
+  bool isPooled (void * v) {
+    return (_slots != NULL && (char *)v >= (char *)_slots
+            && (char *)v < (char *)(_slots + xdefines::THREAD_POOL_WORKERS));
+  }
+
+  /// @brief Copy the live stack of the calling thread into the slot: a
+  /// parked worker has to find the spawner's frames where a forked child
+  /// would, arguments on the stack included.
+  /// @return false if it is too deep to be copied.
+  bool copyStack (PoolSlot * slot);
+
+  /// @brief The first thread of a worker returned: park it on its own
+  /// stack, the one it was forked on is reused for every later thread.
+  void becomeWorker (PoolSlot * slot);
+
+  /// @return true if the slot was handed a thread to run.
+  static bool handedThread (unsigned long state) {
+    return (state == THREAD_RUNNING || state == THREAD_DETACHED);
+  }
+
+  /// @brief Run the threads handed to the slot of this worker, forever.
+  static void parkWorker (void);
+#endif
+
   /// @return a chunk of memory shared across processes.
   void * allocateSharedObject (size_t sz) {
 #if 0
@@ -134,6 +275,33 @@ private:
 
   int              _protected;
 
+  /// Live threads of all processes, in shared memory.
+  volatile unsigned long * _live;
+
+  /// Statuses shared by all threads, taken round robin. A status the
+  /// table has no room for is a page of its own.
+  ThreadStatus *   _statuses;
+  int              _nextStatus;
+
+  /// The status of this thread; NULL in the main thread.
+  static ThreadStatus * _self;
+
+#ifdef THREAD_POOL
+  /// The slots and the stacks of their workers, mapped by the first
+  /// spawn of this process.
+  PoolSlot *       _slots;
+  char *           _stacks;
+
+  /// How many times any thread of the program mapped memory, in shared
+  /// memory. Before the first spawn there are no workers to tell.
+  volatile unsigned long * _mappings;
+
+  /// This object and the runner, for the park loop that runs on a stack
+  /// of its own.
+  static xthread *  _worker;
+  static xrun *     _workerRunner;
+#endif
+
 //  int              _heapid;
 };
 
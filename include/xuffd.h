@@ -0,0 +1,177 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xuffd.h
+ * @brief  Write tracking with userfaultfd write-protection (Linux 5.7+).
+ *
+ *         Instead of mapping the private copy read-only and fixing up one
+ *         page per SIGSEGV with mprotect, the mapping stays writable and
+ *         the page table entries are write-protected through userfaultfd.
+ *         A write to a protected page raises SIGBUS in the writer (there is
+ *         nobody else in a Sheriff "thread" to resolve the fault), and the
+ *         handler clears the protection of that page only. No VMA is ever
+ *         split, and whole ranges are re-protected with one ioctl.
+ *
+ *         A userfaultfd is bound to the address space that opened it, so
+ *         every process opens its own. The descriptor table is shared with
+ *         the other "threads" (CLONE_FILES), so it has to be closed on exit.
+ */
+
+#ifndef SHERIFF_XUFFD_H
+#define SHERIFF_XUFFD_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/userfaultfd.h>
+
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+
+class xuffd {
+public:
+
+  static xuffd& getInstance (void) {
+    static char buf[sizeof(xuffd)];
+    static xuffd * theOneTrueObject = new (buf) xuffd();
+    return *theOneTrueObject;
+  }
+
+  /// @brief Register a range for write-protection in this process.
+  /// @return false if the kernel or the backing store does not support it.
+  bool registerRange (void * start, size_t size) {
+#if defined(__NR_userfaultfd) && defined(UFFDIO_WRITEPROTECT_MODE_WP)
+    if (!open()) {
+      return false;
+    }
+
+    struct uffdio_register reg;
+    reg.range.start = (unsigned long) start;
+    reg.range.len = size;
+    reg.mode = UFFDIO_REGISTER_MODE_WP;
+
+    // Private mappings of regular files can not be write-protected,
+    // only anonymous and shmem memory.
+    if (ioctl (_fd, UFFDIO_REGISTER, &reg) == -1) {
+      return false;
+    }
+
+    if (!(reg.ioctls & ((__u64)1 << _UFFDIO_WRITEPROTECT))) {
+      ioctl (_fd, UFFDIO_UNREGISTER, &reg.range);
+      return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /// @brief Write-protect a registered range, including pages not yet faulted in.
+  void writeProtect (void * start, size_t size) {
+    setProtection (start, size, true);
+  }
+
+  /// @brief Let writes through to a registered range again.
+  void unprotect (void * start, size_t size) {
+    setProtection (start, size, false);
+  }
+
+  /// @brief Close the userfaultfd of this process, if it has one.
+  void close (void) {
+    if (_fd != -1 && _owningPid == syscall(SYS_getpid)) {
+      ::close (_fd);
+      _fd = -1;
+    }
+  }
+
+private:
+
+  xuffd (void)
+    : _owningPid (0),
+      _fd (-1)
+  {}
+
+  /// @return true if this process has a usable userfaultfd.
+  bool open (void) {
+#if defined(__NR_userfaultfd) && defined(UFFDIO_WRITEPROTECT_MODE_WP)
+    pid_t mypid = syscall(SYS_getpid);
+
+    if (_owningPid == mypid) {
+      return (_fd != -1);
+    }
+
+    // A descriptor inherited from the parent still refers to the parent's
+    // address space; leave it alone and open our own.
+    _owningPid = mypid;
+    _fd = syscall (__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    if (_fd == -1 && errno == EINVAL) {
+      // Kernels before 5.11 do not know about UFFD_USER_MODE_ONLY.
+      _fd = syscall (__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    }
+    if (_fd == -1) {
+      return false;
+    }
+
+    // Faults have to be delivered as signals to the writer.
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_SIGBUS;
+    if (ioctl (_fd, UFFDIO_API, &api) == -1) {
+      ::close (_fd);
+      _fd = -1;
+      return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void setProtection (void * start, size_t size, bool protect) {
+#if defined(__NR_userfaultfd) && defined(UFFDIO_WRITEPROTECT_MODE_WP)
+    struct uffdio_writeprotect wp;
+    wp.range.start = (unsigned long) start;
+    wp.range.len = size;
+    wp.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+
+    if (ioctl (_fd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+      fprintf (stderr, "Weird, %d write-protect of %p (size %ld) failed with error %s!!!\n",
+               getpid(), start, size, strerror(errno));
+      exit (-1);
+    }
+#endif
+  }
+
+  /// The process that opened _fd.
+  pid_t _owningPid;
+
+  int _fd;
+};
+
+#endif
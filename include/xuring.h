@@ -0,0 +1,315 @@
+// -*- C++ -*-
+
+/*
+  Copyright (C) 2012 University of Massachusetts Amherst.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   xuring.h
+ * @brief  Batch madvise() calls of a transaction boundary in one io_uring submission.
+ *
+ *         Refreshing a scattered dirty set drops every run of pages with
+ *         its own madvise(MADV_DONTNEED). Instead the runs are queued as
+ *         IORING_OP_MADVISE requests (Linux 5.6+) and submitted, and waited
+ *         for, with a single io_uring_enter() once the whole set is queued.
+ *         io_uring has no mprotect operation, so protection changes are
+ *         still made one run at a time.
+ *
+ *         A ring works on the address space of the process that set it
+ *         up, so every process sets up its own, lazily, after attach()
+ *         has dropped the parent's. The descriptor table is shared with
+ *         the other "threads" (CLONE_FILES), so it has to be closed on
+ *         exit. No liburing: the few ring operations needed are done here
+ *         on the raw system calls.
+ */
+
+#ifndef SHERIFF_XURING_H
+#define SHERIFF_XURING_H
+
+#include <errno.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+#include "xdefines.h"
+
+class xuring {
+public:
+
+  static xuring& getInstance (void) {
+    static char buf[sizeof(xuring)];
+    static xuring * theOneTrueObject = new (buf) xuring();
+    return *theOneTrueObject;
+  }
+
+  /// @brief Forget a ring inherited from the parent: it works on the
+  /// parent's memory. Called first thing in every new thread.
+  void attach (void) {
+    unmap();
+    _fd = -1;
+    _probed = false;
+    _queued = 0;
+    _enters = 0;
+  }
+
+  /// @return true if this process has a ring that can run madvise().
+  bool available (void) {
+    if (_probed) {
+      return (_fd != -1);
+    }
+    _probed = true;
+
+    if (!setup()) {
+      close();
+      return false;
+    }
+
+    // Kernels before 5.6 set the ring up but fail the operation.
+    void * page = mmap (NULL, xdefines::PageSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool works = false;
+    if (page != MAP_FAILED) {
+      queue (page, xdefines::PageSize, MADV_DONTNEED);
+      works = (submit() == 0);
+      munmap (page, xdefines::PageSize);
+    }
+
+    if (!works) {
+      close();
+      return false;
+    }
+    _enters = 0;
+    return true;
+  }
+
+  /// @brief Queue madvise(start, size, advice); it takes effect at submit().
+  void madvise (void * start, size_t size, int advice) {
+    if (_queued == _entries) {
+      submit();
+    }
+    queue (start, size, advice);
+  }
+
+  /// @brief Run everything queued so far and wait for it.
+  /// Requests the ring failed are retried with plain madvise().
+  /// @return the number of requests that failed in the ring.
+  int submit (void) {
+    int failed = 0;
+    unsigned toSubmit = _queued;
+    unsigned pending = _queued;
+    _queued = 0;
+
+    while (pending > 0) {
+      int ret = syscall (__NR_io_uring_enter, _fd, toSubmit, pending,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+      _enters++;
+      if (ret < 0) {
+        // Our own timer may interrupt the wait.
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+          continue;
+        }
+        fprintf (stderr, "%d : io_uring_enter failed with error %s\n", getpid(), strerror(errno));
+        ::abort();
+      }
+      toSubmit -= ((unsigned)ret < toSubmit) ? ret : toSubmit;
+      pending -= reap (&failed);
+    }
+    return failed;
+  }
+
+  /// @return io_uring_enter() calls made since the last call.
+  unsigned long takeEnters (void) {
+    unsigned long enters = _enters;
+    _enters = 0;
+    return enters;
+  }
+
+  /// @brief Close the ring of this process, if it has one.
+  void close (void) {
+    unmap();
+    if (_fd != -1) {
+      ::close (_fd);
+      _fd = -1;
+    }
+  }
+
+  /// Requests submitted at once at most.
+  enum { RING_ENTRIES = 256 };
+
+private:
+
+  xuring (void)
+    : _fd (-1),
+      _probed (false),
+      _sqRing (MAP_FAILED),
+      _cqRing (MAP_FAILED),
+      _sqes ((struct io_uring_sqe *) MAP_FAILED),
+      _queued (0),
+      _enters (0)
+  {}
+
+  bool setup (void) {
+    struct io_uring_params params;
+    memset (&params, 0, sizeof(params));
+
+    _fd = syscall (__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (_fd == -1) {
+      return false;
+    }
+
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      if (_cqRingSize > _sqRingSize) {
+        _sqRingSize = _cqRingSize;
+      }
+      _cqRingSize = _sqRingSize;
+    }
+
+    _sqRing = mmap (NULL, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    _fd, IORING_OFF_SQ_RING);
+    if (_sqRing == MAP_FAILED) {
+      return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      _cqRing = _sqRing;
+    }
+    else {
+      _cqRing = mmap (NULL, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      _fd, IORING_OFF_CQ_RING);
+      if (_cqRing == MAP_FAILED) {
+        return false;
+      }
+    }
+
+    _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    _sqes = (struct io_uring_sqe *) mmap (NULL, _sqesSize, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+      return false;
+    }
+
+    char * sq = (char *)_sqRing;
+    char * cq = (char *)_cqRing;
+    _sqTail = (unsigned *)(sq + params.sq_off.tail);
+    _sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    _sqArray = (unsigned *)(sq + params.sq_off.array);
+    _cqHead = (unsigned *)(cq + params.cq_off.head);
+    _cqTail = (unsigned *)(cq + params.cq_off.tail);
+    _cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    _cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    _entries = (params.sq_entries < RING_ENTRIES) ? params.sq_entries : RING_ENTRIES;
+    return true;
+  }
+
+  void queue (void * start, size_t size, int advice) {
+    unsigned tail = *_sqTail;
+    unsigned index = tail & _sqMask;
+    struct io_uring_sqe * sqe = &_sqes[index];
+
+    memset (sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_MADVISE;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long) start;
+    sqe->len = size;
+    sqe->fadvise_advice = advice;
+    sqe->user_data = _queued;
+    _sqArray[index] = index;
+
+    _requests[_queued].start = start;
+    _requests[_queued].size = size;
+    _requests[_queued].advice = advice;
+
+    // The kernel must see the entry before the new tail.
+    __atomic_store_n (_sqTail, tail + 1, __ATOMIC_RELEASE);
+    _queued++;
+  }
+
+  /// @return the number of completions consumed.
+  unsigned reap (int * failed) {
+    unsigned head = *_cqHead;
+    unsigned tail = __atomic_load_n (_cqTail, __ATOMIC_ACQUIRE);
+    unsigned reaped = tail - head;
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe * cqe = &_cqes[head & _cqMask];
+      if (cqe->res < 0) {
+        struct request * r = &_requests[cqe->user_data];
+        ::madvise (r->start, r->size, r->advice);
+        (*failed)++;
+      }
+    }
+    __atomic_store_n (_cqHead, tail, __ATOMIC_RELEASE);
+    return reaped;
+  }
+
+  /// @brief Unmap the rings, ours or inherited ones.
+  void unmap (void) {
+    if (_sqes != MAP_FAILED) {
+      munmap (_sqes, _sqesSize);
+    }
+    if (_cqRing != MAP_FAILED && _cqRing != _sqRing) {
+      munmap (_cqRing, _cqRingSize);
+    }
+    if (_sqRing != MAP_FAILED) {
+      munmap (_sqRing, _sqRingSize);
+    }
+    _sqes = (struct io_uring_sqe *) MAP_FAILED;
+    _sqRing = _cqRing = MAP_FAILED;
+  }
+
+  int _fd;
+  bool _probed;
+
+  void * _sqRing;
+  void * _cqRing;
+  struct io_uring_sqe * _sqes;
+  size_t _sqRingSize;
+  size_t _cqRingSize;
+  size_t _sqesSize;
+
+  unsigned * _sqTail;
+  unsigned * _sqArray;
+  unsigned _sqMask;
+  unsigned * _cqHead;
+  unsigned * _cqTail;
+  unsigned _cqMask;
+  struct io_uring_cqe * _cqes;
+  unsigned _entries;
+
+  /// Requests queued and not yet submitted.
+  unsigned _queued;
+
+  /// What each queued request does, to retry it if the ring fails it.
+  struct request {
+    void * start;
+    size_t size;
+    int advice;
+  } _requests[RING_ENTRIES];
+
+  /// io_uring_enter() calls not yet reported.
+  unsigned long _enters;
+};
+
+#endif
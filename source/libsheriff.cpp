@@ -32,8 +32,21 @@
 #endif
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #include "xrun.h"
+#include "xomp.h"
+
+#ifdef UFFD_TRACKING
+#include "xuffd.h"
+#endif
+#ifdef IO_URING_BATCHING
+#include "xuring.h"
+#endif
+
+#ifdef SOFT_DIRTY_DETECTION
+#include "xsoftdirty.h"
+#endif
 
 extern "C" {
 
@@ -45,6 +58,27 @@ extern "C" {
   int textStart, textEnd; 
  
   static bool initialized = false;
+
+  // Calls into the interposers from the runtime itself are no points
+  // where the program's thread is idle, nor mappings of the program's.
+  // They come from the object the runtime is loaded as.
+  static bool calledByProgram (void * caller) {
+    static void * runtimeBase = NULL;
+    static void * lastCaller = NULL;
+    static bool lastProgram = false;
+    Dl_info info;
+
+    if (caller == lastCaller) {
+      return lastProgram;
+    }
+    if (runtimeBase == NULL && dladdr ((void *)calledByProgram, &info) != 0) {
+      runtimeBase = info.dli_fbase;
+    }
+    bool program = (dladdr (caller, &info) == 0 || info.dli_fbase != runtimeBase);
+    lastProgram = program;
+    lastCaller = caller;
+    return program;
+  }
 #ifdef GET_CHARACTERISTICS
   int allocTimes = 0;
   int cleanupSize = 0;
@@ -58,6 +92,7 @@ extern "C" {
     *global_thread_index = 0;
 
     xrun::getInstance().initialize();
+    xomp::getInstance().initialize();
     initialized = true;
     
     // Start our first transaction.
@@ -177,9 +212,18 @@ extern "C" {
     return 0;
   }
 
-  // FIXME: add support for trylock
   int pthread_mutex_trylock(pthread_mutex_t * mutex) {
-    return 0;
+    if (initialized) 
+      return xrun::getInstance().mutex_trylock (mutex);
+    else
+      return 0;
+  }
+
+  int pthread_mutex_timedlock(pthread_mutex_t * mutex, const struct timespec * abstime) {
+    if (initialized) 
+      return xrun::getInstance().mutex_timedlock (mutex, abstime);
+    else
+      return 0;
   }
   
   int pthread_mutex_unlock (pthread_mutex_t * mutex) {    
@@ -258,10 +302,27 @@ extern "C" {
   
   int sched_yield (void) 
   {
+    // A spinning thread hands over the biased locks others wait for.
+    if (initialized && calledByProgram (__builtin_return_address(0))) {
+      xrun::getInstance().revokeDue(false);
+    }
     return 0;
   }
 
   void pthread_exit (void * value_ptr) {
+    // Commit, hand over the locks biased to this thread, and the value.
+    if (initialized) {
+      xrun::getInstance().exitThread(value_ptr);
+    }
+#ifdef UFFD_TRACKING
+    xuffd::getInstance().close();
+#endif
+#ifdef IO_URING_BATCHING
+    xuring::getInstance().close();
+#endif
+#ifdef SOFT_DIRTY_DETECTION
+    xsoftdirty::getInstance().close();
+#endif
     _exit (0);
     // FIX ME?
     // This should probably throw a special exception to be caught in spawn.
@@ -287,6 +348,13 @@ extern "C" {
 
   pthread_t pthread_self (void) 
   {
+    // Libraries set up before us want a handle of their own (libgomp
+    // does, for its affinity).
+    if (!initialized) {
+      if (WRAP(pthread_self) == NULL) 
+        init_real_functions();
+      return WRAP(pthread_self)();
+    }
     return xrun::getInstance().id();
   }
 
@@ -296,50 +364,124 @@ extern "C" {
     return 0;
   }
 
-#if 0
-  int pthread_rwlock_destroy (pthread_rwlock_t * rwlock) NOTHROW
+  int pthread_detach (pthread_t thread)
   {
+    if (initialized) {
+      xrun::getInstance().detach((void*)thread);
+    }
     return 0;
   }
 
+  // Reader-writer lock related functions
   int pthread_rwlock_init (pthread_rwlock_t * rwlock,
-			   const pthread_rwlockattr_t * attr) NOTHROW
+			   const pthread_rwlockattr_t * attr)
   {
-    return 0;
+    if (initialized) 
+      return xrun::getInstance().rwlock_init (rwlock);
+    else
+      return 0;
   }
 
-  int pthread_detach (pthread_t thread) NOTHROW
+  int pthread_rwlock_destroy (pthread_rwlock_t * rwlock)
   {
-    return 0;
+    if (initialized) 
+      return xrun::getInstance().rwlock_destroy (rwlock);
+    else
+      return 0;
   }
 
-  int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock) NOTHROW
+  int pthread_rwlock_rdlock (pthread_rwlock_t * rwlock)
   {
-    return 0;
+    if (initialized) 
+      return xrun::getInstance().rwlock_rdlock (rwlock, NULL);
+    else
+      return 0;
   }
 
-  int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock) NOTHROW
+  int pthread_rwlock_timedrdlock (pthread_rwlock_t * rwlock, const struct timespec * abstime)
   {
-    return 0;
+    if (initialized) 
+      return xrun::getInstance().rwlock_rdlock (rwlock, abstime);
+    else
+      return 0;
   }
 
+  int pthread_rwlock_tryrdlock (pthread_rwlock_t * rwlock)
+  {
+    if (initialized) 
+      return xrun::getInstance().rwlock_tryrdlock (rwlock);
+    else
+      return 0;
+  }
 
-  int pthread_rwlock_unlock(pthread_rwlock_t *rwlock) NOTHROW
+  int pthread_rwlock_wrlock (pthread_rwlock_t * rwlock)
   {
-    return 0;
+    if (initialized) 
+      return xrun::getInstance().rwlock_wrlock (rwlock, NULL);
+    else
+      return 0;
   }
 
-  int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock) NOTHROW
+  int pthread_rwlock_timedwrlock (pthread_rwlock_t * rwlock, const struct timespec * abstime)
   {
-    return 0;
+    if (initialized) 
+      return xrun::getInstance().rwlock_wrlock (rwlock, abstime);
+    else
+      return 0;
   }
 
-  int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock) NOTHROW
+  int pthread_rwlock_trywrlock (pthread_rwlock_t * rwlock)
   {
-    return 0;
+    if (initialized) 
+      return xrun::getInstance().rwlock_trywrlock (rwlock);
+    else
+      return 0;
+  }
+
+  int pthread_rwlock_unlock (pthread_rwlock_t * rwlock)
+  {
+    if (initialized) 
+      return xrun::getInstance().rwlock_unlock (rwlock);
+    else
+      return 0;
+  }
+
+  // Spin lock related functions
+  int pthread_spin_init (pthread_spinlock_t * lock, int pshared) {
+    if (initialized) 
+      return xrun::getInstance().spin_init (lock);
+    else
+      return 0;
+  }
+
+  int pthread_spin_destroy (pthread_spinlock_t * lock) {
+    if (initialized) 
+      return xrun::getInstance().spin_destroy (lock);
+    else
+      return 0;
+  }
+
+  int pthread_spin_lock (pthread_spinlock_t * lock) {
+    if (initialized) 
+      return xrun::getInstance().spin_lock (lock, false);
+    else
+      return 0;
+  }
+
+  int pthread_spin_trylock (pthread_spinlock_t * lock) {
+    if (initialized) 
+      return xrun::getInstance().spin_lock (lock, true);
+    else
+      return 0;
+  }
+
+  int pthread_spin_unlock (pthread_spinlock_t * lock) {
+    if (initialized) 
+      return xrun::getInstance().spin_unlock (lock);
+    else
+      return 0;
   }
 
-#endif
   int pthread_attr_getstacksize (const pthread_attr_t *, size_t * s) {
     *s = 1048576UL; // really? FIX ME
     return 0;
@@ -365,22 +507,579 @@ extern "C" {
     return 0;
   }
 
-  // Make sure that all pages are readable and writable by issuing writes on them 
+  // OpenMP (libgomp) entry points: teams of Sheriff threads, see xomp.h.
+  void GOMP_parallel (void (*fn) (void *), void * data, unsigned int threads, unsigned int flags) {
+    xomp::getInstance().parallel (fn, data, threads, NULL);
+  }
+
+  void GOMP_parallel_sections (void (*fn) (void *), void * data, unsigned int threads,
+      unsigned int count, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (1, count + 1, 1, xomp::SCHEDULE_DYNAMIC, 1, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  void GOMP_parallel_loop_static (void (*fn) (void *), void * data, unsigned int threads,
+      long start, long end, long incr, long chunk, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (start, end, incr, xomp::SCHEDULE_STATIC, chunk, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  void GOMP_parallel_loop_dynamic (void (*fn) (void *), void * data, unsigned int threads,
+      long start, long end, long incr, long chunk, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (start, end, incr, xomp::SCHEDULE_DYNAMIC, chunk, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  void GOMP_parallel_loop_guided (void (*fn) (void *), void * data, unsigned int threads,
+      long start, long end, long incr, long chunk, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (start, end, incr, xomp::SCHEDULE_GUIDED, chunk, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  void GOMP_parallel_loop_runtime (void (*fn) (void *), void * data, unsigned int threads,
+      long start, long end, long incr, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (start, end, incr, xomp::SCHEDULE_RUNTIME, 0, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  void GOMP_parallel_loop_nonmonotonic_dynamic (void (*fn) (void *), void * data, unsigned int threads,
+      long start, long end, long incr, long chunk, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (start, end, incr, xomp::SCHEDULE_DYNAMIC, chunk, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  void GOMP_parallel_loop_nonmonotonic_guided (void (*fn) (void *), void * data, unsigned int threads,
+      long start, long end, long incr, long chunk, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (start, end, incr, xomp::SCHEDULE_GUIDED, chunk, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  void GOMP_parallel_loop_nonmonotonic_runtime (void (*fn) (void *), void * data, unsigned int threads,
+      long start, long end, long incr, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (start, end, incr, xomp::SCHEDULE_RUNTIME, 0, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  void GOMP_parallel_loop_maybe_nonmonotonic_runtime (void (*fn) (void *), void * data, unsigned int threads,
+      long start, long end, long incr, unsigned int flags) {
+    struct omploop loop = xomp::makeLoop (start, end, incr, xomp::SCHEDULE_RUNTIME, 0, false);
+    xomp::getInstance().parallel (fn, data, threads, &loop);
+  }
+
+  int omp_get_thread_num (void) {
+    return xomp::getInstance().threadNum();
+  }
+
+  int omp_get_num_threads (void) {
+    return xomp::getInstance().numThreads();
+  }
+
+  int omp_in_parallel (void) {
+    return (xomp::getInstance().activeLevel() != 0);
+  }
+
+  int omp_get_level (void) {
+    return xomp::getInstance().level();
+  }
+
+  int omp_get_active_level (void) {
+    return xomp::getInstance().activeLevel();
+  }
+
+  void GOMP_barrier (void) {
+    xomp::getInstance().barrier();
+  }
+
+  void GOMP_critical_start (void) {
+    if (initialized) 
+      xrun::getInstance().mutex_lock (xomp::getInstance().critical());
+  }
+
+  void GOMP_critical_end (void) {
+    if (initialized) 
+      xrun::getInstance().mutex_unlock (xomp::getInstance().critical());
+  }
+
+  void GOMP_critical_name_start (void ** name) {
+    if (initialized) 
+      xrun::getInstance().mutex_lock (xomp::getInstance().critical(name));
+  }
+
+  void GOMP_critical_name_end (void ** name) {
+    if (initialized) 
+      xrun::getInstance().mutex_unlock (xomp::getInstance().critical(name));
+  }
+
+  void GOMP_atomic_start (void) {
+    if (initialized) 
+      xrun::getInstance().mutex_lock (xomp::getInstance().atomics());
+  }
+
+  void GOMP_atomic_end (void) {
+    if (initialized) 
+      xrun::getInstance().mutex_unlock (xomp::getInstance().atomics());
+  }
+
+  void GOMP_ordered_start (void) {
+    if (initialized) 
+      xomp::getInstance().orderedStart();
+  }
+
+  void GOMP_ordered_end (void) {
+    if (initialized) 
+      xomp::getInstance().orderedEnd();
+  }
+
+  bool GOMP_single_start (void) {
+    return xomp::getInstance().singleStart();
+  }
+
+  // copyprivate hands over a pointer into the stack of one thread.
+  void * GOMP_single_copy_start (void) {
+    xomp::unsupported ("single copyprivate");
+    return NULL;
+  }
+
+  void GOMP_single_copy_end (void * data) {
+    xomp::unsupported ("single copyprivate");
+  }
+
+  unsigned int GOMP_sections_start (unsigned int count) {
+    return xomp::getInstance().sectionsStart (count);
+  }
+
+  unsigned int GOMP_sections_next (void) {
+    return xomp::getInstance().sectionsNext();
+  }
+
+  void GOMP_sections_end (void) {
+    xomp::getInstance().loopEnd (true);
+  }
+
+  void GOMP_sections_end_nowait (void) {
+    xomp::getInstance().loopEnd (false);
+  }
+
+  bool GOMP_loop_static_start (long start, long end, long incr, long chunk, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_STATIC, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_static_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_dynamic_start (long start, long end, long incr, long chunk, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_DYNAMIC, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_dynamic_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_guided_start (long start, long end, long incr, long chunk, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_GUIDED, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_guided_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_runtime_start (long start, long end, long incr, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_RUNTIME, 0, false), istart, iend);
+  }
+
+  bool GOMP_loop_runtime_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_nonmonotonic_dynamic_start (long start, long end, long incr, long chunk, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_DYNAMIC, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_nonmonotonic_dynamic_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_nonmonotonic_guided_start (long start, long end, long incr, long chunk, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_GUIDED, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_nonmonotonic_guided_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_nonmonotonic_runtime_start (long start, long end, long incr, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_RUNTIME, 0, false), istart, iend);
+  }
+
+  bool GOMP_loop_nonmonotonic_runtime_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_maybe_nonmonotonic_runtime_start (long start, long end, long incr, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_RUNTIME, 0, false), istart, iend);
+  }
+
+  bool GOMP_loop_maybe_nonmonotonic_runtime_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ordered_static_start (long start, long end, long incr, long chunk, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_STATIC, chunk, true), istart, iend);
+  }
+
+  bool GOMP_loop_ordered_static_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ordered_dynamic_start (long start, long end, long incr, long chunk, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_DYNAMIC, chunk, true), istart, iend);
+  }
+
+  bool GOMP_loop_ordered_dynamic_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ordered_guided_start (long start, long end, long incr, long chunk, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_GUIDED, chunk, true), istart, iend);
+  }
+
+  bool GOMP_loop_ordered_guided_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ordered_runtime_start (long start, long end, long incr, long * istart, long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, xomp::SCHEDULE_RUNTIME, 0, true), istart, iend);
+  }
+
+  bool GOMP_loop_ordered_runtime_next (long * istart, long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  // Task reductions and scan or conditional lastprivate scratch space
+  // live in libgomp's own team.
+  bool GOMP_loop_start (long start, long end, long incr, long schedule, long chunk,
+      long * istart, long * iend, uintptr_t * reductions, void ** mem) {
+    if (reductions != NULL || mem != NULL) 
+      xomp::unsupported ("loop reductions and scratch memory");
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, schedule, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_ordered_start (long start, long end, long incr, long schedule, long chunk,
+      long * istart, long * iend, uintptr_t * reductions, void ** mem) {
+    if (reductions != NULL || mem != NULL) 
+      xomp::unsupported ("loop reductions and scratch memory");
+    return xomp::getInstance().loopStart (xomp::makeLoop (start, end, incr, schedule, chunk, true), istart, iend);
+  }
+
+  bool GOMP_loop_ull_static_start (bool up, unsigned long long start, unsigned long long end, unsigned long long incr,
+      unsigned long long chunk, unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (up, start, end, incr, xomp::SCHEDULE_STATIC, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_ull_static_next (unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ull_dynamic_start (bool up, unsigned long long start, unsigned long long end, unsigned long long incr,
+      unsigned long long chunk, unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (up, start, end, incr, xomp::SCHEDULE_DYNAMIC, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_ull_dynamic_next (unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ull_guided_start (bool up, unsigned long long start, unsigned long long end, unsigned long long incr,
+      unsigned long long chunk, unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (up, start, end, incr, xomp::SCHEDULE_GUIDED, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_ull_guided_next (unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ull_runtime_start (bool up, unsigned long long start, unsigned long long end,
+      unsigned long long incr, unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (up, start, end, incr, xomp::SCHEDULE_RUNTIME, 0, false), istart, iend);
+  }
+
+  bool GOMP_loop_ull_runtime_next (unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ull_nonmonotonic_dynamic_start (bool up, unsigned long long start, unsigned long long end, unsigned long long incr,
+      unsigned long long chunk, unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (up, start, end, incr, xomp::SCHEDULE_DYNAMIC, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_ull_nonmonotonic_dynamic_next (unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ull_nonmonotonic_guided_start (bool up, unsigned long long start, unsigned long long end, unsigned long long incr,
+      unsigned long long chunk, unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (up, start, end, incr, xomp::SCHEDULE_GUIDED, chunk, false), istart, iend);
+  }
+
+  bool GOMP_loop_ull_nonmonotonic_guided_next (unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  bool GOMP_loop_ull_maybe_nonmonotonic_runtime_start (bool up, unsigned long long start, unsigned long long end,
+      unsigned long long incr, unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopStart (xomp::makeLoop (up, start, end, incr, xomp::SCHEDULE_RUNTIME, 0, false), istart, iend);
+  }
+
+  bool GOMP_loop_ull_maybe_nonmonotonic_runtime_next (unsigned long long * istart, unsigned long long * iend) {
+    return xomp::getInstance().loopNext (istart, iend);
+  }
+
+  void GOMP_loop_end (void) {
+    xomp::getInstance().loopEnd (true);
+  }
+
+  void GOMP_loop_end_nowait (void) {
+    xomp::getInstance().loopEnd (false);
+  }
+
+#ifdef ATOMIC_SYNC
+  // Futexes the program waits on and wakes by itself are synchronization:
+  // see xrun::futex(). Any other system call goes straight through.
+  long syscall (long number, ...) {
+    va_list args;
+    va_start (args, number);
+    long a1 = va_arg (args, long);
+    long a2 = va_arg (args, long);
+    long a3 = va_arg (args, long);
+    long a4 = va_arg (args, long);
+    long a5 = va_arg (args, long);
+    long a6 = va_arg (args, long);
+    va_end (args);
+
+    if (number == SYS_futex && initialized) {
+      return xrun::getInstance().futex ((int *)a1, (int)a2, (int)a3,
+          (const struct timespec *)a4, (int *)a5, (int)a6);
+    }
+    if (initialized && calledByProgram (__builtin_return_address(0))) {
+      xrun::getInstance().revokeDue(false);
+    }
+    if (WRAP(syscall) == NULL) {
+      init_real_functions();
+    }
+    return WRAP(syscall) (number, a1, a2, a3, a4, a5, a6);
+  }
+#endif
+
+#ifdef THREAD_POOL
+  // Parked workers do not see what the program maps after they were
+  // forked: see xthread::spawn().
+  static void programMapped (void * caller) {
+    if (initialized && calledByProgram (caller)) {
+      xrun::getInstance().programMapped();
+    }
+  }
+
+  void * mmap (void * addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    if (WRAP(mmap) == NULL) {
+      init_real_functions();
+    }
+    void * result = WRAP(mmap) (addr, length, prot, flags, fd, offset);
+    if (result != MAP_FAILED) {
+      int error = errno;
+      programMapped (__builtin_return_address(0));
+      errno = error;
+    }
+    return result;
+  }
+
+  void * mremap (void * addr, size_t oldSize, size_t newSize, int flags, ...) {
+    va_list args;
+    va_start (args, flags);
+    void * newAddr = va_arg (args, void *);
+    va_end (args);
+
+    if (WRAP(mremap) == NULL) {
+      init_real_functions();
+    }
+    void * result = WRAP(mremap) (addr, oldSize, newSize, flags, newAddr);
+    if (result != MAP_FAILED) {
+      int error = errno;
+      programMapped (__builtin_return_address(0));
+      errno = error;
+    }
+    return result;
+  }
+
+  void * dlopen (const char * file, int mode) {
+    if (WRAP(dlopen) == NULL) {
+      init_real_functions();
+    }
+    void * result = WRAP(dlopen) (file, mode);
+    if (result != NULL) {
+      programMapped (__builtin_return_address(0));
+    }
+    return result;
+  }
+#endif
+
+  // Make sure that all pages are readable and writable by issuing writes on
+  // them: the kernel fails with EFAULT instead of faulting on a protected
+  // buffer. The writes store what is already there, in case fewer bytes
+  // arrive than asked for.
+  static void touchBuffer (void * buf, size_t count) {
+    volatile char * start = (volatile char *)buf;
+    volatile char * last = start + count - 1;
+
+    if(count == 0) {
+      return;
+    }
+
+    for(volatile char * pos = start; pos < last; pos += xdefines::PageSize) {
+      *pos = *pos;
+    }
+    *last = *last;
+  }
+
+  // A system call about to write to buffers of the program.
+  struct syscallBuffers {
+#ifdef DETECT_FALSE_SHARING
+    sigset_t old;
+#endif
+    bool fenced;
+  };
+
+  static void beginBuffers (struct syscallBuffers * buffers, void * caller) {
+#ifdef DETECT_FALSE_SHARING
+    // The periodic check protects dirtied pages again, so it must not run
+    // between the touch and the end of the system call.
+    sigset_t mask;
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGALRM);
+    sigprocmask (SIG_BLOCK, &mask, &buffers->old);
+#endif
+    if (WRAP(read) == NULL) {
+      init_real_functions();
+    }
+    if (initialized && calledByProgram (caller)) {
+      xrun::getInstance().revokeDue(true);
+    }
+    buffers->fenced = false;
+  }
+
+  static void addBuffer (struct syscallBuffers * buffers, void * buf, size_t count) {
+    if (buf == NULL) {
+      return;
+    }
+    if (initialized) {
+      buffers->fenced = xrun::getInstance().syscallWrites (buf, count, buffers->fenced);
+    }
+    touchBuffer (buf, count);
+  }
+
+  static void addBuffers (struct syscallBuffers * buffers, const struct iovec * iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+      addBuffer (buffers, iov[i].iov_base, iov[i].iov_len);
+    }
+  }
+
+  static void endBuffers (struct syscallBuffers * buffers) {
+    if (buffers->fenced) {
+      xrun::getInstance().syscallWritten();
+    }
+#ifdef DETECT_FALSE_SHARING
+    int error = errno;
+    sigprocmask (SIG_SETMASK, &buffers->old, NULL);
+    errno = error;
+#endif
+  }
+
   ssize_t read (int fd, void * buf, size_t count) {
-    char * start = (char *)buf;
-    long pages = count/xdefines::PageSize;
+    struct syscallBuffers buffers;
+    beginBuffers (&buffers, __builtin_return_address(0));
+    addBuffer (&buffers, buf, count);
+    ssize_t result = WRAP(read) (fd, buf, count);
+    endBuffers (&buffers);
+    return result;
+  }
 
-    if(pages >= 1) {
-     // fprintf(stderr, "fd %d buf %p count %d\n", fd, buf, count);
-    // Trying to read on those pages, thus there won't be a segmenation fault in 
-    // the system call.
-      for(long i = 0; i < pages; i++) {
-        start[i * xdefines::PageSize] = '\0';
-      }
+  ssize_t pread (int fd, void * buf, size_t count, off_t offset) {
+    struct syscallBuffers buffers;
+    beginBuffers (&buffers, __builtin_return_address(0));
+    addBuffer (&buffers, buf, count);
+    ssize_t result = WRAP(pread) (fd, buf, count, offset);
+    endBuffers (&buffers);
+    return result;
+  }
+
+  ssize_t pread64 (int fd, void * buf, size_t count, off64_t offset) {
+    struct syscallBuffers buffers;
+    beginBuffers (&buffers, __builtin_return_address(0));
+    addBuffer (&buffers, buf, count);
+    ssize_t result = WRAP(pread) (fd, buf, count, offset);
+    endBuffers (&buffers);
+    return result;
+  }
+
+  ssize_t readv (int fd, const struct iovec * iov, int iovcnt) {
+    struct syscallBuffers buffers;
+    beginBuffers (&buffers, __builtin_return_address(0));
+    addBuffers (&buffers, iov, iovcnt);
+    ssize_t result = WRAP(readv) (fd, iov, iovcnt);
+    endBuffers (&buffers);
+    return result;
+  }
+
+  ssize_t recv (int fd, void * buf, size_t count, int flags) {
+    struct syscallBuffers buffers;
+    beginBuffers (&buffers, __builtin_return_address(0));
+    addBuffer (&buffers, buf, count);
+    ssize_t result = WRAP(recv) (fd, buf, count, flags);
+    endBuffers (&buffers);
+    return result;
+  }
+
+  ssize_t recvfrom (int fd, void * buf, size_t count, int flags,
+                    struct sockaddr * from, socklen_t * fromlen) {
+    struct syscallBuffers buffers;
+    beginBuffers (&buffers, __builtin_return_address(0));
+    addBuffer (&buffers, buf, count);
+    if (fromlen != NULL) {
+      addBuffer (&buffers, fromlen, sizeof(socklen_t));
+      addBuffer (&buffers, from, *fromlen);
     }
-    
-    // Make sure that last page are written so the page is readable and writable
-    start[count-1] = '\0';
+    ssize_t result = WRAP(recvfrom) (fd, buf, count, flags, from, fromlen);
+    endBuffers (&buffers);
+    return result;
+  }
+
+  ssize_t recvmsg (int fd, struct msghdr * msg, int flags) {
+    struct syscallBuffers buffers;
+    beginBuffers (&buffers, __builtin_return_address(0));
+    // The kernel writes the lengths and flags back into the header.
+    if (msg != NULL) {
+      addBuffer (&buffers, msg, sizeof(struct msghdr));
+      addBuffer (&buffers, msg->msg_name, msg->msg_namelen);
+      addBuffers (&buffers, msg->msg_iov, msg->msg_iovlen);
+      addBuffer (&buffers, msg->msg_control, msg->msg_controllen);
+    }
+    ssize_t result = WRAP(recvmsg) (fd, msg, flags);
+    endBuffers (&buffers);
+    return result;
+  }
+
+  // The C library reads into the stream buffer and into the buffer of the
+  // program with its own read(), which is not ours.
+  size_t fread (void * ptr, size_t size, size_t nmemb, FILE * stream) {
+    struct syscallBuffers buffers;
+    beginBuffers (&buffers, __builtin_return_address(0));
+    addBuffer (&buffers, ptr, size * nmemb);
+    if (stream->_IO_buf_base != NULL) {
+      addBuffer (&buffers, stream->_IO_buf_base, stream->_IO_buf_end - stream->_IO_buf_base);
+    }
+    size_t result = WRAP(fread) (ptr, size, nmemb, stream);
+    endBuffers (&buffers);
+    return result;
   }
 
 #if 0
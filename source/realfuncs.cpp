@@ -9,6 +9,8 @@
 
 // libc functions
 void* (*WRAP(mmap))(void*, size_t, int, int, int, off_t);
+void* (*WRAP(mremap))(void*, size_t, size_t, int, ...);
+void* (*WRAP(dlopen))(const char*, int);
 void* (*WRAP(malloc))(size_t);
 void  (*WRAP(free))(void *);
 void* (*WRAP(realloc))(void *, size_t);
@@ -16,13 +18,25 @@ void* (*WRAP(memalign))(size_t, size_t);
 size_t (*WRAP(malloc_usable_size))(void *);
 ssize_t (*WRAP(read))(int, void*, size_t);
 ssize_t (*WRAP(write))(int, const void*, size_t);
+ssize_t (*WRAP(recv))(int, void*, size_t, int);
+ssize_t (*WRAP(pread))(int, void*, size_t, off_t);
+ssize_t (*WRAP(readv))(int, const struct iovec*, int);
+ssize_t (*WRAP(recvfrom))(int, void*, size_t, int, struct sockaddr*, socklen_t*);
+ssize_t (*WRAP(recvmsg))(int, struct msghdr*, int);
+size_t (*WRAP(fread))(void*, size_t, size_t, FILE*);
 int (*WRAP(sigwait))(const sigset_t*, int*);
+long (*WRAP(syscall))(long, ...);
+
+// libgomp, when the program is built with -fopenmp (NULL otherwise)
+int (*WRAP(omp_get_max_threads))(void);
+void (*WRAP(omp_get_schedule))(int*, int*);
 
 // pthread basics
 int (*WRAP(pthread_create))(pthread_t*, const pthread_attr_t*, void *(*)(void*), void*);
 int (*WRAP(pthread_cancel))(pthread_t);
 int (*WRAP(pthread_join))(pthread_t, void**);
 int (*WRAP(pthread_exit))(void*);
+pthread_t (*WRAP(pthread_self))(void);
 
 // pthread mutexes
 int (*WRAP(pthread_mutexattr_init))(pthread_mutexattr_t*);
@@ -30,6 +44,7 @@ int (*WRAP(pthread_mutex_init))(pthread_mutex_t*, const pthread_mutexattr_t*);
 int (*WRAP(pthread_mutex_lock))(pthread_mutex_t*);
 int (*WRAP(pthread_mutex_unlock))(pthread_mutex_t*);
 int (*WRAP(pthread_mutex_trylock))(pthread_mutex_t*);
+int (*WRAP(pthread_mutex_timedlock))(pthread_mutex_t*, const struct timespec*);
 int (*WRAP(pthread_mutex_destroy))(pthread_mutex_t*);
 
 // pthread condition variables
@@ -45,6 +60,17 @@ int (*WRAP(pthread_barrier_init))(pthread_barrier_t*, pthread_barrierattr_t*, un
 int (*WRAP(pthread_barrier_wait))(pthread_barrier_t*);
 int (*WRAP(pthread_barrier_destroy))(pthread_barrier_t*);
 
+// pthread reader-writer locks
+int (*WRAP(pthread_rwlock_init))(pthread_rwlock_t*, const pthread_rwlockattr_t*);
+int (*WRAP(pthread_rwlock_rdlock))(pthread_rwlock_t*);
+int (*WRAP(pthread_rwlock_wrlock))(pthread_rwlock_t*);
+int (*WRAP(pthread_rwlock_tryrdlock))(pthread_rwlock_t*);
+int (*WRAP(pthread_rwlock_trywrlock))(pthread_rwlock_t*);
+int (*WRAP(pthread_rwlock_timedrdlock))(pthread_rwlock_t*, const struct timespec*);
+int (*WRAP(pthread_rwlock_timedwrlock))(pthread_rwlock_t*, const struct timespec*);
+int (*WRAP(pthread_rwlock_unlock))(pthread_rwlock_t*);
+int (*WRAP(pthread_rwlock_destroy))(pthread_rwlock_t*);
+
 #ifndef assert
 #define assert(x) 
 #endif
@@ -54,6 +80,8 @@ int (*WRAP(pthread_barrier_destroy))(pthread_barrier_t*);
 void init_real_functions() {
 
 	SET_WRAPPED(mmap, RTLD_NEXT);
+	SET_WRAPPED(mremap, RTLD_NEXT);
+	SET_WRAPPED(dlopen, RTLD_NEXT);
 	SET_WRAPPED(malloc, RTLD_NEXT);
 	SET_WRAPPED(free, RTLD_NEXT);
 	SET_WRAPPED(realloc, RTLD_NEXT);
@@ -61,7 +89,16 @@ void init_real_functions() {
 	SET_WRAPPED(malloc_usable_size, RTLD_NEXT);
 	SET_WRAPPED(read, RTLD_NEXT);
 	SET_WRAPPED(write, RTLD_NEXT);
+	SET_WRAPPED(recv, RTLD_NEXT);
+	SET_WRAPPED(pread, RTLD_NEXT);
+	SET_WRAPPED(readv, RTLD_NEXT);
+	SET_WRAPPED(recvfrom, RTLD_NEXT);
+	SET_WRAPPED(recvmsg, RTLD_NEXT);
+	SET_WRAPPED(fread, RTLD_NEXT);
 	SET_WRAPPED(sigwait, RTLD_NEXT);
+	SET_WRAPPED(syscall, RTLD_NEXT);
+	SET_WRAPPED(omp_get_max_threads, RTLD_NEXT);
+	SET_WRAPPED(omp_get_schedule, RTLD_NEXT);
 
 	void *pthread_handle = dlopen("libpthread.so.0", RTLD_NOW | RTLD_GLOBAL | RTLD_NOLOAD);
 	if (pthread_handle == NULL) {
@@ -73,11 +110,13 @@ void init_real_functions() {
 	SET_WRAPPED(pthread_cancel, pthread_handle);
 	SET_WRAPPED(pthread_join, pthread_handle);
 	SET_WRAPPED(pthread_exit, pthread_handle);
+	SET_WRAPPED(pthread_self, pthread_handle);
 
 	SET_WRAPPED(pthread_mutex_init, pthread_handle);
 	SET_WRAPPED(pthread_mutex_lock, pthread_handle);
 	SET_WRAPPED(pthread_mutex_unlock, pthread_handle);
 	SET_WRAPPED(pthread_mutex_trylock, pthread_handle);
+	SET_WRAPPED(pthread_mutex_timedlock, pthread_handle);
 	SET_WRAPPED(pthread_mutex_destroy, pthread_handle);
 	SET_WRAPPED(pthread_mutexattr_init, pthread_handle);
 
@@ -91,4 +130,14 @@ void init_real_functions() {
 	SET_WRAPPED(pthread_barrier_init, pthread_handle);
 	SET_WRAPPED(pthread_barrier_wait, pthread_handle);
 	SET_WRAPPED(pthread_barrier_destroy, pthread_handle);
+
+	SET_WRAPPED(pthread_rwlock_init, pthread_handle);
+	SET_WRAPPED(pthread_rwlock_rdlock, pthread_handle);
+	SET_WRAPPED(pthread_rwlock_wrlock, pthread_handle);
+	SET_WRAPPED(pthread_rwlock_tryrdlock, pthread_handle);
+	SET_WRAPPED(pthread_rwlock_trywrlock, pthread_handle);
+	SET_WRAPPED(pthread_rwlock_timedrdlock, pthread_handle);
+	SET_WRAPPED(pthread_rwlock_timedwrlock, pthread_handle);
+	SET_WRAPPED(pthread_rwlock_unlock, pthread_handle);
+	SET_WRAPPED(pthread_rwlock_destroy, pthread_handle);
 }
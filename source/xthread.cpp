@@ -3,9 +3,45 @@
 #include "xthread.h"
 #include "xrun.h"
 
+#ifdef UFFD_TRACKING
+#include "xuffd.h"
+#endif
+#ifdef IO_URING_BATCHING
+#include "xuring.h"
+#endif
+
+#ifdef SOFT_DIRTY_DETECTION
+#include "xsoftdirty.h"
+#endif
+
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <linux/futex.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifdef THREAD_POOL
+#include <ucontext.h>
+
+extern "C" void * __libc_stack_end;
+
+xthread * xthread::_worker = NULL;
+xrun * xthread::_workerRunner = NULL;
+#endif
+
+xthread::ThreadStatus * xthread::_self = NULL;
+
+static void futex (volatile unsigned long * addr, int op, int val) {
+  WRAP(syscall) (SYS_futex, (int *)addr, op, val, NULL, NULL, 0);
+}
+
 void * xthread::spawn (xrun * runner,
 		       threadFunction * fn,
-		       void * arg)
+		       void * arg,
+		       bool parked)
 {
 
 	if(!_protected) {
@@ -15,11 +51,64 @@ void * xthread::spawn (xrun * runner,
 	}
     
 	runner->atomicEnd(true, false);
+
+  if(_live == NULL) {
+    initializeShared();
+  }
+  reap();
+  atomic::increment(_live);
+
+#ifdef THREAD_POOL
+  // A parked worker runs the thread without a fork, unless the program
+  // mapped memory since it was forked: the thread would miss it, so the
+  // worker is replaced.
+  PoolSlot * slot = parked ? claimSlot(SLOT_PARKED) : NULL;
+  if(slot != NULL && slot->mappings != *_mappings) {
+    kill(slot->status.tid, SIGKILL);
+    forgetProcess(&slot->status);
+  }
+  else if(slot != NULL) {
+    if(copyStack(slot)) {
+      slot->fn = fn;
+      slot->arg = arg;
+      slot->status.retval = NULL;
+      slot->status.alive = 1;
+      atomic::atomic_set(&slot->status.state, THREAD_RUNNING);
+      futex(&slot->status.state, FUTEX_WAKE, INT_MAX);
+
+      runner->atomicBegin(true, false);
+      return (void *) slot;
+    }
+    atomic::atomic_set(&slot->status.state, SLOT_PARKED);
+    slot = NULL;
+  }
+
+  // Otherwise a new worker is forked for an empty slot.
+  if(slot == NULL) {
+    slot = claimSlot(STATUS_FREE);
+  }
+  if(slot != NULL) {
+    slot->mappings = *_mappings;
+    slot->status.tid = 0;
+    slot->status.pidfd = -1;
+    slot->status.alive = 1;
+    slot->status.state = THREAD_RUNNING;
+	  runner->atomicBegin(false, false);
+    return forkSpawn (runner, fn, &slot->status, arg);
+  }
+#endif
  
-  // Allocate an object to hold the thread's return value.
-  void * buf = allocateSharedObject (4096);
-  HL::sassert<(4096 > sizeof(ThreadStatus))> checkSize;
-  ThreadStatus * t = new (buf) ThreadStatus;
+  // Take an object to hold the thread's return value.
+  ThreadStatus * t = claimStatus();
+  if(t == NULL) {
+    void * buf = allocateSharedObject (4096);
+    HL::sassert<(4096 > sizeof(ThreadStatus))> checkSize;
+    t = new (buf) ThreadStatus;
+  }
+  t->tid = 0;
+  t->pidfd = -1;
+  t->alive = 1;
+  t->state = THREAD_RUNNING;
 
 	runner->atomicBegin(false, false);
   return forkSpawn (runner, fn, t, arg);
@@ -42,17 +131,11 @@ void xthread::join (xrun * runner,
   runner->atomicEnd(true, false);
 //  fprintf(stderr, "%d: joining thread %d\n", getpid(), t->tid);
   
-  // FIXME: I should wait until the child thread has been finished.
-  int status;
-  waitpid(t->tid, &status, 0);
+  // The thread sets its state after its last commit: no need to wait
+  // for its process, which may be a worker that lives on.
+  waitThread(t);
 
   runner->atomicBegin(false, false);
-#if 0
-  while(!WIFEXITED(status)) {
-  //  fprintf(stderr, "%d: Now waitAGAIN!!!!!\n", getpid());
-     waitpid(t->tid, &status, 0);
-  } 
-#endif
  
   // Grab the thread result from the status structure (set by the thread),
   // reclaim the memory, and return that result.
@@ -60,15 +143,14 @@ void xthread::join (xrun * runner,
     *result = t->retval;
   }
   
-  // Free the shared object held by this thread.
-  freeSharedObject(t, 4096);
+  release(t);
 
   // JOIN means one child is closed here. If no other threads, we can close
   // the memory protection to improve the performance.
   if(getpid() == runner->main_id()) {
 	// Check whether main thread is the only alive one. If it is, we maybe don't 
     // need protection anymore.
-	  if(waitpid(-1, NULL, WNOHANG) == -1 && errno == ECHILD) {
+	  if(_protected && *_live == 0) {
 		  runner->closeMemoryProtection();
 		  runner->resetThreadIndex();
 		  _protected = false;
@@ -80,15 +162,58 @@ void xthread::join (xrun * runner,
   runner->atomicBegin(false, false);
 }
 
+/// @brief Do pthread_detach.
+void xthread::detach (xrun * runner, void * v)
+{
+  // pthread_self() gives the pid.
+  ThreadStatus * t = (v == (void *)(long)_tid) ? _self : (ThreadStatus *) v;
+  if (t == NULL) {
+    return;
+  }
+
+  // A thread still running gives its status back itself when it is done.
+  unsigned long state = atomic::compare_and_swap(&t->state, THREAD_RUNNING, THREAD_DETACHED);
+  if(state == THREAD_RUNNING) {
+#ifdef THREAD_POOL
+    if(isPooled(t)) {
+      return;
+    }
+#endif
+    // Our mapping of a page of its own: the thread keeps its mapping.
+    if(t != _self && !inTable(t)) {
+      freeSharedObject(t, 4096);
+    }
+    return;
+  }
+  if(state == THREAD_DONE || state == THREAD_GONE) {
+    release(t);
+  }
+}
+
 /// @brief Cancel one thread. We just send out a SIGKILL signal to that thread
 void xthread::cancel (xrun * runner, void *v)
 {
   ThreadStatus * t = (ThreadStatus *) v;
   //fprintf(stderr, "KILL thread %d\n", t->tid);
+  // Finish the thread in its place, unless it is done already: a pooled
+  // worker would be killed with no thread to run.
+  unsigned long state = t->state;
+  if((state != THREAD_RUNNING && state != THREAD_DETACHED)
+     || atomic::compare_and_swap(&t->state, state, THREAD_GONE) != state) {
+    return;
+  }
   kill(t->tid, SIGKILL); 
-  
-  // Free the shared object held by this thread.
-  freeSharedObject(t, 4096);
+
+  t->retval = PTHREAD_CANCELED;
+  if(atomic::compare_and_swap(&t->alive, 1, 0) == 1) {
+    atomic::decrement(_live);
+  }
+  // Nobody joins it to give the status back.
+  if(state == THREAD_DETACHED) {
+    freeStatus(t);
+    return;
+  }
+  futex(&t->state, FUTEX_WAKE, INT_MAX);
 }
 
 void xthread::thread_kill (xrun * runner, void *v, int sig)
@@ -100,7 +225,8 @@ void xthread::thread_kill (xrun * runner, void *v, int sig)
 
 
 int forkWithFS (void) {
-  return syscall(SYS_clone, CLONE_FS|CLONE_FILES|SIGCHLD, (void*) 0 );
+  // No exit signal: threads are reaped apart from the program's children.
+  return syscall(SYS_clone, CLONE_FS|CLONE_FILES, (void*) 0 );
  // return fork();
 }
 
@@ -122,7 +248,11 @@ void * xthread::forkSpawn (xrun * runner,
 #ifndef NDEBUG
 //	fprintf(stderr, "%d : Creating CHILD %d\n", getpid(), child);
 #endif
-    t->tid = child;
+    // The child stores it too: a thread that detached itself may be
+    // done, and its status taken by another, by now.
+    if(t->tid == 0) {
+      t->tid = child;
+    }
   
     // Start a new atomic section and return the thread info.
     runner->atomicBegin(true, false);
@@ -137,6 +267,20 @@ void * xthread::forkSpawn (xrun * runner,
     
     // Set "thread_self".
     setId (mypid);
+    _self = t;
+    t->tid = mypid;
+    // Before the thread runs, and so before anybody may release its status.
+    t->pidfd = WRAP(syscall) (SYS_pidfd_open, mypid, 0);
+
+#ifdef THREAD_POOL
+    _worker = this;
+    _workerRunner = runner;
+#endif
+
+#ifdef IO_URING_BATCHING
+    // The parent's ring works on the parent's memory.
+    xuring::getInstance().attach();
+#endif
 
 	  // Register to the system, we will set the heapid for myself.
 	  runner->threadRegister();
@@ -162,6 +306,25 @@ void * xthread::forkSpawn (xrun * runner,
 //	fprintf(stderr, "%d : EXIT thread\n", mypid);
     // and we're out.
     _nestingLevel--;
+    runner->threadExit();
+    finishThread(t, THREAD_DONE);
+
+#ifdef THREAD_POOL
+    if(isPooled(t)) {
+      becomeWorker((PoolSlot *) t);
+    }
+#endif
+
+#ifdef UFFD_TRACKING
+    // Our userfaultfd lives in the descriptor table shared with the parent.
+    xuffd::getInstance().close();
+#endif
+#ifdef IO_URING_BATCHING
+    xuring::getInstance().close();
+#endif
+#ifdef SOFT_DIRTY_DETECTION
+    xsoftdirty::getInstance().close();
+#endif
 
 //	fprintf(stderr, "%d : EXIT thread\n", mypid);
     // And that's the end of this "thread".
@@ -188,3 +351,257 @@ void xthread::run_thread (xrun * runner,
   // We're done. Write the return value.
   t->retval = result;
 }
+
+void xthread::initializeShared (void)
+{
+  // Fresh shared memory is zeroed: every status is free.
+  _live = (volatile unsigned long *) allocateSharedObject (sizeof(unsigned long));
+  _statuses = (ThreadStatus *) allocateSharedObject (xdefines::THREAD_STATUSES * sizeof(ThreadStatus));
+  if(_live == MAP_FAILED || _statuses == MAP_FAILED) {
+    fprintf(stderr, "%d : thread status mapping failed with error %s\n", getpid(), strerror(errno));
+    ::abort();
+  }
+
+#ifdef THREAD_POOL
+  _slots = (PoolSlot *) allocateSharedObject (xdefines::THREAD_POOL_WORKERS * sizeof(PoolSlot));
+  _mappings = (volatile unsigned long *) allocateSharedObject (sizeof(unsigned long));
+  char * copies = (char *) allocateSharedObject ((size_t)xdefines::THREAD_POOL_WORKERS * xdefines::THREAD_POOL_COPY);
+  // Only a worker touches its stack, so they need not be shared.
+  _stacks = (char *) mmap (NULL, (size_t)xdefines::THREAD_POOL_WORKERS * xdefines::THREAD_POOL_STACK,
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(_slots == MAP_FAILED || _mappings == MAP_FAILED || copies == MAP_FAILED || _stacks == MAP_FAILED) {
+    fprintf(stderr, "%d : thread pool mapping failed with error %s\n", getpid(), strerror(errno));
+    ::abort();
+  }
+
+  for(int i = 0; i < xdefines::THREAD_POOL_WORKERS; i++) {
+    _slots[i].copy = copies + (size_t)i * xdefines::THREAD_POOL_COPY;
+  }
+#endif
+}
+
+void xthread::finishThread (ThreadStatus * t, unsigned long state)
+{
+  if(atomic::compare_and_swap(&t->alive, 1, 0) == 1) {
+    atomic::decrement(_live);
+  }
+
+  if(atomic::compare_and_swap(&t->state, THREAD_RUNNING, state) == THREAD_DETACHED) {
+    // Nobody joins it: the status is given back here. A worker parks
+    // again by itself.
+    unsigned long next = STATUS_FREE;
+#ifdef THREAD_POOL
+    if(isPooled(t) && state == THREAD_DONE) {
+      next = SLOT_PARKED;
+    }
+#endif
+    // A page of its own is unmapped as the process exits.
+    if(next == STATUS_FREE) {
+      forgetProcess(t);
+    }
+    atomic::compare_and_swap(&t->state, THREAD_DETACHED, next);
+    return;
+  }
+  futex(&t->state, FUTEX_WAKE, INT_MAX);
+}
+
+void xthread::waitThread (ThreadStatus * t)
+{
+  struct timespec timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_nsec = xdefines::JOIN_CHECK_INTERVAL;
+
+  unsigned long state;
+  while((state = t->state) == THREAD_RUNNING || state == THREAD_DETACHED) {
+    long result = WRAP(syscall) (SYS_futex, (int *)&t->state, FUTEX_WAIT, (int)state, &timeout, NULL, 0);
+    if(result == 0 || errno != ETIMEDOUT || threadAlive(t)) {
+      continue;
+    }
+
+    // Nobody else finishes it.
+    if(atomic::compare_and_swap(&t->state, state, THREAD_GONE) == state) {
+      t->retval = PTHREAD_CANCELED;
+      if(atomic::compare_and_swap(&t->alive, 1, 0) == 1) {
+        atomic::decrement(_live);
+      }
+    }
+  }
+}
+
+bool xthread::threadAlive (ThreadStatus * t)
+{
+  int pidfd = t->pidfd;
+  if(pidfd >= 0) {
+    // Readable once the process exited, reaped or not.
+    struct pollfd exited;
+    exited.fd = pidfd;
+    exited.events = POLLIN;
+    exited.revents = 0;
+    return !(poll(&exited, 1, 0) == 1 && (exited.revents & POLLIN));
+  }
+
+  // Without pidfds, only a child of ours is known to be gone: once it is
+  // reaped here, its id can not be taken by another process meanwhile.
+  int tid = t->tid;
+  return (tid == 0 || waitpid(tid, NULL, WNOHANG | __WCLONE) != tid);
+}
+
+void xthread::forgetProcess (ThreadStatus * t)
+{
+  if(t->pidfd >= 0) {
+    close(t->pidfd);
+    t->pidfd = -1;
+  }
+}
+
+xthread::ThreadStatus * xthread::claimStatus (void)
+{
+  for(int i = 0; i < xdefines::THREAD_STATUSES; i++) {
+    ThreadStatus * t = &_statuses[_nextStatus];
+    _nextStatus = (_nextStatus + 1) % xdefines::THREAD_STATUSES;
+    if(t->state == STATUS_FREE
+       && atomic::compare_and_swap(&t->state, STATUS_FREE, STATUS_CLAIMED) == STATUS_FREE) {
+      return t;
+    }
+  }
+  return NULL;
+}
+
+void xthread::release (ThreadStatus * t)
+{
+#ifdef THREAD_POOL
+  // A worker whose thread returned parks again at once.
+  if(isPooled(t) && atomic::compare_and_swap(&t->state, THREAD_DONE, SLOT_PARKED) == THREAD_DONE) {
+    return;
+  }
+#endif
+  freeStatus(t);
+  reap();
+}
+
+void xthread::freeStatus (ThreadStatus * t)
+{
+  forgetProcess(t);
+  if(!inTable(t)) {
+#ifdef THREAD_POOL
+    if(isPooled(t)) {
+      atomic::atomic_set(&t->state, STATUS_FREE);
+      return;
+    }
+#endif
+    // Free the shared object held by this thread.
+    freeSharedObject(t, 4096);
+    return;
+  }
+  atomic::atomic_set(&t->state, STATUS_FREE);
+}
+
+void xthread::reap (void)
+{
+  // Threads are the only children without an exit signal.
+  while(waitpid(-1, NULL, WNOHANG | __WCLONE) > 0) {
+  }
+}
+
+void xthread::exitThread (xrun * runner, void * retval)
+{
+  // Hand over what the thread wrote, as a return would.
+  runner->atomicEnd(true, false);
+  if(_self == NULL) {
+    return;
+  }
+
+  runner->threadExit();
+  _self->retval = retval;
+  finishThread(_self, THREAD_GONE);
+}
+
+#ifdef THREAD_POOL
+xthread::PoolSlot * xthread::claimSlot (unsigned long from)
+{
+  for(int i = 0; i < xdefines::THREAD_POOL_WORKERS; i++) {
+    PoolSlot * slot = &_slots[i];
+    if(slot->status.state == from
+       && atomic::compare_and_swap(&slot->status.state, from, STATUS_CLAIMED) == from) {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+bool xthread::copyStack (PoolSlot * slot)
+{
+  // Our callers' frames are all above this one. Their stack ends where
+  // the main one does, or at the end of the stack of a worker.
+  char * sp = (char *) __builtin_frame_address(0);
+  char * top = (char *) __libc_stack_end;
+  size_t stacks = (size_t)xdefines::THREAD_POOL_WORKERS * xdefines::THREAD_POOL_STACK;
+  if(sp >= _stacks && sp < _stacks + stacks) {
+    top = _stacks + ((sp - _stacks) / xdefines::THREAD_POOL_STACK + 1) * xdefines::THREAD_POOL_STACK;
+  }
+
+  size_t size = top - sp;
+  if(size > (size_t)xdefines::THREAD_POOL_COPY) {
+    return false;
+  }
+  slot->stackStart = sp;
+  slot->stackSize = size;
+  memcpy(slot->copy, sp, size);
+  return true;
+}
+
+void xthread::becomeWorker (PoolSlot * slot)
+{
+  ucontext_t context;
+  getcontext(&context);
+  context.uc_stack.ss_sp = _stacks + (slot - _slots) * (size_t)xdefines::THREAD_POOL_STACK;
+  context.uc_stack.ss_size = xdefines::THREAD_POOL_STACK;
+  context.uc_link = NULL;
+  makecontext(&context, parkWorker, 0);
+  setcontext(&context);
+}
+
+void xthread::parkWorker (void)
+{
+  PoolSlot * slot = (PoolSlot *) _self;
+  xrun * runner = _workerRunner;
+
+  while(true) {
+    unsigned long state;
+    while(!handedThread(state = slot->status.state)) {
+      futex(&slot->status.state, FUTEX_WAIT, (int)state);
+    }
+
+    // The spawner's frames, where a child forked by it would have them.
+    memcpy(slot->stackStart, slot->copy, slot->stackSize);
+
+    // A new thread: a new index and heap, and no history.
+    runner->threadRegister();
+    run_thread(runner, slot->fn, &slot->status, slot->arg);
+    runner->threadExit();
+    _worker->finishThread(&slot->status, THREAD_DONE);
+  }
+}
+
+void xthread::programMapped (void)
+{
+  if(_mappings != NULL) {
+    atomic::increment(_mappings);
+  }
+}
+
+void xthread::finalize (xrun * runner)
+{
+  if(_slots == NULL || syscall(SYS_getpid) != runner->main_id()) {
+    return;
+  }
+
+  // Threads still running outlive main() as they would without the pool.
+  for(int i = 0; i < xdefines::THREAD_POOL_WORKERS; i++) {
+    PoolSlot * slot = &_slots[i];
+    if(slot->status.state == SLOT_PARKED || slot->status.state == THREAD_DONE) {
+      kill(slot->status.tid, SIGKILL);
+    }
+  }
+}
+#endif